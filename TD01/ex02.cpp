@@ -43,7 +43,7 @@ int main() {
 	}
 
 	// Initialize Rendering Engine
-	myEngine.initGL();
+	myEngine.initGL((GLADloadproc)glfwGetProcAddress);
 
 	/* Loop until the user closes the window */
 	while (!glfwWindowShouldClose(window))
@@ -70,7 +70,7 @@ int main() {
 	}
 
 	// Initialize Rendering Engine
-	myEngine.initGL();
+	myEngine.initGL((GLADloadproc)glfwGetProcAddress);
 	
 	// Initial window resize to set up projection
 	onWindowResized(window, WINDOW_WIDTH, WINDOW_HEIGHT);
@@ -34,6 +34,10 @@ GLBI_Convex_2D_Shape head;       // Circle for cat's head
 GLBI_Convex_2D_Shape ear;        // Triangle for cat's ear
 GLBI_Convex_2D_Shape eye;        // Circle for cat's eye
 
+/* Both ears and both eyes are drawn in one instanced draw each */
+InstanceBuffer earInstances;
+InstanceBuffer eyeInstances;
+
 /* Global variables */
 bool showAxes = true;
 bool showEyes = true;
@@ -43,6 +47,7 @@ void initScene();
 void renderScene();
 void initAxes();
 void initShapes();
+void initInstances();
 
 /* Error handling function */
 void onError(int error, const char* description) {
@@ -173,87 +178,65 @@ void initShapes() {
 }
 
 
+/**
+ * Initialize the transformation and color of each ear and eye
+ */
+void initInstances() {
+    float sqrt2_2 = 0.7071f;
+    Vector3D rotationAxis{0.0f, 0.0f, 1.0f};
+
+    // Right ear : translation, rotation (60 degrees) then scaling (0.5 on both x and y)
+    Matrix4D rightEar = Matrix4D::translation(sqrt2_2 * 0.5f, sqrt2_2 * 0.5f, 0.0f);
+    rightEar *= Matrix4D::rotation(M_PI/3, rotationAxis);
+    rightEar *= Matrix4D::homothety(0.5f, 0.5f, 1.0f);
+    earInstances.addInstance(rightEar, 0.7f, 0.7f, 0.7f);
+
+    // Left ear : rotation of -60 degrees
+    Matrix4D leftEar = Matrix4D::translation(-sqrt2_2 * 0.5f, sqrt2_2 * 0.5f, 0.0f);
+    leftEar *= Matrix4D::rotation(-M_PI/3, rotationAxis);
+    leftEar *= Matrix4D::homothety(0.5f, 0.5f, 1.0f);
+    earInstances.addInstance(leftEar, 0.7f, 0.7f, 0.7f);
+
+    // Eyes
+    eyeInstances.addInstance(Matrix4D::translation(0.2f, 0.1f, 0.0f), 0.0f, 0.0f, 0.0f);
+    eyeInstances.addInstance(Matrix4D::translation(-0.2f, 0.1f, 0.0f), 0.0f, 0.0f, 0.0f);
+}
+
 void initScene() {
     // Initialize the coordinate axes
     initAxes();
     
     // Initialize the shapes
     initShapes();
+
+    // Initialize ears and eyes placement
+    initInstances();
 }
 
 void renderScene() {
+    // Draws are recorded and replayed at the end, with fewer GL state changes
+    myEngine.beginRecording();
+
     if (showAxes) {
         glLineWidth(2.0);
-        axesLines.drawSet();
+        myEngine.draw(axesLines);
     }
     
     // Set color and draw cat head (circle at the center)
     myEngine.setFlatColor(0.8f, 0.8f, 0.8f);
-    head.drawShape();
-    
-    // Draw right ear with transformations
-    myEngine.setFlatColor(0.7f, 0.7f, 0.7f);
+    myEngine.draw(head);
     
-    // Reset transformation matrix to identity
-    myEngine.mvMatrixStack.loadIdentity();
-    
-    // Apply translation for right ear
-    float sqrt2_2 = 0.7071f; 
-    Vector3D rightEarPos{sqrt2_2 * 0.5f, sqrt2_2 * 0.5f, 0.0f};
-    myEngine.mvMatrixStack.addTranslation(rightEarPos);
-    
-    // Apply rotation 
-    Vector3D rotationAxis{0.0f, 0.0f, 1.0f};
-    myEngine.mvMatrixStack.addRotation(M_PI/3, rotationAxis);
-    
-    // Apply scaling (0.5 on both x and y)
-    Vector3D earScale{0.5f, 0.5f, 1.0f}; 
-    myEngine.mvMatrixStack.addHomothety(earScale);
-    
-    // Send transformations to pipeline
-    myEngine.updateMvMatrix();
-    
-    ear.drawShape();
-    
-    // Reset transformation matrix to identity
-    myEngine.mvMatrixStack.loadIdentity();
-    
-    // Apply translation for left ear
-    Vector3D leftEarPos{-sqrt2_2 * 0.5f, sqrt2_2 * 0.5f, 0.0f};
-    myEngine.mvMatrixStack.addTranslation(leftEarPos);
-    
-    // Apply rotation (-60 degrees = -PI/3)
-    myEngine.mvMatrixStack.addRotation(-M_PI/3, rotationAxis);
-    
-    // Apply scaling (0.5 on both x and y)
-    myEngine.mvMatrixStack.addHomothety(earScale);
-    
-    // Send transformations to pipeline
-    myEngine.updateMvMatrix();
-    
-    // Draw the left ear
-    ear.drawShape();
+    // Draw both ears (color and transformation of each one are in earInstances)
+    myEngine.drawInstanced(ear, earInstances);
     
     // Draw eyes if enabled
     if (showEyes) {
-        // Set color for eyes
-        myEngine.setFlatColor(0.0f, 0.0f, 0.0f);
-        
-        // Draw right eye
-        myEngine.mvMatrixStack.loadIdentity();
-        Vector3D rightEyePos{0.2f, 0.1f, 0.0f};
-        myEngine.mvMatrixStack.addTranslation(rightEyePos);
-        myEngine.updateMvMatrix();
-        eye.drawShape();
-        
-        // Draw left eye
-        myEngine.mvMatrixStack.loadIdentity();
-        Vector3D leftEyePos{-0.2f, 0.1f, 0.0f};
-        myEngine.mvMatrixStack.addTranslation(leftEyePos);
-        myEngine.updateMvMatrix();
-        eye.drawShape();
+        myEngine.drawInstanced(eye, eyeInstances);
     }
     
+    // Replay the recorded draws
+    myEngine.endRecording();
+
     // Reset transformation matrix to identity after all drawing
     myEngine.mvMatrixStack.loadIdentity();
     myEngine.updateMvMatrix();
@@ -292,7 +275,7 @@ int main() {
 	}
 
 	// Initialize Rendering Engine
-	myEngine.initGL();
+	myEngine.initGL((GLADloadproc)glfwGetProcAddress);
 	
 	// Initial window resize to set up projection
 	onWindowResized(window, WINDOW_WIDTH, WINDOW_HEIGHT);
@@ -315,6 +298,7 @@ int main() {
 
 		/* Swap front and back buffers */
 		glfwSwapBuffers(window);
+		STP3D_PROFILE_FRAME();
 
 		/* Poll for and process events */
 		glfwPollEvents();
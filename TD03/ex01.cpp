@@ -2,6 +2,7 @@
 #include "GLFW/glfw3.h"
 #include "glad/glad.h"
 #include "glbasimac/glbi_engine.hpp"
+#include "glbasimac/glbi_app.hpp"
 #include "glbasimac/glbi_set_of_points.hpp"
 #include "glbasimac/glbi_convex_2D_shape.hpp"
 #include <iostream>
@@ -10,8 +11,6 @@
 
 using namespace glbasimac;
 
-/* Minimal time wanted between two images */
-static const double FRAMERATE_IN_SECONDS = 1. / 30.;
 static float aspectRatio = 1.0f;
 
 /* Espace virtuel */
@@ -44,16 +43,8 @@ void initAxes();
 void initShapes();
 void drawFirstArm();
 
-/* Error handling function */
-void onError(int error, const char* description) {
-    std::cerr << "GLFW Error: " << description << std::endl;
-}
-
-/* Window resize handler */
-void onWindowResized(GLFWwindow* window, int width, int height) {
-    // Update viewport dimensions
-    glViewport(0, 0, width, height);
-    
+/* Window resize handler (the viewport is set by GLBI_App) */
+void onWindowResized(int width, int height) {
     // Update aspect ratio
     aspectRatio = (float)width / (float)height;
     
@@ -68,7 +59,7 @@ void onWindowResized(GLFWwindow* window, int width, int height) {
 }
 
 /* Keyboard input handler */
-void clavier(GLFWwindow* window, int key, int scancode, int action, int mods)
+void clavier(GLBI_App& app, int key, int scancode, int action)
 {
     // Vérifier que Q est pressé
     if (key == GLFW_KEY_Q && action == GLFW_PRESS)
@@ -81,7 +72,7 @@ void clavier(GLFWwindow* window, int key, int scancode, int action, int mods)
         
         // Fermeture de la fenêtre
         std::cout << "Fermeture de la fenêtre" << std::endl;
-        glfwSetWindowShouldClose(window, GLFW_TRUE);
+        app.quit();
     }
 
     // Toggle axes display
@@ -196,8 +187,7 @@ void drawFirstArm() {
     myEngine.mvMatrixStack.pushMatrix();
     Vector3D circleScale{0.8f, 0.8f, 1.0f};
     myEngine.mvMatrixStack.addHomothety(circleScale);
-    myEngine.updateMvMatrix();
-    cercle.drawShape();
+    myEngine.draw(cercle);
     myEngine.mvMatrixStack.popMatrix();
     
     // Draw the trapezoid body
@@ -207,8 +197,7 @@ void drawFirstArm() {
     myEngine.mvMatrixStack.addTranslation(trapezePos);
     Vector3D trapezeScale{0.6f, 0.6f, 1.0f};
     myEngine.mvMatrixStack.addHomothety(trapezeScale);
-    myEngine.updateMvMatrix();
-    trapeze.drawShape();
+    myEngine.draw(trapeze);
     myEngine.mvMatrixStack.popMatrix();
     
     // Draw the small circle (top)
@@ -218,8 +207,7 @@ void drawFirstArm() {
     myEngine.mvMatrixStack.addTranslation(smallCirclePos);
     Vector3D smallCircleScale{0.4f, 0.4f, 1.0f};
     myEngine.mvMatrixStack.addHomothety(smallCircleScale);
-    myEngine.updateMvMatrix();
-    cercle.drawShape();
+    myEngine.draw(cercle);
     myEngine.mvMatrixStack.popMatrix();
     
     // Pop the main matrix for the arm
@@ -227,111 +215,65 @@ void drawFirstArm() {
     
     // Reset matrix after drawing
     myEngine.mvMatrixStack.loadIdentity();
-    myEngine.updateMvMatrix();
 }
 
 void renderScene() {
+    // Draws are recorded and replayed at the end, with fewer GL state changes
+    myEngine.beginRecording();
+
     if (showAxes) {
         glLineWidth(2.0);
-        axesLines.drawSet();
+        myEngine.draw(axesLines);
     }
     
     // Draw the first arm
     drawFirstArm();
+
+    // Replay the recorded draws
+    myEngine.endRecording();
     
     // Reset transformation matrix to identity after all drawing
     myEngine.mvMatrixStack.loadIdentity();
     myEngine.updateMvMatrix();
 }
 
-int main()
-{
-    // Initialize GLFW
-    if (!glfwInit()) {
-        std::cerr << "Failed to initialize GLFW" << std::endl;
-        return -1;
-    }
-    
-    // Configure error callback
-    glfwSetErrorCallback(onError);
-    
-    // Configure OpenGL version (3.3 core profile)
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
-    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
-    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-    
-    // Create a window
-    int windowWidth = 500;
-    int windowHeight = 500;
-    aspectRatio = (float)windowWidth / (float)windowHeight;
-    
-    GLFWwindow* window = glfwCreateWindow(windowWidth, windowHeight, "TD03 Ex01 - Bras mécanique", nullptr, nullptr);
-    if (!window) {
-        std::cerr << "Failed to create GLFW window" << std::endl;
-        glfwTerminate();
-        return -1;
-    }
-    
-    // Make the window's context current
-    glfwMakeContextCurrent(window);
-    
-    // Initialize GLAD
-    if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) {
-        std::cerr << "Failed to initialize GLAD" << std::endl;
-        return -1;
-    }
-    
-    // Set up viewport
-    glViewport(0, 0, windowWidth, windowHeight);
-    
-    // Set up callbacks
-    glfwSetKeyCallback(window, clavier);
-    glfwSetWindowSizeCallback(window, onWindowResized);
-    
-    // The engine is automatically initialized
-    // No need to call init as it doesn't exist in this version of GLBI_Engine
-    
-    // Set the projection matrix for the virtual world
-    if (aspectRatio > 1.0) {
-        myEngine.set2DProjection(-GL_VIEW_SIZE * aspectRatio / 2.0f, GL_VIEW_SIZE * aspectRatio / 2.0f, -GL_VIEW_SIZE / 2.0f, GL_VIEW_SIZE / 2.0f);
-    } else {
-        myEngine.set2DProjection(-GL_VIEW_SIZE / 2.0f, GL_VIEW_SIZE / 2.0f, -GL_VIEW_SIZE / (2.0f * aspectRatio), GL_VIEW_SIZE / (2.0f * aspectRatio));
+/* Static scene : nothing to simulate (default update), each frame draws the arm */
+class ArmApp : public GLBI_App {
+public:
+    ArmApp() : GLBI_App(500, 500, "TD03 Ex01 - Bras mécanique") {}
+
+    bool init() override {
+        // Initialize the rendering engine
+        myEngine.initGL((GLADloadproc)glfwGetProcAddress);
+        initScene();
+        return true;
     }
-    
-    // Initialize the scene
-    initScene();
-    
-    double startTime = 0.0;
-    double endTime = 0.0;
-    
-    // Main loop
-    while (!glfwWindowShouldClose(window)) {
-        // Time management
-        startTime = glfwGetTime();
-        
+
+    void render(double alpha) override {
+        (void)alpha;
         // Clear the screen
         glClearColor(bgRed, bgGreen, bgBlue, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT);
-        
-        // Render the scene
+
         renderScene();
-        
-        // Swap buffers and poll events
-        glfwSwapBuffers(window);
-        glfwPollEvents();
-        
-        // Framerate control
-        endTime = glfwGetTime();
-        double elapsed = endTime - startTime;
-        if (elapsed < FRAMERATE_IN_SECONDS) {
-            glfwWaitEventsTimeout(FRAMERATE_IN_SECONDS - elapsed);
-        }
     }
-    
-    // Clean up
-    glfwDestroyWindow(window);
-    glfwTerminate();
-    
-    return 0;
+
+    void onKey(int key, int scancode, int action, int mods) override {
+        (void)mods;
+        clavier(*this, key, scancode, action);
+    }
+
+    void onResize(int new_width, int new_height) override {
+        onWindowResized(new_width, new_height);
+    }
+};
+
+int main()
+{
+    ArmApp app;
+    // Same pace as before : 30 images per second
+    app.setFrameRate(30.0);
+    int result = app.run();
+    std::cout << app.stats();
+    return result;
 }
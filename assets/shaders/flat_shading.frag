@@ -5,13 +5,21 @@ in vec2 uvs;
 
 layout(location = 0) out vec4 final_col;
 
-uniform int use_texture; // 0 if not. 1 else
+uniform int use_texture; // 0 if not. 1 else (when GLBI_TEXTURED is not defined)
 uniform sampler2D tex0;
 
 void main()
 {
+#ifdef GLBI_TEXTURED
+#if GLBI_TEXTURED
+	final_col = texture(tex0,uvs);
+#else
+	final_col = vec4(color,1.0);
+#endif
+#else
 	final_col = vec4(color,1.0);
 	if (use_texture == 1) {
 		final_col = texture(tex0,uvs);
 	}
+#endif
 }
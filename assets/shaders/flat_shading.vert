@@ -0,0 +1,41 @@
+#version 410 core
+
+// Flat shading in 3D, or in 2D with GLBI_2D.
+// With GLBI_INSTANCED, one copy per instance (model matrix and color of the instance).
+
+#ifdef GLBI_2D
+layout(location=0) in vec2 vx_pos; // Indice 0
+uniform mat4 projectionMat;
+#else
+layout(location=0) in vec3 vx_pos; // Indice 0
+#include "frame_data.glsl"
+#endif
+layout(location=2) in vec2 vx_uvs; // Indice 2
+#ifdef GLBI_INSTANCED
+layout(location=4) in mat4 inst_model; // Indices 4 to 7 : model matrix of the instance
+layout(location=8) in vec3 inst_col; // Indice 8 : color of the instance
+#else
+layout(location=3) in vec3 vx_col; // Indice 3
+#endif
+
+uniform mat4 modelviewMat;
+
+out vec3 color;
+out vec2 uvs;
+
+void main()
+{
+#ifdef GLBI_2D
+	vec4 vx = vec4(vx_pos.xy,0.0,1.0);
+#else
+	vec4 vx = vec4(vx_pos,1.0);
+#endif
+#ifdef GLBI_INSTANCED
+	gl_Position = projectionMat*modelviewMat*inst_model*vx;
+	color = inst_col;
+#else
+	gl_Position = projectionMat*modelviewMat*vx;
+	color = vx_col;
+#endif
+	uvs = vx_uvs;
+}
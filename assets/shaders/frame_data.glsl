@@ -0,0 +1,9 @@
+// Per frame data, shared by all the 3D programs (binding point 0, see GLBI_Frame_Data)
+layout(std140) uniform FrameData {
+	mat4 projectionMat;
+	mat4 viewMatrix;
+	vec4 lightPos[6];
+	vec4 lightIntensity[6]; // rgb
+	vec3 attenuationFactor;
+	int numOfLight;
+};
@@ -0,0 +1,5 @@
+// Material of the object (binding point 1, one range of the material buffer)
+layout(std140) uniform MaterialData {
+	vec3 c_spec;
+	float shininess;
+};
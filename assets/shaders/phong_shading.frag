@@ -1,5 +1,10 @@
 #version 410 core 
 
+// Permutations (see GLBI_Engine::specializeShaders), without them the branches are dynamic :
+//  GLBI_TEXTURED     : 1 textured, 0 flat color (instead of use_texture)
+//  GLBI_NB_LIGHTS    : number of lights (instead of numOfLight, at most 6)
+//  GLBI_POINT_LIGHTS : bit i set if light i is a point light (instead of lightPos[i].w > 0)
+
 #define M_PI 3.1415926535897932384626433832795
 const int Nmax = 255;
 
@@ -11,14 +16,8 @@ in vec3 pos;   // Position dans le repere camera
 uniform sampler2D tex0;
 uniform int use_texture; // 0 if not. 1 else
 
-uniform vec3 c_spec;
-uniform float shininess;
-
-uniform vec3 attenuationFactor;
-uniform int numOfLight;
-uniform vec4 lightPos[6];
-uniform vec3 lightIntensity[6];
-uniform mat4 viewMatrix;
+#include "frame_data.glsl"
+#include "material_data.glsl"
 
 layout(location = 0) out vec4 final_col;
 
@@ -32,13 +31,13 @@ float saturate(float val) {
 	return val;
 }
 
-vec4 lambert(int idLight) {
+vec4 lambert(int idLight,bool point_light) {
 	// Normal normalization
 	vec3 nml_cam = normalize(nml);
 
 	// Computing vector PL and setting lambert term
 	vec3 dir_illu;
-	if (lightPos[idLight].w > 0.0) {
+	if (point_light) {
 		vec3 ptlight = vec3(viewMatrix*vec4(lightPos[idLight].xyz,1.0f));
 		dir_illu = ptlight - pos;
 	}
@@ -49,9 +48,9 @@ vec4 lambert(int idLight) {
 	vec3 dir_illu_nml = normalize(dir_illu);
 	float cos_illu = saturate(dot(dir_illu_nml,nml_cam));
 
-	vec3 L = lightIntensity[idLight];
+	vec3 L = lightIntensity[idLight].rgb;
 	float attenuation;
-	if (lightPos[idLight].w > 0.0) {
+	if (point_light) {
 		attenuation = 1.0f/(attenuationFactor.x+attenuationFactor.y*dist+attenuationFactor.z*dist*dist);
 	}
 	else {
@@ -69,19 +68,50 @@ vec4 lambert(int idLight) {
 
 	// Final color computation
 	vec4 c_dif;
+#ifdef GLBI_TEXTURED
+#if GLBI_TEXTURED
+	c_dif  = texture(tex0,uvs);
+#else
+	c_dif = vec4(color,1.0f);
+#endif
+#else
 	if (use_texture == 1) {
 		c_dif  = texture(tex0,uvs);
 	}
 	else {
 		c_dif = vec4(color,1.0f);
 	}
+#endif
 	return vec4(c_dif.rgb*(L*attenuation)*cos_illu + spec_intensity*(L*attenuation)*c_spec,1.0);
 }
 
 void main()
 {
 	final_col = vec4(0.0,0.0,0.0,1.0);
+#ifdef GLBI_NB_LIGHTS
+	// Unrolled : the light types are constants
+#define GLBI_LIGHT(i) final_col += lambert(i,((GLBI_POINT_LIGHTS >> i) & 1) != 0)
+#if GLBI_NB_LIGHTS > 0
+	GLBI_LIGHT(0);
+#endif
+#if GLBI_NB_LIGHTS > 1
+	GLBI_LIGHT(1);
+#endif
+#if GLBI_NB_LIGHTS > 2
+	GLBI_LIGHT(2);
+#endif
+#if GLBI_NB_LIGHTS > 3
+	GLBI_LIGHT(3);
+#endif
+#if GLBI_NB_LIGHTS > 4
+	GLBI_LIGHT(4);
+#endif
+#if GLBI_NB_LIGHTS > 5
+	GLBI_LIGHT(5);
+#endif
+#else
 	for(int i=0;i<numOfLight;i++) {
-		final_col += lambert(i);
+		final_col += lambert(i,lightPos[i].w > 0.0);
 	}
+#endif
 }
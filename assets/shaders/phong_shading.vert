@@ -1,11 +1,19 @@
 #version 410 core 
 
+// With GLBI_INSTANCED, one copy per instance (model matrix and color of the instance)
+
 layout(location=0) in vec3 vx_pos; // Coordonnee du sommet
 layout(location=1) in vec3 vx_nml; // Normale du sommet
 layout(location=2) in vec2 vx_uvs; // Coordonnee de texture du sommet
+#ifdef GLBI_INSTANCED
+layout(location=4) in mat4 inst_model; // Matrice de l'instance (indices 4 a 7)
+layout(location=8) in vec3 inst_col; // Couleur de l'instance
+#else
 layout(location=3) in vec3 vx_col; // Couleur du sommet (ou couleur de l'objet)
+#endif
+
+#include "frame_data.glsl"
 
-uniform mat4 projectionMat;
 uniform mat4 modelviewMat;
 uniform mat4 normalMat;
 
@@ -16,10 +24,20 @@ out vec3 pos;
 
 void main()
 {
+#ifdef GLBI_INSTANCED
+	mat4 mv = modelviewMat*inst_model;
+	gl_Position = projectionMat*mv*vec4(vx_pos,1.0);
+	uvs = vx_uvs;
+	color = inst_col;
+	// Inverse transpose of the instance matrix, then the normal matrix of modelviewMat
+	nml = mat3(normalMat)*(transpose(inverse(mat3(inst_model)))*vx_nml);
+	vec4 pos_t = mv*vec4(vx_pos,1.0);
+#else
 	gl_Position = projectionMat*modelviewMat*vec4(vx_pos,1.0);
 	uvs = vx_uvs;
 	color = vx_col;
 	nml = vec3(normalMat*vec4(vx_nml,0.0));	
 	vec4 pos_t = modelviewMat*vec4(vx_pos,1.0);
+#endif
 	pos = pos_t.xyz/pos_t.w;
 }
@@ -0,0 +1,101 @@
+#version 410 core 
+
+// Phong shading with clustered lights (see GLBI_Light_Clusters).
+// Lights are in view space : global lights (directional or without attenuation)
+// are used for every fragment, others only in the clusters they reach.
+// Permutation : GLBI_TEXTURED 1 textured, 0 flat color (instead of use_texture).
+
+in vec3 color; // Couleur flat du point de l'objet (si existe)
+in vec2 uvs;   // Coordonnees de texture du point de l'object (dans le repere camera)
+in vec3 nml;   // Normale du point de l'object (dans le repere camera)
+in vec3 pos;   // Position dans le repere camera
+
+uniform sampler2D tex0;
+uniform int use_texture; // 0 if not. 1 else
+
+#include "frame_data.glsl"
+#include "material_data.glsl"
+
+uniform samplerBuffer clusterLights;   // 2 texels per light : position, intensity
+uniform usamplerBuffer clusterGrid;    // offset and number of lights of each cluster
+uniform usamplerBuffer clusterIndices; // light ids of the clusters
+uniform vec4 clusterParams;            // nx, ny, nz, z near
+uniform float clusterScale;            // nz/log(z far/z near)
+uniform int numOfGlobalLight;
+
+layout(location = 0) out vec4 final_col;
+
+
+float saturate(float val) {
+	if (val<0.0) return 0.0;
+	return val;
+}
+
+vec3 lambert(int idLight,vec3 nml_cam,vec3 view_dir,vec3 c_dif) {
+	vec4 light_pos = texelFetch(clusterLights,2*idLight);
+	vec3 L = texelFetch(clusterLights,2*idLight+1).rgb;
+
+	// Computing vector PL and setting lambert term
+	vec3 dir_illu;
+	if (light_pos.w > 0.0) {
+		dir_illu = light_pos.xyz - pos;
+	}
+	else {
+		dir_illu = light_pos.xyz;
+	}
+	float dist = length(dir_illu);
+	vec3 dir_illu_nml = normalize(dir_illu);
+	float cos_illu = saturate(dot(dir_illu_nml,nml_cam));
+
+	float attenuation;
+	if (light_pos.w > 0.0) {
+		attenuation = 1.0f/(attenuationFactor.x+attenuationFactor.y*dist+attenuationFactor.z*dist*dist);
+	}
+	else {
+		attenuation = attenuationFactor.x;
+	}
+
+	// Shininess
+	vec3 halfVector = normalize(view_dir + dir_illu_nml);
+	float spec_intensity = 0.0;
+	if (shininess>0.0) {
+		spec_intensity = pow(saturate(dot(nml_cam,halfVector)),shininess);
+	}
+
+	return c_dif*(L*attenuation)*cos_illu + spec_intensity*(L*attenuation)*c_spec;
+}
+
+void main()
+{
+	vec3 nml_cam = normalize(nml);
+	vec3 view_dir = normalize(-pos);
+#ifdef GLBI_TEXTURED
+#if GLBI_TEXTURED
+	vec3 c_dif = texture(tex0,uvs).rgb;
+#else
+	vec3 c_dif = color;
+#endif
+#else
+	vec3 c_dif = color;
+	if (use_texture == 1) {
+		c_dif = texture(tex0,uvs).rgb;
+	}
+#endif
+
+	// Cluster of the fragment
+	vec4 clip = projectionMat*vec4(pos,1.0);
+	vec2 ndc = clip.xy/clip.w;
+	ivec3 dims = ivec3(clusterParams.xyz);
+	ivec2 tile = clamp(ivec2((ndc*0.5+0.5)*clusterParams.xy),ivec2(0),dims.xy-1);
+	int slice = clamp(int(log(-pos.z/clusterParams.w)*clusterScale),0,dims.z-1);
+	uvec2 range = texelFetch(clusterGrid,(slice*dims.y+tile.y)*dims.x+tile.x).xy;
+
+	vec3 col = vec3(0.0);
+	for(int i=0;i<numOfGlobalLight;i++) {
+		col += lambert(i,nml_cam,view_dir,c_dif);
+	}
+	for(uint i=range.x;i<range.x+range.y;i++) {
+		col += lambert(int(texelFetch(clusterIndices,int(i)).r),nml_cam,view_dir,c_dif);
+	}
+	final_col = vec4(col,1.0);
+}
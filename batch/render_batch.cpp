@@ -0,0 +1,739 @@
+#include "glbasimac/glbi_engine.hpp"
+#include "glbasimac/glbi_headless.hpp"
+#include "tools/basic_mesh.hpp"
+#include "tools/frame_capture.hpp"
+#include "tools/video_sink.hpp"
+#include "tools/program_cache.hpp"
+#include "tools/mesh_optimizer.hpp"
+#include "tools/mesh_file.hpp"
+#include "tools/mesh_importer.hpp"
+#include "tools/mesh_simplifier.hpp"
+#include "tools/mesh_manager.hpp"
+#include "tools/buffer_arena.hpp"
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <cmath>
+#include <algorithm>
+#include <random>
+
+using namespace glbasimac;
+
+/*
+ * Renders frames of a scene without window and writes them on disk,
+ * as images or as one video stream (--video, --raw) for an encoder.
+ * The camera turns once around a grid of objects lit by moving lights.
+ * Run from the bin folder (shaders are read in ../assets/shaders).
+ */
+
+/* Command line options */
+struct Options {
+    int frames = 60;
+    int width = 640;
+    int height = 480;
+    int grid = 5;
+    int lights = 4;
+    /* More than one count : light count sweep (render only) */
+    std::vector<int> lightSteps;
+    int detail = 24;
+    std::string importFile;
+    std::string vertexLayout = "float";
+    bool optimizeMeshes = false;
+    bool fastMeshes = false;
+    int meshPool = 0;
+    int gpuBudget = 0;
+    std::string evictionFolder;
+    bool arena = false;
+    bool lod = false;
+    float lodThreshold = 1.0f;
+    std::string meshCache;
+    std::string output = "frame";
+    std::string format = "ppm";
+    std::string video;
+    VideoSink::Format videoFormat = VideoSink::Y4M;
+    int fps = 30;
+    std::string shaderCache;
+    bool write = true;
+    bool blockingCapture = false;
+    bool specializedShaders = true;
+    bool selfTest = false;
+    GLBI_Headless_Backend backend = GLBI_HEADLESS_AUTO;
+};
+
+void usage(const char* name) {
+    std::cout << "Usage : " << name << " [options]" << std::endl;
+    std::cout << "  --frames N          number of frames (60)" << std::endl;
+    std::cout << "  --size WxH          image size (640x480)" << std::endl;
+    std::cout << "  --grid N            N x N objects (5)" << std::endl;
+    std::cout << "  --lights N          moving point lights (4, more than 6 uses clustered lighting)" << std::endl;
+    std::cout << "  --lights N1,N2...   light count sweep : frame and light assignment times of each count" << std::endl;
+    std::cout << "                      (counts up to 6 are run without and with clustered lighting)" << std::endl;
+    std::cout << "  --detail N          sphere subdivisions (24)" << std::endl;
+    std::cout << "  --import FILE       draw the mesh of an OBJ or PLY file (scaled to the size of a sphere) instead of the spheres" << std::endl;
+    std::cout << "  --vertex-layout L   float (one VBO per attribute), interleaved, packed" << std::endl;
+    std::cout << "                      (half uvs, 2_10_10_10 normals) or quantized (packed, 16 bits positions)" << std::endl;
+    std::cout << "  --fast-meshes       generate the sphere and the cone with the parallel generators (fastSphere, fastCone)" << std::endl;
+    std::cout << "  --optimize-meshes   reorder the triangles and vertices of the indexed meshes (MeshOptimizer)" << std::endl;
+    std::cout << "  --lod               draw the levels of detail of the indexed meshes (MeshSimplifier)" << std::endl;
+    std::cout << "  --lod-threshold P   largest screen space error of a level of detail, in pixels (1)" << std::endl;
+    std::cout << "  --mesh-pool N       N spheres (detail, detail+1...) managed by handles, a different one per sphere and frame" << std::endl;
+    std::cout << "  --gpu-budget MB     GPU memory of the mesh pool : the least recently drawn spheres are evicted" << std::endl;
+    std::cout << "  --evict-to DIR      evicted spheres are written in DIR (existing folder) instead of staying in memory" << std::endl;
+    std::cout << "  --arena             the generated indexed meshes share one VAO and its buffers (BufferArena)" << std::endl;
+    std::cout << "  --mesh-cache DIR    save the meshes in DIR (existing folder) and load them in the next runs" << std::endl;
+    std::cout << "  --output PREFIX     images written in PREFIX_0000.ppm... (frame)" << std::endl;
+    std::cout << "  --format F          ppm or png (ppm)" << std::endl;
+    std::cout << "  --video FILE        one Y4M stream instead of images (- : standard output)" << std::endl;
+    std::cout << "  --raw FILE          one raw RGB24 stream instead of images (- : standard output)" << std::endl;
+    std::cout << "  --fps N             frame rate of the stream (30)" << std::endl;
+    std::cout << "  --shader-cache DIR  save linked programs in DIR and reuse them in the next runs" << std::endl;
+    std::cout << "  --no-output         render only (benchmark)" << std::endl;
+    std::cout << "  --blocking-capture  read and write each frame in the render loop (no FrameCapture)" << std::endl;
+    std::cout << "  --uber-shaders      one program branching on texturing and lights (no permutations)" << std::endl;
+    std::cout << "  --backend B         auto, egl or osmesa (auto)" << std::endl;
+    std::cout << "  --selftest          check the SIMD matrix kernels against the scalar formulas and the fast mesh" << std::endl;
+    std::cout << "                      generators against the basic ones, then quit" << std::endl;
+}
+
+bool parseOptions(int argc, char** argv, Options& opt) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool has_value = (i + 1 < argc);
+        if (arg == "--frames" && has_value) opt.frames = atoi(argv[++i]);
+        else if (arg == "--size" && has_value) {
+            if (sscanf(argv[++i], "%dx%d", &opt.width, &opt.height) != 2) return false;
+        }
+        else if (arg == "--grid" && has_value) opt.grid = atoi(argv[++i]);
+        else if (arg == "--lights" && has_value) {
+            std::string counts = argv[++i];
+            opt.lightSteps.clear();
+            for (size_t start = 0; start <= counts.size();) {
+                size_t end = std::min(counts.find(',', start), counts.size());
+                opt.lightSteps.push_back(atoi(counts.substr(start, end - start).c_str()));
+                if (opt.lightSteps.back() < 0) return false;
+                start = end + 1;
+            }
+            // Lights can only be added : the sweep goes up
+            std::sort(opt.lightSteps.begin(), opt.lightSteps.end());
+            opt.lightSteps.erase(std::unique(opt.lightSteps.begin(), opt.lightSteps.end()), opt.lightSteps.end());
+            opt.lights = opt.lightSteps[0];
+        }
+        else if (arg == "--detail" && has_value) opt.detail = atoi(argv[++i]);
+        else if (arg == "--import" && has_value) opt.importFile = argv[++i];
+        else if (arg == "--optimize-meshes") opt.optimizeMeshes = true;
+        else if (arg == "--fast-meshes") opt.fastMeshes = true;
+        else if (arg == "--lod") opt.lod = true;
+        else if (arg == "--lod-threshold" && has_value) opt.lodThreshold = atof(argv[++i]);
+        else if (arg == "--mesh-pool" && has_value) opt.meshPool = atoi(argv[++i]);
+        else if (arg == "--gpu-budget" && has_value) opt.gpuBudget = atoi(argv[++i]);
+        else if (arg == "--evict-to" && has_value) opt.evictionFolder = argv[++i];
+        else if (arg == "--arena") opt.arena = true;
+        else if (arg == "--mesh-cache" && has_value) opt.meshCache = argv[++i];
+        else if (arg == "--vertex-layout" && has_value) {
+            opt.vertexLayout = argv[++i];
+            if (opt.vertexLayout != "float" && opt.vertexLayout != "interleaved" &&
+                opt.vertexLayout != "packed" && opt.vertexLayout != "quantized") return false;
+        }
+        else if (arg == "--output" && has_value) opt.output = argv[++i];
+        else if (arg == "--format" && has_value) {
+            opt.format = argv[++i];
+            if (opt.format != "ppm" && opt.format != "png") return false;
+        }
+        else if ((arg == "--video" || arg == "--raw") && has_value) {
+            opt.video = argv[++i];
+            opt.videoFormat = (arg == "--raw") ? VideoSink::RawRGB : VideoSink::Y4M;
+        }
+        else if (arg == "--fps" && has_value) opt.fps = atoi(argv[++i]);
+        else if (arg == "--shader-cache" && has_value) opt.shaderCache = argv[++i];
+        else if (arg == "--no-output") opt.write = false;
+        else if (arg == "--blocking-capture") opt.blockingCapture = true;
+        else if (arg == "--selftest") opt.selfTest = true;
+        else if (arg == "--uber-shaders") opt.specializedShaders = false;
+        else if (arg == "--backend" && has_value) {
+            std::string b = argv[++i];
+            if (b == "egl") opt.backend = GLBI_HEADLESS_EGL;
+            else if (b == "osmesa") opt.backend = GLBI_HEADLESS_OSMESA;
+            else if (b != "auto") return false;
+        }
+        else return false;
+    }
+    return opt.frames > 0 && opt.width > 0 && opt.height > 0 && opt.grid > 0 && opt.lights >= 0 && opt.fps > 0 && opt.detail > 2 &&
+           opt.meshPool >= 0 && opt.gpuBudget >= 0;
+}
+
+/* Scene */
+GLBI_Engine myEngine;
+IndexedMesh* sphere = nullptr;
+IndexedMesh* cube = nullptr;
+StandardMesh* cone = nullptr;
+/* Levels of detail selected from the projection, and the meshes of the pool (by handle) */
+MeshManager meshManager;
+std::vector<MeshHandle> meshPool;
+/* Buffers shared by the indexed meshes (--arena) */
+BufferArena* arena = nullptr;
+/* Vertices processed by the draws (indices for indexed meshes), and draws of each level of detail */
+double verticesDrawn = 0.0;
+std::vector<double> lodDraws;
+/* Draws submitted and CPU time spent submitting them (recording and replay, without waiting for the GPU) */
+double drawsSubmitted = 0.0;
+double submitTime = 0.0;
+
+VertexLayout makeVertexLayout(const std::string& name) {
+    VertexLayout layout(name != "float");
+    if (name == "packed" || name == "quantized") {
+        layout.setFormat(1, VertexLayout::FormatPacked1010102);
+        layout.setFormat(2, VertexLayout::FormatHalf);
+    }
+    if (name == "quantized") layout.setFormat(0, VertexLayout::FormatQuantized16);
+    return layout;
+}
+
+/* Mesh file of the cache folder (the generated mesh depends on the options) */
+std::string meshFileName(const Options& opt, const std::string& name) {
+    return opt.meshCache + "/" + name + (opt.optimizeMeshes ? "_opt" : "") + ".smesh";
+}
+
+/* Load the mesh from the cache, or generate it (and save it in the cache).
+ * A generated mesh has no VAO yet : its levels of detail are made first (mesh files have none). */
+IndexedMesh* createIndexedMesh(const Options& opt, const std::string& name, IndexedMesh* (*generate)(const Options&),
+                               const VertexLayout& layout, bool& loaded) {
+    IndexedMesh* mesh = nullptr;
+    loaded = false;
+    if (!opt.meshCache.empty() && !opt.lod) mesh = MeshFile::loadIndexedMesh(meshFileName(opt, name), layout);
+    if (mesh) {
+        loaded = true;
+        return mesh;
+    }
+    mesh = generate(opt);
+    if (opt.optimizeMeshes) MeshOptimizer::optimize(*mesh, MeshOptimizer::DEFAULT_CACHE_SIZE, true);
+    if (!opt.meshCache.empty() && !MeshFile::write(meshFileName(opt, name), *mesh)) {
+        std::cerr << "Unable to save mesh " << name << " in " << opt.meshCache << std::endl;
+    }
+    mesh->setVertexLayout(layout);
+    return mesh;
+}
+
+/* Center the mesh and scale it in a sphere of the given radius */
+void fitMesh(IndexedMesh* mesh, float radius) {
+    float* coord = mesh->buffers[0];
+    float low[3] = {coord[0], coord[1], coord[2]};
+    float high[3] = {coord[0], coord[1], coord[2]};
+    for (unsigned int i = 0; i < mesh->nb_elts * 3; i++) {
+        low[i % 3] = std::min(low[i % 3], coord[i]);
+        high[i % 3] = std::max(high[i % 3], coord[i]);
+    }
+    float center[3], size = 0.0f;
+    for (int c = 0; c < 3; c++) {
+        center[c] = 0.5f * (low[c] + high[c]);
+        size += (high[c] - low[c]) * (high[c] - low[c]);
+    }
+    float scale = (size > 0.0f) ? 2.0f * radius / std::sqrt(size) : 1.0f;
+    for (unsigned int i = 0; i < mesh->nb_elts * 3; i++) coord[i] = (coord[i] - center[i % 3]) * scale;
+}
+
+IndexedMesh* makeSphere(const Options& opt) {
+    if (opt.fastMeshes) return fastSphere(0.5f, opt.detail, opt.detail);
+    return basicSphere(0.5f, opt.detail, opt.detail);
+}
+
+IndexedMesh* generateSphere(const Options& opt) {
+    if (opt.importFile.empty()) return makeSphere(opt);
+    MeshImportStats stats;
+    IndexedMesh* mesh = MeshImporter::load(opt.importFile, 0, &stats);
+    if (!mesh) {
+        std::cerr << "Unable to import " << opt.importFile << " : " << STP3D::getError() << std::endl;
+        return makeSphere(opt);
+    }
+    std::cout << "Import " << opt.importFile << " : " << stats << std::endl;
+    fitMesh(mesh, 0.5f);
+    return mesh;
+}
+IndexedMesh* generateCube(const Options&) { return basicCube(0.8f); }
+
+void initScene(const Options& opt) {
+    myEngine.set3DProjection(60.0f, float(opt.width) / opt.height, 0.1f, 100.0f);
+    glEnable(GL_DEPTH_TEST);
+    VertexLayout layout = makeVertexLayout(opt.vertexLayout);
+    std::chrono::steady_clock::time_point mesh_start = std::chrono::steady_clock::now();
+    bool sphere_loaded, cube_loaded, cone_loaded = false;
+    std::string sphere_name = "sphere_" + std::to_string(opt.detail);
+    if (!opt.importFile.empty()) sphere_name = "import_" + opt.importFile.substr(opt.importFile.find_last_of("/\\") + 1);
+    sphere = createIndexedMesh(opt, sphere_name, generateSphere, layout, sphere_loaded);
+    cube = createIndexedMesh(opt, "cube", generateCube, layout, cube_loaded);
+    std::vector<IndexedMesh*> generated;
+    if (!sphere_loaded) generated.push_back(sphere);
+    if (!cube_loaded) generated.push_back(cube);
+    if (opt.lod) {
+        // Both meshes are simplified in parallel
+        std::chrono::steady_clock::time_point lod_start = std::chrono::steady_clock::now();
+        MeshSimplifier::generateLODs(generated);
+        double lod_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - lod_start).count();
+        std::cout << "Levels of detail : " << lod_time * 1000.0 << " ms" << std::endl;
+        for (unsigned int m = 0; m < generated.size(); m++) {
+            std::cout << "  " << (generated[m] == sphere ? "sphere" : "cube") << " :";
+            for (unsigned int l = 0; l < generated[m]->getNbLODs(); l++) {
+                std::cout << " " << generated[m]->getLODIndices(l) / 3 << " (" << generated[m]->getLODError(l) << ")";
+            }
+            std::cout << std::endl;
+        }
+        meshManager.setProjection(Matrix4D::perspective(60.0f, float(opt.width) / opt.height, 0.1f, 100.0f), opt.height);
+        meshManager.setLODThreshold(opt.lodThreshold);
+    }
+    if (opt.arena) arena = new BufferArena(layout);
+    for (unsigned int m = 0; m < generated.size(); m++) {
+        if (arena) generated[m]->setSharedBuffers(arena);
+        generated[m]->createVAO();
+    }
+    // The pool meshes go to the GPU when they are first drawn
+    Options pool_opt = opt;
+    for (int k = 0; k < opt.meshPool; k++) {
+        pool_opt.detail = opt.detail + k;
+        IndexedMesh* mesh = makeSphere(pool_opt);
+        mesh->setVertexLayout(layout);
+        if (arena) mesh->setSharedBuffers(arena);
+        meshPool.push_back(meshManager.addIdxMeshHandle("pool_" + std::to_string(k), mesh));
+    }
+    meshManager.setGPUBudget(size_t(opt.gpuBudget) * 1024 * 1024);
+    meshManager.setEvictionFolder(opt.evictionFolder);
+    if (!opt.meshCache.empty()) cone = MeshFile::loadStandardMesh(meshFileName(opt, "cone"), layout);
+    if (cone) cone_loaded = true;
+    else {
+        cone = opt.fastMeshes ? fastCone(1.0f, 0.4f) : basicCone(1.0f, 0.4f);
+        if (!opt.meshCache.empty() && !MeshFile::write(meshFileName(opt, "cone"), *cone)) {
+            std::cerr << "Unable to save mesh cone in " << opt.meshCache << std::endl;
+        }
+        cone->setVertexLayout(layout);
+        cone->createVAO();
+    }
+    glFinish();
+    double mesh_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - mesh_start).count();
+    int nb_loaded = int(sphere_loaded) + int(cube_loaded) + int(cone_loaded);
+    std::cout << "Meshes : " << mesh_time * 1000.0 << " ms (" << nb_loaded << " loaded from files, ";
+    std::cout << 3 - nb_loaded << " generated)" << std::endl;
+    std::cout << "Vertex layout " << opt.vertexLayout << " : " << sphere->getBytesPerVertex() << " bytes per vertex (";
+    std::cout << sphere->nb_elts + cube->nb_elts + cone->getNbElt() << " vertices, ";
+    std::cout << sphere->nb_elts * sphere->getBytesPerVertex() + cube->nb_elts * cube->getBytesPerVertex() + cone->getNbElt() * cone->getBytesPerVertex();
+    std::cout << " bytes)" << std::endl;
+
+    myEngine.switchToPhongShading();
+    myEngine.setLightPosition(Vector4D(-1.0f, 1.0f, 1.0f, 0.0f), 0);
+    myEngine.setLightIntensity(Vector3D(0.3f, 0.3f, 0.3f), 0);
+    for (int l = 0; l < opt.lights; l++) {
+        myEngine.addALight(Vector4D(0.0f, 1.0f, 0.0f, 1.0f), Vector3D(3.0f, 3.0f, 3.0f));
+    }
+    myEngine.setAttenuationFactor(Vector3D(1.0f, 0.0f, 0.5f));
+    myEngine.setShininess(20.0f);
+    myEngine.setSpecularColor(Vector3D(1.0f, 1.0f, 1.0f));
+}
+
+/* Draw the level of detail of the mesh selected at its place in the modelview stack */
+void drawIndexedMesh(const Options& opt, IndexedMesh& mesh) {
+    unsigned int lod = opt.lod ? meshManager.selectLOD(mesh, myEngine.mvMatrixStack.getTopGLMatrix()) : 0;
+    myEngine.draw(mesh, lod);
+    verticesDrawn += mesh.getLODIndices(lod);
+    if (lodDraws.size() <= lod) lodDraws.resize(lod + 1, 0.0);
+    lodDraws[lod]++;
+}
+
+void renderFrame(const Options& opt, int frame) {
+    float t = float(frame) / opt.frames;
+    float extent = 1.5f * opt.grid;
+    glClearColor(0.1f, 0.1f, 0.12f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+    // Camera turning once around the scene (the view matrix starts the modelview stack)
+    myEngine.mvMatrixStack.loadIdentity();
+    float cam_angle = 2.0f * M_PI * t;
+    Vector3D eye(extent * cos(cam_angle), 0.6f * extent, extent * sin(cam_angle));
+    myEngine.setViewMatrix(Matrix4D::lookAt(eye, Vector3D(0.0f, 0.0f, 0.0f), Vector3D(0.0f, 1.0f, 0.0f)));
+
+    // Lights turning above the objects (light 0 is the directional one)
+    for (int l = 0; l < opt.lights; l++) {
+        float a = 2.0f * M_PI * (float(l) / opt.lights + 2.0f * t);
+        float r = 0.4f * extent * (1.0f + 0.5f * (l % 3));
+        myEngine.setLightPosition(Vector4D(r * cos(a), 1.0f, r * sin(a), 1.0f), l + 1);
+    }
+
+    meshManager.beginFrame();
+    // Meshes evicted from the pool leave holes in the arena
+    if (arena && arena->stats().fragmentation() > 0.5f) arena->compact();
+    std::chrono::steady_clock::time_point submit_start = std::chrono::steady_clock::now();
+    myEngine.beginRecording();
+    for (int i = 0; i < opt.grid; i++) {
+        for (int j = 0; j < opt.grid; j++) {
+            myEngine.mvMatrixStack.pushMatrix();
+            myEngine.mvMatrixStack.addTranslation(Vector3D(1.5f * (i - 0.5f * (opt.grid - 1)), 0.0f, 1.5f * (j - 0.5f * (opt.grid - 1))));
+            myEngine.setFlatColor(0.3f + 0.7f * i / opt.grid, 0.3f + 0.7f * j / opt.grid, 0.6f);
+            switch ((i + j) % 3) {
+                case 0: {
+                    IndexedMesh* mesh = meshPool.empty() ? sphere : meshManager.useIdxMesh(meshPool[(i * opt.grid + j + frame) % meshPool.size()]);
+                    if (mesh) {
+                        drawIndexedMesh(opt, *mesh);
+                        drawsSubmitted++;
+                    }
+                    break;
+                }
+                case 1:
+                    drawIndexedMesh(opt, *cube);
+                    drawsSubmitted++;
+                    break;
+                default:
+                    myEngine.draw(*cone);
+                    drawsSubmitted++;
+                    verticesDrawn += cone->getNbElt();
+                    break;
+            }
+            myEngine.mvMatrixStack.popMatrix();
+        }
+    }
+    myEngine.endRecording();
+    submitTime += std::chrono::duration<double>(std::chrono::steady_clock::now() - submit_start).count();
+}
+
+/* Self test (--selftest) : results of the library checked against straightforward code */
+
+/* Largest difference between two arrays */
+double maxError(const float* a, const double* ref, size_t nb) {
+    double error = 0.0;
+    for (size_t i = 0; i < nb; i++) error = std::max(error, std::fabs(double(a[i]) - ref[i]));
+    return error;
+}
+
+/* m*v in double, column major (the scalar formula of Matrix4D) */
+void referenceTransform(const float* m, const float* v, unsigned int nb_comp, float w, double* r) {
+    for (int l = 0; l < 4; l++) {
+        r[l] = 0.0;
+        for (unsigned int c = 0; c < nb_comp; c++) r[l] += double(m[4 * c + l]) * v[c];
+        if (nb_comp == 3) r[l] += double(m[12 + l]) * w;
+    }
+}
+
+/* Inverse in double by Gauss-Jordan elimination (partial pivoting). False if singular. */
+bool referenceInverse(const float* m, double* inv) {
+    double a[4][8];
+    for (int l = 0; l < 4; l++) {
+        for (int c = 0; c < 4; c++) {
+            a[l][c] = m[4 * c + l];
+            a[l][4 + c] = (l == c) ? 1.0 : 0.0;
+        }
+    }
+    for (int c = 0; c < 4; c++) {
+        int pivot = c;
+        for (int l = c + 1; l < 4; l++) if (std::fabs(a[l][c]) > std::fabs(a[pivot][c])) pivot = l;
+        if (std::fabs(a[pivot][c]) < 1e-12) return false;
+        for (int k = 0; k < 8; k++) std::swap(a[c][k], a[pivot][k]);
+        double p = a[c][c];
+        for (int k = 0; k < 8; k++) a[c][k] /= p;
+        for (int l = 0; l < 4; l++) {
+            if (l == c) continue;
+            double f = a[l][c];
+            for (int k = 0; k < 8; k++) a[l][k] -= f * a[c][k];
+        }
+    }
+    for (int l = 0; l < 4; l++) for (int c = 0; c < 4; c++) inv[4 * c + l] = a[l][4 + c];
+    return true;
+}
+
+/* Matrix4D product, matrix/vector product, inverses and batch transforms on random matrices */
+bool testMatrixKernels() {
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> value(-2.0f, 2.0f);
+    const unsigned int nb_matrices = 1000, nb_vectors = 37;
+    double product_error = 0.0, vector_error = 0.0, inverse_error = 0.0, affine_error = 0.0, batch_error = 0.0;
+    unsigned int singular = 0;
+    std::vector<float> src(4 * nb_vectors), dst(4 * nb_vectors);
+    std::vector<double> ref(4 * nb_vectors);
+    for (unsigned int n = 0; n < nb_matrices; n++) {
+        // Dominant diagonals : the matrices are far from singular
+        Matrix4D a, b;
+        for (int i = 0; i < 16; i++) {
+            a.mat[i] = value(rng) + ((i % 5 == 0) ? 8.0f : 0.0f);
+            b.mat[i] = value(rng);
+        }
+        double r[16];
+        for (int c = 0; c < 4; c++) referenceTransform(a.mat, b.mat + 4 * c, 4, 0.0f, r + 4 * c);
+        Matrix4D ab = a * b;
+        product_error = std::max(product_error, maxError(ab.mat, r, 16));
+
+        Vector4D v(value(rng), value(rng), value(rng), value(rng));
+        Vector4D av = a * v;
+        referenceTransform(a.mat, v.val, 4, 0.0f, r);
+        vector_error = std::max(vector_error, maxError(av.val, r, 4));
+
+        Matrix4D inv = a;
+        if (!referenceInverse(a.mat, r) || !inv.invert()) singular++;
+        else inverse_error = std::max(inverse_error, maxError(inv.mat, r, 16));
+
+        Matrix4D affine = a;
+        affine.mat[3] = affine.mat[7] = affine.mat[11] = 0.0f;
+        affine.mat[15] = 1.0f;
+        inv = affine;
+        if (!referenceInverse(affine.mat, r) || !inv.invertAffine()) singular++;
+        else affine_error = std::max(affine_error, maxError(inv.mat, r, 16));
+
+        // Odd count : the tail after the vector loop is used
+        for (unsigned int i = 0; i < 4 * nb_vectors; i++) src[i] = value(rng);
+        a.transformVectors(&src[0], &dst[0], nb_vectors);
+        for (unsigned int i = 0; i < nb_vectors; i++) referenceTransform(a.mat, &src[4 * i], 4, 0.0f, &ref[4 * i]);
+        batch_error = std::max(batch_error, maxError(&dst[0], &ref[0], 4 * nb_vectors));
+        for (int point = 0; point < 2; point++) {
+            if (point) a.transformPoints(&src[0], &dst[0], nb_vectors);
+            else a.transformDirections(&src[0], &dst[0], nb_vectors);
+            for (unsigned int i = 0; i < nb_vectors; i++) {
+                referenceTransform(a.mat, &src[3 * i], 3, point ? 1.0f : 0.0f, r);
+                batch_error = std::max(batch_error, maxError(&dst[3 * i], r, 3));
+            }
+        }
+    }
+#if defined(STP3D_USE_AVX)
+    const char* path = "AVX";
+#elif defined(STP3D_USE_SSE)
+    const char* path = "SSE";
+#else
+    const char* path = "scalar";
+#endif
+    std::cout << "Matrix kernels (" << path << ", " << nb_matrices << " random matrices), largest absolute error :" << std::endl;
+    std::cout << "  product " << product_error << ", matrix * vector " << vector_error << ", batch transforms " << batch_error << std::endl;
+    std::cout << "  invert " << inverse_error << ", invertAffine " << affine_error << " (" << singular << " refused)" << std::endl;
+    // Float rounding of sums of 4 products of values up to 10, and of the inverses (entries under 1)
+    bool ok = product_error < 1e-4 && vector_error < 1e-4 && batch_error < 1e-4 && inverse_error < 1e-5 && affine_error < 1e-5 && singular == 0;
+    std::cout << "  " << (ok ? "passed" : "FAILED") << std::endl;
+    return ok;
+}
+
+/* Largest difference between the n floats of two buffers (infinite if one is missing) */
+double bufferError(const float* a, const float* b, size_t nb) {
+    if (!a || !b) return HUGE_VAL;
+    double error = 0.0;
+    for (size_t i = 0; i < nb; i++) error = std::max(error, std::fabs(double(a[i]) - b[i]));
+    return error;
+}
+
+/* Coordinates, normals and uvs of the fast generators against the basic ones. The indices must be the same. */
+double compareMeshes(const IndexedMesh& fast, const IndexedMesh& basic, bool& same_indices) {
+    const unsigned int sizes[3] = {3, 3, 2};
+    double error = 0.0;
+    same_indices = same_indices && fast.nb_elts == basic.nb_elts && fast.nb_primitive == basic.nb_primitive;
+    if (fast.nb_elts != basic.nb_elts) return HUGE_VAL;
+    for (int b = 0; b < 3; b++) error = std::max(error, bufferError(fast.buffers[b], basic.buffers[b], size_t(fast.nb_elts) * sizes[b]));
+    if (same_indices) {
+        same_indices = std::equal(fast.index_buffer, fast.index_buffer + 3 * fast.nb_primitive, basic.index_buffer);
+    }
+    return error;
+}
+
+bool testMeshGenerators() {
+    // Several threads on small meshes : the split of the rows is used
+    const unsigned int nb_threads = 4;
+    double sphere_error = 0.0, cylinder_error = 0.0, cone_error = 0.0;
+    bool same_indices = true;
+    const unsigned int spheres[3][2] = {{2, 3}, {24, 24}, {300, 700}};
+    for (int i = 0; i < 3; i++) {
+        IndexedMesh* fast = fastSphere(0.5f, spheres[i][0], spheres[i][1], nb_threads);
+        IndexedMesh* basic = basicSphere(0.5f, spheres[i][0], spheres[i][1]);
+        sphere_error = std::max(sphere_error, compareMeshes(*fast, *basic, same_indices));
+        delete fast;
+        delete basic;
+    }
+    const unsigned int cylinders[3][2] = {{3, 1}, {64, 5}, {700, 300}};
+    for (int i = 0; i < 3; i++) {
+        IndexedMesh* fast = fastCylinder(1.0f, 0.4f, cylinders[i][0], cylinders[i][1], nb_threads);
+        IndexedMesh* basic = basicCylinder(1.0f, 0.4f, cylinders[i][0], cylinders[i][1]);
+        cylinder_error = std::max(cylinder_error, compareMeshes(*fast, *basic, same_indices));
+        delete fast;
+        delete basic;
+    }
+    const unsigned int cones[3] = {1, 64, 100000};
+    for (int i = 0; i < 3; i++) {
+        StandardMesh* fast = fastCone(1.0f, 0.4f, 0.1f, cones[i], nb_threads);
+        StandardMesh* basic = basicCone(1.0f, 0.4f, 0.1f, cones[i]);
+        if (fast->getNbElt() != basic->getNbElt()) cone_error = HUGE_VAL;
+        else {
+            const unsigned int sizes[3] = {3, 3, 2};
+            for (int b = 0; b < 3; b++) {
+                cone_error = std::max(cone_error, bufferError(fast->getBuffer(b), basic->getBuffer(b), size_t(fast->getNbElt()) * sizes[b]));
+            }
+        }
+        delete fast;
+        delete basic;
+    }
+    // Divisions refused instead of dividing by 0
+    bool refused = !fastSphere(0.5f, 1, 8) && !fastSphere(0.5f, 8, 0) && !fastCylinder(1.0f, 0.4f, 0, 1) &&
+                   !fastCylinder(1.0f, 0.4f, 8, 0) && !fastCone(1.0f, 0.4f, 0.0f, 0);
+    std::cout << "Fast mesh generators against the basic ones, largest absolute error :" << std::endl;
+    std::cout << "  sphere " << sphere_error << ", cylinder " << cylinder_error << ", cone " << cone_error;
+    std::cout << ", indices " << (same_indices ? "identical" : "DIFFERENT") << ", no division " << (refused ? "refused" : "ACCEPTED") << std::endl;
+    // The table of sines and cosines is made by rotations in double : float rounding only
+    bool ok = sphere_error < 1e-6 && cylinder_error < 1e-6 && cone_error < 1e-6 && same_indices && refused;
+    std::cout << "  " << (ok ? "passed" : "FAILED") << std::endl;
+    return ok;
+}
+
+/* Render the frames of each light count of the sweep, without output */
+void lightSweep(Options& opt) {
+    typedef std::chrono::steady_clock clock;
+    std::cout << "Light sweep : " << opt.frames << " frames per step" << std::endl;
+    for (unsigned int s = 0; s < opt.lightSteps.size(); s++) {
+        for (int l = opt.lights; l < opt.lightSteps[s]; l++) {
+            myEngine.addALight(Vector4D(0.0f, 1.0f, 0.0f, 1.0f), Vector3D(3.0f, 3.0f, 3.0f));
+        }
+        opt.lights = opt.lightSteps[s];
+        // Few lights : phong_shading.frag against clustered lighting. Past GLBI_MAX_LIGHTS, always clustered.
+        for (int forced = 0; forced < 2; forced++) {
+            if (forced && opt.lights > GLBI_MAX_LIGHTS) break;
+            myEngine.forceClusteredLighting(forced != 0);
+            // The first frame builds the program of the light count
+            renderFrame(opt, 0);
+            glFinish();
+            double assign_us = 0.0, update_us = 0.0;
+            clock::time_point start = clock::now();
+            for (int frame = 0; frame < opt.frames; frame++) {
+                renderFrame(opt, frame);
+                if (myEngine.useClusteredLighting() && myEngine.lightClusters) {
+                    assign_us += myEngine.lightClusters->stats.assignTimeUs;
+                    update_us += myEngine.lightClusters->stats.updateTimeUs;
+                }
+            }
+            glFinish();
+            double time = std::chrono::duration<double>(clock::now() - start).count();
+            std::cout << "  " << opt.lights << " lights, " << (myEngine.useClusteredLighting() ? "clustered" : "naive    ") << " : ";
+            std::cout << 1000.0 * time / opt.frames << " ms/frame";
+            // The upload may wait for the GPU still reading the lights of the previous frame
+            if (myEngine.useClusteredLighting()) {
+                std::cout << ", cluster build " << assign_us / opt.frames << " us/frame, upload " << (update_us - assign_us) / opt.frames << " us/frame";
+            }
+            std::cout << std::endl;
+        }
+    }
+    myEngine.forceClusteredLighting(false);
+}
+
+void releaseScene() {
+    delete sphere;
+    delete cube;
+    delete cone;
+    // Detaches the pool meshes : they are deleted with the mesh manager
+    delete arena;
+}
+
+int main(int argc, char** argv) {
+    Options opt;
+    if (!parseOptions(argc, argv, opt)) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (opt.selfTest) {
+        bool matrices = testMatrixKernels();
+        bool meshes = testMeshGenerators();
+        return (matrices && meshes) ? 0 : 1;
+    }
+
+    // The video goes to the standard output : messages go to the error output
+    if (opt.video == "-") std::cout.rdbuf(std::cerr.rdbuf());
+
+    typedef std::chrono::steady_clock clock;
+    clock::time_point launch = clock::now();
+    GLBI_Headless_Context context;
+    if (!context.create(opt.width, opt.height, opt.backend)) return -1;
+    std::cout << "Headless context : " << context.backendName() << ", " << glGetString(GL_RENDERER) << std::endl;
+
+    if (!opt.shaderCache.empty()) ProgramCache::setDirectory(opt.shaderCache);
+    myEngine.mode2D = false;
+    myEngine.specializeShaders(opt.specializedShaders);
+    std::cout << (opt.specializedShaders ? "Specialized shaders" : "Uber shaders") << std::endl;
+    myEngine.initGL(context.loader());
+    initScene(opt);
+    if (opt.lightSteps.size() > 1) {
+        lightSweep(opt);
+        releaseScene();
+        return 0;
+    }
+
+    // Frames are read back and written by FrameCapture without stalling the rendering.
+    // A batch keeps every frame : the loop waits when the disk is slower than the rendering.
+    FrameCapture capture;
+    capture.setWaitWhenFull(true);
+    std::vector<unsigned char> pixels;
+    // A stream is written by the capture worker : a slow reader makes the loop wait
+    VideoSink sink;
+    if (opt.write && !opt.video.empty()) {
+        if (!sink.open(opt.video, opt.videoFormat, opt.width, opt.height, opt.fps)) return -1;
+        sink.attach(capture);
+        opt.blockingCapture = false;
+    }
+
+    clock::time_point start = clock::now();
+    double first_frame_time = 0.0;
+    std::vector<char> filename(opt.output.size() + 16);
+    for (int frame = 0; frame < opt.frames; frame++) {
+        renderFrame(opt, frame);
+        if (frame == 0) {
+            // Cold start : context, shaders (compiled or restored from the cache), meshes and the first image
+            glFinish();
+            first_frame_time = std::chrono::duration<double>(clock::now() - launch).count();
+        }
+        if (!opt.write) continue;
+        if (!opt.video.empty()) {
+            capture.capture(opt.width, opt.height);
+            continue;
+        }
+        snprintf(&filename[0], filename.size(), "%s_%04d.%s", opt.output.c_str(), frame, opt.format.c_str());
+        if (opt.blockingCapture) {
+            context.readPixels(pixels);
+            bool ok = (opt.format == "png") ? FrameCapture::writePNG(&filename[0], opt.width, opt.height, 3, &pixels[0])
+                                            : FrameCapture::writePPM(&filename[0], opt.width, opt.height, 3, &pixels[0]);
+            if (!ok) return -1;
+        }
+        else {
+            capture.capture(opt.width, opt.height, &filename[0]);
+        }
+    }
+    capture.finish();
+    sink.close();
+    glFinish();
+    double total_time = std::chrono::duration<double>(clock::now() - start).count();
+
+    std::cout << opt.frames << " frames " << opt.width << "x" << opt.height << " : " << 1000.0 * total_time / opt.frames;
+    std::cout << " ms/frame (" << opt.frames / total_time << " frames/s)" << std::endl;
+    double vertices = verticesDrawn / opt.frames;
+    std::cout << "Vertices : " << vertices << " per frame, " << verticesDrawn / total_time / 1e6 << " M/s" << std::endl;
+    // CPU cost of a draw (uniforms, bindings, GL calls) : compare it between builds to measure an engine change.
+    // A software renderer rasterizes in the draw calls : a small --size leaves mostly the engine work.
+    if (drawsSubmitted > 0.0) {
+        std::cout << "Draw submission : " << 1e6 * submitTime / drawsSubmitted << " us/draw (" << drawsSubmitted / opt.frames;
+        std::cout << " draws per frame, " << 1000.0 * submitTime / opt.frames << " ms/frame)" << std::endl;
+    }
+    if (opt.lod) {
+        std::cout << "Levels of detail drawn :";
+        for (unsigned int l = 0; l < lodDraws.size(); l++) std::cout << " " << l << ":" << lodDraws[l] / opt.frames;
+        std::cout << " per frame" << std::endl;
+    }
+    const ProgramCacheStats& cache = ProgramCache::stats();
+    std::cout << "Time to first frame : " << 1000.0 * first_frame_time << " ms, shaders " << 1000.0 * cache.loadTime << " ms";
+    if (ProgramCache::isEnabled()) {
+        std::cout << " (cache " << ProgramCache::getDirectory() << " : " << cache.hits << " restored, " << cache.misses << " compiled, ";
+        std::cout << cache.rejected << " rejected, " << cache.stored << " saved)" << std::endl;
+    }
+    else {
+        std::cout << " (no shader cache)" << std::endl;
+    }
+    FrameCaptureStats st = capture.stats();
+    if (st.requested) {
+        std::cout << "Capture : " << st.delivered << " frames, " << st.failed << " failed, " << st.waits << " waits, ";
+        std::cout << st.maxQueued << " frames queued at most" << std::endl;
+    }
+    if (!opt.video.empty()) {
+        std::cout << "Stream : " << sink.getNbFramesWritten() << " frames" << (sink.failed() ? " (write failed)" : "") << std::endl;
+    }
+    if (!meshPool.empty()) std::cout << "Mesh pool : " << meshManager.residencyStats() << std::endl;
+    if (arena) std::cout << "Buffer arena : " << arena->stats() << std::endl;
+    std::cout << myEngine.counters;
+
+    releaseScene();
+    return 0;
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include "tools/gl_tools.hpp"
+
+struct GLFWwindow;
+
+using namespace STP3D;
+
+namespace glbasimac {
+
+/// Frame pacing statistics of a GLBI_App. Times are in milliseconds, over the last frames (GLBI_App::STATS_WINDOW)
+struct GLBI_App_Stats {
+	/// Frames presented, simulation steps, and frames presented after their deadline
+	unsigned long frames,simulationSteps,missedDeadlines;
+	/// Simulation time dropped because a frame took longer than GLBI_App::maxFrameTime (s)
+	double droppedSimulationTime;
+	/// Time between two presents
+	double frameTimeP50,frameTimeP95,frameTimeP99,frameTimeMax;
+	/// Time from the first input event of a frame to the present of the frame reacting to it
+	unsigned long latencySamples;
+	double latencyP50,latencyP95,latencyMax;
+};
+
+std::ostream& operator<<(std::ostream& os,const GLBI_App_Stats& st);
+
+/**
+ * Run loop of a GLFW program. The simulation advances by fixed steps
+ * (update(dt), setSimulationRate()) and render(alpha) draws between the last
+ * two states : alpha is the fraction of the next step already elapsed.
+ * Frames are paced either by vsync (setVSync()) or by a limiter
+ * (setFrameRate()) : the loop waits for events until spinMargin before the
+ * deadline, then spins on the clock up to it. Input events are thus handled
+ * as they arrive, and the deadline is met more precisely than with a timeout.
+ * A frame presented after its deadline counts as missed and the next
+ * deadline starts from it (no catch-up burst).
+ * Deriving programs override init(), update(), render() and the event
+ * handlers, then call run().
+ */
+struct GLBI_App {
+	/// Number of frames of the frame time and latency statistics
+	static const unsigned int STATS_WINDOW = 600;
+
+	GLBI_App(int width,int height,const char* title);
+	virtual ~GLBI_App();
+
+	/// Open the window, load GL, call init() then loop until the window closes. Returns 0, or -1 on failure.
+	int run();
+	/// Close the window at the end of the frame
+	void quit();
+
+	/// Called once the GL context is ready. Returning false stops the program.
+	virtual bool init() {return true;}
+	/// Advance the simulation by dt seconds (always the simulation step)
+	virtual void update(double dt) {(void)dt;}
+	/// Draw the frame, alpha in [0,1) between the previous and the current simulation state
+	virtual void render(double alpha) = 0;
+	virtual void onKey(int key,int scancode,int action,int mods) {(void)key;(void)scancode;(void)action;(void)mods;}
+	virtual void onMouseButton(int button,int action,int mods) {(void)button;(void)action;(void)mods;}
+	/// Framebuffer resized (the viewport is already set)
+	virtual void onResize(int new_width,int new_height) {(void)new_width;(void)new_height;}
+
+	/// Simulation steps per second
+	void setSimulationRate(double steps_per_second) {simulationStep = 1.0/steps_per_second;}
+	/// Frames per second of the limiter, 0 : no limit
+	void setFrameRate(double fps) {frameRate = fps;}
+	/// Pace frames with the display refresh instead of the limiter
+	void setVSync(bool use_vsync);
+
+	GLBI_App_Stats stats() const;
+
+	GLFWwindow* window;
+	/// Framebuffer size
+	int width,height;
+	/// Limiter : time before the deadline where waiting stops and spinning starts (s)
+	double spinMargin;
+	/// Longest frame taken into account by the simulation (s) : a slower machine slows the simulation down
+	double maxFrameTime;
+
+private:
+	void waitUntil(double deadline);
+	void recordInput();
+	static void keyCallback(GLFWwindow* w,int key,int scancode,int action,int mods);
+	static void mouseButtonCallback(GLFWwindow* w,int button,int action,int mods);
+	static void framebufferSizeCallback(GLFWwindow* w,int new_width,int new_height);
+
+	std::string title;
+	double simulationStep,frameRate;
+	bool vsync;
+	/// Refresh period of the monitor (s), used to detect missed vsync deadlines
+	double refreshPeriod;
+	/// Time of the first input event not yet presented (< 0 : none)
+	double pendingInput;
+	GLBI_App_Stats counters;
+	/// Last frame times and latencies (ms), rings of STATS_WINDOW values
+	std::vector<float> frameTimes,latencies;
+	unsigned int frameHead,latencyHead;
+};
+
+}
@@ -24,6 +24,8 @@ struct GLBI_Convex_2D_Shape {
 	void changeNature(unsigned int new_gl_type);
 
 	void drawShape();
+	// Draw one shape per instance (the instanced program must be in use, see GLBI_Engine::drawInstanced)
+	void drawShapeInstanced(InstanceBuffer& instances);
 
 	// Application and GL parameters
 	unsigned int nb_pts;
@@ -3,23 +3,205 @@
 #define _USE_MATH_DEFINES
 #include <cmath>
 #include <iostream>
+#include <cstring>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include <map>
+#include <cstdint>
+#include "tools/gl_tools.hpp"
 #include "tools/matrix4d.hpp"
 #include "tools/matrix_stack.hpp"
+#include "tools/mesh.hpp"
+#include "tools/indexed_mesh.hpp"
+#include "tools/instance_buffer.hpp"
+#include "tools/multi_draw_batch.hpp"
+#include "glbasimac/glbi_light_clusters.hpp"
 
 using namespace STP3D;
 
 namespace glbasimac {
 
+/// Work counters of the engine. Allows to check how much work is saved by the engine caches.
+struct GLBI_Counters {
+	GLBI_Counters() {reset();}
+	void reset() {
+		mvUploads = mvUploadsSkipped = 0;
+		nmlIdentity = nmlRigid = nmlUniformScale = nmlGeneral = 0;
+		frameUploads = materialUploads = materialBinds = 0;
+		drawCommands = cmdProgramChanges = cmdTextureChanges = cmdMeshChanges = cmdColorChanges = 0;
+		instancedDraws = instancesDrawn = 0;
+		batchSubmissions = batchDraws = batchCalls = 0;
+	}
+
+	/// Number of modelview matrices sent to GL / not sent because the shader already had it
+	unsigned long mvUploads,mvUploadsSkipped;
+	/// Number of normal matrices computed, by transformation class
+	unsigned long nmlIdentity,nmlRigid,nmlUniformScale,nmlGeneral;
+	/// Number of writes of the frame uniform buffer, of new materials written and of material changes
+	unsigned long frameUploads,materialUploads,materialBinds;
+	/// Number of recorded draws, and changes of program / texture / mesh / flat color while replaying them
+	unsigned long drawCommands,cmdProgramChanges,cmdTextureChanges,cmdMeshChanges,cmdColorChanges;
+	/// Number of instanced draws and of instances they drew
+	unsigned long instancedDraws,instancesDrawn;
+	/// Number of batches submitted, of draws they hold and of GL draw calls they needed (when not recorded)
+	unsigned long batchSubmissions,batchDraws,batchCalls;
+};
+
+std::ostream& operator<<(std::ostream& os,const GLBI_Counters& cnt);
+
+/// Maximum number of lights of phong_shading.frag. Past it, lights are clustered (see GLBI_Light_Clusters)
+static const int GLBI_MAX_LIGHTS = 6;
+/// Materials made by setShininess / setSpecularColor kept at most : the least recently used are reused
+static const unsigned int GLBI_MAX_TRANSIENT_MATERIALS = 64;
+
+/// Programs of the engine (index in idShader). Each program has an instanced variant
+/// (built with GLBI_INSTANCED), GLBI_NB_BASE_PROGRAMS further. Only the flat ones exist in 2D mode.
+enum GLBI_Program {
+	GLBI_P_FLAT,GLBI_P_PHONG,GLBI_P_PHONG_CLUSTERED,GLBI_NB_BASE_PROGRAMS,
+	GLBI_P_FLAT_INSTANCED = GLBI_NB_BASE_PROGRAMS,GLBI_P_PHONG_INSTANCED,GLBI_P_PHONG_CLUSTERED_INSTANCED,
+	GLBI_NB_PROGRAMS
+};
+
+/// Build state of an engine program (programs are built on first use)
+enum GLBI_Program_State {GLBI_PS_NONE,GLBI_PS_PENDING,GLBI_PS_READY,GLBI_PS_FAILED};
+
+/// Binding points of the uniform blocks of the 3D shaders
+enum GLBI_Uniform_Block {GLBI_UB_FRAME = 0,GLBI_UB_MATERIAL = 1};
+
+/// CPU copy of the FrameData uniform block (std140) shared by all the 3D shaders
+struct GLBI_Frame_Data {
+	float projectionMat[16];
+	float viewMatrix[16];
+	float lightPos[GLBI_MAX_LIGHTS][4];
+	float lightIntensity[GLBI_MAX_LIGHTS][4];
+	float attenuationFactor[3];
+	int numOfLight;
+};
+
+/// MaterialData uniform block (std140). Materials are stored in one buffer, one aligned range each.
+struct GLBI_Material {
+	float c_spec[3];
+	float shininess;
+};
+
+/// Order of the materials for the lookup of their id (same bytes, same material)
+struct GLBI_Material_Less {
+	bool operator()(const GLBI_Material& a,const GLBI_Material& b) const {return memcmp(&a,&b,sizeof(GLBI_Material)) < 0;}
+};
+
+/// Uniforms used by the engine shaders, outside of the uniform blocks
+/// (projectionMat is in FrameData for the 3D shaders)
+enum GLBI_Uniform {
+	GLBI_U_PROJECTION,GLBI_U_MODELVIEW,GLBI_U_NORMAL,GLBI_U_USE_TEXTURE,GLBI_U_TEX0,
+	GLBI_U_CLUSTER_LIGHTS,GLBI_U_CLUSTER_GRID,GLBI_U_CLUSTER_INDICES,GLBI_U_CLUSTER_PARAMS,GLBI_U_CLUSTER_SCALE,
+	GLBI_U_NUM_OF_GLOBAL_LIGHT,
+	GLBI_NB_UNIFORMS
+};
+/// Vertex attributes used by the engine shaders
+enum GLBI_Attribute {GLBI_A_POS,GLBI_A_NML,GLBI_A_UVS,GLBI_A_COL,GLBI_NB_ATTRIBUTES};
+
+/// Locations of the engine uniforms and attributes in one program (-1 if the program does not use it)
+struct GLBI_Program_Locations {
+	GLBI_Program_Locations() {
+		for(int i=0;i<GLBI_NB_UNIFORMS;i++) uniform[i] = -1;
+		for(int i=0;i<GLBI_NB_ATTRIBUTES;i++) attribute[i] = -1;
+	}
+	/// Fill the table from the program interface built when the program was linked
+	void fetch(unsigned int id_program);
+
+	int uniform[GLBI_NB_UNIFORMS];
+	int attribute[GLBI_NB_ATTRIBUTES];
+};
+
+/// One permutation of an engine program (see GLBI_Engine::specializeShaders)
+struct GLBI_Program_Variant {
+	GLBI_Program_Variant():id(0),state(GLBI_PS_NONE) {}
+	unsigned int id;
+	int state;
+	GLBI_Program_Locations locations;
+};
+
+struct GLBI_Convex_2D_Shape;
+struct GLBI_Set_Of_Points;
+
+/**
+ * One draw recorded by GLBI_Engine between beginRecording() and endRecording() :
+ * the mesh with all the engine state it is drawn with.
+ * Sort key, from the most significant bits : program (4 bits), texture (12 bits),
+ * mesh (16 bits), view space depth (32 bits). Textures and meshes are numbered
+ * in order of first use in the frame.
+ */
+struct GLBI_Draw_Command {
+	uint64_t key;
+	/// Draw function of the mesh type
+	void (*draw)(void* mesh,InstanceBuffer* instances,unsigned int lod);
+	void* mesh;
+	/// Instances of an instanced draw (NULL : one draw)
+	InstanceBuffer* instances;
+	/// Level of detail of an IndexedMesh
+	unsigned int lod;
+	unsigned int vao;
+	int shader;
+	unsigned int material;
+	/// Texture bound on unit 0 (0 : texturing not activated)
+	unsigned int texture;
+	float color[3];
+	float normal[3];
+	Matrix4D mvMatrix;
+	TransformClass transfoClass;
+	unsigned int mvVersion;
+};
+
 struct GLBI_Engine {
-	GLBI_Engine():mode2D(true),useTexture(0),currentShader(0),attFactors({1.0,0.0,1.0}),numberOfLight(1) {
+	GLBI_Engine():nbPendingPrograms(0),specialized(true),hasProjection2D(false),mode2D(true),useTexture(0),currentShader(0),
+	              frameUBO(0),frameDirty(true),materialUBO(0),materialStride(0),materialCapacity(0),
+	              currentMaterial(0),materialDirty(false),attFactors({1.0,0.0,1.0}),numberOfLight(1),
+	              forceClusters(false),lightCutoff(1.0f/256.0f),zNear(0.1f),zFar(100.0f),
+	              recording(false),sortCommands(false),wantedMaterialIdx(0),materialClock(0),recordingClock(0) {
 		lightPos.push_back({0.0,0.0,0.0,0.0});
 		lightIntensity.push_back({0.0,0.0,0.0});
+		for(int i=0;i<GLBI_NB_PROGRAMS;i++) {
+			idShader[i] = uploadedMvVersion[i] = 0;
+			programState[i] = GLBI_PS_NONE;
+			programUseTexture[i] = 0;
+			programKey[i] = i;
+		}
+		GLBI_Material no_spec = {{0.0,0.0,0.0},0.0};
+		materials.push_back(no_spec);
+		materialIds[no_spec] = 0;
+		materialTransient.push_back(false);
+		materialLastUse.push_back(0);
+		wantedMaterial = no_spec;
+		memset(&frameData,0,sizeof(GLBI_Frame_Data));
+		for(int i=0;i<4;i++) frameData.projectionMat[5*i] = 1.0f;
+		// Default value of generic vertex attributes
+		for(int i=0;i<3;i++) flatColor[i] = normal2DShape[i] = 0.0f;
 	}
 
 	~GLBI_Engine() {}
 
-	/// Set the OpenGL Engine
-	void initGL();
+	/// Set the OpenGL Engine. \param loader is the GL function loader given to glad
+	/// (glfwGetProcAddress) : it is used to load the functions newer than GL 4.0 (see GLExt).
+	/// Programs are built on first use. With GL_KHR_parallel_shader_compile, they are all
+	/// queued here and the driver builds them in the background.
+	void initGL(GLADloadproc loader = NULL);
+	/// Id of a program of the engine, built now if needed (waits for it if it is being built). 0 if it failed.
+	unsigned int requireProgram(int program) {
+		if (programState[program] == GLBI_PS_NONE || programState[program] == GLBI_PS_PENDING) buildProgram(program);
+		return idShader[program];
+	}
+	/// True if the program is linked and set up
+	bool isProgramReady(int program) const {return programState[program] == GLBI_PS_READY;}
+	/// Finish the programs built in the background that the driver completed (never waits)
+	void pollPrograms();
+	/** Build the programs for the current state (default) : texturing, number and types of the
+	  * lights are #define of the shaders instead of dynamic branches. Each permutation is
+	  * compiled when first used and kept : going back to a previous state costs nothing.
+	  * False : one uber program per slot, branching on use_texture, numOfLight and lightPos.w.
+	  */
+	void specializeShaders(bool specialize);
+	bool useSpecializedShaders() const {return specialized;}
 	/// Set 2D orthographic projection. Resulting virtual screen size is [xmin,ymin][xmax,ymax]
 	void set2DProjection(float xmin,float xmax,float ymin,float ymax);
 	/// Set 3D perspective projection with a \param fov and \param z_near / \param \z_far depth range
@@ -29,7 +211,17 @@ struct GLBI_Engine {
 	/// Set the current flat color to r,g,b. This color will remains until changed
 	void setViewMatrix(const Matrix4D& mat);
 	/// Send current transformation to GL Engine. ids is the id of the shader to set.
+	/// Nothing is sent if the current shader already has the top matrix of mvMatrixStack.
 	void updateMvMatrix();
+	/// Compute the normal matrix of the top of mvMatrixStack with the cheapest method for its transformation class
+	void computeNormalMatrix(Matrix4D& nmlMatrix);
+	/// Send the per frame data (projection, view, lights) and the current material if they changed.
+	/// Called by updateMvMatrix, so before each draw : the frame buffer is written once per frame.
+	void flushFrameData();
+	/// Create the frame and material uniform buffers (3D mode, called by initGL)
+	void createUniformBuffers();
+	/// (Re)allocate the material buffer and write all the materials
+	void uploadMaterials();
 	
 	/// In 3D configuration, activate or desactivate texturing.
 	void activateTexturing(bool use_texture);
@@ -37,6 +229,18 @@ struct GLBI_Engine {
 	void switchToFlatShading();
 	/// Switch shader to "phong shading".
 	void switchToPhongShading();
+	/// Use clustered lighting even with few lights (it is always used past GLBI_MAX_LIGHTS lights)
+	void forceClusteredLighting(bool use_clusters);
+	/// True if phong shading uses clustered lights
+	bool useClusteredLighting() const {return forceClusters || numberOfLight > GLBI_MAX_LIGHTS;}
+	/// Index of the phong program in idShader (phong_shading.frag or phong_shading_clustered.frag)
+	int phongShader() const {return useClusteredLighting() ? GLBI_P_PHONG_CLUSTERED : GLBI_P_PHONG;}
+	/// Index of the instanced variant of the current program in idShader
+	int instancedShader() const {return currentShader%GLBI_NB_BASE_PROGRAMS+GLBI_NB_BASE_PROGRAMS;}
+	/// True if the program exists in the current mode (only the flat programs exist in 2D)
+	bool hasProgram(int program) const {return !mode2D || program%GLBI_NB_BASE_PROGRAMS == GLBI_P_FLAT;}
+	/// Assign the lights to the clusters (called by flushFrameData when lights or camera changed)
+	void updateLightClusters();
 	/// Setting light position for light number num_light
 	void setLightPosition(const Vector4D& light_pos,int num_light=0);
 	/// Setting light intensity for light number num_light
@@ -51,20 +255,143 @@ struct GLBI_Engine {
 	void setShininess(float new_shininess);
 	/// Set specular coefficient (for future rendered object)
 	void setSpecularColor(const Vector3D& c_spec);
+	/// Register a material (specular color and shininess) and return its id. Same values give the same id.
+	unsigned int addMaterial(const Vector3D& c_spec,float shininess);
+	/// Use a registered material for future rendered object
+	void useMaterial(unsigned int id_material);
+
+	/// Draw a mesh with the current transformation (top of mvMatrixStack), color, material and texture.
+	/// The draw is issued now, or recorded if recording is on. The dequantization matrix of a mesh
+	/// with quantized positions (see VertexLayout) is composed with the current transformation.
+	/// \param lod is the level of detail of an IndexedMesh (see MeshManager::selectLOD).
+	void draw(StandardMesh& mesh);
+	void draw(IndexedMesh& mesh,unsigned int lod = 0);
+	void draw(GLBI_Convex_2D_Shape& shape);
+	void draw(GLBI_Set_Of_Points& set);
+	/// Draw one copy of a mesh per instance of \param instances, with the instanced variant of the current
+	/// program. Instance matrices are applied after the current transformation. Recorded if recording is on :
+	/// then the instances must not change before endRecording(). Meshes with quantized positions cannot be instanced.
+	void drawInstanced(StandardMesh& mesh,InstanceBuffer& instances);
+	void drawInstanced(IndexedMesh& mesh,InstanceBuffer& instances,unsigned int lod = 0);
+	void drawInstanced(GLBI_Convex_2D_Shape& shape,InstanceBuffer& instances);
+	void drawInstanced(GLBI_Set_Of_Points& set,InstanceBuffer& instances);
+	/// Submit all the draws of a batch, with the instanced variant of the current program
+	/// (matrices of the draws are applied after the current transformation). Can be recorded.
+	void drawBatch(MultiDrawBatch& batch);
+	/** Start recording the draws (see draw()) instead of issuing them.
+	  * At endRecording(), they are replayed with as few state changes as possible.
+	  * If \param sort_commands is true (ignored in 2D mode, where the drawing order
+	  * is the painter order), they are first sorted by program, texture, mesh, then
+	  * front to back : this is only correct for opaque objects drawn with depth test.
+	  * Texturing (activateTexturing()) is a program state : it applies to the whole replay.
+	  * Between beginRecording() and endRecording(), meshes must not be drawn directly.
+	  */
+	void beginRecording(bool sort_commands = true);
+	/// Sort and replay the recorded draws. The engine ends in the state it had at the last recorded draw.
+	void endRecording();
+	bool isRecording() const {return recording;}
 
 	/// GL parameters
-	unsigned int idShader[3];
+	unsigned int idShader[GLBI_NB_PROGRAMS];
+	GLBI_Program_Locations locations[GLBI_NB_PROGRAMS];
+	int programState[GLBI_NB_PROGRAMS];
+	/// Programs started and not finished
+	int nbPendingPrograms;
+	/// Permutation of each program (see permutationKey) and all the permutations built
+	uint64_t programKey[GLBI_NB_PROGRAMS];
+	std::map<uint64_t,GLBI_Program_Variant> programVariants;
+	bool specialized;
+	/// Texturing of each program (see activateTexturing), given to programs built later
+	int programUseTexture[GLBI_NB_PROGRAMS];
+	/// Projection of the 2D programs, given to programs built later
+	Matrix4D projection2D;
+	bool hasProjection2D;
 	MatrixStack mvMatrixStack;
 	Matrix4D viewMatrix;
 	bool mode2D;
 	int useTexture; // 0 do not use texture. Else number of texture to use (TODO, 1 for the moment)
 	int currentShader;
+	/// Version of the top of mvMatrixStack last sent to each shader (0 : none)
+	unsigned int uploadedMvVersion[GLBI_NB_PROGRAMS];
+	/// Work counters
+	GLBI_Counters counters;
+
+	/// Uniform buffers of the 3D mode
+	unsigned int frameUBO;
+	GLBI_Frame_Data frameData;
+	bool frameDirty;
+	unsigned int materialUBO;
+	/// Size of one material in materialUBO (aligned on GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT)
+	unsigned int materialStride,materialCapacity;
+	std::vector<GLBI_Material> materials;
+	/// Material bound to GLBI_UB_MATERIAL / material asked by setShininess and setSpecularColor
+	unsigned int currentMaterial;
+	GLBI_Material wantedMaterial;
+	bool materialDirty;
 
 	/// Light parameters
 	Vector3D attFactors;
 	std::vector<Vector4D> lightPos;
 	std::vector<Vector3D> lightIntensity;
 	int numberOfLight;
+	/// Clustered lighting (created on first use)
+	std::unique_ptr<GLBI_Light_Clusters> lightClusters;
+	std::vector<GLBI_Cluster_Light> clusterLights;
+	bool forceClusters;
+	/// A point light is ignored where intensity*attenuation is under lightCutoff (clustered lighting only)
+	float lightCutoff;
+	float zNear,zFar;
+
+	/// Current flat color and normal of convex 2D shapes (generic vertex attributes)
+	float flatColor[3];
+	float normal2DShape[3];
+	/// Draw command list
+	bool recording,sortCommands;
+	std::vector<GLBI_Draw_Command> commands;
+
+private:
+	/// Start building the program (if needed) and wait for it
+	void buildProgram(int program);
+	/// Compile and link the program, without waiting (see ShaderManager::beginProgram)
+	void startProgram(int program);
+	/// Wait for the program started and set it up
+	void finishProgram(int program);
+	/// Give the engine state to a program just linked (locations, uniform blocks, samplers, texturing...)
+	void setupProgram(int program);
+	/// Uniforms of a clustered program describing the clusters
+	void setClusterUniforms(int program);
+	/// Key of the permutation of the program needed by the engine state : program index (bits 0-3),
+	/// specialized (4), textured (5), number of lights (6-8), point lights mask (9-14)
+	uint64_t permutationKey(int program) const;
+	/// Use the permutation of the program needed by the engine state (built on first use)
+	void selectPermutation(int program);
+	/// selectPermutation for all the programs (after a change of texturing or of the lights)
+	void updatePermutations();
+	/// updateMvMatrix() for the program number \param program (which must be in use)
+	void updateMvMatrix(int program);
+	void recordDraw(void (*draw_fct)(void*,InstanceBuffer*,unsigned int),void* mesh,unsigned int vao,InstanceBuffer* instances,int program,
+	                unsigned int lod = 0);
+	void replayCommands();
+	/// Material asked for future rendered objects (resolved if set by setShininess or setSpecularColor)
+	unsigned int wantedMaterialId();
+	/// Id of the material (stored if new). A transient one may take the slot of the least recently
+	/// used transient material not drawn by the recorded commands.
+	unsigned int storeMaterial(const GLBI_Material& mat,bool transient);
+	void bindMaterial(unsigned int id_material);
+	/// Radix sort of the commands (keys and order in sortIndices)
+	void sortCommandList();
+	std::vector<std::pair<uint64_t,unsigned int> > sortIndices,sortTmp;
+	/// First use numbering of the textures and meshes of the recorded frame
+	std::vector<unsigned int> frameTextures;
+	std::unordered_map<unsigned int,unsigned int> frameMeshes;
+	unsigned int wantedMaterialIdx;
+	/// Id of each material, materials made by setShininess / setSpecularColor (reusable slots)
+	/// and last use of each material (value of materialClock, recordingClock at beginRecording)
+	std::map<GLBI_Material,unsigned int,GLBI_Material_Less> materialIds;
+	std::vector<bool> materialTransient;
+	std::vector<unsigned int> transientMaterials;
+	std::vector<unsigned long> materialLastUse;
+	unsigned long materialClock,recordingClock;
 };
 
 }
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <iostream>
+#include <vector>
+#include "tools/gl_tools.hpp"
+
+using namespace STP3D;
+
+namespace glbasimac {
+
+/// Libraries able to give a GL context without display
+enum GLBI_Headless_Backend {GLBI_HEADLESS_AUTO,GLBI_HEADLESS_EGL,GLBI_HEADLESS_OSMESA};
+
+/// Entry points of the backend of one context (see glbi_headless.cpp)
+struct GLBI_Headless_Functions;
+
+/**
+ * OpenGL 4.1 core context without window, for batch rendering on machines
+ * without display server (and without GPU with Mesa llvmpipe).
+ * Backends, tried in this order in GLBI_HEADLESS_AUTO :
+ *  - EGL on the surfaceless platform of Mesa (or the default display),
+ *    with no surface or a 1x1 pbuffer
+ *  - OSMesa, rendering in a 1x1 client buffer
+ * Libraries are opened at run time : nothing to link and no header needed
+ * (Linux and other dlopen systems only). Drawing goes to an FBO of
+ * width x height (RGBA8, depth 24), bound as draw and read framebuffer.
+ * Each context has its own entry points : destroying one leaves the others usable.
+ * loader() gives the functions of the last context created.
+ * Usage :
+ *   GLBI_Headless_Context ctx;
+ *   if (!ctx.create(640,480)) ...
+ *   gladLoadGLLoader(ctx.loader());
+ *   myEngine.initGL(ctx.loader());
+ *   ... draw ...
+ *   ctx.writePPM("frame.ppm");
+ */
+struct GLBI_Headless_Context {
+	GLBI_Headless_Context();
+	~GLBI_Headless_Context();
+
+	/// Create the context and the framebuffer, and make them current. Returns false if no backend works.
+	bool create(int width,int height,GLBI_Headless_Backend wanted = GLBI_HEADLESS_AUTO);
+	void destroy();
+	/// GL function loader of the context (for gladLoadGLLoader and GLBI_Engine::initGL)
+	static GLADloadproc loader();
+	/// Name of the backend in use
+	const char* backendName() const;
+
+	/// Wait for the end of the rendering and read the framebuffer in RGB, first row at the top
+	void readPixels(std::vector<unsigned char>& rgb);
+	/// Write the framebuffer in a binary PPM file
+	bool writePPM(const char* filename);
+
+	int width,height;
+	GLBI_Headless_Backend backend;
+	/// Framebuffer drawn into
+	unsigned int idFBO;
+
+private:
+	bool createEGL();
+	bool createOSMesa();
+	bool createFramebuffer();
+
+	// Owns a context : no copy
+	GLBI_Headless_Context(const GLBI_Headless_Context&);
+	GLBI_Headless_Context& operator=(const GLBI_Headless_Context&);
+
+	GLBI_Headless_Functions* functions;
+	void* library;
+	void* display;
+	void* context;
+	void* surface;
+	/// OSMesa needs a color buffer even if it is not drawn into
+	std::vector<unsigned char> osmesaBuffer;
+	unsigned int idRenderbuffers[2];
+	std::vector<unsigned char> rowBuffer;
+};
+
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <iostream>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "tools/gl_tools.hpp"
+
+using namespace STP3D;
+
+namespace glbasimac {
+
+/// A light given to the clusters, in view space.
+/// radius < 0 : the light reaches every fragment (directional light or no attenuation)
+struct GLBI_Cluster_Light {
+	float pos[4];
+	float intensity[3];
+	float radius;
+};
+
+/// Light assignment statistics of the last update
+struct GLBI_Cluster_Stats {
+	unsigned int nbLights,nbGlobalLights,nbClusters,nbThreads;
+	/// Number of (cluster,light) pairs, largest light list, clusters without light
+	unsigned int lightRefs,maxLightsPerCluster,emptyClusters;
+	/// CPU time of the assignment / of the whole update (with upload), in microseconds
+	double assignTimeUs,updateTimeUs;
+};
+
+std::ostream& operator<<(std::ostream& os,const GLBI_Cluster_Stats& st);
+
+/**
+ * Clustered forward lighting. The view frustum is split in nx*ny tiles in
+ * screen space and nz slices in depth (exponential spacing between the near
+ * and far planes). Every frame, lights are assigned on the CPU to the
+ * clusters their sphere of influence touches, depth slices being shared
+ * between worker threads. The result is sent in three texture buffers read
+ * by phong_shading_clustered.frag :
+ *  - lights : 2 RGBA32F texels per light (view space position, intensity),
+ *    global lights first
+ *  - grid : one RG32UI texel (offset,count) per cluster
+ *  - indices : R32UI light ids, cluster after cluster
+ */
+struct GLBI_Light_Clusters {
+	/// Grid of nx*ny*nz clusters. nb_threads = 0 : one thread per hardware thread
+	GLBI_Light_Clusters(unsigned int nx = 16,unsigned int ny = 9,unsigned int nz = 24,unsigned int nb_threads = 0);
+	~GLBI_Light_Clusters();
+
+	/// Set the frustum split by the clusters (symmetric or not perspective projection, column major)
+	void setProjection(const float* proj,float z_near,float z_far);
+	/// Assign the lights to the clusters and send everything to GL
+	void update(const std::vector<GLBI_Cluster_Light>& lights);
+	/// Bind the three texture buffers on texture units GL_TEXTURE0+first_unit...+2
+	void bindTextures(unsigned int first_unit);
+
+	/// Attenuation radius of a light : distance where intensity*attenuation falls under cutoff
+	static float influenceRadius(const float intensity[3],const float att_factors[3],float cutoff = 1.0f/256.0f);
+
+	unsigned int nx,ny,nz;
+	/// Depth slicing : slice = log(depth/zNear)*depthScale
+	float zNear,zFar,depthScale;
+	/// Number of global lights in the last update
+	unsigned int nbGlobalLights;
+	GLBI_Cluster_Stats stats;
+
+private:
+	void assignSlices(unsigned int thread_id);
+	void workerLoop(unsigned int thread_id);
+	void createGLObjects();
+
+	/// View space bounding box of each cluster (min xyz, max xyz)
+	std::vector<float> clusterBoxes;
+	/// Terms of the projection the boxes were made with (m0,m5,m8,m9)
+	float projTerms[4];
+	/// Lights of the frame, global lights first
+	std::vector<GLBI_Cluster_Light> frameLights;
+	/// Per thread results : light ids, and (offset in ids,count) of each cluster
+	std::vector<std::vector<unsigned int> > threadIds;
+	std::vector<unsigned int> clusterRanges;
+	/// Data sent to GL
+	std::vector<unsigned int> gridData,indexData;
+	std::vector<float> lightData;
+
+	/// Worker threads (thread 0 is the caller)
+	std::vector<std::thread> workers;
+	std::mutex mtx;
+	std::condition_variable cvStart,cvDone;
+	unsigned int generation,pending;
+	bool quit;
+
+	/// GL buffers and their buffer textures : lights, grid, indices
+	unsigned int idBuffers[3];
+	unsigned int idTextures[3];
+};
+
+}
@@ -33,6 +33,8 @@ struct GLBI_Set_Of_Points {
 	void changeNature(unsigned int new_gl_type);
 
 	void drawSet();
+	// Draw one set per instance (the instanced program must be in use, see GLBI_Engine::drawInstanced)
+	void drawSetInstanced(InstanceBuffer& instances);
 
 	// Application and GL parameters
 	unsigned int nb_pts;
@@ -0,0 +1,202 @@
+#include "glbasimac/glbi_app.hpp"
+#include "tools/profiler.hpp"
+#define GLFW_INCLUDE_NONE
+#include "GLFW/glfw3.h"
+#include <algorithm>
+#include <thread>
+
+namespace glbasimac {
+
+	static void onGLFWError(int error,const char* description) {
+		std::cerr<<"GLFW error "<<error<<" : "<<description<<std::endl;
+	}
+
+	/// Push a value in a ring of GLBI_App::STATS_WINDOW values
+	static void pushSample(std::vector<float>& ring,unsigned int& head,float value) {
+		if (ring.size() < GLBI_App::STATS_WINDOW) {
+			ring.push_back(value);
+			return;
+		}
+		ring[head] = value;
+		head = (head+1)%GLBI_App::STATS_WINDOW;
+	}
+
+	static double percentile(const std::vector<float>& sorted,unsigned int p) {
+		if (sorted.empty()) return 0.0;
+		return sorted[(sorted.size()-1)*p/100];
+	}
+
+	GLBI_App::GLBI_App(int w,int h,const char* window_title)
+		:window(NULL),width(w),height(h),spinMargin(0.002),maxFrameTime(0.25),
+		 title(window_title),simulationStep(1.0/60.0),frameRate(60.0),vsync(false),
+		 refreshPeriod(1.0/60.0),pendingInput(-1.0),frameHead(0),latencyHead(0) {
+		counters = GLBI_App_Stats();
+	}
+
+	GLBI_App::~GLBI_App() {
+		if (window) {
+			glfwDestroyWindow(window);
+			glfwTerminate();
+		}
+	}
+
+	void GLBI_App::setVSync(bool use_vsync) {
+		vsync = use_vsync;
+		if (window) glfwSwapInterval(vsync ? 1 : 0);
+	}
+
+	void GLBI_App::quit() {
+		if (window) glfwSetWindowShouldClose(window,GLFW_TRUE);
+	}
+
+	int GLBI_App::run() {
+		glfwSetErrorCallback(onGLFWError);
+		if (!glfwInit()) return -1;
+		// Engine shaders are GLSL 4.10
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR,4);
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR,1);
+		glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT,GL_TRUE);
+		glfwWindowHint(GLFW_OPENGL_PROFILE,GLFW_OPENGL_CORE_PROFILE);
+		window = glfwCreateWindow(width,height,title.c_str(),NULL,NULL);
+		if (!window) {
+			glfwTerminate();
+			return -1;
+		}
+		glfwMakeContextCurrent(window);
+		if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) {
+			std::cerr<<"Unable to load OpenGL"<<std::endl;
+			return -1;
+		}
+		glfwSetWindowUserPointer(window,this);
+		glfwSetKeyCallback(window,keyCallback);
+		glfwSetMouseButtonCallback(window,mouseButtonCallback);
+		glfwSetFramebufferSizeCallback(window,framebufferSizeCallback);
+		glfwSwapInterval(vsync ? 1 : 0);
+		GLFWmonitor* monitor = glfwGetPrimaryMonitor();
+		const GLFWvidmode* mode = monitor ? glfwGetVideoMode(monitor) : NULL;
+		if (mode && mode->refreshRate > 0) refreshPeriod = 1.0/mode->refreshRate;
+
+		if (!init()) return -1;
+		glfwGetFramebufferSize(window,&width,&height);
+		framebufferSizeCallback(window,width,height);
+
+		double previous = glfwGetTime();
+		double last_present = previous;
+		double deadline = previous;
+		double accumulator = 0.0;
+		while (!glfwWindowShouldClose(window)) {
+			glfwPollEvents();
+
+			// Fixed steps of simulation for the time elapsed since the previous frame
+			double now = glfwGetTime();
+			double elapsed = now-previous;
+			previous = now;
+			if (elapsed > maxFrameTime) {
+				counters.droppedSimulationTime += elapsed-maxFrameTime;
+				elapsed = maxFrameTime;
+			}
+			accumulator += elapsed;
+			while (accumulator >= simulationStep) {
+				update(simulationStep);
+				accumulator -= simulationStep;
+				counters.simulationSteps++;
+			}
+			render(accumulator/simulationStep);
+
+			glfwSwapBuffers(window);
+			STP3D_PROFILE_FRAME();
+			double present = glfwGetTime();
+			counters.frames++;
+			if (pendingInput >= 0.0) {
+				pushSample(latencies,latencyHead,1000.0*(present-pendingInput));
+				counters.latencySamples++;
+				pendingInput = -1.0;
+			}
+
+			// Pacing
+			if (vsync) {
+				if (present-last_present > 1.5*refreshPeriod) counters.missedDeadlines++;
+			}
+			else if (frameRate > 0.0) {
+				deadline += 1.0/frameRate;
+				if (present > deadline) {
+					counters.missedDeadlines++;
+					deadline = present;
+				}
+				else {
+					waitUntil(deadline);
+					present = glfwGetTime();
+				}
+			}
+			pushSample(frameTimes,frameHead,1000.0*(present-last_present));
+			last_present = present;
+		}
+
+		glfwDestroyWindow(window);
+		window = NULL;
+		glfwTerminate();
+		return 0;
+	}
+
+	void GLBI_App::waitUntil(double deadline) {
+		// Events wake the wait up : they are handled (and time stamped) when they arrive
+		double remaining = deadline-spinMargin-glfwGetTime();
+		while (remaining > 0.0) {
+			glfwWaitEventsTimeout(remaining);
+			remaining = deadline-spinMargin-glfwGetTime();
+		}
+		// Timeouts are not precise : the end is a busy wait
+		while (glfwGetTime() < deadline) std::this_thread::yield();
+	}
+
+	void GLBI_App::recordInput() {
+		if (pendingInput < 0.0) pendingInput = glfwGetTime();
+	}
+
+	void GLBI_App::keyCallback(GLFWwindow* w,int key,int scancode,int action,int mods) {
+		GLBI_App* app = static_cast<GLBI_App*>(glfwGetWindowUserPointer(w));
+		app->recordInput();
+		app->onKey(key,scancode,action,mods);
+	}
+
+	void GLBI_App::mouseButtonCallback(GLFWwindow* w,int button,int action,int mods) {
+		GLBI_App* app = static_cast<GLBI_App*>(glfwGetWindowUserPointer(w));
+		app->recordInput();
+		app->onMouseButton(button,action,mods);
+	}
+
+	void GLBI_App::framebufferSizeCallback(GLFWwindow* w,int new_width,int new_height) {
+		GLBI_App* app = static_cast<GLBI_App*>(glfwGetWindowUserPointer(w));
+		app->width = new_width;
+		app->height = new_height;
+		glViewport(0,0,new_width,new_height);
+		app->onResize(new_width,new_height);
+	}
+
+	GLBI_App_Stats GLBI_App::stats() const {
+		GLBI_App_Stats st = counters;
+		std::vector<float> sorted(frameTimes);
+		std::sort(sorted.begin(),sorted.end());
+		st.frameTimeP50 = percentile(sorted,50);
+		st.frameTimeP95 = percentile(sorted,95);
+		st.frameTimeP99 = percentile(sorted,99);
+		st.frameTimeMax = sorted.empty() ? 0.0 : sorted.back();
+		sorted = latencies;
+		std::sort(sorted.begin(),sorted.end());
+		st.latencyP50 = percentile(sorted,50);
+		st.latencyP95 = percentile(sorted,95);
+		st.latencyMax = sorted.empty() ? 0.0 : sorted.back();
+		return st;
+	}
+
+	std::ostream& operator<<(std::ostream& os,const GLBI_App_Stats& st) {
+		os<<"Frames      : "<<st.frames<<" ("<<st.missedDeadlines<<" missed deadlines), ";
+		os<<st.simulationSteps<<" simulation steps ("<<st.droppedSimulationTime<<" s dropped)"<<std::endl;
+		os<<"Frame time  : p50 "<<st.frameTimeP50<<" p95 "<<st.frameTimeP95<<" p99 "<<st.frameTimeP99;
+		os<<" max "<<st.frameTimeMax<<" ms"<<std::endl;
+		os<<"Input latency : p50 "<<st.latencyP50<<" p95 "<<st.latencyP95<<" max "<<st.latencyMax;
+		os<<" ms ("<<st.latencySamples<<" samples)"<<std::endl;
+		return os;
+	}
+
+}
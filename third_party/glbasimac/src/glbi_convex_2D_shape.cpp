@@ -40,4 +40,8 @@ namespace glbasimac {
 		shape.draw();
 	}
 
+	void GLBI_Convex_2D_Shape::drawShapeInstanced(InstanceBuffer& instances) {
+		shape.drawInstanced(instances);
+	}
+
 }
@@ -1,95 +1,538 @@
 #include "glbasimac/glbi_engine.hpp"
 #include "tools/shaders.hpp"
+#include "tools/gl_state.hpp"
+#include "tools/profiler.hpp"
+#include "glbasimac/glbi_convex_2D_shape.hpp"
+#include "glbasimac/glbi_set_of_points.hpp"
+#include <algorithm>
+#include <sstream>
+#include <thread>
 using namespace glbasimac;
 using namespace STP3D;
 
 namespace glbasimac {
 
-	void GLBI_Engine::initGL() {
+	/// Name, vertex and fragment shaders of the programs, in 2D and in 3D (NULL : no such program).
+	/// 2D and instanced variants are the same files built with GLBI_2D / GLBI_INSTANCED.
+	static const char* programFiles[2][GLBI_NB_PROGRAMS][3] = {
+		{
+			{"Flat 2D","../assets/shaders/flat_shading.vert","../assets/shaders/flat_shading.frag"},
+			{NULL,NULL,NULL},
+			{NULL,NULL,NULL},
+			{"Flat 2D instanced","../assets/shaders/flat_shading.vert","../assets/shaders/flat_shading.frag"},
+			{NULL,NULL,NULL},
+			{NULL,NULL,NULL}
+		},
+		{
+			{"Flat 3D","../assets/shaders/flat_shading.vert","../assets/shaders/flat_shading.frag"},
+			{"Phong 3D","../assets/shaders/phong_shading.vert","../assets/shaders/phong_shading.frag"},
+			{"Phong 3D clustered lights","../assets/shaders/phong_shading.vert","../assets/shaders/phong_shading_clustered.frag"},
+			{"Flat 3D instanced","../assets/shaders/flat_shading.vert","../assets/shaders/flat_shading.frag"},
+			{"Phong 3D instanced","../assets/shaders/phong_shading.vert","../assets/shaders/phong_shading.frag"},
+			{"Phong 3D instanced clustered lights","../assets/shaders/phong_shading.vert","../assets/shaders/phong_shading_clustered.frag"}
+		}
+	};
+
+	void GLBI_Engine::initGL(GLADloadproc loader) {
+		STP3D_PROFILE_ZONE("GLBI_Engine::initGL");
 		std::cout<<"Initialisation of GL Engine"<<std::endl;
+		GLExt::load(loader);
+		GLState::reset();
+		if (!GLExt::hasProgramUniform()) {
+			std::cerr<<"No glProgramUniform : uniforms of unused programs are deferred"<<std::endl;
+		}
 
-		if (mode2D) {
-			std::cerr<<"Flat 2D"<<std::endl;
-			idShader[0] = ShaderManager::loadShader("../assets/shaders/flat_shading_2D.vert","../assets/shaders/flat_shading.frag",true);
+		for(int i=0;i<GLBI_NB_PROGRAMS;i++) {
+			idShader[i] = uploadedMvVersion[i] = 0;
+			programState[i] = GLBI_PS_NONE;
+			programUseTexture[i] = useTexture;
 		}
-		else {
-			std::cerr<<"Flat 3D"<<std::endl;
-			idShader[0] = ShaderManager::loadShader("../assets/shaders/flat_shading_3D.vert","../assets/shaders/flat_shading.frag",true);
-			std::cerr<<"Phong 3D"<<std::endl;
-			idShader[1] = ShaderManager::loadShader("../assets/shaders/phong_shading.vert","../assets/shaders/phong_shading.frag",true);
+		programVariants.clear();
+		for(int i=0;i<GLBI_NB_PROGRAMS;i++) programKey[i] = permutationKey(i);
+		nbPendingPrograms = 0;
+		// Without parallel compilation, each program is built when first used.
+		// With it, all of them are queued now : a first use only waits for its own program.
+		// On a single core, the background builds would only slow down the first frames.
+		if (GLExt::hasParallelShaderCompile() && std::thread::hardware_concurrency() > 1) {
+			GLExt::fn().MaxShaderCompilerThreads(0xFFFFFFFFu);
+			for(int i=0;i<GLBI_NB_PROGRAMS;i++) {
+				if (hasProgram(i)) startProgram(i);
+			}
 		}
 		mvMatrixStack.loadIdentity();
-		glUseProgram(idShader[0]);
+		// Programs are bound by their first draw (see updateMvMatrix)
+		currentShader = GLBI_P_FLAT;
 		if (!mode2D) {
-			glUniform1i(glGetUniformLocation(idShader[0],"use_texture"),useTexture);
-			glUseProgram(idShader[1]);
-			glUniform3fv(glGetUniformLocation(idShader[1],"attenuationFactor"),1,attFactors);
-			glUniform1f(glGetUniformLocation(idShader[1],"shininess"),0.0);
-			glUniform1i(glGetUniformLocation(idShader[1],"numOfLight"),numberOfLight);
-			glUniform1i(glGetUniformLocation(idShader[1],"use_texture"),useTexture);
-			glUseProgram(idShader[0]);
+			createUniformBuffers();
+		}
+		else {
+			updateMvMatrix();
+		}
+	}
+
+	void GLBI_Engine::buildProgram(int program) {
+		if (programState[program] == GLBI_PS_NONE) startProgram(program);
+		if (programState[program] == GLBI_PS_PENDING) finishProgram(program);
+	}
+
+	void GLBI_Engine::startProgram(int program) {
+		const char* const* files = programFiles[mode2D ? 0 : 1][program];
+		if (!files[0]) {
+			programState[program] = GLBI_PS_FAILED;
+			return;
+		}
+		// Permutation of the program (see permutationKey)
+		uint64_t key = programKey[program];
+		std::ostringstream defines;
+		if (mode2D) defines<<"#define GLBI_2D\n";
+		if (program >= GLBI_NB_BASE_PROGRAMS) defines<<"#define GLBI_INSTANCED\n";
+		std::cerr<<files[0];
+		if (key & (1<<4)) {
+			defines<<"#define GLBI_TEXTURED "<<((key>>5) & 1)<<"\n";
+			std::cerr<<" (textured "<<((key>>5) & 1);
+			if (program%GLBI_NB_BASE_PROGRAMS == GLBI_P_PHONG) {
+				defines<<"#define GLBI_NB_LIGHTS "<<((key>>6) & 7)<<"\n";
+				defines<<"#define GLBI_POINT_LIGHTS "<<((key>>9) & 63)<<"\n";
+				std::cerr<<", lights "<<((key>>6) & 7)<<", point lights mask "<<((key>>9) & 63);
+			}
+			std::cerr<<")";
+		}
+		std::cerr<<std::endl;
+		std::vector<const char*> filenames(files+1,files+3);
+		std::vector<ShaderType> types(1,Vertex);
+		types.push_back(Fragment);
+		idShader[program] = ShaderManager::beginProgram(filenames,types,true,defines.str());
+		if (idShader[program]) {
+			programState[program] = GLBI_PS_PENDING;
+			nbPendingPrograms++;
 		}
 		else {
-			glUniformMatrix4fv(glGetUniformLocation(idShader[currentShader],"modelviewMat"),1,GL_FALSE,mvMatrixStack.getTopGLMatrix());
+			programState[program] = GLBI_PS_FAILED;
+		}
+	}
+
+	void GLBI_Engine::finishProgram(int program) {
+		nbPendingPrograms--;
+		if (!ShaderManager::finishProgram(idShader[program],true)) {
+			std::cerr<<"Program "<<programFiles[mode2D ? 0 : 1][program][0]<<" will not be used"<<std::endl;
+			idShader[program] = 0;
+			programState[program] = GLBI_PS_FAILED;
+			return;
+		}
+		programState[program] = GLBI_PS_READY;
+		setupProgram(program);
+	}
+
+	void GLBI_Engine::pollPrograms() {
+		for(int i=0;i<GLBI_NB_PROGRAMS && nbPendingPrograms > 0;i++) {
+			if (programState[i] == GLBI_PS_PENDING && ShaderManager::isProgramCompleted(idShader[i])) finishProgram(i);
 		}
 	}
 
+	uint64_t GLBI_Engine::permutationKey(int program) const {
+		uint64_t key = program;
+		if (!specialized) return key;
+		key |= 1<<4;
+		if (programUseTexture[program]) key |= 1<<5;
+		// The clustered program reads its lights from the clusters
+		if (program%GLBI_NB_BASE_PROGRAMS == GLBI_P_PHONG) {
+			int nb_light = (numberOfLight < GLBI_MAX_LIGHTS) ? numberOfLight : GLBI_MAX_LIGHTS;
+			key |= uint64_t(nb_light)<<6;
+			for(int i=0;i<nb_light;i++) {
+				if (lightPos[i].w > 0.0) key |= uint64_t(1)<<(9+i);
+			}
+		}
+		return key;
+	}
+
+	void GLBI_Engine::selectPermutation(int program) {
+		uint64_t key = permutationKey(program);
+		if (key == programKey[program]) return;
+		// A program being built is finished first : pollPrograms only knows the current permutations
+		if (programState[program] == GLBI_PS_PENDING) finishProgram(program);
+		GLBI_Program_Variant& previous = programVariants[programKey[program]];
+		previous.id = idShader[program];
+		previous.state = programState[program];
+		previous.locations = locations[program];
+
+		programKey[program] = key;
+		GLBI_Program_Variant& variant = programVariants[key];
+		idShader[program] = variant.id;
+		programState[program] = variant.state;
+		locations[program] = variant.locations;
+		uploadedMvVersion[program] = 0;
+		// The engine state may have changed since this permutation was used
+		if (programState[program] == GLBI_PS_READY) setupProgram(program);
+	}
+
+	void GLBI_Engine::updatePermutations() {
+		for(int i=0;i<GLBI_NB_PROGRAMS;i++) {
+			if (hasProgram(i)) selectPermutation(i);
+		}
+	}
+
+	void GLBI_Engine::specializeShaders(bool specialize) {
+		specialized = specialize;
+		updatePermutations();
+	}
+
+	void GLBI_Engine::setupProgram(int program) {
+		unsigned int id = idShader[program];
+		GLBI_Program_Locations& loc = locations[program];
+		loc.fetch(id);
+		uploadedMvVersion[program] = 0;
+		if (mode2D) {
+			if (hasProjection2D) GLState::uniformMatrix4fv(id,loc.uniform[GLBI_U_PROJECTION],projection2D);
+			return;
+		}
+		GLState::uniform1i(id,loc.uniform[GLBI_U_USE_TEXTURE],programUseTexture[program]);
+		ShaderManager::bindUniformBlock(id,"FrameData",GLBI_UB_FRAME);
+		ShaderManager::bindUniformBlock(id,"MaterialData",GLBI_UB_MATERIAL);
+		if (program%GLBI_NB_BASE_PROGRAMS == GLBI_P_PHONG_CLUSTERED) {
+			// Clustered lights use texture units 1 to 3
+			GLState::uniform1i(id,loc.uniform[GLBI_U_CLUSTER_LIGHTS],1);
+			GLState::uniform1i(id,loc.uniform[GLBI_U_CLUSTER_GRID],2);
+			GLState::uniform1i(id,loc.uniform[GLBI_U_CLUSTER_INDICES],3);
+			if (lightClusters) setClusterUniforms(program);
+		}
+	}
+
+	static const char* uniformNames[GLBI_NB_UNIFORMS] = {
+		"projectionMat","modelviewMat","normalMat","use_texture","tex0",
+		"clusterLights","clusterGrid","clusterIndices","clusterParams","clusterScale","numOfGlobalLight"
+	};
+	static const char* attributeNames[GLBI_NB_ATTRIBUTES] = {"vx_pos","vx_nml","vx_uvs","vx_col"};
+
+	void GLBI_Program_Locations::fetch(unsigned int id_program) {
+		const ProgramInterface& itf = ShaderManager::getProgramInterface(id_program);
+		for(int i=0;i<GLBI_NB_UNIFORMS;i++) uniform[i] = itf.getUniformLocation(uniformNames[i]);
+		for(int i=0;i<GLBI_NB_ATTRIBUTES;i++) attribute[i] = itf.getAttribLocation(attributeNames[i]);
+	}
+
 	void GLBI_Engine::setFlatColor(float r,float g,float b) {
-		glVertexAttrib3f(glGetAttribLocation(idShader[currentShader],"vx_col"),r,g,b);
+		flatColor[0] = r;
+		flatColor[1] = g;
+		flatColor[2] = b;
+		// Recorded draws keep their color
+		if (recording) return;
+		GLint loc = locations[currentShader].attribute[GLBI_A_COL];
+		if (loc >= 0) glVertexAttrib3f(loc,r,g,b);
 	}
 
 	void GLBI_Engine::updateMvMatrix() {
-		glUniformMatrix4fv(glGetUniformLocation(idShader[currentShader],"modelviewMat"),1,GL_FALSE,mvMatrixStack.getTopGLMatrix());
-		if (!mode2D) {
-			Matrix4D nmlMatrix = mvMatrixStack.getTopGLMatrix();
-			nmlMatrix.invert();
-			nmlMatrix.transpose();
-			glUniformMatrix4fv(glGetUniformLocation(idShader[currentShader],"normalMat"),1,GL_FALSE,nmlMatrix);
+		updateMvMatrix(currentShader);
+	}
+
+	void GLBI_Engine::updateMvMatrix(int program) {
+		// Programs are bound here when built late (first draw, change of permutation)
+		if (GLState::currentProgram() != requireProgram(program)) {
+			GLState::useProgram(idShader[program]);
+			// Generic attributes, set while the program was not built
+			GLint loc = locations[program].attribute[GLBI_A_COL];
+			if (loc >= 0) glVertexAttrib3f(loc,flatColor[0],flatColor[1],flatColor[2]);
+			loc = locations[program].attribute[GLBI_A_NML];
+			if (!mode2D && loc >= 0) glVertexAttrib3f(loc,normal2DShape[0],normal2DShape[1],normal2DShape[2]);
+		}
+		flushFrameData();
+		if (program%GLBI_NB_BASE_PROGRAMS == GLBI_P_PHONG_CLUSTERED) lightClusters->bindTextures(1);
+		if (mvMatrixStack.getTopVersion() == uploadedMvVersion[program]) {
+			counters.mvUploadsSkipped++;
+			return;
+		}
+		uploadedMvVersion[program] = mvMatrixStack.getTopVersion();
+		counters.mvUploads++;
+		GLState::uniformMatrix4fv(idShader[program],locations[program].uniform[GLBI_U_MODELVIEW],mvMatrixStack.getTopGLMatrix());
+		// Only Phong shading uses the normal matrix
+		if (!mode2D && program%GLBI_NB_BASE_PROGRAMS != GLBI_P_FLAT) {
+			Matrix4D nmlMatrix;
+			computeNormalMatrix(nmlMatrix);
+			GLState::uniformMatrix4fv(idShader[program],locations[program].uniform[GLBI_U_NORMAL],nmlMatrix);
+		}
+	}
+
+	void GLBI_Engine::computeNormalMatrix(Matrix4D& nmlMatrix) {
+		// The normal matrix is the inverse transpose of the modelview matrix.
+		// The translation part is useless (normals are sent with w=0).
+		const Matrix4D& mv = mvMatrixStack.stack.back();
+		switch(mvMatrixStack.getTopTransformClass()) {
+			case TransfoIdentity :
+				// Identity is its own inverse transpose
+				counters.nmlIdentity++;
+				return;
+			case TransfoRigid :
+				// Inverse transpose of a rotation is the rotation itself
+				counters.nmlRigid++;
+				nmlMatrix = mv;
+				break;
+			case TransfoUniformScale : {
+				// (s.R)^-T = R/s = (s.R)/s^2
+				counters.nmlUniformScale++;
+				const float* m = mv.mat;
+				float inv_s2 = 1.0f/(m[0]*m[0]+m[1]*m[1]+m[2]*m[2]);
+				for(int i=0;i<12;i++) nmlMatrix.mat[i] = m[i]*inv_s2;
+				break;
+			}
+			default :
+				counters.nmlGeneral++;
+				nmlMatrix = mv;
+				if (nmlMatrix.isAffine()) nmlMatrix.invertAffine();
+				else nmlMatrix.invert();
+				nmlMatrix.transpose();
+				return;
+		}
+		nmlMatrix.mat[3] = nmlMatrix.mat[7] = nmlMatrix.mat[11] = 0.0f;
+		nmlMatrix.mat[12] = nmlMatrix.mat[13] = nmlMatrix.mat[14] = 0.0f;
+		nmlMatrix.mat[15] = 1.0f;
+	}
+
+	static_assert(sizeof(GLBI_Frame_Data) == 336,"GLBI_Frame_Data must follow the std140 layout of FrameData");
+	static_assert(sizeof(GLBI_Material) == 16,"GLBI_Material must follow the std140 layout of MaterialData");
+
+	void GLBI_Engine::createUniformBuffers() {
+		if (!frameUBO) glGenBuffers(1,&frameUBO);
+		GLState::bindBuffer(GL_UNIFORM_BUFFER,frameUBO);
+		glBufferData(GL_UNIFORM_BUFFER,sizeof(GLBI_Frame_Data),NULL,GL_DYNAMIC_DRAW);
+		GLState::bindBufferBase(GL_UNIFORM_BUFFER,GLBI_UB_FRAME,frameUBO);
+		frameDirty = true;
+
+		// Each material starts on an offset usable by glBindBufferRange
+		GLint align = 16;
+		glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT,&align);
+		materialStride = ((sizeof(GLBI_Material)+align-1)/align)*align;
+		if (!materialUBO) glGenBuffers(1,&materialUBO);
+		materialCapacity = 0;
+		uploadMaterials();
+		currentMaterial = materials.size();
+		useMaterial(0);
+	}
+
+	void GLBI_Engine::uploadMaterials() {
+		materialCapacity = 16;
+		while (materialCapacity < materials.size()) materialCapacity *= 2;
+		std::vector<unsigned char> data(materialCapacity*materialStride,0);
+		for(unsigned int i=0;i<materials.size();i++) {
+			memcpy(&data[i*materialStride],&materials[i],sizeof(GLBI_Material));
 		}
+		GLState::bindBuffer(GL_UNIFORM_BUFFER,materialUBO);
+		glBufferData(GL_UNIFORM_BUFFER,data.size(),&data[0],GL_STATIC_DRAW);
+		counters.materialUploads += materials.size();
+	}
+
+	unsigned int GLBI_Engine::addMaterial(const Vector3D& c_spec,float shininess) {
+		GLBI_Material mat = {{c_spec.x,c_spec.y,c_spec.z},shininess};
+		return storeMaterial(mat,false);
+	}
+
+	unsigned int GLBI_Engine::storeMaterial(const GLBI_Material& mat,bool transient) {
+		std::map<GLBI_Material,unsigned int,GLBI_Material_Less>::iterator found = materialIds.find(mat);
+		if (found != materialIds.end()) {
+			// A registered material is kept for good
+			if (!transient) materialTransient[found->second] = false;
+			return found->second;
+		}
+		unsigned int id = materials.size();
+		if (transient && transientMaterials.size() >= GLBI_MAX_TRANSIENT_MATERIALS) {
+			// Reuse the least recently used slot. Slots of the recorded draws and of the wanted material are kept
+			// (all of them in use : the table grows for this frame).
+			unsigned int oldest = 0;
+			for(unsigned int i=0;i<transientMaterials.size();) {
+				unsigned int slot = transientMaterials[i];
+				if (!materialTransient[slot]) {
+					transientMaterials[i] = transientMaterials.back();
+					transientMaterials.pop_back();
+					continue;
+				}
+				bool in_use = slot == wantedMaterialIdx || (recording && materialLastUse[slot] >= recordingClock);
+				if (!in_use && (id == materials.size() || materialLastUse[slot] < materialLastUse[oldest])) {
+					id = slot;
+					oldest = slot;
+				}
+				i++;
+			}
+		}
+		if (id == materials.size()) {
+			materials.push_back(mat);
+			materialTransient.push_back(transient);
+			materialLastUse.push_back(0);
+			if (transient) transientMaterials.push_back(id);
+		}
+		else {
+			materialIds.erase(materials[id]);
+			materials[id] = mat;
+		}
+		materialIds[mat] = id;
+		// Not yet in 3D mode : the buffer is filled by createUniformBuffers
+		if (materialStride == 0) return id;
+		if (materials.size() > materialCapacity) {
+			uploadMaterials();
+		}
+		else {
+			GLState::bindBuffer(GL_UNIFORM_BUFFER,materialUBO);
+			glBufferSubData(GL_UNIFORM_BUFFER,id*materialStride,sizeof(GLBI_Material),&mat);
+			counters.materialUploads++;
+		}
+		return id;
+	}
+
+	void GLBI_Engine::useMaterial(unsigned int id_material) {
+		if (id_material >= materials.size()) {
+			std::cerr<<"Unknown material "<<id_material<<std::endl;
+			return;
+		}
+		wantedMaterial = materials[id_material];
+		wantedMaterialIdx = id_material;
+		materialDirty = false;
+		// Recorded draws keep their material
+		if (!recording) bindMaterial(id_material);
+	}
+
+	unsigned int GLBI_Engine::wantedMaterialId() {
+		if (materialDirty) {
+			useMaterial(storeMaterial(wantedMaterial,true));
+		}
+		materialLastUse[wantedMaterialIdx] = ++materialClock;
+		return wantedMaterialIdx;
+	}
+
+	void GLBI_Engine::bindMaterial(unsigned int id_material) {
+		if (id_material == currentMaterial || materialStride == 0) return;
+		currentMaterial = id_material;
+		GLState::bindBufferRange(GL_UNIFORM_BUFFER,GLBI_UB_MATERIAL,materialUBO,id_material*materialStride,sizeof(GLBI_Material));
+		counters.materialBinds++;
+	}
+
+	void GLBI_Engine::flushFrameData() {
+		if (nbPendingPrograms > 0) pollPrograms();
+		if (mode2D) return;
+		if (frameDirty) {
+			STP3D_PROFILE_ZONE("GLBI_Engine::flushFrameData");
+			memcpy(frameData.viewMatrix,viewMatrix.mat,16*sizeof(float));
+			int nb_light = (numberOfLight < GLBI_MAX_LIGHTS) ? numberOfLight : GLBI_MAX_LIGHTS;
+			for(int i=0;i<nb_light;i++) {
+				for(int j=0;j<4;j++) frameData.lightPos[i][j] = lightPos[i][j];
+				for(int j=0;j<3;j++) frameData.lightIntensity[i][j] = lightIntensity[i][j];
+			}
+			for(int j=0;j<3;j++) frameData.attenuationFactor[j] = attFactors[j];
+			frameData.numOfLight = nb_light;
+			// One write of the whole block (the previous content is orphaned)
+			GLState::bindBuffer(GL_UNIFORM_BUFFER,frameUBO);
+			glBufferData(GL_UNIFORM_BUFFER,sizeof(GLBI_Frame_Data),&frameData,GL_DYNAMIC_DRAW);
+			frameDirty = false;
+			counters.frameUploads++;
+			if (useClusteredLighting()) updateLightClusters();
+		}
+		if (materialDirty) wantedMaterialId();
+	}
+
+	void GLBI_Engine::updateLightClusters() {
+		STP3D_PROFILE_ZONE("GLBI_Engine::updateLightClusters");
+		if (!lightClusters) lightClusters.reset(new GLBI_Light_Clusters());
+		lightClusters->setProjection(frameData.projectionMat,zNear,zFar);
+		// Lights in view space, as phong_shading.frag computes them
+		clusterLights.resize(numberOfLight);
+		for(int i=0;i<numberOfLight;i++) {
+			GLBI_Cluster_Light& light = clusterLights[i];
+			bool point = lightPos[i].w > 0.0;
+			Vector4D p = lightPos[i];
+			if (point) p.w = 1.0;
+			p = viewMatrix*p;
+			for(int j=0;j<4;j++) light.pos[j] = p[j];
+			light.pos[3] = point ? 1.0f : 0.0f;
+			for(int j=0;j<3;j++) light.intensity[j] = lightIntensity[i][j];
+			light.radius = point ? GLBI_Light_Clusters::influenceRadius(light.intensity,attFactors.val,lightCutoff) : -1.0f;
+		}
+		lightClusters->update(clusterLights);
+
+		// Programs built later get the clusters in setupProgram
+		for(int i=GLBI_P_PHONG_CLUSTERED;i<GLBI_NB_PROGRAMS;i+=GLBI_NB_BASE_PROGRAMS) {
+			if (isProgramReady(i)) setClusterUniforms(i);
+		}
+	}
+
+	void GLBI_Engine::setClusterUniforms(int program) {
+		float params[4] = {float(lightClusters->nx),float(lightClusters->ny),float(lightClusters->nz),zNear};
+		GLState::uniform4fv(idShader[program],locations[program].uniform[GLBI_U_CLUSTER_PARAMS],1,params);
+		GLState::uniform1f(idShader[program],locations[program].uniform[GLBI_U_CLUSTER_SCALE],lightClusters->depthScale);
+		GLState::uniform1i(idShader[program],locations[program].uniform[GLBI_U_NUM_OF_GLOBAL_LIGHT],lightClusters->nbGlobalLights);
 	}
 
 	void GLBI_Engine::set2DProjection(float xmin,float xmax,float ymin,float ymax) {
 		Matrix4D proj = Matrix4D::ortho2D(xmin,xmax,ymin,ymax);
-		glUniformMatrix4fv(glGetUniformLocation(idShader[currentShader],"projectionMat"),1,GL_FALSE,proj);
+		if (mode2D) {
+			projection2D = proj;
+			hasProjection2D = true;
+		}
+		// Current program and its instanced variant
+		for(int i=currentShader%GLBI_NB_BASE_PROGRAMS;i<GLBI_NB_PROGRAMS;i+=GLBI_NB_BASE_PROGRAMS) {
+			if (!isProgramReady(i)) continue;
+			GLState::uniformMatrix4fv(idShader[i],locations[i].uniform[GLBI_U_PROJECTION],proj);
+		}
 	}
 
 	void GLBI_Engine::set3DProjection(float fov,float ratio,float z_near,float z_far) {
 		Matrix4D proj = Matrix4D::perspective(fov,ratio,z_near,z_far);
-		glUseProgram(idShader[0]);
-		glUniformMatrix4fv(glGetUniformLocation(idShader[0],"projectionMat"),1,GL_FALSE,proj);
-		if (!mode2D) {
-			glUseProgram(idShader[1]);
-			glUniformMatrix4fv(glGetUniformLocation(idShader[1],"projectionMat"),1,GL_FALSE,proj);
-			glUseProgram(idShader[currentShader]);
+		if (mode2D) {
+			projection2D = proj;
+			hasProjection2D = true;
+			for(int i=GLBI_P_FLAT;i<GLBI_NB_PROGRAMS;i+=GLBI_NB_BASE_PROGRAMS) {
+				if (!isProgramReady(i)) continue;
+				GLState::uniformMatrix4fv(idShader[i],locations[i].uniform[GLBI_U_PROJECTION],proj);
+			}
+		}
+		else {
+			memcpy(frameData.projectionMat,proj.mat,16*sizeof(float));
+			zNear = z_near;
+			zFar = z_far;
+			frameDirty = true;
 		}
 	}
 
 	void GLBI_Engine::setViewMatrix(const Matrix4D& mat) {
 		viewMatrix = mat;
-		// Mettre le uniform dans le shader correspondant.
-		if (!mode2D) {
-			glUseProgram(idShader[1]);
-			glUniformMatrix4fv(glGetUniformLocation(idShader[1],"viewMatrix"),1,GL_FALSE,viewMatrix);
-			glUseProgram(idShader[currentShader]);
-		}
+		// The view matrix is part of the frame data
+		frameDirty = true;
 		mvMatrixStack.addTransformation(mat);
 	}
 
 	void GLBI_Engine::activateTexturing(bool use_texture) {
 		useTexture = use_texture;
-		glActiveTexture(GL_TEXTURE0);
+		GLState::activeTexture(GL_TEXTURE0);
 		if (!mode2D) {
-			glUniform1i(glGetUniformLocation(idShader[currentShader],"tex0"),0);
-			glUniform1i(glGetUniformLocation(idShader[currentShader],"use_texture"),useTexture);
+			// Both phong programs (with or without clusters) and the instanced variants share the texturing state
+			int first = (currentShader%GLBI_NB_BASE_PROGRAMS == GLBI_P_FLAT) ? GLBI_P_FLAT : GLBI_P_PHONG;
+			int last = (currentShader%GLBI_NB_BASE_PROGRAMS == GLBI_P_FLAT) ? GLBI_P_FLAT : GLBI_P_PHONG_CLUSTERED;
+			for(int i=first;i<=last;i++) {
+				for(int j=i;j<GLBI_NB_PROGRAMS;j+=GLBI_NB_BASE_PROGRAMS) {
+					programUseTexture[j] = useTexture;
+					selectPermutation(j);
+					if (!isProgramReady(j)) continue;
+					GLState::uniform1i(idShader[j],locations[j].uniform[GLBI_U_TEX0],0);
+					GLState::uniform1i(idShader[j],locations[j].uniform[GLBI_U_USE_TEXTURE],useTexture);
+				}
+			}
 		}
 		else {
 			std::cerr<<"Unable to use texturing in 2D mode"<<std::endl;
 		}
 	}
 
+	std::ostream& operator<<(std::ostream& os,const GLBI_Counters& cnt) {
+		os<<"Modelview uploads : "<<cnt.mvUploads<<" (skipped "<<cnt.mvUploadsSkipped<<")"<<std::endl;
+		os<<"Normal matrices   : identity "<<cnt.nmlIdentity<<" / rigid "<<cnt.nmlRigid;
+		os<<" / uniform scale "<<cnt.nmlUniformScale<<" / general "<<cnt.nmlGeneral<<std::endl;
+		os<<"Frame data writes : "<<cnt.frameUploads<<std::endl;
+		os<<"Materials         : "<<cnt.materialUploads<<" written / "<<cnt.materialBinds<<" changes"<<std::endl;
+		os<<"Recorded draws    : "<<cnt.drawCommands<<" / changes of program "<<cnt.cmdProgramChanges;
+		os<<" / texture "<<cnt.cmdTextureChanges<<" / mesh "<<cnt.cmdMeshChanges<<" / color "<<cnt.cmdColorChanges<<std::endl;
+		os<<"Instanced draws   : "<<cnt.instancedDraws<<" ("<<cnt.instancesDrawn<<" instances)"<<std::endl;
+		os<<"Batches           : "<<cnt.batchSubmissions<<" ("<<cnt.batchDraws<<" draws in "<<cnt.batchCalls<<" GL calls)"<<std::endl;
+		return os;
+	}
+
 	void GLBI_Engine::switchToFlatShading() {
-		currentShader = 0;
-		glUseProgram(idShader[0]);
+		currentShader = GLBI_P_FLAT;
+		// Not built yet : the first draw builds and binds it
+		if (!recording && isProgramReady(currentShader)) GLState::useProgram(idShader[GLBI_P_FLAT]);
 	}
 
 	void GLBI_Engine::switchToPhongShading() {
@@ -97,19 +540,28 @@ namespace glbasimac {
 			std::cerr<<"Unable to switch to Phong Shading in 2D mode"<<std::endl;
 		}
 		else {
-			currentShader = 1;
-			glUseProgram(idShader[1]);
+			currentShader = phongShader();
+			if (!recording && isProgramReady(currentShader)) GLState::useProgram(idShader[currentShader]);
 		}
 	}
 
+	void GLBI_Engine::forceClusteredLighting(bool use_clusters) {
+		forceClusters = use_clusters;
+		frameDirty = true;
+		if (!mode2D && currentShader != 0) switchToPhongShading();
+	}
+
 	void GLBI_Engine::setLightPosition(const Vector4D& light_pos,int num_light) {
 		if (mode2D || currentShader == 0) {
 			std::cerr<<"Unable to set light position in 2D mode or in Flat shading"<<std::endl;
 		}
 		else {
 			if (num_light<numberOfLight) {
+				bool type_change = (lightPos[num_light].w > 0.0) != (light_pos.w > 0.0);
 				lightPos[num_light] = light_pos;
-				glUniform4fv(glGetUniformLocation(idShader[currentShader],"lightPos"),numberOfLight,&lightPos[0][0]);
+				frameDirty = true;
+				// The light types are constants of the specialized programs
+				if (type_change && specialized && num_light < GLBI_MAX_LIGHTS) updatePermutations();
 			}
 		}
 	}
@@ -121,7 +573,7 @@ namespace glbasimac {
 		else {
 			if (num_light<numberOfLight) {
 				lightIntensity[num_light] = light_intensity;
-				glUniform3fv(glGetUniformLocation(idShader[currentShader],"lightIntensity"),numberOfLight,&lightIntensity[0][0]);
+				frameDirty = true;
 			}
 		}
 	}
@@ -131,7 +583,12 @@ namespace glbasimac {
 			std::cerr<<"Unable to set light position in 2D mode or in Flat shading"<<std::endl;
 		}
 		else {
-			glVertexAttrib3f(glGetAttribLocation(idShader[currentShader],"vx_nml"),nml.x,nml.y,nml.z);
+			normal2DShape[0] = nml.x;
+			normal2DShape[1] = nml.y;
+			normal2DShape[2] = nml.z;
+			if (recording) return;
+			GLint loc = locations[currentShader].attribute[GLBI_A_NML];
+			if (loc >= 0) glVertexAttrib3f(loc,nml.x,nml.y,nml.z);
 		}
 	}
 
@@ -141,7 +598,7 @@ namespace glbasimac {
 		}
 		else {
 			attFactors = factors;
-			glUniform3fv(glGetUniformLocation(idShader[1],"attenuationFactor"),1,attFactors);
+			frameDirty = true;
 		}
 	}
 
@@ -153,9 +610,10 @@ namespace glbasimac {
 			numberOfLight++;
 			lightPos.push_back(light_pos);
 			lightIntensity.push_back(light_intensity);
-			glUseProgram(idShader[1]);
-			glUniform1i(glGetUniformLocation(idShader[1],"numOfLight"),numberOfLight);
-			glUseProgram(idShader[currentShader]);
+			frameDirty = true;
+			if (specialized) updatePermutations();
+			// Past GLBI_MAX_LIGHTS lights, phong shading goes clustered
+			if (currentShader != 0 && currentShader != phongShader()) switchToPhongShading();
 		}
 	}
 
@@ -164,7 +622,8 @@ namespace glbasimac {
 			std::cerr<<"Unable to set shininess in 2D mode or in Flat shading"<<std::endl;
 		}
 		else {
-			glUniform1f(glGetUniformLocation(idShader[1],"shininess"),new_shininess);
+			wantedMaterial.shininess = new_shininess;
+			materialDirty = true;
 		}
 	}
 
@@ -173,9 +632,264 @@ namespace glbasimac {
 			std::cerr<<"Unable to set shininess in 2D mode or in Flat shading"<<std::endl;
 		}
 		else {
-			glUniform3fv(glGetUniformLocation(idShader[1],"c_spec"),1,c_spec.val);
+			for(int i=0;i<3;i++) wantedMaterial.c_spec[i] = c_spec[i];
+			materialDirty = true;
 		}
 	}
 
+	static void drawStandardMesh(void* mesh,InstanceBuffer* instances,unsigned int) {
+		if (instances) static_cast<StandardMesh*>(mesh)->drawInstanced(*instances);
+		else static_cast<StandardMesh*>(mesh)->draw();
+	}
+	static void drawIndexedMesh(void* mesh,InstanceBuffer* instances,unsigned int lod) {
+		if (instances) static_cast<IndexedMesh*>(mesh)->drawInstanced(*instances,lod);
+		else static_cast<IndexedMesh*>(mesh)->draw(lod);
+	}
+
+	void GLBI_Engine::draw(StandardMesh& mesh) {
+		// Quantized positions : the dequantization is the first transformation
+		if (mesh.hasDequantization()) {
+			mvMatrixStack.pushMatrix();
+			mvMatrixStack.addTransformation(mesh.getDequantization());
+		}
+		if (recording) {
+			recordDraw(drawStandardMesh,&mesh,mesh.getIdVAO(),NULL,currentShader);
+		}
+		else {
+			updateMvMatrix();
+			mesh.draw();
+		}
+		if (mesh.hasDequantization()) mvMatrixStack.popMatrix();
+	}
+
+	void GLBI_Engine::draw(IndexedMesh& mesh,unsigned int lod) {
+		if (mesh.hasDequantization()) {
+			mvMatrixStack.pushMatrix();
+			mvMatrixStack.addTransformation(mesh.getDequantization());
+		}
+		if (recording) {
+			recordDraw(drawIndexedMesh,&mesh,mesh.id_vao,NULL,currentShader,lod);
+		}
+		else {
+			updateMvMatrix();
+			mesh.draw(lod);
+		}
+		if (mesh.hasDequantization()) mvMatrixStack.popMatrix();
+	}
+
+	void GLBI_Engine::drawInstanced(StandardMesh& mesh,InstanceBuffer& instances) {
+		// The dequantization would come after the instance matrices
+		if (mesh.hasDequantization()) {
+			std::cerr<<"Unable to draw instances of a mesh with quantized positions"<<std::endl;
+			return;
+		}
+		counters.instancedDraws++;
+		counters.instancesDrawn += instances.size();
+		if (recording) {
+			recordDraw(drawStandardMesh,&mesh,mesh.getIdVAO(),&instances,instancedShader());
+		}
+		else {
+			int program = instancedShader();
+			GLState::useProgram(requireProgram(program));
+			updateMvMatrix(program);
+			mesh.drawInstanced(instances);
+			GLState::useProgram(idShader[currentShader]);
+		}
+	}
+
+	void GLBI_Engine::drawInstanced(IndexedMesh& mesh,InstanceBuffer& instances,unsigned int lod) {
+		if (mesh.hasDequantization()) {
+			std::cerr<<"Unable to draw instances of a mesh with quantized positions"<<std::endl;
+			return;
+		}
+		counters.instancedDraws++;
+		counters.instancesDrawn += instances.size();
+		if (recording) {
+			recordDraw(drawIndexedMesh,&mesh,mesh.id_vao,&instances,instancedShader(),lod);
+		}
+		else {
+			int program = instancedShader();
+			GLState::useProgram(requireProgram(program));
+			updateMvMatrix(program);
+			mesh.drawInstanced(instances,lod);
+			GLState::useProgram(idShader[currentShader]);
+		}
+	}
+
+	void GLBI_Engine::drawInstanced(GLBI_Convex_2D_Shape& shape,InstanceBuffer& instances) {
+		drawInstanced(shape.shape,instances);
+	}
+
+	void GLBI_Engine::drawInstanced(GLBI_Set_Of_Points& set,InstanceBuffer& instances) {
+		drawInstanced(set.pts,instances);
+	}
+
+	static void drawMultiDrawBatch(void* batch,InstanceBuffer*,unsigned int) {
+		static_cast<MultiDrawBatch*>(batch)->draw();
+	}
+
+	void GLBI_Engine::drawBatch(MultiDrawBatch& batch) {
+		counters.batchSubmissions++;
+		counters.batchDraws += batch.getNbDraws();
+		if (recording) {
+			recordDraw(drawMultiDrawBatch,&batch,batch.getIdVAO(),NULL,instancedShader());
+		}
+		else {
+			int program = instancedShader();
+			GLState::useProgram(requireProgram(program));
+			updateMvMatrix(program);
+			counters.batchCalls += batch.draw();
+			GLState::useProgram(idShader[currentShader]);
+		}
+	}
+
+	void GLBI_Engine::draw(GLBI_Convex_2D_Shape& shape) {
+		draw(shape.shape);
+	}
+
+	void GLBI_Engine::draw(GLBI_Set_Of_Points& set) {
+		draw(set.pts);
+	}
+
+	void GLBI_Engine::beginRecording(bool sort_commands) {
+		recording = true;
+		// Materials used from now on are needed by the replay
+		recordingClock = materialClock+1;
+		// In 2D, the drawing order is the only depth information
+		sortCommands = sort_commands && !mode2D;
+		commands.clear();
+		frameTextures.clear();
+		frameMeshes.clear();
+	}
+
+	/// Float to unsigned int with the same order
+	static inline uint32_t sortableDepth(float depth) {
+		uint32_t bits;
+		memcpy(&bits,&depth,sizeof(float));
+		return (bits & 0x80000000u) ? ~bits : (bits | 0x80000000u);
+	}
+
+	void GLBI_Engine::recordDraw(void (*draw_fct)(void*,InstanceBuffer*,unsigned int),void* mesh,unsigned int vao,InstanceBuffer* instances,int program,
+	                             unsigned int lod) {
+		commands.push_back(GLBI_Draw_Command());
+		GLBI_Draw_Command& cmd = commands.back();
+		cmd.draw = draw_fct;
+		cmd.mesh = mesh;
+		cmd.instances = instances;
+		cmd.lod = lod;
+		cmd.vao = vao;
+		cmd.shader = program;
+		cmd.material = mode2D ? 0 : wantedMaterialId();
+		cmd.texture = useTexture ? GLState::boundTexture(GL_TEXTURE0,GL_TEXTURE_2D) : 0;
+		for(int i=0;i<3;i++) {
+			cmd.color[i] = flatColor[i];
+			cmd.normal[i] = normal2DShape[i];
+		}
+		cmd.mvMatrix = mvMatrixStack.stack.back();
+		cmd.transfoClass = mvMatrixStack.getTopTransformClass();
+		cmd.mvVersion = mvMatrixStack.getTopVersion();
+
+		// Textures and meshes are numbered in order of first use
+		unsigned int tex_slot = 0;
+		while (tex_slot < frameTextures.size() && frameTextures[tex_slot] != cmd.texture) tex_slot++;
+		if (tex_slot == frameTextures.size()) frameTextures.push_back(cmd.texture);
+		unsigned int mesh_slot = frameMeshes.insert(std::make_pair(vao,(unsigned int)frameMeshes.size())).first->second;
+		// Camera looks toward -z : view space depth is -z of the object origin
+		cmd.key = (uint64_t(cmd.shader & 0xF) << 60) | (uint64_t(std::min(tex_slot,0xFFFu)) << 48) |
+		          (uint64_t(std::min(mesh_slot,0xFFFFu)) << 32) | sortableDepth(-cmd.mvMatrix.mat[14]);
+	}
+
+	void GLBI_Engine::sortCommandList() {
+		STP3D_PROFILE_ZONE("GLBI_Engine::sortCommandList");
+		unsigned int nb_cmds = commands.size();
+		sortIndices.resize(nb_cmds);
+		for(unsigned int i=0;i<nb_cmds;i++) sortIndices[i] = std::make_pair(commands[i].key,i);
+		if (!sortCommands || nb_cmds < 2) return;
+		// LSD radix sort, 8 bits at a time (stable : same keys stay in drawing order)
+		sortTmp.resize(nb_cmds);
+		for(int shift=0;shift<64;shift+=8) {
+			unsigned int count[256] = {0};
+			for(unsigned int i=0;i<nb_cmds;i++) count[(sortIndices[i].first >> shift) & 0xFF]++;
+			// Every key has the same byte : the pass would change nothing
+			if (count[(sortIndices[0].first >> shift) & 0xFF] == nb_cmds) continue;
+			unsigned int offset = 0;
+			for(int b=0;b<256;b++) {
+				unsigned int nb = count[b];
+				count[b] = offset;
+				offset += nb;
+			}
+			for(unsigned int i=0;i<nb_cmds;i++) sortTmp[count[(sortIndices[i].first >> shift) & 0xFF]++] = sortIndices[i];
+			sortIndices.swap(sortTmp);
+		}
+	}
+
+	void GLBI_Engine::endRecording() {
+		if (!recording) return;
+		recording = false;
+		counters.drawCommands += commands.size();
+		if (!commands.empty()) {
+			sortCommandList();
+			replayCommands();
+		}
+		commands.clear();
+	}
+
+	void GLBI_Engine::replayCommands() {
+		STP3D_PROFILE_GPU_ZONE("GLBI_Engine::replayCommands");
+		// State at the end of the recording, given back after the replay
+		int last_shader = currentShader;
+		unsigned int last_material = mode2D ? 0 : wantedMaterialId();
+		GLuint last_texture = GLState::boundTexture(GL_TEXTURE0,GL_TEXTURE_2D);
+
+		mvMatrixStack.pushMatrix();
+		int shader = -1;
+		unsigned int vao = 0,texture = last_texture;
+		bool color_set = false,normal_set = false;
+		float color[3],normal[3];
+		for(unsigned int i=0;i<sortIndices.size();i++) {
+			const GLBI_Draw_Command& cmd = commands[sortIndices[i].second];
+			if (cmd.shader != shader) {
+				shader = currentShader = cmd.shader;
+				GLState::useProgram(requireProgram(shader));
+				counters.cmdProgramChanges++;
+				color_set = normal_set = false;
+			}
+			if (!mode2D) bindMaterial(cmd.material);
+			if (cmd.texture && cmd.texture != texture) {
+				texture = cmd.texture;
+				GLState::bindTexture(GL_TEXTURE0,GL_TEXTURE_2D,texture);
+				counters.cmdTextureChanges++;
+			}
+			if (cmd.vao != vao) {
+				vao = cmd.vao;
+				counters.cmdMeshChanges++;
+			}
+			GLint loc = locations[shader].attribute[GLBI_A_COL];
+			if (loc >= 0 && (!color_set || memcmp(color,cmd.color,3*sizeof(float)) != 0)) {
+				memcpy(color,cmd.color,3*sizeof(float));
+				glVertexAttrib3f(loc,color[0],color[1],color[2]);
+				color_set = true;
+				counters.cmdColorChanges++;
+			}
+			loc = locations[shader].attribute[GLBI_A_NML];
+			if (!mode2D && loc >= 0 && (!normal_set || memcmp(normal,cmd.normal,3*sizeof(float)) != 0)) {
+				memcpy(normal,cmd.normal,3*sizeof(float));
+				glVertexAttrib3f(loc,normal[0],normal[1],normal[2]);
+				normal_set = true;
+			}
+			mvMatrixStack.restoreTop(cmd.mvMatrix,cmd.transfoClass,cmd.mvVersion);
+			updateMvMatrix();
+			cmd.draw(cmd.mesh,cmd.instances,cmd.lod);
+		}
+		mvMatrixStack.popMatrix();
+
+		currentShader = last_shader;
+		GLState::useProgram(idShader[currentShader]);
+		if (!mode2D) bindMaterial(last_material);
+		GLState::bindTexture(GL_TEXTURE0,GL_TEXTURE_2D,last_texture);
+		setFlatColor(flatColor[0],flatColor[1],flatColor[2]);
+		GLint loc = locations[currentShader].attribute[GLBI_A_NML];
+		if (!mode2D && loc >= 0) glVertexAttrib3f(loc,normal2DShape[0],normal2DShape[1],normal2DShape[2]);
+	}
 
 }
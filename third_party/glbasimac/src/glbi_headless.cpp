@@ -0,0 +1,333 @@
+#include "glbasimac/glbi_headless.hpp"
+#include "tools/gl_state.hpp"
+#include <cstdio>
+#include <cstring>
+#include <map>
+#ifndef _WIN32
+#include <dlfcn.h>
+#endif
+
+namespace glbasimac {
+
+	// EGL and OSMesa declarations used here (the libraries are opened at run time)
+	typedef int EGLint;
+	typedef unsigned int EGLBoolean;
+	typedef unsigned int EGLenum;
+	typedef void* EGLDisplay;
+	typedef void* EGLConfig;
+	typedef void* EGLContext;
+	typedef void* EGLSurface;
+	static const EGLint EGL_ALPHA_SIZE = 0x3021;
+	static const EGLint EGL_BLUE_SIZE = 0x3022;
+	static const EGLint EGL_GREEN_SIZE = 0x3023;
+	static const EGLint EGL_RED_SIZE = 0x3024;
+	static const EGLint EGL_SURFACE_TYPE = 0x3033;
+	static const EGLint EGL_NONE = 0x3038;
+	static const EGLint EGL_RENDERABLE_TYPE = 0x3040;
+	static const EGLint EGL_EXTENSIONS = 0x3055;
+	static const EGLint EGL_HEIGHT = 0x3056;
+	static const EGLint EGL_WIDTH = 0x3057;
+	static const EGLint EGL_PBUFFER_BIT = 0x0001;
+	static const EGLint EGL_OPENGL_BIT = 0x0008;
+	static const EGLenum EGL_OPENGL_API = 0x30A2;
+	static const EGLint EGL_CONTEXT_MAJOR_VERSION = 0x3098;
+	static const EGLint EGL_CONTEXT_MINOR_VERSION = 0x30FB;
+	static const EGLint EGL_CONTEXT_OPENGL_PROFILE_MASK = 0x30FD;
+	static const EGLint EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT = 0x0001;
+	static const EGLenum EGL_PLATFORM_SURFACELESS_MESA = 0x31DD;
+	typedef void* (*PFN_eglGetProcAddress)(const char*);
+	typedef EGLDisplay (*PFN_eglGetDisplay)(void*);
+	typedef EGLDisplay (*PFN_eglGetPlatformDisplayEXT)(EGLenum,void*,const EGLint*);
+	typedef EGLBoolean (*PFN_eglInitialize)(EGLDisplay,EGLint*,EGLint*);
+	typedef EGLBoolean (*PFN_eglTerminate)(EGLDisplay);
+	typedef const char* (*PFN_eglQueryString)(EGLDisplay,EGLint);
+	typedef EGLBoolean (*PFN_eglChooseConfig)(EGLDisplay,const EGLint*,EGLConfig*,EGLint,EGLint*);
+	typedef EGLBoolean (*PFN_eglBindAPI)(EGLenum);
+	typedef EGLContext (*PFN_eglCreateContext)(EGLDisplay,EGLConfig,EGLContext,const EGLint*);
+	typedef EGLBoolean (*PFN_eglDestroyContext)(EGLDisplay,EGLContext);
+	typedef EGLSurface (*PFN_eglCreatePbufferSurface)(EGLDisplay,EGLConfig,const EGLint*);
+	typedef EGLBoolean (*PFN_eglDestroySurface)(EGLDisplay,EGLSurface);
+	typedef EGLBoolean (*PFN_eglMakeCurrent)(EGLDisplay,EGLSurface,EGLSurface,EGLContext);
+
+	static const int OSMESA_RGBA = 0x1908;
+	static const int OSMESA_FORMAT = 0x22;
+	static const int OSMESA_DEPTH_BITS = 0x30;
+	static const int OSMESA_PROFILE = 0x33;
+	static const int OSMESA_CORE_PROFILE = 0x34;
+	static const int OSMESA_CONTEXT_MAJOR_VERSION = 0x36;
+	static const int OSMESA_CONTEXT_MINOR_VERSION = 0x37;
+	typedef void* (*PFN_OSMesaCreateContextAttribs)(const int*,void*);
+	typedef void (*PFN_OSMesaDestroyContext)(void*);
+	typedef unsigned char (*PFN_OSMesaMakeCurrent)(void*,void*,unsigned int,int,int);
+	typedef void* (*PFN_OSMesaGetProcAddress)(const char*);
+
+	/// Entry points of the backend of a context
+	struct GLBI_Headless_Functions {
+		PFN_eglGetProcAddress eglGetProcAddress;
+		PFN_eglTerminate eglTerminate;
+		PFN_eglDestroyContext eglDestroyContext;
+		PFN_eglDestroySurface eglDestroySurface;
+		PFN_eglMakeCurrent eglMakeCurrent;
+		PFN_OSMesaGetProcAddress OSMesaGetProcAddress;
+		PFN_OSMesaDestroyContext OSMesaDestroyContext;
+	};
+
+	/// Functions of the last context created, used by loader()
+	static const GLBI_Headless_Functions* loaderFunctions = NULL;
+	/// Contexts using each EGL display : it is terminated with the last one
+	static std::map<void*,int> eglDisplayUsers;
+
+	static void* headlessGetProcAddress(const char* name) {
+		if (!loaderFunctions) return NULL;
+		if (loaderFunctions->eglGetProcAddress) return loaderFunctions->eglGetProcAddress(name);
+		if (loaderFunctions->OSMesaGetProcAddress) return loaderFunctions->OSMesaGetProcAddress(name);
+		return NULL;
+	}
+
+	static void* openLibrary(const char* const* names) {
+#ifndef _WIN32
+		for(unsigned int i=0;names[i];i++) {
+			void* lib = dlopen(names[i],RTLD_LAZY|RTLD_LOCAL);
+			if (lib) return lib;
+		}
+#else
+		(void)names;
+#endif
+		return NULL;
+	}
+
+	static void* librarySymbol(void* lib,const char* name) {
+#ifndef _WIN32
+		return dlsym(lib,name);
+#else
+		(void)lib;(void)name;
+		return NULL;
+#endif
+	}
+
+	static void closeLibrary(void* lib) {
+#ifndef _WIN32
+		if (lib) dlclose(lib);
+#else
+		(void)lib;
+#endif
+	}
+
+	static bool hasExtension(const char* extensions,const char* name) {
+		if (!extensions) return false;
+		size_t lg = strlen(name);
+		for(const char* p=strstr(extensions,name);p;p=strstr(p+lg,name)) {
+			if ((p == extensions || p[-1] == ' ') && (p[lg] == ' ' || p[lg] == '\0')) return true;
+		}
+		return false;
+	}
+
+	GLBI_Headless_Context::GLBI_Headless_Context()
+		:width(0),height(0),backend(GLBI_HEADLESS_AUTO),idFBO(0),
+		 functions(new GLBI_Headless_Functions()),library(NULL),display(NULL),context(NULL),surface(NULL) {
+		idRenderbuffers[0] = idRenderbuffers[1] = 0;
+	}
+
+	GLBI_Headless_Context::~GLBI_Headless_Context() {
+		destroy();
+		delete functions;
+	}
+
+	GLADloadproc GLBI_Headless_Context::loader() {
+		return headlessGetProcAddress;
+	}
+
+	const char* GLBI_Headless_Context::backendName() const {
+		if (!context) return "none";
+		return (backend == GLBI_HEADLESS_EGL) ? "EGL" : "OSMesa";
+	}
+
+	bool GLBI_Headless_Context::create(int w,int h,GLBI_Headless_Backend wanted) {
+		destroy();
+		width = w;
+		height = h;
+		bool ok = false;
+		if (wanted != GLBI_HEADLESS_OSMESA) ok = createEGL();
+		if (!ok && wanted != GLBI_HEADLESS_EGL) ok = createOSMesa();
+		if (!ok) {
+			std::cerr<<"Unable to create a headless GL context (no EGL or OSMesa library able to give GL 4.1 core)"<<std::endl;
+			return false;
+		}
+		loaderFunctions = functions;
+		if (!gladLoadGLLoader(loader()) || !createFramebuffer()) {
+			std::cerr<<"Unable to create the framebuffer of the headless context"<<std::endl;
+			destroy();
+			return false;
+		}
+		return true;
+	}
+
+	bool GLBI_Headless_Context::createEGL() {
+		static const char* const names[] = {"libEGL.so.1","libEGL.so",NULL};
+		library = openLibrary(names);
+		if (!library) return false;
+		functions->eglGetProcAddress = (PFN_eglGetProcAddress)librarySymbol(library,"eglGetProcAddress");
+		functions->eglTerminate = (PFN_eglTerminate)librarySymbol(library,"eglTerminate");
+		functions->eglDestroyContext = (PFN_eglDestroyContext)librarySymbol(library,"eglDestroyContext");
+		functions->eglDestroySurface = (PFN_eglDestroySurface)librarySymbol(library,"eglDestroySurface");
+		functions->eglMakeCurrent = (PFN_eglMakeCurrent)librarySymbol(library,"eglMakeCurrent");
+		PFN_eglGetDisplay getDisplay = (PFN_eglGetDisplay)librarySymbol(library,"eglGetDisplay");
+		PFN_eglInitialize initialize = (PFN_eglInitialize)librarySymbol(library,"eglInitialize");
+		PFN_eglQueryString queryString = (PFN_eglQueryString)librarySymbol(library,"eglQueryString");
+		PFN_eglChooseConfig chooseConfig = (PFN_eglChooseConfig)librarySymbol(library,"eglChooseConfig");
+		PFN_eglBindAPI bindAPI = (PFN_eglBindAPI)librarySymbol(library,"eglBindAPI");
+		PFN_eglCreateContext createContext = (PFN_eglCreateContext)librarySymbol(library,"eglCreateContext");
+		PFN_eglCreatePbufferSurface createPbuffer = (PFN_eglCreatePbufferSurface)librarySymbol(library,"eglCreatePbufferSurface");
+		if (!functions->eglGetProcAddress || !functions->eglTerminate || !functions->eglDestroyContext ||
+		    !functions->eglDestroySurface || !functions->eglMakeCurrent || !getDisplay || !initialize ||
+		    !queryString || !chooseConfig || !bindAPI || !createContext || !createPbuffer) {
+			destroy();
+			return false;
+		}
+		backend = GLBI_HEADLESS_EGL;
+
+		// Surfaceless platform of Mesa : no display server needed
+		if (hasExtension(queryString(NULL,EGL_EXTENSIONS),"EGL_MESA_platform_surfaceless")) {
+			PFN_eglGetPlatformDisplayEXT getPlatformDisplay = (PFN_eglGetPlatformDisplayEXT)functions->eglGetProcAddress("eglGetPlatformDisplayEXT");
+			if (getPlatformDisplay) display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA,NULL,NULL);
+			if (display && !initialize(display,NULL,NULL)) display = NULL;
+		}
+		if (!display) {
+			display = getDisplay(NULL);
+			if (display && !initialize(display,NULL,NULL)) display = NULL;
+		}
+		if (!display) {
+			destroy();
+			return false;
+		}
+		// Displays are shared : the other contexts of the display keep it initialized
+		eglDisplayUsers[display]++;
+
+		const EGLint config_attribs[] = {EGL_SURFACE_TYPE,EGL_PBUFFER_BIT,EGL_RENDERABLE_TYPE,EGL_OPENGL_BIT,
+		                                 EGL_RED_SIZE,8,EGL_GREEN_SIZE,8,EGL_BLUE_SIZE,8,EGL_ALPHA_SIZE,8,EGL_NONE};
+		EGLConfig config = NULL;
+		EGLint nb_configs = 0;
+		if (!chooseConfig(display,config_attribs,&config,1,&nb_configs) || nb_configs == 0) config = NULL;
+		const char* extensions = queryString(display,EGL_EXTENSIONS);
+		bool surfaceless = hasExtension(extensions,"EGL_KHR_surfaceless_context");
+		if ((!config && !hasExtension(extensions,"EGL_KHR_no_config_context")) || (!config && !surfaceless)) {
+			destroy();
+			return false;
+		}
+
+		const EGLint context_attribs[] = {EGL_CONTEXT_MAJOR_VERSION,4,EGL_CONTEXT_MINOR_VERSION,1,
+		                                  EGL_CONTEXT_OPENGL_PROFILE_MASK,EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,EGL_NONE};
+		bindAPI(EGL_OPENGL_API);
+		context = createContext(display,config,NULL,context_attribs);
+		if (context && !surfaceless) {
+			const EGLint pbuffer_attribs[] = {EGL_WIDTH,1,EGL_HEIGHT,1,EGL_NONE};
+			surface = createPbuffer(display,config,pbuffer_attribs);
+		}
+		if (!context || (!surfaceless && !surface) || !functions->eglMakeCurrent(display,surface,surface,context)) {
+			destroy();
+			return false;
+		}
+		return true;
+	}
+
+	bool GLBI_Headless_Context::createOSMesa() {
+		static const char* const names[] = {"libOSMesa.so.8","libOSMesa.so.6","libOSMesa.so",NULL};
+		library = openLibrary(names);
+		if (!library) return false;
+		functions->OSMesaGetProcAddress = (PFN_OSMesaGetProcAddress)librarySymbol(library,"OSMesaGetProcAddress");
+		functions->OSMesaDestroyContext = (PFN_OSMesaDestroyContext)librarySymbol(library,"OSMesaDestroyContext");
+		PFN_OSMesaCreateContextAttribs createContext = (PFN_OSMesaCreateContextAttribs)librarySymbol(library,"OSMesaCreateContextAttribs");
+		PFN_OSMesaMakeCurrent makeCurrent = (PFN_OSMesaMakeCurrent)librarySymbol(library,"OSMesaMakeCurrent");
+		if (!functions->OSMesaGetProcAddress || !functions->OSMesaDestroyContext || !createContext || !makeCurrent) {
+			destroy();
+			return false;
+		}
+		backend = GLBI_HEADLESS_OSMESA;
+		const int attribs[] = {OSMESA_FORMAT,OSMESA_RGBA,OSMESA_DEPTH_BITS,24,OSMESA_PROFILE,OSMESA_CORE_PROFILE,
+		                       OSMESA_CONTEXT_MAJOR_VERSION,4,OSMESA_CONTEXT_MINOR_VERSION,1,0};
+		context = createContext(attribs,NULL);
+		// Drawing goes to the FBO : the buffer of the context is only needed to make it current
+		osmesaBuffer.resize(4);
+		if (!context || !makeCurrent(context,&osmesaBuffer[0],GL_UNSIGNED_BYTE,1,1)) {
+			destroy();
+			return false;
+		}
+		return true;
+	}
+
+	bool GLBI_Headless_Context::createFramebuffer() {
+		glGenFramebuffers(1,&idFBO);
+		glBindFramebuffer(GL_FRAMEBUFFER,idFBO);
+		glGenRenderbuffers(2,idRenderbuffers);
+		glBindRenderbuffer(GL_RENDERBUFFER,idRenderbuffers[0]);
+		glRenderbufferStorage(GL_RENDERBUFFER,GL_RGBA8,width,height);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER,GL_COLOR_ATTACHMENT0,GL_RENDERBUFFER,idRenderbuffers[0]);
+		glBindRenderbuffer(GL_RENDERBUFFER,idRenderbuffers[1]);
+		glRenderbufferStorage(GL_RENDERBUFFER,GL_DEPTH_COMPONENT24,width,height);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER,GL_DEPTH_ATTACHMENT,GL_RENDERBUFFER,idRenderbuffers[1]);
+		glBindRenderbuffer(GL_RENDERBUFFER,0);
+		glViewport(0,0,width,height);
+		return glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+	}
+
+	void GLBI_Headless_Context::destroy() {
+		// GL calls go to the current context : the objects of another one go with it
+		bool current = (loaderFunctions == functions);
+		if (context && idFBO && current) {
+			glDeleteRenderbuffers(2,idRenderbuffers);
+			glDeleteFramebuffers(1,&idFBO);
+		}
+		idFBO = idRenderbuffers[0] = idRenderbuffers[1] = 0;
+		if (backend == GLBI_HEADLESS_EGL && display) {
+			if (current) functions->eglMakeCurrent(display,NULL,NULL,NULL);
+			if (context) functions->eglDestroyContext(display,context);
+			if (surface) functions->eglDestroySurface(display,surface);
+			if (--eglDisplayUsers[display] <= 0) {
+				eglDisplayUsers.erase(display);
+				functions->eglTerminate(display);
+			}
+		}
+		if (backend == GLBI_HEADLESS_OSMESA && context) {
+			functions->OSMesaDestroyContext(context);
+		}
+		// The library stays loaded while other contexts use it (dlopen counts the users)
+		closeLibrary(library);
+		if (current) loaderFunctions = NULL;
+		memset(functions,0,sizeof(GLBI_Headless_Functions));
+		library = display = context = surface = NULL;
+		backend = GLBI_HEADLESS_AUTO;
+	}
+
+	void GLBI_Headless_Context::readPixels(std::vector<unsigned char>& rgb) {
+		rgb.resize(3*width*height);
+		glBindFramebuffer(GL_READ_FRAMEBUFFER,idFBO);
+		GLState::bindBuffer(GL_PIXEL_PACK_BUFFER,0);
+		glPixelStorei(GL_PACK_ALIGNMENT,1);
+		glReadPixels(0,0,width,height,GL_RGB,GL_UNSIGNED_BYTE,&rgb[0]);
+		// GL rows go upward, images rows downward
+		const size_t row = 3*width;
+		rowBuffer.resize(row);
+		for(int y=0;y<height/2;y++) {
+			unsigned char* top = &rgb[y*row];
+			unsigned char* bottom = &rgb[(height-1-y)*row];
+			memcpy(&rowBuffer[0],top,row);
+			memcpy(top,bottom,row);
+			memcpy(bottom,&rowBuffer[0],row);
+		}
+	}
+
+	bool GLBI_Headless_Context::writePPM(const char* filename) {
+		std::vector<unsigned char> rgb;
+		readPixels(rgb);
+		FILE* out = fopen(filename,"wb");
+		if (!out) {
+			std::cerr<<"Unable to write "<<filename<<std::endl;
+			return false;
+		}
+		fprintf(out,"P6\n%d %d\n255\n",width,height);
+		bool ok = fwrite(&rgb[0],1,rgb.size(),out) == rgb.size();
+		fclose(out);
+		return ok;
+	}
+
+}
@@ -0,0 +1,249 @@
+#include "glbasimac/glbi_light_clusters.hpp"
+#include "tools/gl_state.hpp"
+#include <cmath>
+#include <chrono>
+#include <algorithm>
+
+namespace glbasimac {
+
+	GLBI_Light_Clusters::GLBI_Light_Clusters(unsigned int n_x,unsigned int n_y,unsigned int n_z,unsigned int nb_threads)
+		:nx(n_x),ny(n_y),nz(n_z),zNear(0.0f),zFar(0.0f),depthScale(0.0f),nbGlobalLights(0),
+		 generation(0),pending(0),quit(false) {
+		if (nb_threads == 0) nb_threads = std::thread::hardware_concurrency();
+		nb_threads = std::max(1u,std::min(nb_threads,nz));
+		threadIds.resize(nb_threads);
+		clusterRanges.resize(2*nx*ny*nz);
+		gridData.resize(2*nx*ny*nz);
+		for(unsigned int t=1;t<nb_threads;t++) {
+			workers.push_back(std::thread(&GLBI_Light_Clusters::workerLoop,this,t));
+		}
+		for(int i=0;i<3;i++) idBuffers[i] = idTextures[i] = 0;
+		for(int i=0;i<4;i++) projTerms[i] = 0.0f;
+		stats = GLBI_Cluster_Stats();
+		stats.nbClusters = nx*ny*nz;
+		stats.nbThreads = nb_threads;
+	}
+
+	GLBI_Light_Clusters::~GLBI_Light_Clusters() {
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			quit = true;
+		}
+		cvStart.notify_all();
+		for(unsigned int i=0;i<workers.size();i++) workers[i].join();
+		// GL objects are released with the context
+	}
+
+	void GLBI_Light_Clusters::setProjection(const float* proj,float z_near,float z_far) {
+		// ndc = m0*x/d - m8 with d = -z, so x = (ndc+m8)*d/m0 (same for y)
+		float m0 = proj[0],m5 = proj[5],m8 = proj[8],m9 = proj[9];
+		// The field of view and the aspect ratio change the boxes as well as the planes
+		if (z_near == zNear && z_far == zFar && m0 == projTerms[0] && m5 == projTerms[1] &&
+		    m8 == projTerms[2] && m9 == projTerms[3] && !clusterBoxes.empty()) return;
+		zNear = z_near;
+		zFar = z_far;
+		depthScale = nz/logf(zFar/zNear);
+		projTerms[0] = m0;
+		projTerms[1] = m5;
+		projTerms[2] = m8;
+		projTerms[3] = m9;
+		clusterBoxes.resize(6*nx*ny*nz);
+		for(unsigned int k=0;k<nz;k++) {
+			float d0 = zNear*powf(zFar/zNear,float(k)/nz);
+			float d1 = zNear*powf(zFar/zNear,float(k+1)/nz);
+			for(unsigned int j=0;j<ny;j++) {
+				float y0 = -1.0f+2.0f*j/ny+m9,y1 = -1.0f+2.0f*(j+1)/ny+m9;
+				for(unsigned int i=0;i<nx;i++) {
+					float x0 = -1.0f+2.0f*i/nx+m8,x1 = -1.0f+2.0f*(i+1)/nx+m8;
+					float* box = &clusterBoxes[6*((k*ny+j)*nx+i)];
+					box[0] = std::min(x0*d0,x0*d1)/m0;
+					box[1] = std::min(y0*d0,y0*d1)/m5;
+					box[2] = -d1;
+					box[3] = std::max(x1*d0,x1*d1)/m0;
+					box[4] = std::max(y1*d0,y1*d1)/m5;
+					box[5] = -d0;
+				}
+			}
+		}
+	}
+
+	float GLBI_Light_Clusters::influenceRadius(const float intensity[3],const float att_factors[3],float cutoff) {
+		float i_max = std::max(intensity[0],std::max(intensity[1],intensity[2]));
+		if (i_max <= 0.0f) return 0.0f;
+		// Solve a + b.d + c.d^2 = i_max/cutoff
+		float a = att_factors[0],b = att_factors[1],c = att_factors[2];
+		float target = i_max/cutoff;
+		if (c > 0.0f) {
+			float delta = b*b-4.0f*c*(a-target);
+			if (delta < 0.0f) return 0.0f;
+			return std::max(0.0f,(-b+sqrtf(delta))/(2.0f*c));
+		}
+		if (b > 0.0f) return std::max(0.0f,(target-a)/b);
+		return -1.0f;
+	}
+
+	/// Squared distance from p to the box (min xyz, max xyz), ignoring the axis before first_axis
+	static inline float sphereBoxDist2(const float* p,const float* box,int first_axis) {
+		float dist2 = 0.0f;
+		for(int a=first_axis;a<3;a++) {
+			if (p[a] < box[a]) dist2 += (box[a]-p[a])*(box[a]-p[a]);
+			else if (p[a] > box[a+3]) dist2 += (p[a]-box[a+3])*(p[a]-box[a+3]);
+		}
+		return dist2;
+	}
+
+	void GLBI_Light_Clusters::assignSlices(unsigned int thread_id) {
+		unsigned int nb_threads = threadIds.size();
+		std::vector<unsigned int>& ids = threadIds[thread_id];
+		ids.clear();
+		std::vector<unsigned int> candidates,row_candidates;
+		for(unsigned int k=thread_id;k<nz;k+=nb_threads) {
+			// Lights touching the depth range of the slice
+			const float* slice_box = &clusterBoxes[6*k*ny*nx];
+			candidates.clear();
+			for(unsigned int l=nbGlobalLights;l<frameLights.size();l++) {
+				const GLBI_Cluster_Light& light = frameLights[l];
+				if (light.pos[2]-light.radius <= slice_box[5] && light.pos[2]+light.radius >= slice_box[2]) {
+					candidates.push_back(l);
+				}
+			}
+			for(unsigned int j=0;j<ny;j++) {
+				// Lights touching the row of tiles (y and z extents are the same for the whole row)
+				const float* row_box = &clusterBoxes[6*(k*ny+j)*nx];
+				row_candidates.clear();
+				for(unsigned int n=0;n<candidates.size();n++) {
+					const GLBI_Cluster_Light& light = frameLights[candidates[n]];
+					if (sphereBoxDist2(light.pos,row_box,1) <= light.radius*light.radius) {
+						row_candidates.push_back(candidates[n]);
+					}
+				}
+				for(unsigned int c=(k*ny+j)*nx;c<(k*ny+j+1)*nx;c++) {
+					const float* box = &clusterBoxes[6*c];
+					clusterRanges[2*c] = ids.size();
+					for(unsigned int n=0;n<row_candidates.size();n++) {
+						const GLBI_Cluster_Light& light = frameLights[row_candidates[n]];
+						if (sphereBoxDist2(light.pos,box,0) <= light.radius*light.radius) ids.push_back(row_candidates[n]);
+					}
+					clusterRanges[2*c+1] = ids.size()-clusterRanges[2*c];
+				}
+			}
+		}
+	}
+
+	void GLBI_Light_Clusters::workerLoop(unsigned int thread_id) {
+		unsigned int seen = 0;
+		while (true) {
+			{
+				std::unique_lock<std::mutex> lock(mtx);
+				cvStart.wait(lock,[&]{return quit || generation != seen;});
+				if (quit) return;
+				seen = generation;
+			}
+			assignSlices(thread_id);
+			{
+				std::lock_guard<std::mutex> lock(mtx);
+				if (--pending == 0) cvDone.notify_one();
+			}
+		}
+	}
+
+	void GLBI_Light_Clusters::update(const std::vector<GLBI_Cluster_Light>& lights) {
+		typedef std::chrono::steady_clock clock;
+		clock::time_point start = clock::now();
+
+		// Global lights first : the shader loops over them for every fragment
+		frameLights.clear();
+		for(unsigned int i=0;i<lights.size();i++) {
+			if (lights[i].radius < 0.0f) frameLights.push_back(lights[i]);
+		}
+		nbGlobalLights = frameLights.size();
+		for(unsigned int i=0;i<lights.size();i++) {
+			if (lights[i].radius >= 0.0f) frameLights.push_back(lights[i]);
+		}
+
+		// Assignment, slices are shared between the threads
+		if (!workers.empty()) {
+			{
+				std::lock_guard<std::mutex> lock(mtx);
+				pending = workers.size();
+				generation++;
+			}
+			cvStart.notify_all();
+		}
+		assignSlices(0);
+		if (!workers.empty()) {
+			std::unique_lock<std::mutex> lock(mtx);
+			cvDone.wait(lock,[&]{return pending == 0;});
+		}
+
+		// Gather the per thread lists, cluster after cluster
+		unsigned int nb_threads = threadIds.size();
+		unsigned int nb_clusters = nx*ny*nz;
+		indexData.clear();
+		stats.maxLightsPerCluster = stats.emptyClusters = 0;
+		for(unsigned int c=0;c<nb_clusters;c++) {
+			const std::vector<unsigned int>& ids = threadIds[(c/(nx*ny))%nb_threads];
+			unsigned int offset = clusterRanges[2*c],count = clusterRanges[2*c+1];
+			gridData[2*c] = indexData.size();
+			gridData[2*c+1] = count;
+			indexData.insert(indexData.end(),ids.begin()+offset,ids.begin()+offset+count);
+			stats.maxLightsPerCluster = std::max(stats.maxLightsPerCluster,count);
+			if (count == 0) stats.emptyClusters++;
+		}
+		stats.assignTimeUs = std::chrono::duration<double,std::micro>(clock::now()-start).count();
+
+		lightData.resize(8*frameLights.size());
+		for(unsigned int l=0;l<frameLights.size();l++) {
+			float* d = &lightData[8*l];
+			for(int a=0;a<4;a++) d[a] = frameLights[l].pos[a];
+			for(int a=0;a<3;a++) d[4+a] = frameLights[l].intensity[a];
+			d[7] = frameLights[l].radius;
+		}
+
+		stats.nbLights = frameLights.size();
+		stats.nbGlobalLights = nbGlobalLights;
+		stats.lightRefs = indexData.size();
+
+		// Upload (buffers are never empty : texture buffers need a data store)
+		if (!idBuffers[0]) createGLObjects();
+		if (lightData.empty()) lightData.resize(8,0.0f);
+		if (indexData.empty()) indexData.push_back(0);
+		GLState::bindBuffer(GL_TEXTURE_BUFFER,idBuffers[0]);
+		glBufferData(GL_TEXTURE_BUFFER,lightData.size()*sizeof(float),&lightData[0],GL_STREAM_DRAW);
+		GLState::bindBuffer(GL_TEXTURE_BUFFER,idBuffers[1]);
+		glBufferData(GL_TEXTURE_BUFFER,gridData.size()*sizeof(unsigned int),&gridData[0],GL_STREAM_DRAW);
+		GLState::bindBuffer(GL_TEXTURE_BUFFER,idBuffers[2]);
+		glBufferData(GL_TEXTURE_BUFFER,indexData.size()*sizeof(unsigned int),&indexData[0],GL_STREAM_DRAW);
+
+		stats.updateTimeUs = std::chrono::duration<double,std::micro>(clock::now()-start).count();
+	}
+
+	void GLBI_Light_Clusters::createGLObjects() {
+		static const GLenum formats[3] = {GL_RGBA32F,GL_RG32UI,GL_R32UI};
+		glGenBuffers(3,idBuffers);
+		glGenTextures(3,idTextures);
+		for(int i=0;i<3;i++) {
+			GLState::bindBuffer(GL_TEXTURE_BUFFER,idBuffers[i]);
+			glBufferData(GL_TEXTURE_BUFFER,16,NULL,GL_STREAM_DRAW);
+			GLState::bindTexture(GL_TEXTURE_BUFFER,idTextures[i]);
+			glTexBuffer(GL_TEXTURE_BUFFER,formats[i],idBuffers[i]);
+		}
+	}
+
+	void GLBI_Light_Clusters::bindTextures(unsigned int first_unit) {
+		for(unsigned int i=0;i<3;i++) {
+			GLState::bindTexture(GL_TEXTURE0+first_unit+i,GL_TEXTURE_BUFFER,idTextures[i]);
+		}
+		GLState::activeTexture(GL_TEXTURE0);
+	}
+
+	std::ostream& operator<<(std::ostream& os,const GLBI_Cluster_Stats& st) {
+		os<<"Clusters : "<<st.nbLights<<" lights ("<<st.nbGlobalLights<<" global) in "<<st.nbClusters;
+		os<<" clusters with "<<st.nbThreads<<" threads"<<std::endl;
+		os<<"  "<<st.lightRefs<<" light refs, at most "<<st.maxLightsPerCluster<<" per cluster, ";
+		os<<st.emptyClusters<<" empty"<<std::endl;
+		os<<"  assignment "<<st.assignTimeUs<<" us, with upload "<<st.updateTimeUs<<" us"<<std::endl;
+		return os;
+	}
+
+}
@@ -88,4 +88,8 @@ namespace glbasimac {
 	void GLBI_Set_Of_Points::drawSet() {
 		pts.draw();
 	}
+
+	void GLBI_Set_Of_Points::drawSetInstanced(InstanceBuffer& instances) {
+		pts.drawInstanced(instances);
+	}
 }
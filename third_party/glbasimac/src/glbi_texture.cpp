@@ -14,7 +14,7 @@ namespace glbasimac {
 			std::cerr<<"Unable to attach an uncreated Texture"<<std::endl;
 			exit(1);
 		}
-		glBindTexture(GL_TEXTURE_2D,id_in_GL);
+		GLState::bindTexture(GL_TEXTURE_2D,id_in_GL);
 	}
 
 	void GLBI_Texture::loadImage(unsigned int w,unsigned int h,unsigned int n_chan,unsigned char* pixels) {
@@ -30,7 +30,7 @@ namespace glbasimac {
 	}
 
 	void GLBI_Texture::detachTexture() {
-		glBindTexture(GL_TEXTURE_2D,0);
+		GLState::bindTexture(GL_TEXTURE_2D,0);
 	}
 
 	void GLBI_Texture::setParameters(unsigned int param,unsigned int value) {
@@ -22,6 +22,8 @@
 #include <vector>
 #include <cassert>
 #include <cmath>
+#include <thread>
+#include <algorithm>
 #include "mesh.hpp"
 #include "indexed_mesh.hpp"
 
@@ -91,6 +93,34 @@ namespace STP3D {
 	  */
 	IndexedMesh* basicSphere(float radius = 1.0f,unsigned int nb_div_h=64, unsigned int nb_div_circle=64);
 
+	/** FAST GENERATORS
+	  * Same meshes as basicCone, basicCylinder and basicSphere (within float precision), for
+	  * high resolutions. The sines and cosines of a circle are computed once, by rotations, and
+	  * not once per vertex. Coordinates, normals and uvs are written in the same pass, and the
+	  * rows of vertices and indices are split between \a nb_threads threads (0 : one per core,
+	  * small meshes use one thread).
+	  * The fill functions write in storage given by the application (a pool, a mapped buffer...)
+	  * whose sizes are given by the size functions : \a nb_points * 3 floats of coordinates and of
+	  * normals, \a nb_points * 2 floats of uvs and \a nb_prim * 3 indices.
+	  * The fast functions allocate the buffers of the mesh once and fill them in place.
+	  * Without division (or with less than 2 divisions of the sphere height), the fill functions
+	  * return false and write nothing, and the fast functions return NULL.
+	  */
+	void basicConeSize(unsigned int nb_div,unsigned int& nb_points);
+	bool fillCone(float h,float radius,float radius_up,unsigned int nb_div,
+	              float* coord,float* normals,float* uv,unsigned int nb_threads = 0);
+	StandardMesh* fastCone(float h,float radius,float radius_up = 0.0,unsigned int nb_div = 64,unsigned int nb_threads = 0);
+
+	void basicCylinderSize(unsigned int div_round,unsigned int div_height,unsigned int& nb_points,unsigned int& nb_prim);
+	bool fillCylinder(float h,float radius,unsigned int div_round,unsigned int div_height,
+	                  float* coord,float* normals,float* uv,unsigned int* indexes,unsigned int nb_threads = 0);
+	IndexedMesh* fastCylinder(float h,float radius,unsigned int div_round = 64,unsigned int div_height = 1,unsigned int nb_threads = 0);
+
+	void basicSphereSize(unsigned int nb_div_h,unsigned int nb_div_circle,unsigned int& nb_points,unsigned int& nb_prim);
+	bool fillSphere(float radius,unsigned int nb_div_h,unsigned int nb_div_circle,
+	                float* coord,float* normals,float* uv,unsigned int* indexes,unsigned int nb_threads = 0);
+	IndexedMesh* fastSphere(float radius = 1.0f,unsigned int nb_div_h = 64,unsigned int nb_div_circle = 64,unsigned int nb_threads = 0);
+
 	inline StandardMesh* createRepere(float lg) {
 		StandardMesh* repere = new StandardMesh(6,GL_LINES);
 		float coord[18] = {0.0,0.0,0.0,lg,0.0,0.0,
@@ -398,6 +428,260 @@ namespace STP3D {
 		return sphere;
 	}
 
+	/// Cosines and sines of the angles k * \a step, k < \a count, by rotations of \a step
+	/// (computed again every 256 steps to bound the error)
+	inline void circleTable(double step,unsigned int count,float* cosines,float* sines) {
+		double cos_step = cos(step),sin_step = sin(step);
+		double c = 1.0,s = 0.0;
+		for(unsigned int k=0;k<count;k++) {
+			cosines[k] = c;
+			sines[k] = s;
+			if ((k+1)%256 == 0) {
+				c = cos((k+1)*step);
+				s = sin((k+1)*step);
+			}
+			else {
+				double next_c = c*cos_step-s*sin_step;
+				s = s*cos_step+c*sin_step;
+				c = next_c;
+			}
+		}
+	}
+
+	/// Call \a f(first,last) on ranges of the \a nb_rows rows of \a row_size vertices, in parallel
+	template<typename Function> void generateRows(unsigned int nb_rows,unsigned int row_size,unsigned int nb_threads,Function f) {
+		if (nb_threads == 0) nb_threads = std::thread::hardware_concurrency();
+		// At least 16K vertices per thread
+		size_t max_threads = (size_t(nb_rows)*row_size)/16384+1;
+		nb_threads = std::max(1u,std::min(nb_threads,(unsigned int)std::min(max_threads,size_t(nb_rows))));
+		std::vector<std::thread> workers;
+		for(unsigned int t=1;t<nb_threads;t++) {
+			workers.push_back(std::thread(f,size_t(nb_rows)*t/nb_threads,size_t(nb_rows)*(t+1)/nb_threads));
+		}
+		if (nb_rows > 0) f(size_t(0),size_t(nb_rows)/nb_threads);
+		for(unsigned int t=0;t<workers.size();t++) workers[t].join();
+	}
+
+	inline void basicConeSize(unsigned int nb_div,unsigned int& nb_points) {
+		nb_points = (nb_div+1)*2;
+	}
+
+	inline bool fillCone(float h,float radius,float r_up,unsigned int nb_div,
+	                     float* coord,float* normals,float* uv,unsigned int nb_threads) {
+		if (nb_div == 0) {
+			STP3D::setError("fillCone : no division");
+			return false;
+		}
+		std::vector<float> cosines(nb_div+1),sines(nb_div+1);
+		circleTable(2*M_PI/nb_div,nb_div+1,&cosines[0],&sines[0]);
+		double angle_to_axis_y = atan(radius/h);
+		float cos_to_xz = cos(angle_to_axis_y);
+		float sin_to_xz = sin(angle_to_axis_y);
+		// One row : the two vertices of each division
+		generateRows(nb_div+1,2,nb_threads,[&](size_t first,size_t last) {
+			for(size_t i=first;i<last;i++) {
+				float cos_pt = cosines[i],sin_pt = sines[i];
+				coord[6*i  ] = radius*cos_pt; coord[6*i+1] = 0.0f; coord[6*i+2] = radius*sin_pt;
+				coord[6*i+3] = r_up*cos_pt;   coord[6*i+4] = h;    coord[6*i+5] = r_up*sin_pt;
+				normals[6*i  ] = cos_pt*cos_to_xz; normals[6*i+1] = sin_to_xz; normals[6*i+2] = sin_pt*cos_to_xz;
+				normals[6*i+3] = cos_pt*cos_to_xz; normals[6*i+4] = sin_to_xz; normals[6*i+5] = sin_pt*cos_to_xz;
+				uv[4*i  ] = (float)i/nb_div; uv[4*i+1] = 0.0f;
+				uv[4*i+2] = (float)i/nb_div; uv[4*i+3] = 1.0f;
+			}
+		});
+		return true;
+	}
+
+	inline StandardMesh* fastCone(float h,float radius,float r_up,unsigned int nb_div,unsigned int nb_threads) {
+		if (nb_div == 0) {
+			STP3D::setError("fastCone : no division");
+			return NULL;
+		}
+		unsigned int nb_points;
+		basicConeSize(nb_div,nb_points);
+		StandardMesh* cone = new StandardMesh(nb_points,GL_TRIANGLE_STRIP);
+		float* coord = new float[nb_points*3];
+		float* normals = new float[nb_points*3];
+		float* uv = new float[nb_points*2];
+		fillCone(h,radius,r_up,nb_div,coord,normals,uv,nb_threads);
+		cone->addOneBuffer(0,3,coord,"coordinates",false);
+		cone->addOneBuffer(1,3,normals,"normals",false);
+		cone->addOneBuffer(2,2,uv,"uvs",false);
+		return cone;
+	}
+
+	inline void basicCylinderSize(unsigned int div_round,unsigned int div_height,unsigned int& nb_points,unsigned int& nb_prim) {
+		nb_points = (div_round+1)*(div_height+1);
+		nb_prim = 2*div_round*div_height;
+	}
+
+	inline bool fillCylinder(float h,float radius,unsigned int div_round,unsigned int div_height,
+	                         float* coord,float* normals,float* uv,unsigned int* indexes,unsigned int nb_threads) {
+		if (div_round == 0 || div_height == 0) {
+			STP3D::setError("fillCylinder : no division");
+			return false;
+		}
+		// As in basicCylinder, the angle goes on from one ring to the next one :
+		// vertex i of ring j is at angle (i+j) * 2PI/div_round
+		std::vector<float> cosines(div_round),sines(div_round);
+		circleTable(2*M_PI/div_round,div_round,&cosines[0],&sines[0]);
+		unsigned int row = div_round+1;
+		generateRows(div_height+1,row,nb_threads,[&](size_t first,size_t last) {
+			for(size_t j=first;j<last;j++) {
+				float height = (double)h*j/div_height;
+				float v = j/(float)div_height;
+				float* pt_coord = coord+3*j*row;
+				float* pt_nml = normals+3*j*row;
+				float* pt_uv = uv+2*j*row;
+				for(unsigned int i=0;i<=div_round;i++) {
+					unsigned int k = (i+j)%div_round;
+					pt_coord[3*i  ] = radius*cosines[k];
+					pt_coord[3*i+1] = height;
+					pt_coord[3*i+2] = radius*sines[k];
+					pt_nml[3*i  ] = cosines[k];
+					pt_nml[3*i+1] = 0.0f;
+					pt_nml[3*i+2] = sines[k];
+					pt_uv[2*i  ] = i/(float)div_round;
+					pt_uv[2*i+1] = v;
+				}
+				if (j == div_height) continue;
+				// Quads between this ring and the next one
+				unsigned int* pt_indx = indexes+6*j*div_round;
+				for(unsigned int i=0;i<div_round;i++) {
+					pt_indx[6*i+0] = j*row+i;           // A
+					pt_indx[6*i+1] = j*row+(i+1);       // B
+					pt_indx[6*i+2] = (j+1)*row+i;       // C
+					pt_indx[6*i+3] = (j+1)*row+i;       // C
+					pt_indx[6*i+4] = j*row+(i+1);       // B
+					pt_indx[6*i+5] = (j+1)*row+(i+1);   // D
+				}
+			}
+		});
+		return true;
+	}
+
+	inline IndexedMesh* fastCylinder(float h,float radius,unsigned int div_round,unsigned int div_height,unsigned int nb_threads) {
+		if (div_round == 0 || div_height == 0) {
+			STP3D::setError("fastCylinder : no division");
+			return NULL;
+		}
+		unsigned int nb_points,nb_prim;
+		basicCylinderSize(div_round,div_height,nb_points,nb_prim);
+		IndexedMesh* cyl = new IndexedMesh(nb_prim,nb_points,GL_TRIANGLES);
+		float* coord = new float[nb_points*3];
+		float* normals = new float[nb_points*3];
+		float* uv = new float[nb_points*2];
+		unsigned int* indexes = new unsigned int[3*nb_prim];
+		fillCylinder(h,radius,div_round,div_height,coord,normals,uv,indexes,nb_threads);
+		cyl->addOneBuffer(0,3,coord,"coordinates",false);
+		cyl->addOneBuffer(1,3,normals,"normals",false);
+		cyl->addOneBuffer(2,2,uv,"uvs",false);
+		cyl->addIndexBuffer(indexes,false);
+		return cyl;
+	}
+
+	inline void basicSphereSize(unsigned int nb_div_h,unsigned int nb_div_circle,unsigned int& nb_points,unsigned int& nb_prim) {
+		nb_points = 2+((nb_div_h-1)*(nb_div_circle+1));
+		nb_prim = nb_div_circle*2 + (nb_div_h-2)*2*nb_div_circle;
+	}
+
+	inline bool fillSphere(float radius,unsigned int nb_div_h,unsigned int nb_div_circle,
+	                       float* coord,float* normals,float* uv,unsigned int* indexes,unsigned int nb_threads) {
+		if (nb_div_h < 2 || nb_div_circle == 0) {
+			STP3D::setError("fillSphere : less than 2 divisions of the height or no division of the circle");
+			return false;
+		}
+		unsigned int nb_points,nb_prim;
+		basicSphereSize(nb_div_h,nb_div_circle,nb_points,nb_prim);
+		unsigned int row = nb_div_circle+1;
+		float step_y_angle = M_PI/(float)nb_div_h;
+		float step_circle_angle = 2*M_PI/(float)nb_div_circle;
+		std::vector<float> cosines(row),sines(row);
+		circleTable(step_circle_angle,row,&cosines[0],&sines[0]);
+
+		// Bottom and top of the sphere
+		coord[0] = coord[2] = 0.0f;
+		coord[1] = -radius;
+		normals[0] = normals[2] = 0.0f;
+		normals[1] = -1.0f;
+		uv[0] = uv[1] = 0.0f;
+		coord[3*(nb_points-1)] = coord[3*(nb_points-1)+2] = 0.0f;
+		coord[3*(nb_points-1)+1] = radius;
+		normals[3*(nb_points-1)] = normals[3*(nb_points-1)+2] = 0.0f;
+		normals[3*(nb_points-1)+1] = 1.0f;
+		uv[2*(nb_points-1)] = 0.0f;
+		uv[2*(nb_points-1)+1] = 1.0f;
+		// South pole
+		for(unsigned int i=0;i<nb_div_circle;i++) {
+			indexes[3*i  ] = 0;
+			indexes[3*i+1] = 1+i;
+			indexes[3*i+2] = 1+((i+1)%nb_div_circle);
+		}
+		// North pole
+		unsigned int* pt_north = indexes+3*(nb_prim-nb_div_circle);
+		unsigned int k = (nb_div_h-2);
+		for(unsigned int j=0;j<nb_div_circle;j++) {
+			pt_north[3*j  ] = 1 +  j    + k * row;
+			pt_north[3*j+1] = 1 + (j+1) + k * row;
+			pt_north[3*j+2] = nb_points-1;
+		}
+
+		// All other slices, with the quads between a slice and the previous one
+		generateRows(nb_div_h-1,row,nb_threads,[&](size_t first,size_t last) {
+			for(size_t i=first+1;i<=last;i++) {
+				float y_value = sin(-(M_PI/2.0)+i*step_y_angle);
+				float inner_radius = cos(-M_PI/2.0+i*step_y_angle);
+				float v = (float)i/(float)nb_div_h;
+				float* pt_coord = coord+3*(1+(i-1)*row);
+				float* pt_nml = normals+3*(1+(i-1)*row);
+				float* pt_uv = uv+2*(1+(i-1)*row);
+				for(unsigned int j=0;j<=nb_div_circle;j++) {
+					float x = inner_radius*cosines[j];
+					float z = -inner_radius*sines[j];
+					pt_coord[3*j  ] = radius*x;
+					pt_coord[3*j+1] = radius*y_value;
+					pt_coord[3*j+2] = radius*z;
+					pt_nml[3*j  ] = x;
+					pt_nml[3*j+1] = y_value;
+					pt_nml[3*j+2] = z;
+					pt_uv[2*j  ] = (float)j/(float)nb_div_circle;
+					pt_uv[2*j+1] = v;
+				}
+				if (i == 1) continue;
+				unsigned int* pt_indx = indexes+3*nb_div_circle+6*(i-2)*nb_div_circle;
+				for(unsigned int j=0;j<nb_div_circle;j++) {
+					pt_indx[6*j  ] = 1 +  j    + (i-2) * row;
+					pt_indx[6*j+1] = 1 + (j+1) + (i-1) * row;
+					pt_indx[6*j+2] = 1 +  j    + (i-1) * row;
+					pt_indx[6*j+3] = 1 +  j    + (i-2) * row;
+					pt_indx[6*j+4] = 1 + (j+1) + (i-2) * row;
+					pt_indx[6*j+5] = 1 + (j+1) + (i-1) * row;
+				}
+			}
+		});
+		return true;
+	}
+
+	inline IndexedMesh* fastSphere(float radius,unsigned int nb_div_h,unsigned int nb_div_circle,unsigned int nb_threads) {
+		if (nb_div_h < 2 || nb_div_circle == 0) {
+			STP3D::setError("fastSphere : less than 2 divisions of the height or no division of the circle");
+			return NULL;
+		}
+		unsigned int nb_points,nb_prim;
+		basicSphereSize(nb_div_h,nb_div_circle,nb_points,nb_prim);
+		IndexedMesh* sphere = new IndexedMesh(nb_prim,nb_points,GL_TRIANGLES);
+		float* coord = new float[nb_points*3];
+		float* normals = new float[nb_points*3];
+		float* uv = new float[nb_points*2];
+		unsigned int* indexes = new unsigned int[3*nb_prim];
+		fillSphere(radius,nb_div_h,nb_div_circle,coord,normals,uv,indexes,nb_threads);
+		sphere->addOneBuffer(0,3,coord,"coordinates",false);
+		sphere->addOneBuffer(1,3,normals,"normals",false);
+		sphere->addOneBuffer(2,2,uv,"uvs",false);
+		sphere->addIndexBuffer(indexes,false);
+		return sphere;
+	}
+
 };
 
 #endif
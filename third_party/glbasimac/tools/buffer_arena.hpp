@@ -0,0 +1,677 @@
+/***************************************************************************
+                       buffer_arena.hpp  -  description
+                             -------------------
+    copyright            : (C) 2012 by Biri Venceslas
+    email                : biri@univ-mlv.fr
+ ***************************************************************************/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef _STP3D_BUFFER_ARENA_HPP_
+#define _STP3D_BUFFER_ARENA_HPP_
+
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <cstddef>
+#include "globals.hpp"
+#include "gl_state.hpp"
+#include "vertex_layout.hpp"
+#include "indexed_mesh.hpp"
+
+namespace STP3D {
+
+	/**
+	  * \brief Two level segregated fit allocator of ranges in [0,capacity[.
+	  * The free ranges are kept in lists by size class : the first level is the
+	  * power of two of the size, the second level splits it in SL_COUNT classes.
+	  * Two bitmaps give the first non empty class able to hold a size in constant
+	  * time. Freed ranges are merged with their free neighbours at once.
+	  * Units are free (vertices, indices...). Only the bookkeeping is done here.
+	  */
+	class TLSFAllocator {
+	public:
+		static const unsigned int NONE = 0xFFFFFFFFu;
+
+		TLSFAllocator(unsigned int capacity = 0) {reset(capacity);};
+
+		/// Forget all the ranges : one free range of \param capacity
+		void reset(unsigned int capacity);
+		/// Add free space at the end (\param new_capacity greater than the capacity)
+		void grow(unsigned int new_capacity);
+		/// Allocate \param size units. Returns the block (NONE if no range is large enough).
+		unsigned int allocate(unsigned int size);
+		/// Free the \param block returned by allocate
+		void release(unsigned int block);
+		unsigned int offset(unsigned int block) const {return blocks[block].offset;};
+		unsigned int size(unsigned int block) const {return blocks[block].size;};
+
+		unsigned int capacity() const {return total;};
+		unsigned int used() const {return nb_used;};
+		unsigned int nbFreeBlocks() const {return nb_free_blocks;};
+		unsigned int largestFree() const;
+
+	private:
+		static const unsigned int SL_LOG = 4;
+		static const unsigned int SL_COUNT = 1<<SL_LOG;
+		static const unsigned int FL_COUNT = 32-SL_LOG+1;
+
+		struct Block {
+			unsigned int offset,size;
+			/// Neighbours in the range and in the free list of the class
+			unsigned int prev_phys,next_phys;
+			unsigned int prev_free,next_free;
+			bool free;
+		};
+
+		static unsigned int highestBit(unsigned int v);
+		static unsigned int lowestBit(unsigned int v);
+		static void mapping(unsigned int size,unsigned int& fl,unsigned int& sl);
+		unsigned int newBlock();
+		void insertFree(unsigned int block);
+		void removeFree(unsigned int block);
+		/// Merge \param next in \param block (physical neighbours, both free and out of the lists)
+		void merge(unsigned int block,unsigned int next);
+
+		std::vector<Block> blocks;
+		/// Blocks not in the range anymore (merged)
+		std::vector<unsigned int> unused;
+		unsigned int heads[FL_COUNT][SL_COUNT];
+		unsigned int fl_bitmap;
+		unsigned int sl_bitmap[FL_COUNT];
+		unsigned int last_block;
+		unsigned int total,nb_used,nb_free_blocks;
+	};
+
+	inline unsigned int TLSFAllocator::highestBit(unsigned int v) {
+#if defined(__GNUC__)
+		return 31-__builtin_clz(v);
+#else
+		unsigned int b = 0;
+		while (v >>= 1) b++;
+		return b;
+#endif
+	}
+
+	inline unsigned int TLSFAllocator::lowestBit(unsigned int v) {
+#if defined(__GNUC__)
+		return __builtin_ctz(v);
+#else
+		unsigned int b = 0;
+		while (!(v & 1)) {v >>= 1;b++;}
+		return b;
+#endif
+	}
+
+	inline void TLSFAllocator::mapping(unsigned int size,unsigned int& fl,unsigned int& sl) {
+		if (size < SL_COUNT) {
+			fl = 0;
+			sl = size;
+			return;
+		}
+		unsigned int bit = highestBit(size);
+		fl = bit-SL_LOG+1;
+		sl = (size >> (bit-SL_LOG))-SL_COUNT;
+	}
+
+	inline void TLSFAllocator::reset(unsigned int capacity) {
+		blocks.clear();
+		unused.clear();
+		fl_bitmap = 0;
+		for(unsigned int f=0;f<FL_COUNT;f++) {
+			sl_bitmap[f] = 0;
+			for(unsigned int s=0;s<SL_COUNT;s++) heads[f][s] = NONE;
+		}
+		total = capacity;
+		nb_used = nb_free_blocks = 0;
+		last_block = NONE;
+		if (capacity == 0) return;
+		last_block = newBlock();
+		Block& b = blocks[last_block];
+		b.offset = 0;
+		b.size = capacity;
+		b.prev_phys = b.next_phys = NONE;
+		insertFree(last_block);
+	}
+
+	inline void TLSFAllocator::grow(unsigned int new_capacity) {
+		if (new_capacity <= total) return;
+		unsigned int extra = new_capacity-total;
+		total = new_capacity;
+		if (last_block != NONE && blocks[last_block].free) {
+			removeFree(last_block);
+			blocks[last_block].size += extra;
+			insertFree(last_block);
+			return;
+		}
+		unsigned int block = newBlock();
+		Block& b = blocks[block];
+		b.offset = new_capacity-extra;
+		b.size = extra;
+		b.prev_phys = last_block;
+		b.next_phys = NONE;
+		if (last_block != NONE) blocks[last_block].next_phys = block;
+		last_block = block;
+		insertFree(block);
+	}
+
+	inline unsigned int TLSFAllocator::allocate(unsigned int size) {
+		if (size == 0) size = 1;
+		// Round up to the next class : any block of that class is large enough
+		unsigned int fl,sl;
+		unsigned int block = NONE;
+		unsigned int rounded = size;
+		if (size >= SL_COUNT) rounded += (1u << (highestBit(size)-SL_LOG))-1;
+		if (rounded >= size) {
+			mapping(rounded,fl,sl);
+			unsigned int sl_map = (fl < FL_COUNT) ? sl_bitmap[fl] & (~0u << sl) : 0;
+			if (!sl_map) {
+				unsigned int fl_map = (fl+1 < FL_COUNT) ? fl_bitmap & (~0u << (fl+1)) : 0;
+				if (fl_map) {
+					fl = lowestBit(fl_map);
+					sl_map = sl_bitmap[fl];
+				}
+			}
+			if (sl_map) block = heads[fl][lowestBit(sl_map)];
+		}
+		if (block == NONE) {
+			// The class of the size itself may still hold a block large enough
+			mapping(size,fl,sl);
+			for(unsigned int b=heads[fl][sl];b!=NONE;b=blocks[b].next_free) {
+				if (blocks[b].size >= size) {block = b;break;}
+			}
+			if (block == NONE) return NONE;
+		}
+
+		removeFree(block);
+		if (blocks[block].size > size) {
+			// The rest stays free, after the block
+			unsigned int rest = newBlock();
+			Block& b = blocks[block];
+			Block& r = blocks[rest];
+			r.offset = b.offset+size;
+			r.size = b.size-size;
+			r.prev_phys = block;
+			r.next_phys = b.next_phys;
+			if (b.next_phys != NONE) blocks[b.next_phys].prev_phys = rest;
+			else last_block = rest;
+			b.next_phys = rest;
+			b.size = size;
+			insertFree(rest);
+		}
+		nb_used += size;
+		return block;
+	}
+
+	inline void TLSFAllocator::release(unsigned int block) {
+		if (block >= blocks.size() || blocks[block].free) return;
+		nb_used -= blocks[block].size;
+		unsigned int next = blocks[block].next_phys;
+		if (next != NONE && blocks[next].free) {
+			removeFree(next);
+			merge(block,next);
+		}
+		unsigned int prev = blocks[block].prev_phys;
+		if (prev != NONE && blocks[prev].free) {
+			removeFree(prev);
+			merge(prev,block);
+			block = prev;
+		}
+		insertFree(block);
+	}
+
+	inline unsigned int TLSFAllocator::largestFree() const {
+		if (!fl_bitmap) return 0;
+		unsigned int fl = highestBit(fl_bitmap);
+		unsigned int sl = highestBit(sl_bitmap[fl]);
+		unsigned int largest = 0;
+		for(unsigned int b=heads[fl][sl];b!=NONE;b=blocks[b].next_free) largest = std::max(largest,blocks[b].size);
+		return largest;
+	}
+
+	inline unsigned int TLSFAllocator::newBlock() {
+		if (!unused.empty()) {
+			unsigned int block = unused.back();
+			unused.pop_back();
+			return block;
+		}
+		blocks.push_back(Block());
+		return blocks.size()-1;
+	}
+
+	inline void TLSFAllocator::insertFree(unsigned int block) {
+		Block& b = blocks[block];
+		unsigned int fl,sl;
+		mapping(b.size,fl,sl);
+		b.free = true;
+		b.prev_free = NONE;
+		b.next_free = heads[fl][sl];
+		if (b.next_free != NONE) blocks[b.next_free].prev_free = block;
+		heads[fl][sl] = block;
+		fl_bitmap |= 1u << fl;
+		sl_bitmap[fl] |= 1u << sl;
+		nb_free_blocks++;
+	}
+
+	inline void TLSFAllocator::removeFree(unsigned int block) {
+		Block& b = blocks[block];
+		unsigned int fl,sl;
+		mapping(b.size,fl,sl);
+		if (b.prev_free != NONE) blocks[b.prev_free].next_free = b.next_free;
+		else heads[fl][sl] = b.next_free;
+		if (b.next_free != NONE) blocks[b.next_free].prev_free = b.prev_free;
+		if (heads[fl][sl] == NONE) {
+			sl_bitmap[fl] &= ~(1u << sl);
+			if (!sl_bitmap[fl]) fl_bitmap &= ~(1u << fl);
+		}
+		b.free = false;
+		nb_free_blocks--;
+	}
+
+	inline void TLSFAllocator::merge(unsigned int block,unsigned int next) {
+		Block& b = blocks[block];
+		Block& n = blocks[next];
+		b.size += n.size;
+		b.next_phys = n.next_phys;
+		if (n.next_phys != NONE) blocks[n.next_phys].prev_phys = block;
+		else last_block = block;
+		unused.push_back(next);
+	}
+
+	/// Occupation of a BufferArena
+	struct BufferArenaStats {
+		BufferArenaStats() : nb_meshes(0),vertex_capacity(0),vertex_used(0),vertex_free_blocks(0),vertex_largest_free(0),
+		                     index_capacity(0),index_used(0),index_free_blocks(0),index_largest_free(0),
+		                     gpu_bytes(0),used_bytes(0),grows(0),compactions(0),moved_meshes(0) {}
+		unsigned int nb_meshes;
+		/// In vertices
+		unsigned int vertex_capacity,vertex_used,vertex_free_blocks,vertex_largest_free;
+		/// In indices
+		unsigned int index_capacity,index_used,index_free_blocks,index_largest_free;
+		/// Bytes of the buffers, and of the ranges of the meshes
+		size_t gpu_bytes,used_bytes;
+		/// Buffers made larger, compactions and meshes moved by them (vertices and indices counted apart)
+		unsigned int grows,compactions,moved_meshes;
+
+		/// Part of the buffers used by meshes
+		float utilization() const {return gpu_bytes ? float(double(used_bytes)/gpu_bytes) : 0.0f;};
+		/// 0 : the free space is one range, near 1 : it is spread in small ranges. Worst of vertices and indices.
+		float fragmentation() const {
+			return std::max(fragmentation(vertex_capacity-vertex_used,vertex_largest_free),
+			                fragmentation(index_capacity-index_used,index_largest_free));
+		};
+		static float fragmentation(unsigned int free_units,unsigned int largest) {
+			return free_units ? 1.0f-float(largest)/free_units : 0.0f;
+		};
+	};
+
+	inline std::ostream& operator<<(std::ostream& os,const BufferArenaStats& st) {
+		os<<st.nb_meshes<<" meshes, "<<st.gpu_bytes/(1024.0*1024.0)<<" MB ("<<st.utilization()*100.0f<<" % used), vertices ";
+		os<<st.vertex_used<<"/"<<st.vertex_capacity<<" ("<<st.vertex_free_blocks<<" free blocks), indices ";
+		os<<st.index_used<<"/"<<st.index_capacity<<" ("<<st.index_free_blocks<<" free blocks), fragmentation ";
+		os<<st.fragmentation()*100.0f<<" %, "<<st.grows<<" grows, "<<st.compactions<<" compactions ("<<st.moved_meshes<<" meshes moved)";
+		return os;
+	}
+
+	/**
+	  * \brief GL buffers shared by indexed meshes of the same attributes.
+	  * The vertices of all the meshes are in the same VBOs (packed as the VertexLayout
+	  * of the arena says) and their indices in the same index buffer. All the meshes
+	  * use one VAO : drawing several of them binds it once, and each draw starts at
+	  * the range of its mesh with glDrawElementsBaseVertex.
+	  * Ranges are given by two TLSFAllocator (vertices and indices). The buffers grow
+	  * (twice larger) when a mesh does not fit, and compact() moves the meshes
+	  * together to remove the holes left by the released ones.
+	  * Meshes are added with addMesh (or setSharedBuffers then createVAO) : they need
+	  * their CPU data, and the attributes (ids and sizes) of the first mesh.
+	  * The arena has to be deleted after its meshes are released, or it detaches them.
+	  */
+	class BufferArena : public SharedMeshBuffers {
+	public:
+		/// Initial capacities in vertices and in indices (they are also the smallest after compact)
+		BufferArena(const VertexLayout& new_layout = VertexLayout(),unsigned int vertex_capacity = 65536,unsigned int index_capacity = 262144) :
+			layout(new_layout),initial_vertices(std::max(vertex_capacity,1u)),initial_indices(std::max(index_capacity,1u)),
+			id_vao(0),id_index(0),instance_serial(0),vertex_size(0) {};
+		~BufferArena();
+
+		/// Store \param mesh in the arena (createVAO of the mesh)
+		bool addMesh(IndexedMesh& mesh) {mesh.setSharedBuffers(this);return mesh.createVAO();};
+		bool storeMesh(IndexedMesh& mesh);
+		void releaseMesh(IndexedMesh& mesh);
+		unsigned int& instanceSerial() {return instance_serial;};
+
+		const VertexLayout& getVertexLayout() const {return layout;};
+		unsigned int getVAO() const {return id_vao;};
+		/// Move all the meshes at the start of new buffers (1.5 times the used space). Returns false on GL error.
+		bool compact();
+		BufferArenaStats stats() const;
+
+	private:
+		// Owns GL buffers : no copy
+		BufferArena(const BufferArena&);
+		BufferArena& operator=(const BufferArena&);
+
+		struct Entry {
+			IndexedMesh* mesh;
+			unsigned int vertex_block,index_block;
+		};
+		/// One run of units to copy from an old buffer to a new one
+		struct Move {
+			Move(unsigned int src,unsigned int dst,unsigned int nb) : from(src),to(dst),size(nb) {}
+			unsigned int from,to,size;
+		};
+
+		bool createBuffers(const IndexedMesh& mesh);
+		/// Make the buffers large enough for \param nb_vertices more vertices (and indices)
+		bool growVertices(unsigned int nb_vertices);
+		bool growIndices(unsigned int nb_indices);
+		/// Copy runs of units of \param unit_size bytes from \param old_buffer to a new buffer of \param capacity units
+		static unsigned int copyBuffer(unsigned int old_buffer,unsigned int unit_size,unsigned int capacity,const std::vector<Move>& moves);
+		/// Copy the VBOs in new buffers of \param vertex_capacity vertices and the index buffer in a new one of \param index_capacity
+		/// indices (0 : the buffer is kept). The new buffers replace the old ones only if all of them are made.
+		bool moveBuffers(unsigned int vertex_capacity,const std::vector<Move>& vertex_moves,
+		                 unsigned int index_capacity,const std::vector<Move>& index_moves);
+		/// Point the VAO on the current buffers
+		void bindBuffers();
+
+		VertexLayout layout;
+		unsigned int initial_vertices,initial_indices;
+		/// Attributes of the meshes
+		std::vector<unsigned int> attr_id,size_one_elt;
+		unsigned int id_vao;
+		std::vector<unsigned int> vbo_id;
+		unsigned int id_index;
+		unsigned int instance_serial;
+		unsigned int vertex_size;
+		TLSFAllocator vertices,indices;
+		std::vector<Entry> entries;
+		std::vector<unsigned int> free_entries;
+		BufferArenaStats counters;
+	};
+
+	inline BufferArena::~BufferArena() {
+		// Meshes still in the arena are not drawable anymore
+		for(unsigned int e=0;e<entries.size();e++) {
+			if (!entries[e].mesh) continue;
+			entries[e].mesh->id_vao = 0;
+			entries[e].mesh->shared_buffers = NULL;
+		}
+		if (!vbo_id.empty()) GLState::deleteBuffers(vbo_id.size(),&(vbo_id[0]));
+		if (id_index) GLState::deleteBuffers(1,&id_index);
+		if (id_vao) GLState::deleteVertexArrays(1,&id_vao);
+	}
+
+	inline bool BufferArena::createBuffers(const IndexedMesh& mesh) {
+		attr_id = mesh.attr_id;
+		size_one_elt = mesh.size_one_elt;
+		vertex_size = layout.vertexSize(attr_id,size_one_elt);
+		glGenVertexArrays(1,&id_vao);
+		if (id_vao == 0) {
+			STP3D::setError("BufferArena : unable to find a value for a VAO");
+			return false;
+		}
+		vbo_id.resize(layout.nbBuffers(attr_id));
+		glGenBuffers(vbo_id.size(),&(vbo_id[0]));
+		glGenBuffers(1,&id_index);
+		for(unsigned int i=0;i<vbo_id.size();i++) {
+			if (vbo_id[i] == 0) {STP3D::setError("BufferArena : unable to find an empty VBO");return false;}
+			GLState::bindBuffer(GL_ARRAY_BUFFER,vbo_id[i]);
+			glBufferData(GL_ARRAY_BUFFER,size_t(initial_vertices)*layout.bufferStride(i,attr_id,size_one_elt),NULL,GL_STATIC_DRAW);
+		}
+		if (id_index == 0) {STP3D::setError("BufferArena : unable to find an empty VBO for index buffer");return false;}
+		GLState::bindBuffer(GL_COPY_WRITE_BUFFER,id_index);
+		glBufferData(GL_COPY_WRITE_BUFFER,size_t(initial_indices)*sizeof(unsigned int),NULL,GL_STATIC_DRAW);
+		vertices.reset(initial_vertices);
+		indices.reset(initial_indices);
+		bindBuffers();
+		return true;
+	}
+
+	inline void BufferArena::bindBuffers() {
+		GLState::bindVertexArray(id_vao);
+		layout.setAttributes(attr_id,size_one_elt,vbo_id);
+		GLState::bindBuffer(GL_ELEMENT_ARRAY_BUFFER,id_index);
+	}
+
+	inline unsigned int BufferArena::copyBuffer(unsigned int old_buffer,unsigned int unit_size,unsigned int capacity,
+	                                            const std::vector<Move>& moves) {
+		unsigned int buffer = 0;
+		glGenBuffers(1,&buffer);
+		if (buffer == 0) return 0;
+		GLState::bindBuffer(GL_COPY_WRITE_BUFFER,buffer);
+		glBufferData(GL_COPY_WRITE_BUFFER,size_t(capacity)*unit_size,NULL,GL_STATIC_DRAW);
+		GLState::bindBuffer(GL_COPY_READ_BUFFER,old_buffer);
+		for(unsigned int m=0;m<moves.size();m++) {
+			glCopyBufferSubData(GL_COPY_READ_BUFFER,GL_COPY_WRITE_BUFFER,size_t(moves[m].from)*unit_size,
+			                    size_t(moves[m].to)*unit_size,size_t(moves[m].size)*unit_size);
+		}
+		return buffer;
+	}
+
+	inline bool BufferArena::moveBuffers(unsigned int vertex_capacity,const std::vector<Move>& vertex_moves,
+	                                     unsigned int index_capacity,const std::vector<Move>& index_moves) {
+		std::vector<unsigned int> new_vbo;
+		unsigned int new_index = 0;
+		for(unsigned int i=0;vertex_capacity && i<vbo_id.size();i++) {
+			new_vbo.push_back(copyBuffer(vbo_id[i],layout.bufferStride(i,attr_id,size_one_elt),vertex_capacity,vertex_moves));
+			if (new_vbo.back() == 0) {
+				GLState::deleteBuffers(new_vbo.size(),&(new_vbo[0]));
+				STP3D::setError("BufferArena : unable to find an empty VBO");
+				return false;
+			}
+		}
+		if (index_capacity) {
+			new_index = copyBuffer(id_index,sizeof(unsigned int),index_capacity,index_moves);
+			if (new_index == 0) {
+				if (!new_vbo.empty()) GLState::deleteBuffers(new_vbo.size(),&(new_vbo[0]));
+				STP3D::setError("BufferArena : unable to find an empty VBO for index buffer");
+				return false;
+			}
+		}
+		// Every copy is made : the old buffers can go
+		if (vertex_capacity && !vbo_id.empty()) {
+			GLState::deleteBuffers(vbo_id.size(),&(vbo_id[0]));
+			vbo_id = new_vbo;
+		}
+		if (index_capacity) {
+			GLState::deleteBuffers(1,&id_index);
+			id_index = new_index;
+		}
+		bindBuffers();
+		return true;
+	}
+
+	inline bool BufferArena::growVertices(unsigned int nb_vertices) {
+		unsigned int capacity = vertices.capacity();
+		unsigned int new_capacity = std::max(capacity*2,capacity+nb_vertices);
+		if (!moveBuffers(new_capacity,std::vector<Move>(1,Move(0,0,capacity)),0,std::vector<Move>())) return false;
+		vertices.grow(new_capacity);
+		counters.grows++;
+		return true;
+	}
+
+	inline bool BufferArena::growIndices(unsigned int nb_indices) {
+		unsigned int capacity = indices.capacity();
+		unsigned int new_capacity = std::max(capacity*2,capacity+nb_indices);
+		if (!moveBuffers(0,std::vector<Move>(),new_capacity,std::vector<Move>(1,Move(0,0,capacity)))) return false;
+		indices.grow(new_capacity);
+		counters.grows++;
+		return true;
+	}
+
+	inline bool BufferArena::storeMesh(IndexedMesh& mesh) {
+		STP3D_PROFILE_ZONE("BufferArena::storeMesh");
+		if (mesh.id_vao && (!mesh.vbo_id.empty() || mesh.id_index)) {
+			// VAO and buffers of its own (createVAO before setSharedBuffers) : released as without arena
+			SharedMeshBuffers* shared = mesh.shared_buffers;
+			mesh.shared_buffers = NULL;
+			mesh.releaseGPUMemory();
+			mesh.shared_buffers = shared;
+		}
+		if (mesh.id_vao) {
+			releaseMesh(mesh);
+			mesh.id_vao = 0;
+		}
+		if (!mesh.hasCPUData()) {
+			STP3D::setError("BufferArena : the mesh has no CPU data");
+			return false;
+		}
+		if (id_vao == 0 && !createBuffers(mesh)) return false;
+		if (mesh.attr_id != attr_id || mesh.size_one_elt != size_one_elt) {
+			STP3D::setError("BufferArena : the attributes of the mesh differ from the ones of the arena");
+			return false;
+		}
+		float offset[3];
+		float scale;
+		Matrix4D dequant;
+		if (!layout.quantization(mesh.nb_elts,attr_id,size_one_elt,mesh.buffers,offset,scale,dequant)) return false;
+
+		// Ranges, with larger buffers if needed
+		unsigned int nb_mesh_indices = mesh.getLODIndices(0);
+		unsigned int nb_indices = nb_mesh_indices+mesh.lod_indices.size();
+		unsigned int vertex_block = vertices.allocate(mesh.nb_elts);
+		if (vertex_block == TLSFAllocator::NONE) {
+			if (!growVertices(mesh.nb_elts)) return false;
+			vertex_block = vertices.allocate(mesh.nb_elts);
+		}
+		unsigned int index_block = indices.allocate(nb_indices);
+		if (index_block == TLSFAllocator::NONE) {
+			if (!growIndices(nb_indices)) {vertices.release(vertex_block);return false;}
+			index_block = indices.allocate(nb_indices);
+		}
+		unsigned int base_vertex = vertices.offset(vertex_block);
+		unsigned int first_index = indices.offset(index_block);
+
+		// Upload (the element buffer of the VAO is not touched)
+		std::vector<unsigned char> packed;
+		for(unsigned int i=0;i<vbo_id.size();i++) {
+			unsigned int stride = layout.bufferStride(i,attr_id,size_one_elt);
+			GLState::bindBuffer(GL_ARRAY_BUFFER,vbo_id[i]);
+			if (!layout.isInterleaved() && layout.getFormat(attr_id[i]) == VertexLayout::FormatFloat) {
+				glBufferSubData(GL_ARRAY_BUFFER,size_t(base_vertex)*stride,size_t(mesh.nb_elts)*stride,mesh.buffers[i]);
+				continue;
+			}
+			packed.resize(size_t(mesh.nb_elts)*stride);
+			if (packed.empty()) continue;
+			layout.packBuffer(i,mesh.nb_elts,attr_id,size_one_elt,mesh.buffers,offset,scale,&packed[0]);
+			glBufferSubData(GL_ARRAY_BUFFER,size_t(base_vertex)*stride,packed.size(),&packed[0]);
+		}
+		GLState::bindBuffer(GL_COPY_WRITE_BUFFER,id_index);
+		glBufferSubData(GL_COPY_WRITE_BUFFER,size_t(first_index)*sizeof(unsigned int),nb_mesh_indices*sizeof(unsigned int),mesh.index_buffer);
+		if (!mesh.lod_indices.empty()) {
+			glBufferSubData(GL_COPY_WRITE_BUFFER,size_t(first_index+nb_mesh_indices)*sizeof(unsigned int),
+			                mesh.lod_indices.size()*sizeof(unsigned int),&mesh.lod_indices[0]);
+		}
+
+		unsigned int entry;
+		if (free_entries.empty()) {
+			entry = entries.size();
+			entries.push_back(Entry());
+		}
+		else {
+			entry = free_entries.back();
+			free_entries.pop_back();
+		}
+		entries[entry].mesh = &mesh;
+		entries[entry].vertex_block = vertex_block;
+		entries[entry].index_block = index_block;
+		counters.nb_meshes++;
+
+		mesh.id_vao = id_vao;
+		mesh.vbo_id.clear();
+		mesh.id_index = 0;
+		mesh.layout = layout;
+		mesh.dequant_matrix = dequant;
+		mesh.quantized = (MatrixStack::classify(dequant) != TransfoIdentity);
+		mesh.shared_first_index = first_index;
+		mesh.shared_base_vertex = base_vertex;
+		mesh.shared_id = entry;
+		return true;
+	}
+
+	inline void BufferArena::releaseMesh(IndexedMesh& mesh) {
+		if (mesh.shared_id >= entries.size() || entries[mesh.shared_id].mesh != &mesh) return;
+		Entry& e = entries[mesh.shared_id];
+		vertices.release(e.vertex_block);
+		indices.release(e.index_block);
+		e.mesh = NULL;
+		free_entries.push_back(mesh.shared_id);
+		counters.nb_meshes--;
+	}
+
+	inline bool BufferArena::compact() {
+		STP3D_PROFILE_ZONE("BufferArena::compact");
+		if (id_vao == 0) return true;
+		std::vector<unsigned int> live;
+		for(unsigned int e=0;e<entries.size();e++) if (entries[e].mesh) live.push_back(e);
+		unsigned int nb_moved = 0;
+		// New ranges (vertices then indices) : the arena is only changed once the buffers are copied
+		TLSFAllocator new_alloc[2];
+		std::vector<unsigned int> new_blocks[2];
+		std::vector<Move> moves[2];
+		for(int pass=0;pass<2;pass++) {
+			const TLSFAllocator& alloc = pass ? indices : vertices;
+			std::vector<unsigned int> offsets(entries.size(),0),sizes(entries.size(),0);
+			for(unsigned int l=0;l<live.size();l++) {
+				unsigned int block = pass ? entries[live[l]].index_block : entries[live[l]].vertex_block;
+				offsets[live[l]] = alloc.offset(block);
+				sizes[live[l]] = alloc.size(block);
+			}
+			// In the order of the old buffer : runs of neighbour meshes are copied at once
+			std::sort(live.begin(),live.end(),[&offsets](unsigned int a,unsigned int b) {return offsets[a] < offsets[b];});
+			unsigned int used = alloc.used();
+			new_alloc[pass].reset(std::max(pass ? initial_indices : initial_vertices,used+used/2));
+			new_blocks[pass].assign(entries.size(),0);
+			for(unsigned int l=0;l<live.size();l++) {
+				unsigned int from = offsets[live[l]];
+				unsigned int size = sizes[live[l]];
+				unsigned int block = new_alloc[pass].allocate(size);
+				unsigned int to = new_alloc[pass].offset(block);
+				if (from != to) nb_moved++;
+				if (!moves[pass].empty() && moves[pass].back().from+moves[pass].back().size == from && moves[pass].back().to+moves[pass].back().size == to) {
+					moves[pass].back().size += size;
+				}
+				else moves[pass].push_back(Move(from,to,size));
+				new_blocks[pass][live[l]] = block;
+			}
+		}
+		if (!moveBuffers(new_alloc[0].capacity(),moves[0],new_alloc[1].capacity(),moves[1])) return false;
+		vertices = new_alloc[0];
+		indices = new_alloc[1];
+		for(unsigned int l=0;l<live.size();l++) {
+			Entry& e = entries[live[l]];
+			e.vertex_block = new_blocks[0][live[l]];
+			e.index_block = new_blocks[1][live[l]];
+			e.mesh->shared_base_vertex = vertices.offset(e.vertex_block);
+			e.mesh->shared_first_index = indices.offset(e.index_block);
+		}
+		counters.compactions++;
+		counters.moved_meshes += nb_moved;
+		return true;
+	}
+
+	inline BufferArenaStats BufferArena::stats() const {
+		BufferArenaStats st = counters;
+		st.vertex_capacity = vertices.capacity();
+		st.vertex_used = vertices.used();
+		st.vertex_free_blocks = vertices.nbFreeBlocks();
+		st.vertex_largest_free = vertices.largestFree();
+		st.index_capacity = indices.capacity();
+		st.index_used = indices.used();
+		st.index_free_blocks = indices.nbFreeBlocks();
+		st.index_largest_free = indices.largestFree();
+		st.gpu_bytes = size_t(st.vertex_capacity)*vertex_size+size_t(st.index_capacity)*sizeof(unsigned int);
+		st.used_bytes = size_t(st.vertex_used)*vertex_size+size_t(st.index_used)*sizeof(unsigned int);
+		return st;
+	}
+
+};
+
+#endif
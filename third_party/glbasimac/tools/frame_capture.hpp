@@ -0,0 +1,440 @@
+/***************************************************************************
+                       frame_capture.hpp  -  description
+                             -------------------
+    copyright            : (C) 2012 by Biri Venceslas
+    email                : biri@univ-mlv.fr
+ ***************************************************************************/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef _STP3D_FRAME_CAPTURE_HPP_
+#define _STP3D_FRAME_CAPTURE_HPP_
+
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "gl_tools.hpp"
+#include "gl_state.hpp"
+
+namespace STP3D {
+
+	/// A captured frame given to a FrameCapture consumer. Rows are in image order (first row at the top).
+	struct CapturedFrame {
+		unsigned long index;
+		int width,height;
+		unsigned int nbChannels;
+		const unsigned char* pixels;
+	};
+
+	/// Counters of a FrameCapture
+	struct FrameCaptureStats {
+		/// Frames asked, handed to the worker, dropped because every buffer was busy,
+		/// lost because the readback failed (fence wait or buffer mapping)
+		unsigned long requested,delivered,dropped,failed;
+		/// Times the render thread waited (only with setWaitWhenFull(true))
+		unsigned long waits;
+		/// Largest number of frames waiting for the worker
+		unsigned int maxQueued;
+	};
+
+	/**
+	  * \brief Asynchronous capture of the framebuffer, replacing GLTools::takeSnapshot for every frame captures.
+	  * capture() starts a glReadPixels into one of a ring of pixel buffer
+	  * objects and puts a fence behind it : the call returns at once. Later
+	  * calls (or poll()) map the buffers whose fence is signaled, copy the
+	  * pixels out and hand them to a worker thread. The worker flips the rows
+	  * and either writes the file (.ppm or .png, from the name) or calls the
+	  * consumer (setConsumer()).
+	  * The render thread never waits for the GPU or the disk : when every PBO
+	  * is still in flight, or when maxQueued frames already wait for the
+	  * worker, the frame is dropped and counted. setWaitWhenFull(true) waits
+	  * instead, for recordings that must keep every frame.
+	  * Reads the current read framebuffer (call before swapping buffers).
+	  * Must be used and destroyed with its GL context current.
+	  */
+	class FrameCapture {
+	public:
+		typedef std::function<void(const CapturedFrame&)> Consumer;
+
+		/// \param nb_buffers PBOs in the ring (3 or 4 : frames can be mapped 2 or 3 frames later)
+		/// \param max_queued frames waiting for the worker at most (memory bound)
+		FrameCapture(unsigned int nb_buffers = 3,unsigned int max_queued = 8);
+		~FrameCapture();
+
+		/// Consumer called by the worker for capture() without file name
+		void setConsumer(const Consumer& consumer) {std::lock_guard<std::mutex> lock(mtx);frameConsumer = consumer;}
+		void setWaitWhenFull(bool wait) {waitWhenFull = wait;}
+		/// 3 (RGB, default) or 4 (RGBA) channels
+		void setNbChannels(unsigned int nb_channels) {nbChannels = nb_channels;}
+
+		/// Start the capture of the w x h lower left part of the read framebuffer.
+		/// \param filename file written by the worker (.png or .ppm), empty : given to the consumer
+		/// \return false if the frame is dropped
+		bool capture(int w,int h,const std::string& filename = std::string());
+		/// Hand the finished readbacks to the worker, without waiting
+		void poll();
+		/// Wait for all the captures : readbacks, then the worker
+		void finish();
+
+		FrameCaptureStats stats() const {std::lock_guard<std::mutex> lock(mtx);return counters;}
+
+		static bool writePPM(const char* filename,int w,int h,unsigned int nb_channels,const unsigned char* pixels);
+		/// PNG with stored (not compressed) deflate blocks : no dependency, fast, large files
+		static bool writePNG(const char* filename,int w,int h,unsigned int nb_channels,const unsigned char* pixels);
+
+	private:
+		struct Slot {
+			GLuint pbo;
+			GLsync fence;
+			int width,height;
+			unsigned int nbChannels;
+			unsigned long index;
+			std::string filename;
+		};
+		struct Job {
+			unsigned long index;
+			int width,height;
+			unsigned int nbChannels;
+			std::string filename;
+			std::vector<unsigned char> pixels;
+		};
+
+		// Owns GL buffers and a thread : no copy
+		FrameCapture(const FrameCapture&);
+		FrameCapture& operator=(const FrameCapture&);
+
+		static std::vector<unsigned int> crcTable();
+		static void pushBE32(std::vector<unsigned char>& v,unsigned int x) {
+			v.push_back(x >> 24);v.push_back(x >> 16);v.push_back(x >> 8);v.push_back(x);
+		}
+		/// Copy the oldest readback to a job if it is done (or always if wait)
+		bool retireOldest(bool wait);
+		void workerLoop();
+		void process(Job& job);
+
+		std::vector<Slot> slots;
+		/// Ring of in flight readbacks : first and number of slots
+		unsigned int first,nbPending;
+		unsigned int nbChannels;
+		unsigned int maxQueued;
+		bool waitWhenFull;
+		unsigned long nextIndex;
+
+		mutable std::mutex mtx;
+		std::condition_variable cvWork,cvDone;
+		std::deque<Job> jobs;
+		/// Pixel buffers of finished jobs, reused
+		std::vector<std::vector<unsigned char> > freeBuffers;
+		bool busy,quit;
+		Consumer frameConsumer;
+		FrameCaptureStats counters;
+		std::thread worker;
+	};
+
+	inline FrameCapture::FrameCapture(unsigned int nb_buffers,unsigned int max_queued)
+		:first(0),nbPending(0),nbChannels(3),maxQueued(max_queued),waitWhenFull(false),nextIndex(0),busy(false),quit(false) {
+		slots.resize(nb_buffers < 2 ? 2 : nb_buffers);
+		for(unsigned int i=0;i<slots.size();i++) {
+			slots[i].pbo = 0;
+			slots[i].fence = 0;
+			slots[i].width = slots[i].height = 0;
+			slots[i].nbChannels = 0;
+		}
+		memset(&counters,0,sizeof(counters));
+		worker = std::thread(&FrameCapture::workerLoop,this);
+	}
+
+	inline FrameCapture::~FrameCapture() {
+		finish();
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			quit = true;
+		}
+		cvWork.notify_one();
+		worker.join();
+		for(unsigned int i=0;i<slots.size();i++) {
+			if (slots[i].pbo) GLState::deleteBuffers(1,&(slots[i].pbo));
+		}
+	}
+
+	inline bool FrameCapture::capture(int w,int h,const std::string& filename) {
+		poll();
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			counters.requested++;
+		}
+		if (nbPending == slots.size()) {
+			if (!waitWhenFull) {
+				std::lock_guard<std::mutex> lock(mtx);
+				counters.dropped++;
+				return false;
+			}
+			if (!retireOldest(true)) return false;
+		}
+		Slot& slot = slots[(first+nbPending)%slots.size()];
+		GLsizeiptr size = GLsizeiptr(w)*h*nbChannels;
+		if (!slot.pbo) glGenBuffers(1,&slot.pbo);
+		GLState::bindBuffer(GL_PIXEL_PACK_BUFFER,slot.pbo);
+		if (slot.width != w || slot.height != h || slot.nbChannels != nbChannels) {
+			glBufferData(GL_PIXEL_PACK_BUFFER,size,NULL,GL_STREAM_READ);
+			slot.width = w;
+			slot.height = h;
+			slot.nbChannels = nbChannels;
+		}
+		glPixelStorei(GL_PACK_ALIGNMENT,1);
+		glReadPixels(0,0,w,h,(nbChannels == 4) ? GL_RGBA : GL_RGB,GL_UNSIGNED_BYTE,0);
+		GLState::bindBuffer(GL_PIXEL_PACK_BUFFER,0);
+		slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE,0);
+		slot.index = nextIndex++;
+		slot.filename = filename;
+		nbPending++;
+		// The fence must reach the GPU, or polling it later never sees it signaled
+		glFlush();
+		return true;
+	}
+
+	inline void FrameCapture::poll() {
+		while (nbPending > 0 && retireOldest(false)) {}
+	}
+
+	inline bool FrameCapture::retireOldest(bool wait) {
+		Slot& slot = slots[first];
+		GLenum status = glClientWaitSync(slot.fence,0,0);
+		if (status == GL_TIMEOUT_EXPIRED) {
+			if (!wait) return false;
+			std::lock_guard<std::mutex> lock(mtx);
+			counters.waits++;
+		}
+		Job job;
+		{
+			std::unique_lock<std::mutex> lock(mtx);
+			if (jobs.size() >= maxQueued) {
+				if (!wait) return false;
+				counters.waits++;
+				cvDone.wait(lock,[&]{return jobs.size() < maxQueued;});
+			}
+			if (!freeBuffers.empty()) {
+				job.pixels.swap(freeBuffers.back());
+				freeBuffers.pop_back();
+			}
+		}
+		if (status == GL_TIMEOUT_EXPIRED) status = glClientWaitSync(slot.fence,GL_SYNC_FLUSH_COMMANDS_BIT,GLuint64(-1));
+		glDeleteSync(slot.fence);
+		slot.fence = 0;
+		if (status == GL_WAIT_FAILED) {
+			// The readback may not be done : the slot is dropped without reading its pixels
+			slot.filename.clear();
+			first = (first+1)%slots.size();
+			nbPending--;
+			{
+				std::lock_guard<std::mutex> lock(mtx);
+				if (!job.pixels.empty()) freeBuffers.push_back(std::move(job.pixels));
+				counters.failed++;
+			}
+			STP3D::setError("FrameCapture : waiting for a readback failed");
+			return true;
+		}
+
+		size_t size = size_t(slot.width)*slot.height*slot.nbChannels;
+		job.pixels.resize(size);
+		GLState::bindBuffer(GL_PIXEL_PACK_BUFFER,slot.pbo);
+		const void* data = glMapBufferRange(GL_PIXEL_PACK_BUFFER,0,size,GL_MAP_READ_BIT);
+		if (data) {
+			memcpy(&job.pixels[0],data,size);
+			glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+		}
+		GLState::bindBuffer(GL_PIXEL_PACK_BUFFER,0);
+		job.index = slot.index;
+		job.width = slot.width;
+		job.height = slot.height;
+		job.nbChannels = slot.nbChannels;
+		job.filename.swap(slot.filename);
+		first = (first+1)%slots.size();
+		nbPending--;
+		if (!data) {
+			{
+				std::lock_guard<std::mutex> lock(mtx);
+				freeBuffers.push_back(std::move(job.pixels));
+				counters.failed++;
+			}
+			STP3D::setError("FrameCapture : unable to map a pixel buffer");
+			return true;
+		}
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			jobs.push_back(std::move(job));
+			counters.delivered++;
+			if (jobs.size() > counters.maxQueued) counters.maxQueued = jobs.size();
+		}
+		cvWork.notify_one();
+		return true;
+	}
+
+	inline void FrameCapture::finish() {
+		while (nbPending > 0) retireOldest(true);
+		std::unique_lock<std::mutex> lock(mtx);
+		cvDone.wait(lock,[&]{return jobs.empty() && !busy;});
+	}
+
+	inline void FrameCapture::workerLoop() {
+		Job job;
+		while (true) {
+			{
+				std::unique_lock<std::mutex> lock(mtx);
+				if (!job.pixels.empty()) freeBuffers.push_back(std::move(job.pixels));
+				busy = false;
+				cvDone.notify_all();
+				cvWork.wait(lock,[&]{return quit || !jobs.empty();});
+				if (jobs.empty()) return;
+				job = std::move(jobs.front());
+				jobs.pop_front();
+				busy = true;
+			}
+			process(job);
+		}
+	}
+
+	inline void FrameCapture::process(Job& job) {
+		// GL rows go upward
+		const size_t row = size_t(job.width)*job.nbChannels;
+		std::vector<unsigned char> tmp(row);
+		for(int y=0;y<job.height/2;y++) {
+			unsigned char* top = &job.pixels[y*row];
+			unsigned char* bottom = &job.pixels[(job.height-1-y)*row];
+			memcpy(&tmp[0],top,row);
+			memcpy(top,bottom,row);
+			memcpy(bottom,&tmp[0],row);
+		}
+		if (job.filename.empty()) {
+			Consumer consumer;
+			{
+				std::lock_guard<std::mutex> lock(mtx);
+				consumer = frameConsumer;
+			}
+			if (consumer) {
+				CapturedFrame frame = {job.index,job.width,job.height,job.nbChannels,&job.pixels[0]};
+				consumer(frame);
+			}
+			return;
+		}
+		const std::string& name = job.filename;
+		bool png = name.size() > 4 && (name.compare(name.size()-4,4,".png") == 0 || name.compare(name.size()-4,4,".PNG") == 0);
+		if (png) writePNG(name.c_str(),job.width,job.height,job.nbChannels,&job.pixels[0]);
+		else writePPM(name.c_str(),job.width,job.height,job.nbChannels,&job.pixels[0]);
+	}
+
+	inline bool FrameCapture::writePPM(const char* filename,int w,int h,unsigned int nb_channels,const unsigned char* pixels) {
+		FILE* out = fopen(filename,"wb");
+		if (!out) {
+			std::cerr<<"Unable to write "<<filename<<std::endl;
+			return false;
+		}
+		fprintf(out,"P6\n%d %d\n255\n",w,h);
+		bool ok = true;
+		if (nb_channels == 3) {
+			ok = fwrite(pixels,1,size_t(w)*h*3,out) == size_t(w)*h*3;
+		}
+		else {
+			std::vector<unsigned char> rgb(size_t(w)*3);
+			for(int y=0;y<h && ok;y++) {
+				const unsigned char* src = pixels+size_t(y)*w*nb_channels;
+				for(int x=0;x<w;x++) memcpy(&rgb[3*x],src+x*nb_channels,3);
+				ok = fwrite(&rgb[0],1,rgb.size(),out) == rgb.size();
+			}
+		}
+		fclose(out);
+		return ok;
+	}
+
+	inline std::vector<unsigned int> FrameCapture::crcTable() {
+		std::vector<unsigned int> table(256);
+		for(unsigned int n=0;n<256;n++) {
+			unsigned int c = n;
+			for(int k=0;k<8;k++) c = (c & 1) ? 0xEDB88320u^(c >> 1) : (c >> 1);
+			table[n] = c;
+		}
+		return table;
+	}
+
+	inline bool FrameCapture::writePNG(const char* filename,int w,int h,unsigned int nb_channels,const unsigned char* pixels) {
+		static const std::vector<unsigned int> crc_table = crcTable();
+		// Raw data : filter byte 0 then the row
+		const size_t row = size_t(w)*nb_channels;
+		std::vector<unsigned char> raw;
+		raw.reserve((row+1)*h);
+		for(int y=0;y<h;y++) {
+			raw.push_back(0);
+			raw.insert(raw.end(),pixels+y*row,pixels+(y+1)*row);
+		}
+		// zlib stream of stored blocks
+		std::vector<unsigned char> idat;
+		idat.reserve(raw.size()+raw.size()/65535*5+16);
+		idat.push_back('I');idat.push_back('D');idat.push_back('A');idat.push_back('T');
+		idat.push_back(0x78);idat.push_back(0x01);
+		unsigned int a = 1,b = 0;
+		for(size_t pos=0;pos<raw.size();) {
+			size_t lg = std::min(raw.size()-pos,size_t(65535));
+			idat.push_back(pos+lg == raw.size() ? 1 : 0);
+			idat.push_back(lg & 0xFF);idat.push_back(lg >> 8);
+			idat.push_back(~lg & 0xFF);idat.push_back((~lg >> 8) & 0xFF);
+			idat.insert(idat.end(),raw.begin()+pos,raw.begin()+pos+lg);
+			for(size_t i=pos;i<pos+lg;i++) {
+				a = (a+raw[i])%65521;
+				b = (b+a)%65521;
+			}
+			pos += lg;
+		}
+		pushBE32(idat,(b << 16) | a);
+
+		std::vector<unsigned char> ihdr;
+		ihdr.push_back('I');ihdr.push_back('H');ihdr.push_back('D');ihdr.push_back('R');
+		pushBE32(ihdr,w);
+		pushBE32(ihdr,h);
+		ihdr.push_back(8);
+		ihdr.push_back(nb_channels == 4 ? 6 : 2);
+		ihdr.push_back(0);ihdr.push_back(0);ihdr.push_back(0);
+
+		FILE* out = fopen(filename,"wb");
+		if (!out) {
+			std::cerr<<"Unable to write "<<filename<<std::endl;
+			return false;
+		}
+		static const unsigned char signature[8] = {0x89,'P','N','G','\r','\n',0x1A,'\n'};
+		static const unsigned char iend[4] = {'I','E','N','D'};
+		bool ok = fwrite(signature,1,8,out) == 8;
+		const std::vector<unsigned char>* chunks[3] = {&ihdr,&idat,NULL};
+		const std::vector<unsigned char> end(iend,iend+4);
+		chunks[2] = &end;
+		for(int c=0;c<3 && ok;c++) {
+			const std::vector<unsigned char>& data = *chunks[c];
+			std::vector<unsigned char> header;
+			pushBE32(header,data.size()-4);
+			unsigned int crc = 0xFFFFFFFFu;
+			for(size_t i=0;i<data.size();i++) crc = crc_table[(crc^data[i]) & 0xFF]^(crc >> 8);
+			std::vector<unsigned char> footer;
+			pushBE32(footer,crc^0xFFFFFFFFu);
+			ok = fwrite(&header[0],1,4,out) == 4 && fwrite(&data[0],1,data.size(),out) == data.size() &&
+			     fwrite(&footer[0],1,4,out) == 4;
+		}
+		fclose(out);
+		return ok;
+	}
+
+};
+
+#endif
@@ -0,0 +1,169 @@
+/***************************************************************************
+                         gl_ext.hpp  -  description
+                             -------------------
+    copyright            : (C) 2012 by Biri Venceslas
+    email                : biri@univ-mlv.fr
+ ***************************************************************************/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef _STP3D_GL_EXT_HPP_
+#define _STP3D_GL_EXT_HPP_
+
+#include <cstring>
+#include "gl_tools.hpp"
+
+// GL 4.1 / ARB_get_program_binary enums (not in the GL 4.0 glad header)
+#ifndef GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+#endif
+// KHR_parallel_shader_compile enums (same values for the ARB extension)
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_MAX_SHADER_COMPILER_THREADS_KHR 0x91B0
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+namespace STP3D {
+
+	/**
+	  * \brief Entry points newer than the GL 4.0 core profile loaded by glad.
+	  * glad is generated for GL 4.0 without extensions, so functions of later
+	  * versions (or of extensions) are fetched here with the same loader than
+	  * glad (typically glfwGetProcAddress). Every pointer is NULL when the
+	  * context does not support the feature, so callers MUST keep a 4.0 path.
+	  * Call GLExt::load once, after gladLoadGLLoader, with a current context.
+	  */
+	class GLExt {
+	public:
+		// GL 4.1 / ARB_separate_shader_objects
+		typedef void (APIENTRYP PFN_ProgramUniform1i)(GLuint,GLint,GLint);
+		typedef void (APIENTRYP PFN_ProgramUniform1f)(GLuint,GLint,GLfloat);
+		typedef void (APIENTRYP PFN_ProgramUniformfv)(GLuint,GLint,GLsizei,const GLfloat*);
+		typedef void (APIENTRYP PFN_ProgramUniformMatrix4fv)(GLuint,GLint,GLsizei,GLboolean,const GLfloat*);
+		// GL 4.1 / ARB_get_program_binary
+		typedef void (APIENTRYP PFN_GetProgramBinary)(GLuint,GLsizei,GLsizei*,GLenum*,void*);
+		typedef void (APIENTRYP PFN_ProgramBinary)(GLuint,GLenum,const void*,GLsizei);
+		typedef void (APIENTRYP PFN_ProgramParameteri)(GLuint,GLenum,GLint);
+		// KHR_parallel_shader_compile / ARB_parallel_shader_compile
+		typedef void (APIENTRYP PFN_MaxShaderCompilerThreads)(GLuint);
+		// GL 4.2 / ARB_base_instance
+		typedef void (APIENTRYP PFN_DrawArraysInstancedBaseInstance)(GLenum,GLint,GLsizei,GLsizei,GLuint);
+		typedef void (APIENTRYP PFN_DrawElementsInstancedBaseVertexBaseInstance)(GLenum,GLsizei,GLenum,const void*,GLsizei,GLint,GLuint);
+		// GL 4.3 / ARB_multi_draw_indirect
+		typedef void (APIENTRYP PFN_MultiDrawArraysIndirect)(GLenum,const void*,GLsizei,GLsizei);
+		typedef void (APIENTRYP PFN_MultiDrawElementsIndirect)(GLenum,GLenum,const void*,GLsizei,GLsizei);
+
+		struct Functions {
+			Functions() : ProgramUniform1i(NULL),ProgramUniform1f(NULL),ProgramUniform3fv(NULL),
+			              ProgramUniform4fv(NULL),ProgramUniformMatrix4fv(NULL),
+			              GetProgramBinary(NULL),ProgramBinary(NULL),ProgramParameteri(NULL),MaxShaderCompilerThreads(NULL),
+			              DrawArraysInstancedBaseInstance(NULL),DrawElementsInstancedBaseVertexBaseInstance(NULL),
+			              MultiDrawArraysIndirect(NULL),MultiDrawElementsIndirect(NULL) {}
+			PFN_ProgramUniform1i ProgramUniform1i;
+			PFN_ProgramUniform1f ProgramUniform1f;
+			PFN_ProgramUniformfv ProgramUniform3fv;
+			PFN_ProgramUniformfv ProgramUniform4fv;
+			PFN_ProgramUniformMatrix4fv ProgramUniformMatrix4fv;
+			PFN_GetProgramBinary GetProgramBinary;
+			PFN_ProgramBinary ProgramBinary;
+			PFN_ProgramParameteri ProgramParameteri;
+			PFN_MaxShaderCompilerThreads MaxShaderCompilerThreads;
+			PFN_DrawArraysInstancedBaseInstance DrawArraysInstancedBaseInstance;
+			PFN_DrawElementsInstancedBaseVertexBaseInstance DrawElementsInstancedBaseVertexBaseInstance;
+			PFN_MultiDrawArraysIndirect MultiDrawArraysIndirect;
+			PFN_MultiDrawElementsIndirect MultiDrawElementsIndirect;
+		};
+
+		/// Load all the entry points available in the current context
+		static void load(GLADloadproc loader);
+		/// The loaded entry points
+		static const Functions& fn() {return functions();}
+		/// True if glProgramUniform* can be used
+		static bool hasProgramUniform() {return fn().ProgramUniformMatrix4fv != NULL;}
+		/// True if linked programs can be saved and reloaded (glGetProgramBinary / glProgramBinary)
+		static bool hasProgramBinary() {return fn().GetProgramBinary != NULL && fn().ProgramBinary != NULL && fn().ProgramParameteri != NULL;}
+		/// True if the driver compiles and links in the background (GL_COMPLETION_STATUS_KHR can be queried)
+		static bool hasParallelShaderCompile() {return fn().MaxShaderCompilerThreads != NULL;}
+		/// True if draws can start at a given instance (glDraw*BaseInstance)
+		static bool hasBaseInstance() {return fn().DrawElementsInstancedBaseVertexBaseInstance != NULL && fn().DrawArraysInstancedBaseInstance != NULL;}
+		/// True if glMultiDraw*Indirect can be used
+		static bool hasMultiDrawIndirect() {return fn().MultiDrawElementsIndirect != NULL && fn().MultiDrawArraysIndirect != NULL;}
+
+		/// True if the current context version is at least major.minor
+		static bool hasVersion(int major,int minor);
+		/// True if the current context exposes the extension name
+		static bool hasExtension(const char* name);
+
+	private:
+		static Functions& functions() {static Functions f;return f;}
+		static void* get(GLADloadproc loader,const char* name,bool supported) {
+			return supported ? loader(name) : NULL;
+		}
+	};
+
+	inline bool GLExt::hasVersion(int major,int minor) {
+		GLint maj = 0,min = 0;
+		glGetIntegerv(GL_MAJOR_VERSION,&maj);
+		glGetIntegerv(GL_MINOR_VERSION,&min);
+		return (maj > major) || (maj == major && min >= minor);
+	}
+
+	inline bool GLExt::hasExtension(const char* name) {
+		GLint nb_ext = 0;
+		glGetIntegerv(GL_NUM_EXTENSIONS,&nb_ext);
+		for(GLint i=0;i<nb_ext;i++) {
+			const char* ext = (const char*)glGetStringi(GL_EXTENSIONS,i);
+			if (ext && strcmp(ext,name) == 0) return true;
+		}
+		return false;
+	}
+
+	inline void GLExt::load(GLADloadproc loader) {
+		Functions& f = functions();
+		f = Functions();
+		if (!loader) return;
+		// Some loaders return non NULL pointers for unsupported functions : check support first
+		bool sso = hasVersion(4,1) || hasExtension("GL_ARB_separate_shader_objects");
+		f.ProgramUniform1i = (PFN_ProgramUniform1i)get(loader,"glProgramUniform1i",sso);
+		f.ProgramUniform1f = (PFN_ProgramUniform1f)get(loader,"glProgramUniform1f",sso);
+		f.ProgramUniform3fv = (PFN_ProgramUniformfv)get(loader,"glProgramUniform3fv",sso);
+		f.ProgramUniform4fv = (PFN_ProgramUniformfv)get(loader,"glProgramUniform4fv",sso);
+		f.ProgramUniformMatrix4fv = (PFN_ProgramUniformMatrix4fv)get(loader,"glProgramUniformMatrix4fv",sso);
+		if (!f.ProgramUniform1i || !f.ProgramUniform1f || !f.ProgramUniform3fv || !f.ProgramUniform4fv) {
+			f.ProgramUniformMatrix4fv = NULL;
+		}
+		// Drivers may expose the functions with no binary format : then nothing can be saved
+		GLint nb_formats = 0;
+		bool binary = hasVersion(4,1) || hasExtension("GL_ARB_get_program_binary");
+		if (binary) glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS,&nb_formats);
+		binary = binary && nb_formats > 0;
+		f.GetProgramBinary = (PFN_GetProgramBinary)get(loader,"glGetProgramBinary",binary);
+		f.ProgramBinary = (PFN_ProgramBinary)get(loader,"glProgramBinary",binary);
+		f.ProgramParameteri = (PFN_ProgramParameteri)get(loader,"glProgramParameteri",binary);
+		if (hasExtension("GL_KHR_parallel_shader_compile")) {
+			f.MaxShaderCompilerThreads = (PFN_MaxShaderCompilerThreads)get(loader,"glMaxShaderCompilerThreadsKHR",true);
+		}
+		else if (hasExtension("GL_ARB_parallel_shader_compile")) {
+			f.MaxShaderCompilerThreads = (PFN_MaxShaderCompilerThreads)get(loader,"glMaxShaderCompilerThreadsARB",true);
+		}
+		bool base_instance = hasVersion(4,2) || hasExtension("GL_ARB_base_instance");
+		f.DrawArraysInstancedBaseInstance = (PFN_DrawArraysInstancedBaseInstance)get(loader,"glDrawArraysInstancedBaseInstance",base_instance);
+		f.DrawElementsInstancedBaseVertexBaseInstance = (PFN_DrawElementsInstancedBaseVertexBaseInstance)get(loader,"glDrawElementsInstancedBaseVertexBaseInstance",base_instance);
+		// The baseInstance field of indirect commands is only read with base instance support
+		bool mdi = base_instance && (hasVersion(4,3) || hasExtension("GL_ARB_multi_draw_indirect"));
+		f.MultiDrawArraysIndirect = (PFN_MultiDrawArraysIndirect)get(loader,"glMultiDrawArraysIndirect",mdi);
+		f.MultiDrawElementsIndirect = (PFN_MultiDrawElementsIndirect)get(loader,"glMultiDrawElementsIndirect",mdi);
+	}
+
+}
+
+#endif
@@ -0,0 +1,551 @@
+/***************************************************************************
+                        gl_state.hpp  -  description
+                             -------------------
+    copyright            : (C) 2012 by Biri Venceslas
+    email                : biri@univ-mlv.fr
+ ***************************************************************************/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef _STP3D_GL_STATE_HPP_
+#define _STP3D_GL_STATE_HPP_
+
+#include <iostream>
+#include <cstring>
+#include <map>
+#include <vector>
+#include <utility>
+#include "gl_tools.hpp"
+#include "gl_ext.hpp"
+
+namespace STP3D {
+
+	/**
+	  * \brief Shadow of the GL state used by STP3D and glbasimac.
+	  * GLState keeps a copy of the current program, VAO, buffer bindings,
+	  * texture units and of the uniform values of every program. Calls that
+	  * would not change the GL state are dropped.
+	  * Uniforms can be set on any program : they are sent with glProgramUniform*
+	  * when available (see GLExt), else they are kept and sent when the
+	  * program is next used. Hence no program switch is needed to set them.
+	  *
+	  * All the state changes of the library go through GLState. If an
+	  * application changes the state by itself, it has to call GLState::reset().
+	  * Note that the element buffer is part of the VAO state : since VAO are
+	  * not unbound after a draw anymore, binding an element buffer (or setting
+	  * attribute pointers) without binding its own VAO first changes the last
+	  * drawn mesh.
+	  *
+	  * In validation mode (setValidation(true) or STP3D_GL_STATE_VALIDATION
+	  * defined) every shadowed value is checked against the real GL state
+	  * before being used. Mismatches are reported on std::cerr and the shadow
+	  * is fixed.
+	  */
+	class GLState {
+	public:
+		/// Number of state changes sent to GL and dropped by the shadow
+		struct Stats {
+			Stats() {reset();}
+			void reset() {
+				programBinds = programBindsSkipped = 0;
+				vaoBinds = vaoBindsSkipped = 0;
+				bufferBinds = bufferBindsSkipped = 0;
+				textureBinds = textureBindsSkipped = 0;
+				uniformSets = uniformSetsSkipped = uniformsDeferred = 0;
+				validationErrors = 0;
+			}
+			unsigned long programBinds,programBindsSkipped;
+			unsigned long vaoBinds,vaoBindsSkipped;
+			unsigned long bufferBinds,bufferBindsSkipped;
+			unsigned long textureBinds,textureBindsSkipped;
+			/// Uniforms sent / dropped (same value) / waiting for their program to be used
+			unsigned long uniformSets,uniformSetsSkipped,uniformsDeferred;
+			unsigned long validationErrors;
+		};
+
+		/// Forget the whole shadow : next state changes will all be sent to GL
+		static void reset();
+		/// Check every shadowed value against GL before using it
+		static void setValidation(bool validate) {state().validation = validate;}
+		static bool isValidating() {return state().validation;}
+		/// Check the whole shadow against GL. Returns false (and reports) on mismatch.
+		static bool validate();
+		static Stats& stats() {return state().stats;}
+
+		/// Bindings
+		static void useProgram(GLuint program);
+		static GLuint currentProgram() {return state().program;}
+		static void bindVertexArray(GLuint vao);
+		static void bindBuffer(GLenum target,GLuint buffer);
+		/// Indexed bindings (uniform buffers). Also bind the buffer to target, as GL does.
+		static void bindBufferBase(GLenum target,GLuint index,GLuint buffer) {bindBufferRange(target,index,buffer,0,-1);}
+		static void bindBufferRange(GLenum target,GLuint index,GLuint buffer,GLintptr offset,GLsizeiptr size);
+		/// Select the texture unit (GL_TEXTURE0+i)
+		static void activeTexture(GLenum unit);
+		/// Bind a texture on the current texture unit
+		static void bindTexture(GLenum target,GLuint texture);
+		/// Bind a texture on the texture unit (GL_TEXTURE0+i)
+		static void bindTexture(GLenum unit,GLenum target,GLuint texture) {activeTexture(unit);bindTexture(target,texture);}
+		/// Texture bound on the texture unit (GL_TEXTURE0+i). Asked to GL (once) if unknown.
+		static GLuint boundTexture(GLenum unit,GLenum target);
+
+		/// Uniforms of any program (location -1 is ignored, as GL does)
+		static void uniform1i(GLuint program,GLint loc,GLint v) {setUniform(program,loc,UniInt,1,&v);}
+		static void uniform1f(GLuint program,GLint loc,GLfloat v) {setUniform(program,loc,UniFloat,1,&v);}
+		static void uniform3fv(GLuint program,GLint loc,GLsizei count,const GLfloat* v) {setUniform(program,loc,UniVec3,count,v);}
+		static void uniform4fv(GLuint program,GLint loc,GLsizei count,const GLfloat* v) {setUniform(program,loc,UniVec4,count,v);}
+		static void uniformMatrix4fv(GLuint program,GLint loc,const GLfloat* v) {setUniform(program,loc,UniMat4,1,v);}
+
+		/// Object deletion (keeps the shadow coherent)
+		static void deleteProgram(GLuint program);
+		static void deleteVertexArrays(GLsizei n,const GLuint* vaos);
+		static void deleteBuffers(GLsizei n,const GLuint* buffers);
+		static void deleteTextures(GLsizei n,const GLuint* textures);
+
+	private:
+		enum UniformType {UniInt,UniFloat,UniVec3,UniVec4,UniMat4};
+		static const GLuint UNKNOWN = 0xFFFFFFFFu;
+
+		struct UniformValue {
+			UniformValue() : type(UniInt),count(0),dirty(false) {}
+			UniformType type;
+			GLsizei count;
+			std::vector<unsigned char> data;
+			bool dirty;
+		};
+		struct ProgramUniforms {
+			std::map<GLint,UniformValue> values;
+			/// Locations set while the program was not in use (without glProgramUniform)
+			std::vector<GLint> pending;
+		};
+		struct IndexedBinding {
+			GLuint buffer;
+			GLintptr offset;
+			/// -1 : whole buffer (glBindBufferBase)
+			GLsizeiptr size;
+		};
+		struct State {
+			State() : validation(false) {
+#ifdef STP3D_GL_STATE_VALIDATION
+				validation = true;
+#endif
+				forget();
+			}
+			void forget() {
+				program = vao = UNKNOWN;
+				activeUnit = 0;
+				buffers.clear();
+				elementBuffers.clear();
+				indexedBuffers.clear();
+				textures.clear();
+			}
+			GLuint program;
+			GLuint vao;
+			/// Bindings of the buffer targets that are not VAO state. Missing : unknown
+			std::map<GLenum,GLuint> buffers;
+			/// Element buffer of each VAO. Missing : unknown
+			std::map<GLuint,GLuint> elementBuffers;
+			/// Indexed bindings of each (target,index). Missing : unknown
+			std::map<std::pair<GLenum,GLuint>,IndexedBinding> indexedBuffers;
+			/// Current texture unit (0 : unknown)
+			GLenum activeUnit;
+			/// Texture bound to each (unit,target). Missing : unknown
+			std::map<std::pair<GLenum,GLenum>,GLuint> textures;
+			std::map<GLuint,ProgramUniforms> uniforms;
+			bool validation;
+			Stats stats;
+		};
+
+		static State& state() {static State s;return s;}
+		static unsigned int uniformSize(UniformType type);
+		static void setUniform(GLuint program,GLint loc,UniformType type,GLsizei count,const void* v);
+		static void sendUniform(GLuint program,GLint loc,const UniformValue& u,bool program_in_use);
+		static GLenum bufferBindingQuery(GLenum target);
+		static GLenum textureBindingQuery(GLenum target);
+		static bool check(const char* what,GLenum pname,GLuint& shadow);
+	};
+
+	inline std::ostream& operator<<(std::ostream& os,const GLState::Stats& st) {
+		os<<"Program binds : "<<st.programBinds<<" (skipped "<<st.programBindsSkipped<<")"<<std::endl;
+		os<<"VAO binds     : "<<st.vaoBinds<<" (skipped "<<st.vaoBindsSkipped<<")"<<std::endl;
+		os<<"Buffer binds  : "<<st.bufferBinds<<" (skipped "<<st.bufferBindsSkipped<<")"<<std::endl;
+		os<<"Texture binds : "<<st.textureBinds<<" (skipped "<<st.textureBindsSkipped<<")"<<std::endl;
+		os<<"Uniforms      : "<<st.uniformSets<<" (skipped "<<st.uniformSetsSkipped;
+		os<<", deferred "<<st.uniformsDeferred<<")"<<std::endl;
+		if (st.validationErrors) os<<"Shadow errors : "<<st.validationErrors<<std::endl;
+		return os;
+	}
+
+	inline void GLState::reset() {
+		State& s = state();
+		s.forget();
+		// Uniform values stay in the programs : only forget the ones already sent
+		std::map<GLuint,ProgramUniforms>::iterator it;
+		for(it=s.uniforms.begin();it!=s.uniforms.end();++it) {
+			std::map<GLint,UniformValue>& values = it->second.values;
+			std::map<GLint,UniformValue>::iterator u = values.begin();
+			while(u != values.end()) {
+				if (u->second.dirty) ++u;
+				else values.erase(u++);
+			}
+		}
+	}
+
+	inline bool GLState::check(const char* what,GLenum pname,GLuint& shadow) {
+		if (shadow == UNKNOWN) return true;
+		GLint real = 0;
+		glGetIntegerv(pname,&real);
+		if ((GLuint)real == shadow) return true;
+		std::cerr<<"GLState : shadow of "<<what<<" is "<<shadow<<" but GL has "<<real<<std::endl;
+		STP3D::setError(std::string("GLState : shadow of ")+what+" differs from GL state");
+		state().stats.validationErrors++;
+		shadow = (GLuint)real;
+		return false;
+	}
+
+	inline GLenum GLState::bufferBindingQuery(GLenum target) {
+		switch(target) {
+			case GL_ARRAY_BUFFER : return GL_ARRAY_BUFFER_BINDING;
+			case GL_ELEMENT_ARRAY_BUFFER : return GL_ELEMENT_ARRAY_BUFFER_BINDING;
+			case GL_UNIFORM_BUFFER : return GL_UNIFORM_BUFFER_BINDING;
+			case GL_PIXEL_PACK_BUFFER : return GL_PIXEL_PACK_BUFFER_BINDING;
+			case GL_PIXEL_UNPACK_BUFFER : return GL_PIXEL_UNPACK_BUFFER_BINDING;
+			case GL_DRAW_INDIRECT_BUFFER : return GL_DRAW_INDIRECT_BUFFER_BINDING;
+			// The binding queries of the copy targets are the targets themselves
+			case GL_COPY_READ_BUFFER : return GL_COPY_READ_BUFFER;
+			case GL_COPY_WRITE_BUFFER : return GL_COPY_WRITE_BUFFER;
+			default : return 0;
+		}
+	}
+
+	inline GLenum GLState::textureBindingQuery(GLenum target) {
+		switch(target) {
+			case GL_TEXTURE_2D : return GL_TEXTURE_BINDING_2D;
+			case GL_TEXTURE_2D_ARRAY : return GL_TEXTURE_BINDING_2D_ARRAY;
+			case GL_TEXTURE_CUBE_MAP : return GL_TEXTURE_BINDING_CUBE_MAP;
+			case GL_TEXTURE_BUFFER : return GL_TEXTURE_BINDING_BUFFER;
+			default : return 0;
+		}
+	}
+
+	inline void GLState::useProgram(GLuint program) {
+		State& s = state();
+		if (s.validation) check("program",GL_CURRENT_PROGRAM,s.program);
+		if (s.program == program) {
+			s.stats.programBindsSkipped++;
+		}
+		else {
+			glUseProgram(program);
+			s.program = program;
+			s.stats.programBinds++;
+		}
+		// Send the uniforms set while the program was not in use
+		std::map<GLuint,ProgramUniforms>::iterator it = s.uniforms.find(program);
+		if (it == s.uniforms.end() || it->second.pending.empty()) return;
+		ProgramUniforms& pu = it->second;
+		for(unsigned int i=0;i<pu.pending.size();i++) {
+			UniformValue& u = pu.values[pu.pending[i]];
+			if (!u.dirty) continue;
+			sendUniform(program,pu.pending[i],u,true);
+			u.dirty = false;
+		}
+		pu.pending.clear();
+	}
+
+	inline void GLState::bindVertexArray(GLuint vao) {
+		State& s = state();
+		if (s.validation) check("vertex array",GL_VERTEX_ARRAY_BINDING,s.vao);
+		if (s.vao == vao) {
+			s.stats.vaoBindsSkipped++;
+			return;
+		}
+		glBindVertexArray(vao);
+		s.vao = vao;
+		s.stats.vaoBinds++;
+	}
+
+	inline void GLState::bindBuffer(GLenum target,GLuint buffer) {
+		State& s = state();
+		GLuint* shadow = NULL;
+		if (target == GL_ELEMENT_ARRAY_BUFFER) {
+			// Element buffer binding is stored in the VAO
+			if (s.vao != UNKNOWN) {
+				std::map<GLuint,GLuint>::iterator it = s.elementBuffers.find(s.vao);
+				if (it != s.elementBuffers.end()) shadow = &(it->second);
+			}
+		}
+		else {
+			std::map<GLenum,GLuint>::iterator it = s.buffers.find(target);
+			if (it != s.buffers.end()) shadow = &(it->second);
+		}
+		if (shadow && s.validation && bufferBindingQuery(target)) {
+			check("buffer binding",bufferBindingQuery(target),*shadow);
+		}
+		if (shadow && *shadow == buffer) {
+			s.stats.bufferBindsSkipped++;
+			return;
+		}
+		glBindBuffer(target,buffer);
+		s.stats.bufferBinds++;
+		if (shadow) *shadow = buffer;
+		else if (target != GL_ELEMENT_ARRAY_BUFFER) s.buffers[target] = buffer;
+		else if (s.vao != UNKNOWN) s.elementBuffers[s.vao] = buffer;
+	}
+
+	inline void GLState::bindBufferRange(GLenum target,GLuint index,GLuint buffer,GLintptr offset,GLsizeiptr size) {
+		State& s = state();
+		std::pair<GLenum,GLuint> key(target,index);
+		std::map<std::pair<GLenum,GLuint>,IndexedBinding>::iterator it = s.indexedBuffers.find(key);
+		if (it != s.indexedBuffers.end()) {
+			if (s.validation && bufferBindingQuery(target)) {
+				GLint real = 0;
+				glGetIntegeri_v(bufferBindingQuery(target),index,&real);
+				if ((GLuint)real != it->second.buffer) {
+					std::cerr<<"GLState : shadow of indexed binding "<<index<<" is "<<it->second.buffer<<" but GL has "<<real<<std::endl;
+					s.stats.validationErrors++;
+					it->second.buffer = (GLuint)real;
+				}
+			}
+			const IndexedBinding& b = it->second;
+			if (b.buffer == buffer && b.offset == offset && b.size == size) {
+				s.stats.bufferBindsSkipped++;
+				return;
+			}
+		}
+		if (size < 0) glBindBufferBase(target,index,buffer);
+		else glBindBufferRange(target,index,buffer,offset,size);
+		IndexedBinding b = {buffer,offset,size};
+		s.indexedBuffers[key] = b;
+		s.buffers[target] = buffer;
+		s.stats.bufferBinds++;
+	}
+
+	inline void GLState::activeTexture(GLenum unit) {
+		State& s = state();
+		if (s.validation && s.activeUnit) {
+			GLuint shadow = s.activeUnit;
+			if (!check("active texture",GL_ACTIVE_TEXTURE,shadow)) s.activeUnit = shadow;
+		}
+		if (s.activeUnit == unit) return;
+		glActiveTexture(unit);
+		s.activeUnit = unit;
+	}
+
+	inline void GLState::bindTexture(GLenum target,GLuint texture) {
+		State& s = state();
+		if (s.activeUnit == 0) {
+			// Unknown unit : find which one is active
+			GLint unit = GL_TEXTURE0;
+			glGetIntegerv(GL_ACTIVE_TEXTURE,&unit);
+			s.activeUnit = (GLenum)unit;
+		}
+		std::pair<GLenum,GLenum> key(s.activeUnit,target);
+		std::map<std::pair<GLenum,GLenum>,GLuint>::iterator it = s.textures.find(key);
+		if (it != s.textures.end()) {
+			if (s.validation && textureBindingQuery(target)) {
+				check("texture binding",textureBindingQuery(target),it->second);
+			}
+			if (it->second == texture) {
+				s.stats.textureBindsSkipped++;
+				return;
+			}
+		}
+		glBindTexture(target,texture);
+		s.textures[key] = texture;
+		s.stats.textureBinds++;
+	}
+
+	inline GLuint GLState::boundTexture(GLenum unit,GLenum target) {
+		State& s = state();
+		std::map<std::pair<GLenum,GLenum>,GLuint>::iterator it = s.textures.find(std::make_pair(unit,target));
+		if (it != s.textures.end()) return it->second;
+		GLint texture = 0;
+		if (textureBindingQuery(target)) {
+			activeTexture(unit);
+			glGetIntegerv(textureBindingQuery(target),&texture);
+			s.textures[std::make_pair(unit,target)] = (GLuint)texture;
+		}
+		return (GLuint)texture;
+	}
+
+	inline unsigned int GLState::uniformSize(UniformType type) {
+		switch(type) {
+			case UniInt : return sizeof(GLint);
+			case UniFloat : return sizeof(GLfloat);
+			case UniVec3 : return 3*sizeof(GLfloat);
+			case UniVec4 : return 4*sizeof(GLfloat);
+			default : return 16*sizeof(GLfloat);
+		}
+	}
+
+	inline void GLState::setUniform(GLuint program,GLint loc,UniformType type,GLsizei count,const void* v) {
+		if (loc < 0) return;
+		State& s = state();
+		ProgramUniforms& pu = s.uniforms[program];
+		UniformValue& u = pu.values[loc];
+		unsigned int size = count*uniformSize(type);
+		if (u.count == count && u.type == type && memcmp(&(u.data[0]),v,size) == 0) {
+			s.stats.uniformSetsSkipped++;
+			return;
+		}
+		u.type = type;
+		u.count = count;
+		u.data.assign((const unsigned char*)v,(const unsigned char*)v+size);
+		if (s.validation) check("program",GL_CURRENT_PROGRAM,s.program);
+		bool in_use = (s.program == program);
+		if (in_use || GLExt::hasProgramUniform()) {
+			sendUniform(program,loc,u,in_use);
+			u.dirty = false;
+			s.stats.uniformSets++;
+		}
+		else if (!u.dirty) {
+			u.dirty = true;
+			pu.pending.push_back(loc);
+			s.stats.uniformsDeferred++;
+		}
+	}
+
+	inline void GLState::sendUniform(GLuint program,GLint loc,const UniformValue& u,bool program_in_use) {
+		const GLfloat* f = (const GLfloat*)&(u.data[0]);
+		if (program_in_use) {
+			switch(u.type) {
+				case UniInt : glUniform1i(loc,*(const GLint*)&(u.data[0]));break;
+				case UniFloat : glUniform1f(loc,*f);break;
+				case UniVec3 : glUniform3fv(loc,u.count,f);break;
+				case UniVec4 : glUniform4fv(loc,u.count,f);break;
+				case UniMat4 : glUniformMatrix4fv(loc,u.count,GL_FALSE,f);break;
+			}
+			return;
+		}
+		const GLExt::Functions& ext = GLExt::fn();
+		switch(u.type) {
+			case UniInt : ext.ProgramUniform1i(program,loc,*(const GLint*)&(u.data[0]));break;
+			case UniFloat : ext.ProgramUniform1f(program,loc,*f);break;
+			case UniVec3 : ext.ProgramUniform3fv(program,loc,u.count,f);break;
+			case UniVec4 : ext.ProgramUniform4fv(program,loc,u.count,f);break;
+			case UniMat4 : ext.ProgramUniformMatrix4fv(program,loc,u.count,GL_FALSE,f);break;
+		}
+	}
+
+	inline void GLState::deleteProgram(GLuint program) {
+		State& s = state();
+		s.uniforms.erase(program);
+		// A program in use is only flagged for deletion : its id may still be current
+		if (s.program == program) s.program = UNKNOWN;
+		glDeleteProgram(program);
+	}
+
+	inline void GLState::deleteVertexArrays(GLsizei n,const GLuint* vaos) {
+		State& s = state();
+		for(GLsizei i=0;i<n;i++) {
+			if (vaos[i] == 0) continue;
+			if (s.vao == vaos[i]) s.vao = 0;
+			s.elementBuffers.erase(vaos[i]);
+		}
+		glDeleteVertexArrays(n,vaos);
+	}
+
+	inline void GLState::deleteBuffers(GLsizei n,const GLuint* buffers) {
+		State& s = state();
+		for(GLsizei i=0;i<n;i++) {
+			if (buffers[i] == 0) continue;
+			std::map<GLenum,GLuint>::iterator it;
+			for(it=s.buffers.begin();it!=s.buffers.end();++it) {
+				if (it->second == buffers[i]) it->second = 0;
+			}
+			std::map<std::pair<GLenum,GLuint>,IndexedBinding>::iterator ib;
+			for(ib=s.indexedBuffers.begin();ib!=s.indexedBuffers.end();++ib) {
+				if (ib->second.buffer == buffers[i]) ib->second.buffer = 0;
+			}
+			// Only the bound VAO loses its reference to the buffer
+			std::map<GLuint,GLuint>::iterator e = s.elementBuffers.begin();
+			while(e != s.elementBuffers.end()) {
+				if (e->second != buffers[i]) ++e;
+				else if (e->first == s.vao) {e->second = 0;++e;}
+				else s.elementBuffers.erase(e++);
+			}
+		}
+		glDeleteBuffers(n,buffers);
+	}
+
+	inline void GLState::deleteTextures(GLsizei n,const GLuint* textures) {
+		State& s = state();
+		for(GLsizei i=0;i<n;i++) {
+			if (textures[i] == 0) continue;
+			std::map<std::pair<GLenum,GLenum>,GLuint>::iterator it;
+			for(it=s.textures.begin();it!=s.textures.end();++it) {
+				if (it->second == textures[i]) it->second = 0;
+			}
+		}
+		glDeleteTextures(n,textures);
+	}
+
+	inline bool GLState::validate() {
+		State& s = state();
+		unsigned long errors = s.stats.validationErrors;
+		check("program",GL_CURRENT_PROGRAM,s.program);
+		check("vertex array",GL_VERTEX_ARRAY_BINDING,s.vao);
+		std::map<GLenum,GLuint>::iterator b;
+		for(b=s.buffers.begin();b!=s.buffers.end();++b) {
+			if (bufferBindingQuery(b->first)) check("buffer binding",bufferBindingQuery(b->first),b->second);
+		}
+		if (s.vao != UNKNOWN) {
+			std::map<GLuint,GLuint>::iterator e = s.elementBuffers.find(s.vao);
+			if (e != s.elementBuffers.end()) check("element buffer",GL_ELEMENT_ARRAY_BUFFER_BINDING,e->second);
+		}
+		// Texture units : select each unit, then come back
+		GLint active = GL_TEXTURE0;
+		glGetIntegerv(GL_ACTIVE_TEXTURE,&active);
+		if (s.activeUnit) {
+			GLuint shadow = s.activeUnit;
+			check("active texture",GL_ACTIVE_TEXTURE,shadow);
+		}
+		std::map<std::pair<GLenum,GLenum>,GLuint>::iterator t;
+		for(t=s.textures.begin();t!=s.textures.end();++t) {
+			if (!textureBindingQuery(t->first.second)) continue;
+			glActiveTexture(t->first.first);
+			check("texture binding",textureBindingQuery(t->first.second),t->second);
+		}
+		glActiveTexture(active);
+		s.activeUnit = active;
+		// Uniforms of the program in use (first element of arrays)
+		if (s.program != UNKNOWN && s.program != 0) {
+			std::map<GLuint,ProgramUniforms>::iterator it = s.uniforms.find(s.program);
+			if (it != s.uniforms.end()) {
+				std::map<GLint,UniformValue>::iterator u;
+				for(u=it->second.values.begin();u!=it->second.values.end();++u) {
+					if (u->second.dirty) continue;
+					unsigned int nb = uniformSize(u->second.type)/sizeof(GLfloat);
+					GLfloat real[16];
+					bool same;
+					if (u->second.type == UniInt) {
+						GLint ireal = 0;
+						glGetUniformiv(s.program,u->first,&ireal);
+						same = (ireal == *(const GLint*)&(u->second.data[0]));
+					}
+					else {
+						glGetUniformfv(s.program,u->first,real);
+						same = (memcmp(real,&(u->second.data[0]),nb*sizeof(GLfloat)) == 0);
+					}
+					if (!same) {
+						std::cerr<<"GLState : shadow of uniform "<<u->first<<" of program "<<s.program<<" differs from GL"<<std::endl;
+						s.stats.validationErrors++;
+						// Send it again at next set
+						u->second.count = 0;
+					}
+				}
+			}
+		}
+		return errors == s.stats.validationErrors;
+	}
+
+}
+
+#endif
@@ -87,6 +87,7 @@ inline void checkGL(int line, const char *filename) {
   */
 class GLTools {
 public: 
+	/// Blocking read of the framebuffer (waits for the GPU). To capture every frame, see FrameCapture (frame_capture.hpp)
 	static void takeSnapshot(int w,int h,unsigned char *image_data,unsigned int nb_channel = 3);
 };
 
@@ -20,23 +20,60 @@
 
 #include <iostream>
 #include <vector>
+#include <algorithm>
+#include <cmath>
 #include "globals.hpp"
+#include "gl_state.hpp"
+#include "instance_buffer.hpp"
+#include "vertex_layout.hpp"
+#include "profiler.hpp"
 
 
 namespace STP3D {
 
+	class MultiDrawBatch;
+	class IndexedMesh;
+
+	/**
+	  * \brief GL buffers shared by several indexed meshes (see BufferArena).
+	  * The createVAO of a mesh given to IndexedMesh::setSharedBuffers stores the mesh in them :
+	  * its VAO is the shared one, and it is drawn from its ranges with a base vertex.
+	  */
+	class SharedMeshBuffers {
+	public:
+		virtual ~SharedMeshBuffers() {};
+		/// Copy the CPU data of \param mesh in the buffers (done by createVAO)
+		virtual bool storeMesh(IndexedMesh& mesh) = 0;
+		/// Free the ranges of \param mesh (releaseGPUMemory or destruction of the mesh). No GL call.
+		virtual void releaseMesh(IndexedMesh& mesh) = 0;
+		/// Instance buffer the instance attributes of the shared VAO use (0 : none)
+		virtual unsigned int& instanceSerial() = 0;
+	};
+
+	/// Level of detail of an IndexedMesh : a range of its GL index buffer
+	struct MeshLOD {
+		MeshLOD(unsigned int first = 0,unsigned int nb = 0,float err = 0.0f) : first_index(first),nb_indices(nb),error(err) {}
+		unsigned int first_index;
+		unsigned int nb_indices;
+		/// Distance to the full mesh, in the units of the positions
+		float error;
+	};
+
 	/**
 	  * \class IndexedMesh allows to store generic informations about an indexed mesh.
 	  * IndexedMesh class allows to store several float buffer to use with a GL shaders in
 	  * an indexed way. Such buffers are not interleaved and each has a semantic on his own. 
 	  * Note that an indexed mesh MUST have at least one buffer of coordinates.
-	  * This class allows also the creation of the corresponding VBO.
+	  * This class allows also the creation of the corresponding VBO, one per
+	  * buffer or interleaved and packed as given by a VertexLayout.
 	  * This class may or may not store the data.
 	  */
 	class IndexedMesh {
 	public:
 		/// Standard construtor. Creates an empty mesh withouh any information.
-		IndexedMesh(unsigned int n_prim = 0,unsigned int elts = 0,unsigned int new_gl_type = GL_TRIANGLES) : id_vao(0) {
+		IndexedMesh(unsigned int n_prim = 0,unsigned int elts = 0,unsigned int new_gl_type = GL_TRIANGLES) : id_vao(0),instance_serial(0),quantized(false),
+		                                                                                                      bounding_radius(0.0f),shared_buffers(NULL),shared_first_index(0),
+		                                                                                                      shared_base_vertex(0),shared_id(0) {
 			buffers.clear();
 			size_one_elt.clear();
 			attr_id.clear();
@@ -79,6 +116,24 @@ namespace STP3D {
 		std::vector<unsigned int> vbo_id;
 		/// Id of the corresponding VAO
 		unsigned int id_vao;
+		/// Instance buffer the instance attributes of the VAO use (0 : none)
+		unsigned int instance_serial;
+		/// Layout of the VBO and dequantization matrix of the positions
+		VertexLayout layout;
+		Matrix4D dequant_matrix;
+		bool quantized;
+		/// Levels of detail after the full mesh (level 0), coarser and coarser.
+		/// Their indices follow the ones of the mesh in the GL index buffer.
+		std::vector<MeshLOD> lods;
+		std::vector<unsigned int> lod_indices;
+		/// Distance of the farthest position to the origin of the mesh (set by the first addLOD)
+		float bounding_radius;
+		/// Shared buffers of the mesh (NULL : its own VAO and VBOs), its first index in the shared
+		/// index buffer, the index of its first vertex in the shared VBOs and its id there
+		SharedMeshBuffers* shared_buffers;
+		unsigned int shared_first_index;
+		int shared_base_vertex;
+		unsigned int shared_id;
 
 		/// Set the number of elements in each buffers
 		void setNbElt(unsigned int elts) {nb_elts = elts;};
@@ -87,12 +142,48 @@ namespace STP3D {
 		void addOneBuffer(unsigned int id_attribute,unsigned int one_elt_size,
 		                  float* data,std::string semantic="",bool copy=false);
 		void releaseCPUMemory();
+		/// Add a coarser level of detail (before createVAO) : \param nb_indices indices of the same
+		/// vertices, at \param error of the full mesh. See MeshSimplifier.
+		/// \return false (nothing added) without CPU positions (attribute 0) for the bounding radius
+		bool addLOD(const unsigned int* indices,unsigned int nb_indices,float error);
+		void clearLODs() {lods.clear();lod_indices.clear();};
+		/// Number of levels of detail, the full mesh included
+		unsigned int getNbLODs() const {return lods.size()+1;};
+		float getLODError(unsigned int level) const {return (level == 0 || level > lods.size()) ? 0.0f : lods[level-1].error;};
+		unsigned int getLODIndices(unsigned int level) const {
+			return (level == 0 || level > lods.size()) ? nb_primitive*nb_idx_per_primitive : lods[level-1].nb_indices;
+		};
+		float getBoundingRadius() const {return bounding_radius;};
 		/*****************************************************************
 		 *                      GL RELATED FUNCTIONS
 		 *****************************************************************/
 		void changeType(unsigned int new_gl_type) {gl_type_mesh = new_gl_type;};
+		/// Layout of the VBO made by the next createVAO (default : one VBO of floats per buffer)
+		void setVertexLayout(const VertexLayout& new_layout) {layout = new_layout;};
+		const VertexLayout& getVertexLayout() const {return layout;};
+		/// Bytes of one vertex in GL
+		unsigned int getBytesPerVertex() const {return layout.vertexSize(attr_id,size_one_elt);};
+		/// True if the positions are quantized : getDequantization() must be composed with the modelview matrix
+		bool hasDequantization() const {return quantized;};
+		const Matrix4D& getDequantization() const {return dequant_matrix;};
 		bool createVAO();
-		void draw();
+		/// Store the mesh in \param shared (see BufferArena) at the next createVAO instead of its own VBOs
+		void setSharedBuffers(SharedMeshBuffers* shared) {shared_buffers = shared;};
+		/// Delete the VAO and the VBOs (the CPU data stays : createVAO can be called again)
+		void releaseGPUMemory();
+		bool isOnGPU() const {return id_vao != 0;};
+		/// True if the buffers and the indices are in CPU memory (createVAO is possible)
+		bool hasCPUData() const {return index_buffer != NULL && !buffers.empty() && buffers[0] != NULL;};
+		/// Bytes of the VBOs and of the index buffer (levels of detail included)
+		size_t getGPUBytes() const;
+		/// Draw the level of detail \param lod (0 : full mesh)
+		void draw(unsigned int lod = 0);
+		/// Draw one copy of the mesh per instance of \param instances (with an instanced shader)
+		void drawInstanced(InstanceBuffer& instances,unsigned int lod = 0);
+		/// A batch copies the CPU data of its meshes
+		friend class MultiDrawBatch;
+		/// Mesh files are written from the CPU data and loaded without copy
+		friend class MeshFile;
 
 	private:
 		unsigned int nb_idx_per_primitive;
@@ -107,6 +198,7 @@ namespace STP3D {
 			}
 		}
 		if (index_buffer) delete[](index_buffer);
+		if (shared_buffers && id_vao) shared_buffers->releaseMesh(*this);
 	}
 
 	inline unsigned int IndexedMesh::getNbIdxPerPrimitive() {
@@ -119,52 +211,45 @@ namespace STP3D {
 
 
 	inline bool IndexedMesh::createVAO() {
+		STP3D_PROFILE_ZONE("IndexedMesh::createVAO");
+		if (shared_buffers) return shared_buffers->storeMesh(*this);
 		// Create and use the VAO
 		glGenVertexArrays(1,&id_vao);
+		instance_serial = 0;
 		if (id_vao == 0) {
 			STP3D::setError("Unable to find a value for a VAO");
 			return false;
 		}
-		glBindVertexArray(id_vao);
+		GLState::bindVertexArray(id_vao);
 
 		// Check if mesh is defined
 		if (buffers.size()==0) {
 			STP3D::setError("Impossible to create VBO from empty buffers. This mesh has not been initialized");
 		}
 
-		// Create all VBO (and check)
-		vbo_id.resize(buffers.size());
-		unsigned int* new_id = new unsigned int[buffers.size()];
-		glGenBuffers(buffers.size(),new_id);
-		for(unsigned int i=0;i<buffers.size();++i) {
-			if (new_id[i]==0) {STP3D::setError("Unable to find an empty VBO");return false;}
-			vbo_id[i]=new_id[i];
-		}
-		delete[](new_id);
+		// Create all VBO (and check) and transfer all data from CPU to GPU (packed as the layout says)
+		if (!layout.createBuffers(nb_elts,attr_id,size_one_elt,buffers,vbo_id,dequant_matrix)) return false;
+		quantized = (MatrixStack::classify(dequant_matrix) != TransfoIdentity);
 
 		// Create the index VBO (and check)
 		glGenBuffers(1,&id_index);
 		if (id_index==0) {STP3D::setError("Unable to find an empty VBO for index buffer");return false;}
 
-
-		// Transfer all data for all VBO from CPU to GPU
-		for(std::vector<int>::size_type i = 0; i < buffers.size(); ++i) {
-			glEnableVertexAttribArray(attr_id[i]);
-
-			glBindBuffer(GL_ARRAY_BUFFER,vbo_id[i]);
-
-			glBufferData(GL_ARRAY_BUFFER,nb_elts*size_one_elt[i]*sizeof(GLfloat),buffers[i],GL_STATIC_DRAW);
-
-			glVertexAttribPointer(attr_id[i], size_one_elt[i], GL_FLOAT, GL_FALSE, 0, 0);
-
-			glBindBuffer(GL_ARRAY_BUFFER,0);
+		// Transfer index data VBO from CPU to GPU.
+		// The index buffer stays bound : it is recorded in the VAO.
+		GLState::bindBuffer(GL_ELEMENT_ARRAY_BUFFER,id_index);
+		size_t mesh_size = nb_idx_per_primitive*nb_primitive*sizeof(unsigned int);
+		if (lod_indices.empty()) {
+			glBufferData(GL_ELEMENT_ARRAY_BUFFER,mesh_size,index_buffer,GL_STATIC_DRAW);
+		}
+		else {
+			// Levels of detail after the mesh
+			glBufferData(GL_ELEMENT_ARRAY_BUFFER,mesh_size+lod_indices.size()*sizeof(unsigned int),NULL,GL_STATIC_DRAW);
+			glBufferSubData(GL_ELEMENT_ARRAY_BUFFER,0,mesh_size,index_buffer);
+			glBufferSubData(GL_ELEMENT_ARRAY_BUFFER,mesh_size,lod_indices.size()*sizeof(unsigned int),&lod_indices[0]);
 		}
-		// Transfer index data VBO from CPU to GPU
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,id_index);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER,nb_idx_per_primitive*nb_primitive*sizeof(unsigned int),index_buffer,GL_STATIC_DRAW);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,0);
 
-		glBindVertexArray(0);
+		GLState::bindVertexArray(0);
 		return true;
 	}
 
@@ -191,13 +276,85 @@ namespace STP3D {
 		attr_semantic.push_back(semantic);
 	}
 
-	inline void IndexedMesh::draw() {
-		glBindVertexArray(id_vao);
+	inline void IndexedMesh::releaseGPUMemory() {
+		if (shared_buffers) {
+			// The shared buffers and VAO stay
+			if (id_vao) shared_buffers->releaseMesh(*this);
+			id_vao = 0;
+			return;
+		}
+		if (!vbo_id.empty()) GLState::deleteBuffers(vbo_id.size(),&(vbo_id[0]));
+		vbo_id.clear();
+		if (id_index) GLState::deleteBuffers(1,&id_index);
+		id_index = 0;
+		if (id_vao) GLState::deleteVertexArrays(1,&id_vao);
+		id_vao = 0;
+		instance_serial = 0;
+	}
 
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,id_index);
-		glDrawElements(gl_type_mesh,nb_primitive*nb_idx_per_primitive,GL_UNSIGNED_INT,0);
+	inline size_t IndexedMesh::getGPUBytes() const {
+		size_t nb_indices = size_t(nb_primitive)*nb_idx_per_primitive;
+		for(unsigned int l=0;l<lods.size();l++) nb_indices += lods[l].nb_indices;
+		return size_t(nb_elts)*getBytesPerVertex()+nb_indices*sizeof(unsigned int);
+	}
 
-		glBindVertexArray(0);
+	inline bool IndexedMesh::addLOD(const unsigned int* indices,unsigned int nb_indices,float error) {
+		if (lods.empty()) {
+			// The level is selected from the nearest point of the mesh (positions : attribute 0)
+			unsigned int pos = attr_id.size();
+			for(unsigned int i=0;i<attr_id.size();i++) {
+				if (attr_id[i] == 0) {pos = i;break;}
+			}
+			if (pos == attr_id.size() || !buffers[pos]) {
+				STP3D::setError("addLOD : no CPU positions (attribute 0) for the bounding radius");
+				return false;
+			}
+			unsigned int dim = std::min(size_one_elt[pos],3u);
+			float radius = 0.0f;
+			for(unsigned int v=0;v<nb_elts;v++) {
+				const float* p = buffers[pos]+size_t(v)*size_one_elt[pos];
+				float d = 0.0f;
+				for(unsigned int c=0;c<dim;c++) d += p[c]*p[c];
+				radius = std::max(radius,d);
+			}
+			bounding_radius = sqrtf(radius);
+		}
+		lods.push_back(MeshLOD(nb_primitive*nb_idx_per_primitive+lod_indices.size(),nb_indices,error));
+		lod_indices.insert(lod_indices.end(),indices,indices+nb_indices);
+		return true;
+	}
+
+	inline void IndexedMesh::draw(unsigned int lod) {
+		STP3D_PROFILE_GPU_ZONE("IndexedMesh::draw");
+		// The index buffer is part of the VAO and the VAO stays bound
+		GLState::bindVertexArray(id_vao);
+
+		unsigned int first = (lod == 0 || lod > lods.size()) ? 0 : lods[lod-1].first_index;
+		unsigned int count = getLODIndices(lod);
+		if (shared_buffers) {
+			glDrawElementsBaseVertex(gl_type_mesh,count,GL_UNSIGNED_INT,(const GLvoid*)(size_t(shared_first_index+first)*sizeof(unsigned int)),
+			                         shared_base_vertex);
+		}
+		else glDrawElements(gl_type_mesh,count,GL_UNSIGNED_INT,(const GLvoid*)(size_t(first)*sizeof(unsigned int)));
+	}
+
+	inline void IndexedMesh::drawInstanced(InstanceBuffer& instances,unsigned int lod) {
+		if (instances.size() == 0) return;
+		STP3D_PROFILE_GPU_ZONE("IndexedMesh::drawInstanced");
+		GLState::bindVertexArray(id_vao);
+		// A shared VAO has one instance buffer for all its meshes
+		instances.attach(shared_buffers ? shared_buffers->instanceSerial() : instance_serial);
+
+		unsigned int first = (lod == 0 || lod > lods.size()) ? 0 : lods[lod-1].first_index;
+		unsigned int count = getLODIndices(lod);
+		if (shared_buffers) {
+			glDrawElementsInstancedBaseVertex(gl_type_mesh,count,GL_UNSIGNED_INT,
+			                                  (const GLvoid*)(size_t(shared_first_index+first)*sizeof(unsigned int)),
+			                                  instances.size(),shared_base_vertex);
+		}
+		else {
+			glDrawElementsInstanced(gl_type_mesh,count,GL_UNSIGNED_INT,(const GLvoid*)(size_t(first)*sizeof(unsigned int)),instances.size());
+		}
 	}
 
 
@@ -210,6 +367,8 @@ namespace STP3D {
 			delete[](index_buffer);
 			index_buffer = NULL;
 		}
+		// The levels stay drawable
+		std::vector<unsigned int>().swap(lod_indices);
 	}
 
 
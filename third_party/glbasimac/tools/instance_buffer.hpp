@@ -0,0 +1,136 @@
+/***************************************************************************
+                      instance_buffer.hpp  -  description
+                             -------------------
+    copyright            : (C) 2012 by Biri Venceslas
+    email                : biri@univ-mlv.fr
+ ***************************************************************************/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef _STP3D_INSTANCE_BUFFER_HPP_
+#define _STP3D_INSTANCE_BUFFER_HPP_
+
+#include <vector>
+#include <cstring>
+#include "gl_tools.hpp"
+#include "gl_state.hpp"
+#include "matrix4d.hpp"
+
+namespace STP3D {
+
+	/**
+	  * \brief Per instance data (model matrix and color) of an instanced draw.
+	  * Instances are stored interleaved in one VBO, read by the vertex
+	  * attributes MATRIX_ATTRIBUTE to MATRIX_ATTRIBUTE+3 (one column each) and
+	  * COLOR_ATTRIBUTE, with a divisor of 1. The GLBI_INSTANCED permutation of
+	  * flat_shading.vert and phong_shading.vert draws each instance with
+	  * modelviewMat*inst_model and the color inst_col.
+	  * The buffer is sent to GL by the first draw following a change.
+	  * StandardMesh::drawInstanced and IndexedMesh::drawInstanced point the
+	  * instance attributes of their VAO on the buffer when needed.
+	  */
+	class InstanceBuffer {
+	public:
+		/// First attribute of the model matrix (4 attributes, one per column)
+		static const unsigned int MATRIX_ATTRIBUTE = 4;
+		/// Attribute of the color
+		static const unsigned int COLOR_ATTRIBUTE = 8;
+		/// 16 floats of matrix then 3 floats of color
+		static const unsigned int FLOATS_PER_INSTANCE = 19;
+
+		InstanceBuffer() : id_vbo(0),dirty(true),serial(nextSerial()) {};
+		~InstanceBuffer() {
+			if (id_vbo) GLState::deleteBuffers(1,&id_vbo);
+		};
+
+		/// Remove all the instances
+		void clear() {data.clear();dirty = true;};
+		void reserve(unsigned int nb_instances) {data.reserve(nb_instances*FLOATS_PER_INSTANCE);};
+		/// Add an instance drawn with the \param model matrix (applied after the current modelview) and the color r,g,b
+		void addInstance(const Matrix4D& model,float r,float g,float b);
+		/// Change the instance number \param i
+		void setInstance(unsigned int i,const Matrix4D& model,float r,float g,float b);
+		unsigned int size() const {return data.size()/FLOATS_PER_INSTANCE;};
+
+		/// Send the instances to GL if they changed since the last call
+		void upload();
+		/** Set the instance attributes of the bound VAO on this buffer. \param vao_serial
+		  * is the serial of the instance buffer the VAO uses (0 : none) : nothing is done
+		  * if it is already this one. Also upload the instances if needed.
+		  */
+		void attach(unsigned int& vao_serial);
+		/// Point the instance attributes of the bound VAO on the buffer, starting at instance \param first_instance
+		void setAttributes(unsigned int first_instance = 0);
+
+	private:
+		// Owns a GL buffer : no copy
+		InstanceBuffer(const InstanceBuffer&);
+		InstanceBuffer& operator=(const InstanceBuffer&);
+		/// Unique number of each instance buffer (GL names may be reused after deletion)
+		static unsigned int nextSerial() {static unsigned int last = 0;return ++last;};
+
+		std::vector<float> data;
+		unsigned int id_vbo;
+		bool dirty;
+		unsigned int serial;
+	};
+
+	inline void InstanceBuffer::addInstance(const Matrix4D& model,float r,float g,float b) {
+		data.resize(data.size()+FLOATS_PER_INSTANCE);
+		setInstance(size()-1,model,r,g,b);
+	}
+
+	inline void InstanceBuffer::setInstance(unsigned int i,const Matrix4D& model,float r,float g,float b) {
+		float* inst = &data[i*FLOATS_PER_INSTANCE];
+		memcpy(inst,model.mat,16*sizeof(float));
+		inst[16] = r;
+		inst[17] = g;
+		inst[18] = b;
+		dirty = true;
+	}
+
+	inline void InstanceBuffer::upload() {
+		if (!dirty) return;
+		if (!id_vbo) glGenBuffers(1,&id_vbo);
+		GLState::bindBuffer(GL_ARRAY_BUFFER,id_vbo);
+		// The store is never empty : an attached VAO may still read instance 0
+		if (data.empty()) {
+			glBufferData(GL_ARRAY_BUFFER,FLOATS_PER_INSTANCE*sizeof(float),NULL,GL_STREAM_DRAW);
+		}
+		else {
+			glBufferData(GL_ARRAY_BUFFER,data.size()*sizeof(float),&data[0],GL_STREAM_DRAW);
+		}
+		dirty = false;
+	}
+
+	inline void InstanceBuffer::attach(unsigned int& vao_serial) {
+		upload();
+		if (vao_serial == serial) return;
+		setAttributes(0);
+		vao_serial = serial;
+	}
+
+	inline void InstanceBuffer::setAttributes(unsigned int first_instance) {
+		GLState::bindBuffer(GL_ARRAY_BUFFER,id_vbo);
+		const GLsizei stride = FLOATS_PER_INSTANCE*sizeof(float);
+		const size_t offset = first_instance*stride;
+		for(unsigned int c=0;c<4;c++) {
+			glEnableVertexAttribArray(MATRIX_ATTRIBUTE+c);
+			glVertexAttribPointer(MATRIX_ATTRIBUTE+c,4,GL_FLOAT,GL_FALSE,stride,(const void*)(offset+4*c*sizeof(float)));
+			glVertexAttribDivisor(MATRIX_ATTRIBUTE+c,1);
+		}
+		glEnableVertexAttribArray(COLOR_ATTRIBUTE);
+		glVertexAttribPointer(COLOR_ATTRIBUTE,3,GL_FLOAT,GL_FALSE,stride,(const void*)(offset+16*sizeof(float)));
+		glVertexAttribDivisor(COLOR_ATTRIBUTE,1);
+	}
+
+};
+
+#endif
@@ -0,0 +1,118 @@
+/***************************************************************************
+                       mapped_file.hpp  -  description
+                             -------------------
+    copyright            : (C) 2012 by Biri Venceslas
+    email                : biri@univ-mlv.fr
+ ***************************************************************************/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef _STP3D_MAPPED_FILE_HPP_
+#define _STP3D_MAPPED_FILE_HPP_
+
+#include <string>
+#include <vector>
+#include <cstddef>
+#ifdef _WIN32
+#include <fstream>
+#include <iterator>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#include "globals.hpp"
+
+namespace STP3D {
+
+	/**
+	  * \brief Read only file mapped in memory (mmap).
+	  * The pages are loaded by the system when they are read : nothing is copied
+	  * before use. On Windows, the file is read in memory.
+	  */
+	class MappedFile {
+	public:
+		MappedFile() : data(NULL),size(0) {};
+		~MappedFile() {close();};
+
+		/// Map \param filename. \param sequential : the file is read once, in order (read ahead).
+		/// Empty files are not mapped (returns false).
+		bool open(const std::string& filename,bool sequential = true);
+		void close();
+		bool isOpen() const {return data != NULL;};
+		const unsigned char* getData() const {return data;};
+		size_t getSize() const {return size;};
+
+	private:
+		// Owns a mapping : no copy
+		MappedFile(const MappedFile&);
+		MappedFile& operator=(const MappedFile&);
+
+		const unsigned char* data;
+		size_t size;
+#ifdef _WIN32
+		std::vector<unsigned char> storage;
+#endif
+	};
+
+	inline bool MappedFile::open(const std::string& filename,bool sequential) {
+		close();
+#ifdef _WIN32
+		(void)sequential;
+		std::ifstream file(filename.c_str(),std::ios::binary);
+		if (!file) {
+			STP3D::setError("MappedFile : unable to open the file");
+			return false;
+		}
+		storage.assign(std::istreambuf_iterator<char>(file),std::istreambuf_iterator<char>());
+		if (storage.empty()) return false;
+		data = &storage[0];
+		size = storage.size();
+#else
+		int fd = ::open(filename.c_str(),O_RDONLY);
+		if (fd < 0) {
+			STP3D::setError("MappedFile : unable to open the file");
+			return false;
+		}
+		struct stat st;
+		if (fstat(fd,&st) != 0 || st.st_size == 0) {
+			::close(fd);
+			return false;
+		}
+		void* mapping = mmap(NULL,st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+		// The mapping stays valid without the descriptor
+		::close(fd);
+		if (mapping == MAP_FAILED) {
+			STP3D::setError("MappedFile : unable to map the file");
+			return false;
+		}
+		if (sequential) madvise(mapping,st.st_size,MADV_SEQUENTIAL);
+		madvise(mapping,st.st_size,MADV_WILLNEED);
+		data = (const unsigned char*)mapping;
+		size = st.st_size;
+#endif
+		return true;
+	}
+
+	inline void MappedFile::close() {
+		if (!data) return;
+#ifdef _WIN32
+		std::vector<unsigned char>().swap(storage);
+#else
+		munmap((void*)data,size);
+#endif
+		data = NULL;
+		size = 0;
+	}
+
+};
+
+#endif
@@ -20,6 +20,7 @@
 #include "globals.hpp"
 #include "vector4d.hpp"
 #include "vector3d.hpp"
+#include "matrix4d_simd.hpp"
 #include <string>
 
 namespace STP3D {
@@ -27,10 +28,11 @@ namespace STP3D {
 /** A 4 dimensional matrix.
   * This class allow the creation, storing and manipulation of 4x4 matrix.
   * With many operators and utility functions
-  * Data are stored in column major mode
+  * Data are stored in column major mode, aligned on 16 bytes so that
+  * products, transposition and inversion can use the SIMD kernels of matrix4d_simd.hpp
   * @author Venceslas BIRI (biri@univ-mlv.fr)
   */
-class Matrix4D {
+class alignas(16) Matrix4D {
 public: 
 	float mat[16];			///< values of the matrix...
 
@@ -214,6 +216,14 @@ public:
 	  * \return Indicate whether the inversion was possible or not
 	  */
 	bool invert();
+	/** Invert an affine matrix (last line is 0,0,0,1). Inversion in place.
+	  * Cheaper than invert() : only the 3x3 part is inverted. The result is 
+	  * undefined if the matrix is not affine (see isAffine()).
+	  * \return Indicate whether the inversion was possible or not
+	  */
+	bool invertAffine();
+	/// Indicate if the last line of the matrix is (0,0,0,1)
+	bool isAffine() const {return mat[3]==0.0f && mat[7]==0.0f && mat[11]==0.0f && mat[15]==1.0f;};
 	/** Transpose the matrix.
 	  * Transpose in place.
 	  */
@@ -229,6 +239,20 @@ public:
 	  */
 	void set(unsigned int col,unsigned int lgn,float val);
 	//@}
+
+	/** \name Batch transformations
+	  * Apply the matrix to a contiguous array of \a nb vectors. \a src and \a dst may be the same array.
+	  */
+	//@{
+	/// Points (x,y,z) with w=1. Only x,y,z of the result are stored (affine matrix expected).
+	void transformPoints(const float* src,float* dst,size_t nb) const {simd::transformVec3(mat,src,dst,nb,true);};
+	/// Directions (x,y,z) with w=0.
+	void transformDirections(const float* src,float* dst,size_t nb) const {simd::transformVec3(mat,src,dst,nb,false);};
+	/// Homogeneous vectors (x,y,z,w).
+	void transformVectors(const float* src,float* dst,size_t nb) const {simd::transformVec4(mat,src,dst,nb);};
+	/// Array of Vector4D.
+	void transformVectors(const Vector4D* src,Vector4D* dst,size_t nb) const {if (nb) simd::transformVec4(mat,src[0].val,dst[0].val,nb);};
+	//@}
 	
 };
 
@@ -285,63 +309,19 @@ inline Matrix4D Matrix4D::operator-=(const Matrix4D& ml) {
 
 inline Matrix4D Matrix4D::operator*(const Matrix4D& ml) const {
 	Matrix4D m;
-	
-	// First column
-	m.mat[0]  = ml.mat[0]*mat[0] + ml.mat[1]*mat[4] + ml.mat[2]*mat[8]  + ml.mat[3]*mat[12];
-	m.mat[1]  = ml.mat[0]*mat[1] + ml.mat[1]*mat[5] + ml.mat[2]*mat[9]  + ml.mat[3]*mat[13];
-	m.mat[2]  = ml.mat[0]*mat[2] + ml.mat[1]*mat[6] + ml.mat[2]*mat[10] + ml.mat[3]*mat[14];
-	m.mat[3]  = ml.mat[0]*mat[3] + ml.mat[1]*mat[7] + ml.mat[2]*mat[11] + ml.mat[3]*mat[15];
-	// Second column
-	m.mat[4]  = ml.mat[4]*mat[0] + ml.mat[5]*mat[4] + ml.mat[6]*mat[8]  + ml.mat[7]*mat[12];
-	m.mat[5]  = ml.mat[4]*mat[1] + ml.mat[5]*mat[5] + ml.mat[6]*mat[9]  + ml.mat[7]*mat[13];
-	m.mat[6]  = ml.mat[4]*mat[2] + ml.mat[5]*mat[6] + ml.mat[6]*mat[10] + ml.mat[7]*mat[14];
-	m.mat[7]  = ml.mat[4]*mat[3] + ml.mat[5]*mat[7] + ml.mat[6]*mat[11] + ml.mat[7]*mat[15];
-	// Third column
-	m.mat[8]  = ml.mat[8]*mat[0] + ml.mat[9]*mat[4] + ml.mat[10]*mat[8]  + ml.mat[11]*mat[12];
-	m.mat[9]  = ml.mat[8]*mat[1] + ml.mat[9]*mat[5] + ml.mat[10]*mat[9]  + ml.mat[11]*mat[13];
-	m.mat[10] = ml.mat[8]*mat[2] + ml.mat[9]*mat[6] + ml.mat[10]*mat[10] + ml.mat[11]*mat[14];
-	m.mat[11] = ml.mat[8]*mat[3] + ml.mat[9]*mat[7] + ml.mat[10]*mat[11] + ml.mat[11]*mat[15];
-	// Fourth column
-	m.mat[12] = ml.mat[12]*mat[0] + ml.mat[13]*mat[4] + ml.mat[14]*mat[8]  + ml.mat[15]*mat[12];
-	m.mat[13] = ml.mat[12]*mat[1] + ml.mat[13]*mat[5] + ml.mat[14]*mat[9]  + ml.mat[15]*mat[13];
-	m.mat[14] = ml.mat[12]*mat[2] + ml.mat[13]*mat[6] + ml.mat[14]*mat[10] + ml.mat[15]*mat[14];
-	m.mat[15] = ml.mat[12]*mat[3] + ml.mat[13]*mat[7] + ml.mat[14]*mat[11] + ml.mat[15]*mat[15];
+	simd::mul4x4(mat,ml.mat,m.mat);
 	return m;
 }
 
 inline Matrix4D Matrix4D::operator*=(const Matrix4D& ml) {
-	float mt[16];
-	// First column
-	mt[0]  = ml.mat[0]*mat[0] + ml.mat[1]*mat[4] + ml.mat[2]*mat[8]  + ml.mat[3]*mat[12];
-	mt[1]  = ml.mat[0]*mat[1] + ml.mat[1]*mat[5] + ml.mat[2]*mat[9]  + ml.mat[3]*mat[13];
-	mt[2]  = ml.mat[0]*mat[2] + ml.mat[1]*mat[6] + ml.mat[2]*mat[10] + ml.mat[3]*mat[14];
-	mt[3]  = ml.mat[0]*mat[3] + ml.mat[1]*mat[7] + ml.mat[2]*mat[11] + ml.mat[3]*mat[15];
-	// Second column
-	mt[4]  = ml.mat[4]*mat[0] + ml.mat[5]*mat[4] + ml.mat[6]*mat[8]  + ml.mat[7]*mat[12];
-	mt[5]  = ml.mat[4]*mat[1] + ml.mat[5]*mat[5] + ml.mat[6]*mat[9]  + ml.mat[7]*mat[13];
-	mt[6]  = ml.mat[4]*mat[2] + ml.mat[5]*mat[6] + ml.mat[6]*mat[10] + ml.mat[7]*mat[14];
-	mt[7]  = ml.mat[4]*mat[3] + ml.mat[5]*mat[7] + ml.mat[6]*mat[11] + ml.mat[7]*mat[15];
-	// Third column
-	mt[8]  = ml.mat[8]*mat[0] + ml.mat[9]*mat[4] + ml.mat[10]*mat[8]  + ml.mat[11]*mat[12];
-	mt[9]  = ml.mat[8]*mat[1] + ml.mat[9]*mat[5] + ml.mat[10]*mat[9]  + ml.mat[11]*mat[13];
-	mt[10] = ml.mat[8]*mat[2] + ml.mat[9]*mat[6] + ml.mat[10]*mat[10] + ml.mat[11]*mat[14];
-	mt[11] = ml.mat[8]*mat[3] + ml.mat[9]*mat[7] + ml.mat[10]*mat[11] + ml.mat[11]*mat[15];
-	// Fourth column
-	mt[12] = ml.mat[12]*mat[0] + ml.mat[13]*mat[4] + ml.mat[14]*mat[8]  + ml.mat[15]*mat[12];
-	mt[13] = ml.mat[12]*mat[1] + ml.mat[13]*mat[5] + ml.mat[14]*mat[9]  + ml.mat[15]*mat[13];
-	mt[14] = ml.mat[12]*mat[2] + ml.mat[13]*mat[6] + ml.mat[14]*mat[10] + ml.mat[15]*mat[14];
-	mt[15] = ml.mat[12]*mat[3] + ml.mat[13]*mat[7] + ml.mat[14]*mat[11] + ml.mat[15]*mat[15];
-
-	for(unsigned int i=0;i<16;i++) mat[i] = mt[i];
-
+	simd::mul4x4(mat,ml.mat,mat);
 	return *this;
 }
 
 inline Vector4D Matrix4D::operator*(const Vector4D& ml) const {
-	return Vector4D(ml[0]*mat[0] + ml[1]*mat[4] + ml[2]*mat[8]  + ml[3]*mat[12],
-	                ml[0]*mat[1] + ml[1]*mat[5] + ml[2]*mat[9]  + ml[3]*mat[13],
-	                ml[0]*mat[2] + ml[1]*mat[6] + ml[2]*mat[10] + ml[3]*mat[14],
-	                ml[0]*mat[3] + ml[1]*mat[7] + ml[2]*mat[11] + ml[3]*mat[15]);
+	Vector4D res;
+	simd::mulVec4(mat,ml.val,res.val);
+	return res;
 }
 
 inline Matrix4D Matrix4D::operator=(const Matrix4D& src) {
@@ -546,12 +526,7 @@ inline void Matrix4D::get(float matren[]) const {
 }
 
 inline void Matrix4D::transpose() {
-	Vector4D tmp[4];
-	tmp[0] = Vector4D(mat[0],mat[4],mat[8] ,mat[12]);
-	tmp[1] = Vector4D(mat[1],mat[5],mat[9] ,mat[13]);
-	tmp[2] = Vector4D(mat[2],mat[6],mat[10],mat[14]);
-	tmp[3] = Vector4D(mat[3],mat[7],mat[11],mat[15]);
-	for(int i=0;i<16;i++) {mat[i] = (tmp[i/4])[i%4];}
+	simd::transpose4x4(mat);
 }
 
 inline void Matrix4D::normalFromModelview() {
@@ -564,135 +539,11 @@ inline void Matrix4D::normalFromModelview() {
 
 
 inline bool Matrix4D::invert() {
-	float m[16];
-	float invOut[16];
-	this->get(m);
-	double inv[16], det;
-	int i;
-
-	inv[0] = m[5]  * m[10] * m[15] - 
-	         m[5]  * m[11] * m[14] - 
-	         m[9]  * m[6]  * m[15] + 
-	         m[9]  * m[7]  * m[14] +
-	         m[13] * m[6]  * m[11] - 
-	         m[13] * m[7]  * m[10];
-
-	inv[4] = -m[4]  * m[10] * m[15] + 
-	          m[4]  * m[11] * m[14] + 
-	          m[8]  * m[6]  * m[15] - 
-	          m[8]  * m[7]  * m[14] - 
-	          m[12] * m[6]  * m[11] + 
-	          m[12] * m[7]  * m[10];
-
-	inv[8] = m[4]  * m[9] * m[15] - 
-	         m[4]  * m[11] * m[13] - 
-	         m[8]  * m[5] * m[15] + 
-	         m[8]  * m[7] * m[13] + 
-	         m[12] * m[5] * m[11] - 
-	         m[12] * m[7] * m[9];
-
-	inv[12] = -m[4]  * m[9] * m[14] + 
-	           m[4]  * m[10] * m[13] +
-	           m[8]  * m[5] * m[14] - 
-	           m[8]  * m[6] * m[13] - 
-	           m[12] * m[5] * m[10] + 
-	           m[12] * m[6] * m[9];
-
-	inv[1] = -m[1]  * m[10] * m[15] + 
-	          m[1]  * m[11] * m[14] + 
-	          m[9]  * m[2] * m[15] - 
-	          m[9]  * m[3] * m[14] - 
-	          m[13] * m[2] * m[11] + 
-	          m[13] * m[3] * m[10];
-
-	inv[5] = m[0]  * m[10] * m[15] - 
-	         m[0]  * m[11] * m[14] - 
-	         m[8]  * m[2] * m[15] + 
-	         m[8]  * m[3] * m[14] + 
-	         m[12] * m[2] * m[11] - 
-	         m[12] * m[3] * m[10];
-
-	inv[9] = -m[0]  * m[9] * m[15] + 
-	          m[0]  * m[11] * m[13] + 
-	          m[8]  * m[1] * m[15] - 
-	          m[8]  * m[3] * m[13] - 
-	          m[12] * m[1] * m[11] + 
-	          m[12] * m[3] * m[9];
-
-	inv[13] = m[0]  * m[9] * m[14] - 
-	          m[0]  * m[10] * m[13] - 
-	          m[8]  * m[1] * m[14] + 
-	          m[8]  * m[2] * m[13] + 
-	          m[12] * m[1] * m[10] - 
-	          m[12] * m[2] * m[9];
-
-	inv[2] = m[1]  * m[6] * m[15] - 
-	         m[1]  * m[7] * m[14] - 
-	         m[5]  * m[2] * m[15] + 
-	         m[5]  * m[3] * m[14] + 
-	         m[13] * m[2] * m[7] - 
-	         m[13] * m[3] * m[6];
-
-	inv[6] = -m[0]  * m[6] * m[15] + 
-	          m[0]  * m[7] * m[14] + 
-	          m[4]  * m[2] * m[15] - 
-	          m[4]  * m[3] * m[14] - 
-	          m[12] * m[2] * m[7] + 
-	          m[12] * m[3] * m[6];
-
-	inv[10] = m[0]  * m[5] * m[15] - 
-	          m[0]  * m[7] * m[13] - 
-	          m[4]  * m[1] * m[15] + 
-	          m[4]  * m[3] * m[13] + 
-	          m[12] * m[1] * m[7] - 
-	          m[12] * m[3] * m[5];
-
-	inv[14] = -m[0]  * m[5] * m[14] + 
-	           m[0]  * m[6] * m[13] + 
-	           m[4]  * m[1] * m[14] - 
-	           m[4]  * m[2] * m[13] - 
-	           m[12] * m[1] * m[6] + 
-	           m[12] * m[2] * m[5];
-
-	inv[3] = -m[1] * m[6] * m[11] + 
-	          m[1] * m[7] * m[10] + 
-	          m[5] * m[2] * m[11] - 
-	          m[5] * m[3] * m[10] - 
-	          m[9] * m[2] * m[7] + 
-	          m[9] * m[3] * m[6];
-
-	inv[7] = m[0] * m[6] * m[11] - 
-	         m[0] * m[7] * m[10] - 
-	         m[4] * m[2] * m[11] + 
-	         m[4] * m[3] * m[10] + 
-	         m[8] * m[2] * m[7] - 
-	         m[8] * m[3] * m[6];
-
-	inv[11] = -m[0] * m[5] * m[11] + 
-	           m[0] * m[7] * m[9] + 
-	           m[4] * m[1] * m[11] - 
-	           m[4] * m[3] * m[9] - 
-	           m[8] * m[1] * m[7] + 
-	           m[8] * m[3] * m[5];
-
-	inv[15] = m[0] * m[5] * m[10] - 
-	          m[0] * m[6] * m[9] - 
-	          m[4] * m[1] * m[10] + 
-	          m[4] * m[2] * m[9] + 
-	          m[8] * m[1] * m[6] - 
-	          m[8] * m[2] * m[5];
-
-	det = m[0] * inv[0] + m[1] * inv[4] + m[2] * inv[8] + m[3] * inv[12];
-
-	if (fabs(det) < STP3D_EPSILON)
-	    return false;
-
-	det = 1.0 / det;
-
-	for (i = 0; i < 16; i++)
-	    invOut[i] = inv[i] * det;
-	this->set(invOut);
-	return true;
+	return simd::invert4x4(mat);
+}
+
+inline bool Matrix4D::invertAffine() {
+	return simd::invertAffine4x4(mat);
 }
 
 inline void Matrix4D::set(unsigned int col,unsigned int lgn,float val) {
@@ -0,0 +1,352 @@
+/***************************************************************************
+                      matrix4d_simd.hpp  -  description
+                             -------------------
+    copyright            : (C) 2012 by Biri Venceslas
+    email                : biri@univ-mlv.fr
+ ***************************************************************************/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef _STP3D_MATRIX4D_SIMD_HPP_
+#define _STP3D_MATRIX4D_SIMD_HPP_
+
+#include <cstddef>
+#include <cmath>
+#include "globals.hpp"
+
+// ///////////////////////////////////////////////////////////////////////////
+// SIMD configuration
+// SSE is used as soon as the compiler targets it (always the case on x86_64),
+// AVX only when the code is compiled with -mavx (or /arch:AVX).
+// Define STP3D_NO_SIMD to force the scalar fallback everywhere.
+// ///////////////////////////////////////////////////////////////////////////
+#if !defined(STP3D_NO_SIMD) && (defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1))
+#define STP3D_USE_SSE 1
+#include <xmmintrin.h>
+#endif
+#if defined(STP3D_USE_SSE) && defined(__AVX__)
+#define STP3D_USE_AVX 1
+#include <immintrin.h>
+#endif
+
+namespace STP3D {
+
+/** \namespace STP3D::simd
+  * Low level 4x4 matrix kernels working on column major float[16] arrays.
+  * Matrix4D uses them for its operators. All the functions accept
+  * unaligned pointers, the result may alias any of the operands.
+  * Operations are done in the same order as the scalar code so that
+  * products and matrix/vector multiplications give the same bits.
+  */
+namespace simd {
+
+	/// r = a*b (column major)
+	inline void mul4x4(const float* a,const float* b,float* r) {
+#if defined(STP3D_USE_AVX)
+		__m256 a0 = _mm256_broadcast_ps((const __m128*)(a));
+		__m256 a1 = _mm256_broadcast_ps((const __m128*)(a+4));
+		__m256 a2 = _mm256_broadcast_ps((const __m128*)(a+8));
+		__m256 a3 = _mm256_broadcast_ps((const __m128*)(a+12));
+		__m256 b01 = _mm256_loadu_ps(b);
+		__m256 b23 = _mm256_loadu_ps(b+8);
+		__m256 r01 = _mm256_mul_ps(a0,_mm256_permute_ps(b01,0x00));
+		r01 = _mm256_add_ps(r01,_mm256_mul_ps(a1,_mm256_permute_ps(b01,0x55)));
+		r01 = _mm256_add_ps(r01,_mm256_mul_ps(a2,_mm256_permute_ps(b01,0xAA)));
+		r01 = _mm256_add_ps(r01,_mm256_mul_ps(a3,_mm256_permute_ps(b01,0xFF)));
+		__m256 r23 = _mm256_mul_ps(a0,_mm256_permute_ps(b23,0x00));
+		r23 = _mm256_add_ps(r23,_mm256_mul_ps(a1,_mm256_permute_ps(b23,0x55)));
+		r23 = _mm256_add_ps(r23,_mm256_mul_ps(a2,_mm256_permute_ps(b23,0xAA)));
+		r23 = _mm256_add_ps(r23,_mm256_mul_ps(a3,_mm256_permute_ps(b23,0xFF)));
+		_mm256_storeu_ps(r,r01);
+		_mm256_storeu_ps(r+8,r23);
+#elif defined(STP3D_USE_SSE)
+		__m128 a0 = _mm_loadu_ps(a);
+		__m128 a1 = _mm_loadu_ps(a+4);
+		__m128 a2 = _mm_loadu_ps(a+8);
+		__m128 a3 = _mm_loadu_ps(a+12);
+		for(int j=0;j<4;j++) {
+			__m128 bj = _mm_loadu_ps(b+4*j);
+			__m128 rj = _mm_mul_ps(a0,_mm_shuffle_ps(bj,bj,0x00));
+			rj = _mm_add_ps(rj,_mm_mul_ps(a1,_mm_shuffle_ps(bj,bj,0x55)));
+			rj = _mm_add_ps(rj,_mm_mul_ps(a2,_mm_shuffle_ps(bj,bj,0xAA)));
+			rj = _mm_add_ps(rj,_mm_mul_ps(a3,_mm_shuffle_ps(bj,bj,0xFF)));
+			_mm_storeu_ps(r+4*j,rj);
+		}
+#else
+		float mt[16];
+		for(int j=0;j<4;j++) {
+			for(int i=0;i<4;i++) {
+				mt[4*j+i] = b[4*j]*a[i] + b[4*j+1]*a[4+i] + b[4*j+2]*a[8+i] + b[4*j+3]*a[12+i];
+			}
+		}
+		for(int i=0;i<16;i++) r[i] = mt[i];
+#endif
+	}
+
+	/// r = m*v with v a 4D vector
+	inline void mulVec4(const float* m,const float* v,float* r) {
+#if defined(STP3D_USE_SSE)
+		__m128 res = _mm_mul_ps(_mm_loadu_ps(m),_mm_set1_ps(v[0]));
+		res = _mm_add_ps(res,_mm_mul_ps(_mm_loadu_ps(m+4),_mm_set1_ps(v[1])));
+		res = _mm_add_ps(res,_mm_mul_ps(_mm_loadu_ps(m+8),_mm_set1_ps(v[2])));
+		res = _mm_add_ps(res,_mm_mul_ps(_mm_loadu_ps(m+12),_mm_set1_ps(v[3])));
+		_mm_storeu_ps(r,res);
+#else
+		float res[4];
+		for(int i=0;i<4;i++) res[i] = v[0]*m[i] + v[1]*m[4+i] + v[2]*m[8+i] + v[3]*m[12+i];
+		for(int i=0;i<4;i++) r[i] = res[i];
+#endif
+	}
+
+	/// Transposition in place
+	inline void transpose4x4(float* m) {
+#if defined(STP3D_USE_SSE)
+		__m128 c0 = _mm_loadu_ps(m);
+		__m128 c1 = _mm_loadu_ps(m+4);
+		__m128 c2 = _mm_loadu_ps(m+8);
+		__m128 c3 = _mm_loadu_ps(m+12);
+		_MM_TRANSPOSE4_PS(c0,c1,c2,c3);
+		_mm_storeu_ps(m,c0);
+		_mm_storeu_ps(m+4,c1);
+		_mm_storeu_ps(m+8,c2);
+		_mm_storeu_ps(m+12,c3);
+#else
+		float tmp;
+		for(int i=0;i<4;i++) {
+			for(int j=i+1;j<4;j++) {
+				tmp = m[4*i+j]; m[4*i+j] = m[4*j+i]; m[4*j+i] = tmp;
+			}
+		}
+#endif
+	}
+
+	/** General inversion (Cramer's rule). Inversion in place.
+	  * \return false (and \a m unchanged) if the matrix is singular
+	  */
+	inline bool invert4x4(float* m) {
+#if defined(STP3D_USE_SSE)
+		// Cofactor computation from Intel AP-928 "Streaming SIMD Extensions -
+		// Inverse of 4x4 Matrix". Written for row major data, but since
+		// inv(transpose(M)) = transpose(inv(M)) it works as well on column major.
+		__m128 minor0,minor1,minor2,minor3;
+		__m128 row0,row1,row2,row3;
+		__m128 det,tmp1;
+		tmp1 = _mm_loadh_pi(_mm_loadl_pi(_mm_setzero_ps(),(const __m64*)(m)),(const __m64*)(m+4));
+		row1 = _mm_loadh_pi(_mm_loadl_pi(_mm_setzero_ps(),(const __m64*)(m+8)),(const __m64*)(m+12));
+		row0 = _mm_shuffle_ps(tmp1,row1,0x88);
+		row1 = _mm_shuffle_ps(row1,tmp1,0xDD);
+		tmp1 = _mm_loadh_pi(_mm_loadl_pi(tmp1,(const __m64*)(m+2)),(const __m64*)(m+6));
+		row3 = _mm_loadh_pi(_mm_loadl_pi(_mm_setzero_ps(),(const __m64*)(m+10)),(const __m64*)(m+14));
+		row2 = _mm_shuffle_ps(tmp1,row3,0x88);
+		row3 = _mm_shuffle_ps(row3,tmp1,0xDD);
+
+		tmp1 = _mm_mul_ps(row2,row3);
+		tmp1 = _mm_shuffle_ps(tmp1,tmp1,0xB1);
+		minor0 = _mm_mul_ps(row1,tmp1);
+		minor1 = _mm_mul_ps(row0,tmp1);
+		tmp1 = _mm_shuffle_ps(tmp1,tmp1,0x4E);
+		minor0 = _mm_sub_ps(_mm_mul_ps(row1,tmp1),minor0);
+		minor1 = _mm_sub_ps(_mm_mul_ps(row0,tmp1),minor1);
+		minor1 = _mm_shuffle_ps(minor1,minor1,0x4E);
+
+		tmp1 = _mm_mul_ps(row1,row2);
+		tmp1 = _mm_shuffle_ps(tmp1,tmp1,0xB1);
+		minor0 = _mm_add_ps(_mm_mul_ps(row3,tmp1),minor0);
+		minor3 = _mm_mul_ps(row0,tmp1);
+		tmp1 = _mm_shuffle_ps(tmp1,tmp1,0x4E);
+		minor0 = _mm_sub_ps(minor0,_mm_mul_ps(row3,tmp1));
+		minor3 = _mm_sub_ps(_mm_mul_ps(row0,tmp1),minor3);
+		minor3 = _mm_shuffle_ps(minor3,minor3,0x4E);
+
+		tmp1 = _mm_mul_ps(_mm_shuffle_ps(row1,row1,0x4E),row3);
+		tmp1 = _mm_shuffle_ps(tmp1,tmp1,0xB1);
+		row2 = _mm_shuffle_ps(row2,row2,0x4E);
+		minor0 = _mm_add_ps(_mm_mul_ps(row2,tmp1),minor0);
+		minor2 = _mm_mul_ps(row0,tmp1);
+		tmp1 = _mm_shuffle_ps(tmp1,tmp1,0x4E);
+		minor0 = _mm_sub_ps(minor0,_mm_mul_ps(row2,tmp1));
+		minor2 = _mm_sub_ps(_mm_mul_ps(row0,tmp1),minor2);
+		minor2 = _mm_shuffle_ps(minor2,minor2,0x4E);
+
+		tmp1 = _mm_mul_ps(row0,row1);
+		tmp1 = _mm_shuffle_ps(tmp1,tmp1,0xB1);
+		minor2 = _mm_add_ps(_mm_mul_ps(row3,tmp1),minor2);
+		minor3 = _mm_sub_ps(_mm_mul_ps(row2,tmp1),minor3);
+		tmp1 = _mm_shuffle_ps(tmp1,tmp1,0x4E);
+		minor2 = _mm_sub_ps(_mm_mul_ps(row3,tmp1),minor2);
+		minor3 = _mm_sub_ps(minor3,_mm_mul_ps(row2,tmp1));
+
+		tmp1 = _mm_mul_ps(row0,row3);
+		tmp1 = _mm_shuffle_ps(tmp1,tmp1,0xB1);
+		minor1 = _mm_sub_ps(minor1,_mm_mul_ps(row2,tmp1));
+		minor2 = _mm_add_ps(_mm_mul_ps(row1,tmp1),minor2);
+		tmp1 = _mm_shuffle_ps(tmp1,tmp1,0x4E);
+		minor1 = _mm_add_ps(_mm_mul_ps(row2,tmp1),minor1);
+		minor2 = _mm_sub_ps(minor2,_mm_mul_ps(row1,tmp1));
+
+		tmp1 = _mm_mul_ps(row0,row2);
+		tmp1 = _mm_shuffle_ps(tmp1,tmp1,0xB1);
+		minor1 = _mm_add_ps(_mm_mul_ps(row3,tmp1),minor1);
+		minor3 = _mm_sub_ps(minor3,_mm_mul_ps(row1,tmp1));
+		tmp1 = _mm_shuffle_ps(tmp1,tmp1,0x4E);
+		minor1 = _mm_sub_ps(minor1,_mm_mul_ps(row3,tmp1));
+		minor3 = _mm_add_ps(_mm_mul_ps(row1,tmp1),minor3);
+
+		// Determinant summed in double, as the scalar code : the singularity test
+		// must not depend on float rounding of the sum
+		float r0[4],c0[4];
+		_mm_storeu_ps(r0,row0);
+		_mm_storeu_ps(c0,minor0);
+		double det_val = double(r0[0])*c0[0]+double(r0[1])*c0[1]+double(r0[2])*c0[2]+double(r0[3])*c0[3];
+		if (std::fabs(det_val) < STP3D_EPSILON) return false;
+		det = _mm_set1_ps(float(1.0/det_val));
+
+		_mm_storeu_ps(m,   _mm_mul_ps(det,minor0));
+		_mm_storeu_ps(m+4, _mm_mul_ps(det,minor1));
+		_mm_storeu_ps(m+8, _mm_mul_ps(det,minor2));
+		_mm_storeu_ps(m+12,_mm_mul_ps(det,minor3));
+		return true;
+#else
+		double inv[16];
+		inv[0]  =  m[5]*m[10]*m[15] - m[5]*m[11]*m[14] - m[9]*m[6]*m[15] + m[9]*m[7]*m[14] + m[13]*m[6]*m[11] - m[13]*m[7]*m[10];
+		inv[4]  = -m[4]*m[10]*m[15] + m[4]*m[11]*m[14] + m[8]*m[6]*m[15] - m[8]*m[7]*m[14] - m[12]*m[6]*m[11] + m[12]*m[7]*m[10];
+		inv[8]  =  m[4]*m[9]*m[15]  - m[4]*m[11]*m[13] - m[8]*m[5]*m[15] + m[8]*m[7]*m[13] + m[12]*m[5]*m[11] - m[12]*m[7]*m[9];
+		inv[12] = -m[4]*m[9]*m[14]  + m[4]*m[10]*m[13] + m[8]*m[5]*m[14] - m[8]*m[6]*m[13] - m[12]*m[5]*m[10] + m[12]*m[6]*m[9];
+		inv[1]  = -m[1]*m[10]*m[15] + m[1]*m[11]*m[14] + m[9]*m[2]*m[15] - m[9]*m[3]*m[14] - m[13]*m[2]*m[11] + m[13]*m[3]*m[10];
+		inv[5]  =  m[0]*m[10]*m[15] - m[0]*m[11]*m[14] - m[8]*m[2]*m[15] + m[8]*m[3]*m[14] + m[12]*m[2]*m[11] - m[12]*m[3]*m[10];
+		inv[9]  = -m[0]*m[9]*m[15]  + m[0]*m[11]*m[13] + m[8]*m[1]*m[15] - m[8]*m[3]*m[13] - m[12]*m[1]*m[11] + m[12]*m[3]*m[9];
+		inv[13] =  m[0]*m[9]*m[14]  - m[0]*m[10]*m[13] - m[8]*m[1]*m[14] + m[8]*m[2]*m[13] + m[12]*m[1]*m[10] - m[12]*m[2]*m[9];
+		inv[2]  =  m[1]*m[6]*m[15]  - m[1]*m[7]*m[14]  - m[5]*m[2]*m[15] + m[5]*m[3]*m[14] + m[13]*m[2]*m[7]  - m[13]*m[3]*m[6];
+		inv[6]  = -m[0]*m[6]*m[15]  + m[0]*m[7]*m[14]  + m[4]*m[2]*m[15] - m[4]*m[3]*m[14] - m[12]*m[2]*m[7]  + m[12]*m[3]*m[6];
+		inv[10] =  m[0]*m[5]*m[15]  - m[0]*m[7]*m[13]  - m[4]*m[1]*m[15] + m[4]*m[3]*m[13] + m[12]*m[1]*m[7]  - m[12]*m[3]*m[5];
+		inv[14] = -m[0]*m[5]*m[14]  + m[0]*m[6]*m[13]  + m[4]*m[1]*m[14] - m[4]*m[2]*m[13] - m[12]*m[1]*m[6]  + m[12]*m[2]*m[5];
+		inv[3]  = -m[1]*m[6]*m[11]  + m[1]*m[7]*m[10]  + m[5]*m[2]*m[11] - m[5]*m[3]*m[10] - m[9]*m[2]*m[7]   + m[9]*m[3]*m[6];
+		inv[7]  =  m[0]*m[6]*m[11]  - m[0]*m[7]*m[10]  - m[4]*m[2]*m[11] + m[4]*m[3]*m[10] + m[8]*m[2]*m[7]   - m[8]*m[3]*m[6];
+		inv[11] = -m[0]*m[5]*m[11]  + m[0]*m[7]*m[9]   + m[4]*m[1]*m[11] - m[4]*m[3]*m[9]  - m[8]*m[1]*m[7]   + m[8]*m[3]*m[5];
+		inv[15] =  m[0]*m[5]*m[10]  - m[0]*m[6]*m[9]   - m[4]*m[1]*m[10] + m[4]*m[2]*m[9]  + m[8]*m[1]*m[6]   - m[8]*m[2]*m[5];
+
+		double det = double(m[0])*inv[0] + double(m[1])*inv[4] + double(m[2])*inv[8] + double(m[3])*inv[12];
+		if (std::fabs(det) < STP3D_EPSILON) return false;
+		det = 1.0/det;
+		for(int i=0;i<16;i++) m[i] = float(inv[i]*det);
+		return true;
+#endif
+	}
+
+	/** Inversion of an affine matrix (last line must be 0,0,0,1). Inversion in place.
+	  * Only the 3x3 linear part is inverted, the translation is then rotated back.
+	  * \return false (and \a m unchanged) if the matrix is singular
+	  */
+	inline bool invertAffine4x4(float* m) {
+		// Rows of the inverse of the 3x3 part are the cross products of its columns
+		float r0[3] = {m[5]*m[10]-m[6]*m[9], m[6]*m[8]-m[4]*m[10], m[4]*m[9]-m[5]*m[8]};
+		float r1[3] = {m[9]*m[2]-m[10]*m[1], m[10]*m[0]-m[8]*m[2], m[8]*m[1]-m[9]*m[0]};
+		float r2[3] = {m[1]*m[6]-m[2]*m[5], m[2]*m[4]-m[0]*m[6], m[0]*m[5]-m[1]*m[4]};
+		double det = double(m[0])*r0[0] + double(m[1])*r0[1] + double(m[2])*r0[2];
+		if (std::fabs(det) < STP3D_EPSILON) return false;
+		float inv_det = float(1.0/det);
+#if defined(STP3D_USE_SSE)
+		__m128 id = _mm_set1_ps(inv_det);
+		__m128 c0 = _mm_mul_ps(_mm_setr_ps(r0[0],r1[0],r2[0],0.0f),id);
+		__m128 c1 = _mm_mul_ps(_mm_setr_ps(r0[1],r1[1],r2[1],0.0f),id);
+		__m128 c2 = _mm_mul_ps(_mm_setr_ps(r0[2],r1[2],r2[2],0.0f),id);
+		__m128 t = _mm_mul_ps(c0,_mm_set1_ps(m[12]));
+		t = _mm_add_ps(t,_mm_mul_ps(c1,_mm_set1_ps(m[13])));
+		t = _mm_add_ps(t,_mm_mul_ps(c2,_mm_set1_ps(m[14])));
+		t = _mm_sub_ps(_mm_setr_ps(0.0f,0.0f,0.0f,1.0f),t);
+		_mm_storeu_ps(m,c0);
+		_mm_storeu_ps(m+4,c1);
+		_mm_storeu_ps(m+8,c2);
+		_mm_storeu_ps(m+12,t);
+#else
+		float tx = m[12], ty = m[13], tz = m[14];
+		m[0] = r0[0]*inv_det; m[4] = r0[1]*inv_det; m[8]  = r0[2]*inv_det;
+		m[1] = r1[0]*inv_det; m[5] = r1[1]*inv_det; m[9]  = r1[2]*inv_det;
+		m[2] = r2[0]*inv_det; m[6] = r2[1]*inv_det; m[10] = r2[2]*inv_det;
+		m[3] = m[7] = m[11] = 0.0f;
+		m[12] = -(m[0]*tx + m[4]*ty + m[8]*tz);
+		m[13] = -(m[1]*tx + m[5]*ty + m[9]*tz);
+		m[14] = -(m[2]*tx + m[6]*ty + m[10]*tz);
+		m[15] = 1.0f;
+#endif
+		return true;
+	}
+
+	/** Apply \a m to \a nb 4D vectors stored contiguously (x,y,z,w,x,y,z,w...).
+	  * \a src and \a dst may be the same array.
+	  */
+	inline void transformVec4(const float* m,const float* src,float* dst,size_t nb) {
+#if defined(STP3D_USE_SSE)
+		size_t i = 0;
+#if defined(STP3D_USE_AVX)
+		__m256 c0 = _mm256_broadcast_ps((const __m128*)(m));
+		__m256 c1 = _mm256_broadcast_ps((const __m128*)(m+4));
+		__m256 c2 = _mm256_broadcast_ps((const __m128*)(m+8));
+		__m256 c3 = _mm256_broadcast_ps((const __m128*)(m+12));
+		for(;i+2<=nb;i+=2) {
+			__m256 v = _mm256_loadu_ps(src+4*i);
+			__m256 r = _mm256_mul_ps(c0,_mm256_permute_ps(v,0x00));
+			r = _mm256_add_ps(r,_mm256_mul_ps(c1,_mm256_permute_ps(v,0x55)));
+			r = _mm256_add_ps(r,_mm256_mul_ps(c2,_mm256_permute_ps(v,0xAA)));
+			r = _mm256_add_ps(r,_mm256_mul_ps(c3,_mm256_permute_ps(v,0xFF)));
+			_mm256_storeu_ps(dst+4*i,r);
+		}
+#endif
+		__m128 m0 = _mm_loadu_ps(m);
+		__m128 m1 = _mm_loadu_ps(m+4);
+		__m128 m2 = _mm_loadu_ps(m+8);
+		__m128 m3 = _mm_loadu_ps(m+12);
+		for(;i<nb;i++) {
+			__m128 v = _mm_loadu_ps(src+4*i);
+			__m128 r = _mm_mul_ps(m0,_mm_shuffle_ps(v,v,0x00));
+			r = _mm_add_ps(r,_mm_mul_ps(m1,_mm_shuffle_ps(v,v,0x55)));
+			r = _mm_add_ps(r,_mm_mul_ps(m2,_mm_shuffle_ps(v,v,0xAA)));
+			r = _mm_add_ps(r,_mm_mul_ps(m3,_mm_shuffle_ps(v,v,0xFF)));
+			_mm_storeu_ps(dst+4*i,r);
+		}
+#else
+		for(size_t i=0;i<nb;i++) mulVec4(m,src+4*i,dst+4*i);
+#endif
+	}
+
+	/** Apply \a m to \a nb 3D points or directions stored contiguously (x,y,z,x,y,z...).
+	  * Points use w=1, directions w=0. Only x,y,z of the result are stored, so the
+	  * matrix is expected to be affine for points. \a src and \a dst may be the same array.
+	  */
+	inline void transformVec3(const float* m,const float* src,float* dst,size_t nb,bool is_point) {
+#if defined(STP3D_USE_SSE)
+		__m128 m0 = _mm_loadu_ps(m);
+		__m128 m1 = _mm_loadu_ps(m+4);
+		__m128 m2 = _mm_loadu_ps(m+8);
+		__m128 m3 = is_point ? _mm_loadu_ps(m+12) : _mm_setzero_ps();
+		for(size_t i=0;i<nb;i++,src+=3,dst+=3) {
+			__m128 r = _mm_mul_ps(m0,_mm_set1_ps(src[0]));
+			r = _mm_add_ps(r,_mm_mul_ps(m1,_mm_set1_ps(src[1])));
+			r = _mm_add_ps(r,_mm_mul_ps(m2,_mm_set1_ps(src[2])));
+			r = _mm_add_ps(r,m3);
+			_mm_storel_pi((__m64*)dst,r);
+			_mm_store_ss(dst+2,_mm_movehl_ps(r,r));
+		}
+#else
+		float w = is_point ? 1.0f : 0.0f;
+		for(size_t i=0;i<nb;i++,src+=3,dst+=3) {
+			float x = src[0], y = src[1], z = src[2];
+			dst[0] = x*m[0] + y*m[4] + z*m[8]  + w*m[12];
+			dst[1] = x*m[1] + y*m[5] + z*m[9]  + w*m[13];
+			dst[2] = x*m[2] + y*m[6] + z*m[10] + w*m[14];
+		}
+#endif
+	}
+
+} // simd namespace end
+
+} // Namespace end
+
+#endif
@@ -26,28 +26,60 @@
 
 namespace STP3D {
 
+	/**
+	  * \brief Class of a transformation, from the cheapest to the most general one.
+	  * Composing two transformations gives the greatest of the two classes.
+	  * <ul>
+	  * <li> TransfoIdentity : identity matrix
+	  * <li> TransfoRigid : rotations and translations only
+	  * <li> TransfoUniformScale : rigid motion combined with the same scaling on the 3 axes
+	  * <li> TransfoGeneral : anything else (non uniform scaling, shear, projection...)
+	  * </ul>
+	  */
+	enum TransformClass {TransfoIdentity,TransfoRigid,TransfoUniformScale,TransfoGeneral};
+
 	/**
 	  * \brief The Matrix Stack class allows to store matrix in a simple stack.
 	  * Matrix Stack allows to store several matrix in a stack order. This is
 	  * usefull especially when these matrix store different frame, allowing the
 	  * application to recall, thanks to the stack, previous frame.
+	  * Each matrix of the stack comes with its transformation class and a version
+	  * number, changed each time the matrix is modified. Users of the stack can then
+	  * know if the top matrix changed since they last read it (see getTopVersion()).
+	  * If the matrices are modified directly (through \a stack), touch() must be called.
 	  */
 	class MatrixStack {
 	public:
 		/// Standard construtor. Creates a stack containing one identity matrix.
-		MatrixStack() {
+		MatrixStack() : last_version(1) {
 			stack.clear();
 			stack.push_back(Matrix4D());
+			transfo_class.push_back(TransfoIdentity);
+			version.push_back(last_version);
 		};
 		~MatrixStack() {};
 
 		/// The stack of matrix
 		std::vector<Matrix4D> stack;
+		/// The transformation class of each matrix of the stack
+		std::vector<TransformClass> transfo_class;
+		/// The version of each matrix of the stack
+		std::vector<unsigned int> version;
 
 		/// Push. Copy the current top matrix. Create a new layer and store the copied matrix
-		void pushMatrix() {stack.push_back(stack.back());};
+		void pushMatrix() {
+			stack.push_back(stack.back());
+			transfo_class.push_back(transfo_class.back());
+			version.push_back(version.back());
+		};
 		/// Pop Matrix.
-		void popMatrix() {if (stack.size()>0) stack.pop_back();};
+		void popMatrix() {
+			if (stack.size()>0) {
+				stack.pop_back();
+				transfo_class.pop_back();
+				version.pop_back();
+			}
+		};
 
 		/// Get the number of matrix in the matrix stack
 		size_t getNbElt() {return stack.size();};
@@ -55,11 +87,24 @@ namespace STP3D {
 		void getTopGLMatrix(float mat[]) const {stack.back().get(mat);};
 		float* getTopGLMatrix() {return (float*)stack.back();};
 		Matrix4D getTopGLMatrix() const {return stack.back();};
+		/// Get the transformation class of the top level matrix
+		TransformClass getTopTransformClass() const {return transfo_class.back();};
+		/// Get the version of the top level matrix. Two equal versions mean the same matrix.
+		unsigned int getTopVersion() const {return version.back();};
+		/// Indicate that the top level matrix has been modified outside of the stack functions
+		void touch() {transfo_class.back() = classify(stack.back()); version.back() = ++last_version;};
 
 		/// Erasing all previous transformations and store identity transformation
 		void loadIdentity();
 		/// Erasing previous transformation and store a particular transformation
 		void loadTransformation(const Matrix4D& transfo);
+		/// Store a matrix previously read on the stack, with the class and version it had then
+		/// (getTopTransformClass(), getTopVersion()). Used to replay recorded draws.
+		void restoreTop(const Matrix4D& transfo,TransformClass transfo_cls,unsigned int transfo_version) {
+			stack.back() = transfo;
+			transfo_class.back() = transfo_cls;
+			version.back() = transfo_version;
+		};
 		/// Compose top level matrix with a new transformation
 		void addTransformation(const Matrix4D& transfo);
 		/// Compose top level matrix with a new translation
@@ -70,34 +115,84 @@ namespace STP3D {
 		void addHomothety(float scale);
 		/// Compose top level matrix with a new homothety varying on the 3 axis
 		void addHomothety(const Vector3D& scale);
+
+		/** Find the transformation class of a matrix.
+		  * Columns of the 3x3 part are tested for orthogonality and equal length (with a small tolerance).
+		  */
+		static TransformClass classify(const Matrix4D& m);
+
+	private:
+		/// Last version number given to a matrix
+		unsigned int last_version;
+		/// Store the result of a modification of the top level matrix
+		void changeTop(TransformClass added_class) {
+			if (added_class > transfo_class.back()) transfo_class.back() = added_class;
+			version.back() = ++last_version;
+		};
 	};
 
+	inline TransformClass MatrixStack::classify(const Matrix4D& m) {
+		const float* a = m.mat;
+		if (!m.isAffine()) return TransfoGeneral;
+		static const float id[16] = {1.0f,0.0f,0.0f,0.0f,0.0f,1.0f,0.0f,0.0f,0.0f,0.0f,1.0f,0.0f,0.0f,0.0f,0.0f,1.0f};
+		if (memcmp(a,id,16*sizeof(float)) == 0) return TransfoIdentity;
+		float n0 = a[0]*a[0]+a[1]*a[1]+a[2]*a[2];
+		float n1 = a[4]*a[4]+a[5]*a[5]+a[6]*a[6];
+		float n2 = a[8]*a[8]+a[9]*a[9]+a[10]*a[10];
+		float d01 = a[0]*a[4]+a[1]*a[5]+a[2]*a[6];
+		float d02 = a[0]*a[8]+a[1]*a[9]+a[2]*a[10];
+		float d12 = a[4]*a[8]+a[5]*a[9]+a[6]*a[10];
+		const float tol = 1e-5f*n0;
+		if (n0 == 0.0f || fabs(n1-n0) > tol || fabs(n2-n0) > tol ||
+		    fabs(d01) > tol || fabs(d02) > tol || fabs(d12) > tol) return TransfoGeneral;
+		return (fabs(n0-1.0f) <= 1e-5f) ? TransfoRigid : TransfoUniformScale;
+	}
+
 	inline void MatrixStack::loadIdentity() {
+		// Nothing changes (and the version is kept) if the top matrix is already the identity
+		if (transfo_class.back() == TransfoIdentity) return;
 		stack.back() = Matrix4D();
+		transfo_class.back() = TransfoIdentity;
+		version.back() = ++last_version;
 	}
 
 	inline void MatrixStack::loadTransformation(const Matrix4D& transfo) {
+		if (memcmp(stack.back().mat,transfo.mat,16*sizeof(float)) == 0) return;
 		stack.back() = transfo;
+		transfo_class.back() = classify(transfo);
+		version.back() = ++last_version;
 	}
 
 	inline void MatrixStack::addTransformation(const Matrix4D& transfo) {
+		TransformClass added = classify(transfo);
+		if (added == TransfoIdentity) return;
 		stack.back() *= transfo;
+		changeTop(added);
 	}
 
 	inline void MatrixStack::addTranslation(const Vector3D& trans) {
 		stack.back() *= Matrix4D::translation(trans);
+		changeTop(TransfoRigid);
 	}
 
 	inline void MatrixStack::addRotation(float angle,const Vector3D& axe) {
 		stack.back() *= Matrix4D::rotation(angle,axe);
+		changeTop(TransfoRigid);
 	}
 
 	inline void MatrixStack::addHomothety(float scale) {
 		stack.back() *= Matrix4D::homothety(scale,scale,scale);
+		changeTop((scale == 1.0f) ? TransfoRigid : ((scale != 0.0f) ? TransfoUniformScale : TransfoGeneral));
 	}
 
 	inline void MatrixStack::addHomothety(const Vector3D& scale) {
 		stack.back() *= Matrix4D::homothety(scale.x,scale.y,scale.z);
+		if (scale.x == scale.y && scale.x == scale.z) {
+			changeTop((scale.x == 1.0f) ? TransfoRigid : ((scale.x != 0.0f) ? TransfoUniformScale : TransfoGeneral));
+		}
+		else {
+			changeTop(TransfoGeneral);
+		}
 	}
 
 };
@@ -26,23 +26,30 @@
 #include <string>
 #include <vector>
 #include "gl_tools.hpp"
+#include "gl_state.hpp"
+#include "instance_buffer.hpp"
+#include "vertex_layout.hpp"
+#include "profiler.hpp"
 
 namespace STP3D {
 
+	class MultiDrawBatch;
+
 	/**
 	  * \brief Mesh class allows to store generic informations about a mesh 
 	  * that has no indirect order.
 	  * Mesh class allows to store several float buffer to use with a GL shaders.
 	  * Such buffers are not interleaved and each has a semantic on his own. 
 	  * Note that a mesh MUST have at least one buffer of coordinates.
-	  * This class allows also the creation of the corresponding VBO.
+	  * This class allows also the creation of the corresponding VBO, one per
+	  * buffer or interleaved and packed as given by a VertexLayout.
 	  * This class may or may not store the data.
 	  */
 	class StandardMesh {
 	public:
 		/// Standard construtor. Creates an empty mesh withouh any information.
 		StandardMesh(unsigned int elts = 0,unsigned int new_gl_type = GL_TRIANGLES) 
-			: nb_elts(elts),gl_type_mesh(new_gl_type),id_vao(0) {
+			: nb_elts(elts),gl_type_mesh(new_gl_type),id_vao(0),instance_serial(0),quantized(false) {
 			buffers.clear();
 			size_one_elt.clear();
 			attr_id.clear();
@@ -53,6 +60,9 @@ namespace STP3D {
 
 		/// Set the number of elements in each buffers
 		void setNbElt(unsigned int elts) {nb_elts = elts;};
+		unsigned int getNbElt() const {return nb_elts;};
+		/// CPU data of the buffer added in \param i th position (NULL if none or released)
+		const float* getBuffer(unsigned int i) const {return (i < buffers.size()) ? buffers[i] : NULL;};
 		void addOneBuffer(unsigned int id_attribute,unsigned int one_elt_size,
 		                  float* data,std::string semantic,bool copy=false);
 		void releaseCPUMemory();
@@ -61,9 +71,23 @@ namespace STP3D {
 		 *                      GL RELATED FUNCTIONS
 		 *****************************************************************/
 		void changeType(unsigned int new_gl_type) {gl_type_mesh = new_gl_type;};
+		/// Layout of the VBO made by the next createVAO (default : one VBO of floats per buffer)
+		void setVertexLayout(const VertexLayout& new_layout) {layout = new_layout;};
+		const VertexLayout& getVertexLayout() const {return layout;};
+		/// Bytes of one vertex in GL
+		unsigned int getBytesPerVertex() const {return layout.vertexSize(attr_id,size_one_elt);};
+		/// True if the positions are quantized : getDequantization() must be composed with the modelview matrix
+		bool hasDequantization() const {return quantized;};
+		const Matrix4D& getDequantization() const {return dequant_matrix;};
 		bool createVAO();
 		unsigned int getIdVAO();
 		void draw() const;
+		/// Draw one copy of the mesh per instance of \param instances (with an instanced shader)
+		void drawInstanced(InstanceBuffer& instances);
+		/// A batch copies the CPU data of its meshes
+		friend class MultiDrawBatch;
+		/// Mesh files are written from the CPU data and loaded without copy
+		friend class MeshFile;
 private:
 		//  User defined members
 		/// All the data in CPU buffers
@@ -86,6 +110,12 @@ private:
 		std::vector<unsigned int> vbo_id;
 		/// Id of the corresponding VAO
 		unsigned int id_vao;
+		/// Instance buffer the instance attributes of the VAO use (0 : none)
+		unsigned int instance_serial;
+		/// Layout of the VBO and dequantization matrix of the positions
+		VertexLayout layout;
+		Matrix4D dequant_matrix;
+		bool quantized;
 
 	};
 
@@ -96,19 +126,21 @@ private:
  		size_one_elt.clear();
 		attr_id.clear();
 		attr_semantic.clear();
-		glDeleteBuffers(vbo_id.size(),&(vbo_id[0]));
+		if (!vbo_id.empty()) GLState::deleteBuffers(vbo_id.size(),&(vbo_id[0]));
 		vbo_id.clear();
-		glDeleteVertexArrays(1,&id_vao);
+		if (id_vao) GLState::deleteVertexArrays(1,&id_vao);
 	}
 
 	inline bool StandardMesh::createVAO() {
+		STP3D_PROFILE_ZONE("StandardMesh::createVAO");
 		// Create and use the VAO
 		glGenVertexArrays(1,&id_vao);
+		instance_serial = 0;
 		if (id_vao == 0) {
 			STP3D::setError("Unable to find a value for a VAO");
 			return false;
 		}
-		glBindVertexArray(id_vao);
+		GLState::bindVertexArray(id_vao);
 
 		// Check if mesh is defined
 		if (buffers.size()==0) {
@@ -116,26 +148,14 @@ private:
 			return false;
 		}
 
-		// Create all VBO (\TODO check every VBO is created)
-		vbo_id.resize(buffers.size());
-
-		glGenBuffers(buffers.size(),&(vbo_id[0]));
-
-		// Transfer all data for all VBO from CPU to GPU
+		// Create all VBO and transfer all data from CPU to GPU (packed as the layout says)
+		if (!layout.createBuffers(nb_elts,attr_id,size_one_elt,buffers,vbo_id,dequant_matrix)) return false;
+		quantized = (MatrixStack::classify(dequant_matrix) != TransfoIdentity);
 		for(std::vector<int>::size_type i = 0; i < buffers.size(); ++i) {
-			std::cerr<<"Id VBO for "<<attr_semantic[i]<<" : "<<vbo_id[i]<<std::endl;
-			glBindBuffer(GL_ARRAY_BUFFER,vbo_id[i]);
-
-			glBufferData(GL_ARRAY_BUFFER,nb_elts*size_one_elt[i]*sizeof(GLfloat),buffers[i],GL_STATIC_DRAW);
-
-			glEnableVertexAttribArray(attr_id[i]);
-
-			glVertexAttribPointer(attr_id[i], size_one_elt[i], GL_FLOAT, GL_FALSE, 0, 0);
-
-			glBindBuffer(GL_ARRAY_BUFFER,0);
+			std::cerr<<"Id VBO for "<<attr_semantic[i]<<" : "<<vbo_id[layout.isInterleaved() ? 0 : i]<<std::endl;
 		}
-		
-		glBindVertexArray(0);
+
+		GLState::bindVertexArray(0);
 		return true;
 	}
 
@@ -156,12 +176,25 @@ private:
 		attr_semantic.push_back(semantic);
 	}
 
+	inline unsigned int StandardMesh::getIdVAO() {
+		return id_vao;
+	}
+
 	inline void StandardMesh::draw() const {
-		glBindVertexArray(id_vao);
+		STP3D_PROFILE_GPU_ZONE("StandardMesh::draw");
+		// The VAO stays bound : drawing the same mesh again costs no bind
+		GLState::bindVertexArray(id_vao);
 
 		glDrawArrays(gl_type_mesh,0,nb_elts);
+	}
+
+	inline void StandardMesh::drawInstanced(InstanceBuffer& instances) {
+		if (instances.size() == 0) return;
+		STP3D_PROFILE_GPU_ZONE("StandardMesh::drawInstanced");
+		GLState::bindVertexArray(id_vao);
+		instances.attach(instance_serial);
 
-		glBindVertexArray(0);
+		glDrawArraysInstanced(gl_type_mesh,0,nb_elts,instances.size());
 	}
 
 	inline void StandardMesh::reInit() {
@@ -173,9 +206,9 @@ private:
  		size_one_elt.clear();
 		attr_id.clear();
 		attr_semantic.clear();
-		glDeleteBuffers(vbo_id.size(),&(vbo_id[0]));
+		if (!vbo_id.empty()) GLState::deleteBuffers(vbo_id.size(),&(vbo_id[0]));
 		vbo_id.clear();
-		glDeleteVertexArrays(1,&id_vao);
+		GLState::deleteVertexArrays(1,&id_vao);
 	}
 
 	inline void StandardMesh::releaseCPUMemory() {
@@ -0,0 +1,321 @@
+/***************************************************************************
+                         mesh_file.hpp  -  description
+                             -------------------
+    copyright            : (C) 2012 by Biri Venceslas
+    email                : biri@univ-mlv.fr
+ ***************************************************************************/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef _STP3D_MESH_FILE_HPP_
+#define _STP3D_MESH_FILE_HPP_
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cfloat>
+#include <cstdint>
+#include <algorithm>
+#include "globals.hpp"
+#include "mapped_file.hpp"
+#include "mesh.hpp"
+#include "indexed_mesh.hpp"
+#include "vertex_layout.hpp"
+
+namespace STP3D {
+
+	/// Header of a mesh file (little endian)
+	struct MeshFileHeader {
+		/// "STP3DMSH"
+		char magic[8];
+		/// MeshFile::VERSION
+		uint32_t version;
+		/// 1 for an IndexedMesh, 0 for a StandardMesh
+		uint32_t indexed;
+		uint32_t gl_type;
+		uint32_t nb_vertices;
+		/// Number of indices (0 for a StandardMesh)
+		uint32_t nb_indices;
+		uint32_t nb_attributes;
+		/// Bounding box of attribute 0
+		float bounds_min[3];
+		float bounds_max[3];
+		/// Offset of the indices (unsigned int) in the file
+		uint64_t index_offset;
+		/// Size of the whole file (detects truncated files)
+		uint64_t file_size;
+	};
+
+	/// Descriptor of one vertex attribute, following the header
+	struct MeshFileAttribute {
+		/// Attribute id and floats per vertex (as given to addOneBuffer)
+		uint32_t id;
+		uint32_t nb_components;
+		/// Offset of the nb_vertices*nb_components floats in the file
+		uint64_t offset;
+		char semantic[32];
+	};
+
+	/**
+	  * \brief Binary file of a StandardMesh or an IndexedMesh.
+	  * The file holds a header, the attribute descriptors then one blob per
+	  * attribute (floats, as addOneBuffer takes them) and the indices, each
+	  * aligned on BLOB_ALIGNMENT bytes. Reading maps the file in memory (MappedFile) :
+	  * createVAO reads the blobs in place, so loading a mesh makes no copy of its
+	  * data on the CPU side. Meshes created from a file have no CPU data.
+	  * Writing needs the CPU data of the mesh (before releaseCPUMemory).
+	  */
+	class MeshFile {
+	public:
+		static const uint32_t VERSION = 1;
+		static const unsigned int BLOB_ALIGNMENT = 64;
+
+		MeshFile() : data(NULL),size(0) {};
+		~MeshFile() {close();};
+
+		/// Write the mesh in \param filename. Returns false if the mesh has no CPU data or on write error.
+		static bool write(const std::string& filename,const StandardMesh& mesh);
+		static bool write(const std::string& filename,const IndexedMesh& mesh);
+
+		/// Map the file and check its header. The file stays mapped until close().
+		bool open(const std::string& filename);
+		void close();
+		bool isOpen() const {return data != NULL;};
+		const MeshFileHeader& getHeader() const {return *(const MeshFileHeader*)data;};
+		bool isIndexed() const {return getHeader().indexed != 0;};
+
+		/// Create the mesh of the opened file with its VAO, with the vertex \param layout.
+		/// Returns NULL if the file holds the other type of mesh or on GL error.
+		StandardMesh* createStandardMesh(const VertexLayout& layout = VertexLayout()) const;
+		IndexedMesh* createIndexedMesh(const VertexLayout& layout = VertexLayout()) const;
+
+		/// open, createIndexedMesh (or createStandardMesh) and close
+		static IndexedMesh* loadIndexedMesh(const std::string& filename,const VertexLayout& layout = VertexLayout());
+		static StandardMesh* loadStandardMesh(const std::string& filename,const VertexLayout& layout = VertexLayout());
+
+	private:
+		// Owns a mapping : no copy
+		MeshFile(const MeshFile&);
+		MeshFile& operator=(const MeshFile&);
+		static bool writeFile(const std::string& filename,bool indexed,unsigned int gl_type,unsigned int nb_vertices,
+		                      const std::vector<unsigned int>& ids,const std::vector<unsigned int>& sizes,
+		                      const std::vector<std::string>& semantics,const std::vector<float*>& buffers,
+		                      const unsigned int* indices,unsigned int nb_indices);
+		static uint64_t align(uint64_t offset) {return (offset+BLOB_ALIGNMENT-1)/BLOB_ALIGNMENT*BLOB_ALIGNMENT;};
+		/// Check that every blob lies in the file and that the indices are less than the number of vertices
+		bool check() const;
+		const MeshFileAttribute& attribute(unsigned int i) const {
+			return ((const MeshFileAttribute*)(data+sizeof(MeshFileHeader)))[i];
+		};
+
+		MappedFile mapping;
+		/// Content of the mapping (NULL if not opened)
+		const unsigned char* data;
+		size_t size;
+	};
+
+	inline bool MeshFile::writeFile(const std::string& filename,bool indexed,unsigned int gl_type,unsigned int nb_vertices,
+	                                const std::vector<unsigned int>& ids,const std::vector<unsigned int>& sizes,
+	                                const std::vector<std::string>& semantics,const std::vector<float*>& buffers,
+	                                const unsigned int* indices,unsigned int nb_indices) {
+		for(unsigned int i=0;i<buffers.size();i++) {
+			if (!buffers[i]) {
+				STP3D::setError("MeshFile : unable to write a mesh without CPU data");
+				return false;
+			}
+		}
+		if (indexed && !indices) {
+			STP3D::setError("MeshFile : unable to write a mesh without CPU indices");
+			return false;
+		}
+		MeshFileHeader header;
+		memset(&header,0,sizeof(header));
+		memcpy(header.magic,"STP3DMSH",8);
+		header.version = VERSION;
+		header.indexed = indexed ? 1 : 0;
+		header.gl_type = gl_type;
+		header.nb_vertices = nb_vertices;
+		header.nb_indices = indexed ? nb_indices : 0;
+		header.nb_attributes = ids.size();
+		for(int c=0;c<3;c++) {
+			header.bounds_min[c] = (nb_vertices > 0) ? FLT_MAX : 0.0f;
+			header.bounds_max[c] = (nb_vertices > 0) ? -FLT_MAX : 0.0f;
+		}
+		std::vector<MeshFileAttribute> attributes(ids.size());
+		uint64_t offset = align(sizeof(MeshFileHeader)+ids.size()*sizeof(MeshFileAttribute));
+		for(unsigned int i=0;i<ids.size();i++) {
+			MeshFileAttribute& attr = attributes[i];
+			memset(&attr,0,sizeof(attr));
+			attr.id = ids[i];
+			attr.nb_components = sizes[i];
+			attr.offset = offset;
+			strncpy(attr.semantic,semantics[i].c_str(),sizeof(attr.semantic)-1);
+			offset = align(offset+uint64_t(nb_vertices)*sizes[i]*sizeof(float));
+			if (ids[i] != 0) continue;
+			for(unsigned int v=0;v<nb_vertices;v++) {
+				for(unsigned int c=0;c<sizes[i] && c<3;c++) {
+					float x = buffers[i][v*sizes[i]+c];
+					if (x < header.bounds_min[c]) header.bounds_min[c] = x;
+					if (x > header.bounds_max[c]) header.bounds_max[c] = x;
+				}
+			}
+		}
+		header.index_offset = indexed ? offset : 0;
+		header.file_size = indexed ? offset+uint64_t(nb_indices)*sizeof(unsigned int) : offset;
+
+		std::ofstream file(filename.c_str(),std::ios::binary);
+		if (!file) {
+			STP3D::setError("MeshFile : unable to create the file");
+			return false;
+		}
+		static const char padding[BLOB_ALIGNMENT] = {0};
+		file.write((const char*)&header,sizeof(header));
+		if (!attributes.empty()) file.write((const char*)&attributes[0],attributes.size()*sizeof(MeshFileAttribute));
+		for(unsigned int i=0;i<ids.size();i++) {
+			file.write(padding,attributes[i].offset-uint64_t(file.tellp()));
+			file.write((const char*)buffers[i],uint64_t(nb_vertices)*sizes[i]*sizeof(float));
+		}
+		if (indexed) {
+			file.write(padding,header.index_offset-uint64_t(file.tellp()));
+			file.write((const char*)indices,uint64_t(nb_indices)*sizeof(unsigned int));
+		}
+		else {
+			file.write(padding,header.file_size-uint64_t(file.tellp()));
+		}
+		if (!file) {
+			STP3D::setError("MeshFile : write error");
+			return false;
+		}
+		return true;
+	}
+
+	inline bool MeshFile::write(const std::string& filename,const StandardMesh& mesh) {
+		return writeFile(filename,false,mesh.gl_type_mesh,mesh.nb_elts,mesh.attr_id,mesh.size_one_elt,
+		                 mesh.attr_semantic,mesh.buffers,NULL,0);
+	}
+
+	inline bool MeshFile::write(const std::string& filename,const IndexedMesh& mesh) {
+		return writeFile(filename,true,mesh.gl_type_mesh,mesh.nb_elts,mesh.attr_id,mesh.size_one_elt,
+		                 mesh.attr_semantic,mesh.buffers,mesh.index_buffer,mesh.nb_primitive*mesh.nb_idx_per_primitive);
+	}
+
+	inline bool MeshFile::open(const std::string& filename) {
+		close();
+		// Blobs are read once, in order, by createVAO
+		if (!mapping.open(filename,true)) return false;
+		data = mapping.getData();
+		size = mapping.getSize();
+		if (!check()) {
+			STP3D::setError("MeshFile : not a mesh file, wrong version, truncated file or index out of range");
+			close();
+			return false;
+		}
+		return true;
+	}
+
+	inline void MeshFile::close() {
+		mapping.close();
+		data = NULL;
+		size = 0;
+	}
+
+	inline bool MeshFile::check() const {
+		if (size < sizeof(MeshFileHeader)) return false;
+		const MeshFileHeader& header = getHeader();
+		if (memcmp(header.magic,"STP3DMSH",8) != 0 || header.version != VERSION || header.file_size != size) return false;
+		if (header.nb_attributes > 64 || sizeof(MeshFileHeader)+header.nb_attributes*sizeof(MeshFileAttribute) > size) return false;
+		for(unsigned int i=0;i<header.nb_attributes;i++) {
+			const MeshFileAttribute& attr = attribute(i);
+			if (attr.nb_components == 0 || attr.nb_components > 4 || attr.offset%sizeof(float) != 0) return false;
+			if (attr.offset > size || uint64_t(header.nb_vertices)*attr.nb_components*sizeof(float) > size-attr.offset) return false;
+		}
+		if (header.indexed) {
+			if (header.index_offset%sizeof(unsigned int) != 0 || header.index_offset > size) return false;
+			if (uint64_t(header.nb_indices)*sizeof(unsigned int) > size-header.index_offset) return false;
+			// A corrupted index would make GL fetch vertices out of the buffers
+			const unsigned int* indices = (const unsigned int*)(data+header.index_offset);
+			unsigned int max_index = 0;
+			for(unsigned int i=0;i<header.nb_indices;i++) max_index = std::max(max_index,indices[i]);
+			if (header.nb_indices > 0 && max_index >= header.nb_vertices) return false;
+		}
+		return true;
+	}
+
+	inline StandardMesh* MeshFile::createStandardMesh(const VertexLayout& layout) const {
+		if (!data || isIndexed()) {
+			STP3D::setError("MeshFile : no standard mesh in the file");
+			return NULL;
+		}
+		const MeshFileHeader& header = getHeader();
+		StandardMesh* mesh = new StandardMesh(header.nb_vertices,header.gl_type);
+		// The buffers point in the mapping, not copied
+		for(unsigned int i=0;i<header.nb_attributes;i++) {
+			const MeshFileAttribute& attr = attribute(i);
+			std::string semantic(attr.semantic,strnlen(attr.semantic,sizeof(attr.semantic)));
+			mesh->addOneBuffer(attr.id,attr.nb_components,(float*)(data+attr.offset),semantic,false);
+		}
+		mesh->setVertexLayout(layout);
+		bool ok = mesh->createVAO();
+		// The mapping is released by close() : the mesh keeps no CPU data
+		for(unsigned int i=0;i<mesh->buffers.size();i++) mesh->buffers[i] = NULL;
+		if (!ok) {
+			delete mesh;
+			return NULL;
+		}
+		return mesh;
+	}
+
+	inline IndexedMesh* MeshFile::createIndexedMesh(const VertexLayout& layout) const {
+		if (!data || !isIndexed()) {
+			STP3D::setError("MeshFile : no indexed mesh in the file");
+			return NULL;
+		}
+		const MeshFileHeader& header = getHeader();
+		IndexedMesh* mesh = new IndexedMesh(0,header.nb_vertices,header.gl_type);
+		if (mesh->nb_idx_per_primitive == 0) {
+			delete mesh;
+			return NULL;
+		}
+		mesh->nb_primitive = header.nb_indices/mesh->nb_idx_per_primitive;
+		mesh->index_buffer = (unsigned int*)(data+header.index_offset);
+		for(unsigned int i=0;i<header.nb_attributes;i++) {
+			const MeshFileAttribute& attr = attribute(i);
+			std::string semantic(attr.semantic,strnlen(attr.semantic,sizeof(attr.semantic)));
+			mesh->addOneBuffer(attr.id,attr.nb_components,(float*)(data+attr.offset),semantic,false);
+		}
+		mesh->setVertexLayout(layout);
+		bool ok = mesh->createVAO();
+		// IndexedMesh deletes its buffers : they must not point in the mapping anymore
+		for(unsigned int i=0;i<mesh->buffers.size();i++) mesh->buffers[i] = NULL;
+		mesh->index_buffer = NULL;
+		if (!ok) {
+			delete mesh;
+			return NULL;
+		}
+		return mesh;
+	}
+
+	inline IndexedMesh* MeshFile::loadIndexedMesh(const std::string& filename,const VertexLayout& layout) {
+		MeshFile file;
+		if (!file.open(filename)) return NULL;
+		return file.createIndexedMesh(layout);
+	}
+
+	inline StandardMesh* MeshFile::loadStandardMesh(const std::string& filename,const VertexLayout& layout) {
+		MeshFile file;
+		if (!file.open(filename)) return NULL;
+		return file.createStandardMesh(layout);
+	}
+
+};
+
+#endif
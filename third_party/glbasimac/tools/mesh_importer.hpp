@@ -0,0 +1,1106 @@
+/***************************************************************************
+                      mesh_importer.hpp  -  description
+                             -------------------
+    copyright            : (C) 2012 by Biri Venceslas
+    email                : biri@univ-mlv.fr
+ ***************************************************************************/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef _STP3D_MESH_IMPORTER_HPP_
+#define _STP3D_MESH_IMPORTER_HPP_
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <chrono>
+#include <algorithm>
+#include <climits>
+#include <cctype>
+#include <cstring>
+#include <cstdlib>
+#include <cstdint>
+#include <cmath>
+#include "globals.hpp"
+#include "indexed_mesh.hpp"
+#include "mapped_file.hpp"
+
+namespace STP3D {
+
+	/// Figures of the last import (MeshImporter::load)
+	struct MeshImportStats {
+		MeshImportStats() : bytes(0),nb_vertices(0),nb_triangles(0),nb_threads(0),seconds(0.0) {}
+		/// Size of the file
+		size_t bytes;
+		/// Vertices of the mesh (after welding for OBJ files)
+		unsigned int nb_vertices;
+		unsigned int nb_triangles;
+		unsigned int nb_threads;
+		/// Map, parse and build the CPU buffers (createVAO is not included)
+		double seconds;
+		double megabytesPerSecond() const {return (seconds > 0.0) ? bytes/(1024.0*1024.0)/seconds : 0.0;}
+		double trianglesPerSecond() const {return (seconds > 0.0) ? nb_triangles/seconds : 0.0;}
+	};
+
+	inline std::ostream& operator<<(std::ostream& os,const MeshImportStats& st) {
+		os<<st.nb_triangles<<" triangles, "<<st.nb_vertices<<" vertices in "<<st.seconds*1000.0<<" ms with ";
+		os<<st.nb_threads<<" threads ("<<st.megabytesPerSecond()<<" MB/s, "<<st.trianglesPerSecond()/1.0e6<<" M triangles/s)";
+		return os;
+	}
+
+	/**
+	  * \brief Import of Wavefront OBJ and PLY (ascii, binary little and big endian) files
+	  * as GL_TRIANGLES IndexedMesh.
+	  * The file is mapped in memory (MappedFile) and cut in one chunk per thread :
+	  * <ul>
+	  * <li> OBJ : chunks are cut at line ends and parsed in parallel. Then the v/vt/vn
+	  *      triplets of the faces are welded into vertices with a lock free hash table
+	  *      (open addressing, compare and swap), shared by all the threads. The vertices
+	  *      are numbered in order of first use, so the result does not depend on the
+	  *      number of threads.
+	  * <li> PLY : the vertex element is cut in ranges of vertices (lines in ascii) and
+	  *      the face element in ranges of faces, parsed in parallel. Binary faces
+	  *      holding only triangles are read without a first pass.
+	  * </ul>
+	  * Polygons are triangulated in fans. The attributes are 0 (coordinates), 1 (normals,
+	  * computed from the triangles if the file has none) and 2 (uvs, if the file has some).
+	  * Errors return NULL with the reason in STP3D::getError().
+	  */
+	class MeshImporter {
+	public:
+		/// Load \param filename (by extension : .obj or .ply) with \param nb_threads threads
+		/// (0 : one per core). The mesh has its CPU data and no VAO.
+		static IndexedMesh* load(const std::string& filename,unsigned int nb_threads = 0,MeshImportStats* stats = NULL);
+		static IndexedMesh* loadOBJ(const std::string& filename,unsigned int nb_threads = 0,MeshImportStats* stats = NULL);
+		static IndexedMesh* loadPLY(const std::string& filename,unsigned int nb_threads = 0,MeshImportStats* stats = NULL);
+		/// Parse files already in memory
+		static IndexedMesh* parseOBJ(const char* text,size_t size,unsigned int nb_threads = 0);
+		static IndexedMesh* parsePLY(const unsigned char* data,size_t size,unsigned int nb_threads = 0);
+
+		/// Parse a decimal float after spaces (no locale, no nan/inf). Return the end of the number or NULL.
+		static const char* parseFloat(const char* p,const char* end,float& value);
+		/// Parse a decimal integer after spaces. Return the end of the number or NULL.
+		static const char* parseInt(const char* p,const char* end,int64_t& value);
+
+	private:
+		/// One corner of an OBJ face : 0 based v, vt and vn numbers (NO_INDEX when missing)
+		struct ObjCorner {
+			int v,t,n;
+			bool operator==(const ObjCorner& c) const {return v == c.v && t == c.t && n == c.n;}
+		};
+		static const int NO_INDEX = INT_MIN;
+		/// Part of an OBJ file parsed by one thread
+		struct ObjChunk {
+			ObjChunk() : begin(NULL),end(NULL),error(NULL) {}
+			const char* begin;
+			const char* end;
+			std::vector<float> positions,uvs,normals;
+			/// Corners of the triangles
+			std::vector<ObjCorner> corners;
+			/// Per corner, bits 0, 1 and 2 set when v, vt or vn is relative (negative in the file) :
+			/// the number is then counted from the start of the chunk. Empty if there is none.
+			std::vector<unsigned char> relative;
+			/// First line that could not be parsed
+			const char* error;
+		};
+		enum PlyType {PlyInt8,PlyUInt8,PlyInt16,PlyUInt16,PlyInt32,PlyUInt32,PlyFloat32,PlyFloat64,PlyUnknown};
+		struct PlyProperty {
+			std::string name;
+			PlyType type;
+			/// List : count_type is the type of the number of values
+			bool list;
+			PlyType count_type;
+			/// Coordinate written : 0-2 position, 3-5 normal, 6-7 uv, -1 none
+			int target;
+		};
+		struct PlyElement {
+			std::string name;
+			size_t count;
+			std::vector<PlyProperty> properties;
+			/// Bytes of one element in binary files (0 if it holds a list)
+			size_t stride;
+		};
+
+		static unsigned int threadCount(unsigned int nb_threads,size_t size);
+		/// Run \param f(thread) on \param nb_threads threads (the caller being thread 0)
+		template<typename Function> static void parallel(unsigned int nb_threads,Function f);
+		static size_t rangeBegin(size_t n,unsigned int t,unsigned int nb) {return (size_t)((unsigned long long)n*t/nb);}
+		static bool isBlank(char c) {return c == ' ' || c == '\t' || c == '\r';}
+		static bool isDigit(char c) {return c >= '0' && c <= '9';}
+		static const char* skipBlanks(const char* p,const char* end) {
+			while (p < end && isBlank(*p)) p++;
+			return p;
+		}
+		static const char* lineEnd(const char* p,const char* end) {
+			const char* eol = (const char*)memchr(p,'\n',end-p);
+			return eol ? eol : end;
+		}
+		/// Cut [text,text+size[ in \param nb parts starting at a line
+		static std::vector<const char*> splitLines(const char* text,size_t size,unsigned int nb);
+
+		static void parseObjChunk(ObjChunk& chunk);
+		/// Reserve the arrays of the chunk from samples of its lines (no reallocation while parsing)
+		static void reserveObjChunk(ObjChunk& chunk);
+		static bool parseObjCorner(const char*& p,const char* end,const ObjChunk& chunk,ObjCorner& corner,unsigned char& relative);
+		static uint64_t hashCorner(const ObjCorner& c);
+		static void atomicMin(std::atomic<unsigned int>& a,unsigned int x) {
+			unsigned int current = a.load(std::memory_order_relaxed);
+			while (x < current && !a.compare_exchange_weak(current,x,std::memory_order_relaxed));
+		}
+
+		static PlyType plyType(const std::string& name);
+		static size_t plySize(PlyType type);
+		static double plyValue(const unsigned char* p,PlyType type,bool swap);
+		static bool parsePlyHeader(const unsigned char* data,size_t size,std::vector<PlyElement>& elements,int& format,size_t& body);
+		/// Skip a binary element holding lists. Return the end of the element or NULL.
+		static const unsigned char* skipPlyElement(const unsigned char* p,const unsigned char* end,const PlyElement& element,bool swap);
+
+		/// Mesh owning the buffers (allocated with new[]). Normals are computed if \param normals is NULL.
+		static IndexedMesh* makeMesh(unsigned int nb_vertices,unsigned int nb_triangles,float* positions,float* normals,
+		                             float* uvs,unsigned int* indices);
+		static void computeNormals(const float* positions,const unsigned int* indices,unsigned int nb_vertices,
+		                           unsigned int nb_triangles,float* normals);
+	};
+
+	inline const char* MeshImporter::parseFloat(const char* p,const char* end,float& value) {
+		static const double powers[23] = {1e0,1e1,1e2,1e3,1e4,1e5,1e6,1e7,1e8,1e9,1e10,1e11,1e12,1e13,1e14,1e15,
+		                                  1e16,1e17,1e18,1e19,1e20,1e21,1e22};
+		p = skipBlanks(p,end);
+		if (p == end) return NULL;
+		bool negative = (*p == '-');
+		if (*p == '-' || *p == '+') p++;
+		// Up to 19 significant digits in the mantissa, the others only move the exponent
+		uint64_t mantissa = 0;
+		int digits = 0,exponent = 0;
+		bool found = false;
+		for(;p < end && isDigit(*p);p++) {
+			found = true;
+			if (digits < 19) {
+				mantissa = mantissa*10+(*p-'0');
+				if (mantissa) digits++;
+			}
+			else exponent++;
+		}
+		if (p < end && *p == '.') {
+			for(p++;p < end && isDigit(*p);p++) {
+				found = true;
+				if (digits < 19) {
+					mantissa = mantissa*10+(*p-'0');
+					if (mantissa) digits++;
+					exponent--;
+				}
+			}
+		}
+		if (!found) return NULL;
+		if (p < end && (*p == 'e' || *p == 'E')) {
+			const char* q = p+1;
+			bool negative_exp = false;
+			if (q < end && (*q == '-' || *q == '+')) negative_exp = (*q++ == '-');
+			if (q < end && isDigit(*q)) {
+				int e = 0;
+				for(;q < end && isDigit(*q);q++) if (e < 10000) e = e*10+(*q-'0');
+				exponent += negative_exp ? -e : e;
+				p = q;
+			}
+		}
+		// Exact powers of ten up to 1e22 : one rounding only for the usual numbers
+		double x = double(mantissa);
+		if (mantissa != 0 && exponent != 0) {
+			if (exponent < 0 && exponent >= -22) x /= powers[-exponent];
+			else if (exponent > 0 && exponent <= 22) x *= powers[exponent];
+			else x *= std::pow(10.0,exponent);
+		}
+		value = float(negative ? -x : x);
+		return p;
+	}
+
+	inline const char* MeshImporter::parseInt(const char* p,const char* end,int64_t& value) {
+		p = skipBlanks(p,end);
+		if (p == end) return NULL;
+		bool negative = (*p == '-');
+		if (*p == '-' || *p == '+') p++;
+		if (p == end || !isDigit(*p)) return NULL;
+		int64_t x = 0;
+		for(;p < end && isDigit(*p);p++) {
+			if (x < (INT64_MAX-9)/10) x = x*10+(*p-'0');
+		}
+		value = negative ? -x : x;
+		return p;
+	}
+
+	inline unsigned int MeshImporter::threadCount(unsigned int nb_threads,size_t size) {
+		if (nb_threads == 0) nb_threads = std::thread::hardware_concurrency();
+		if (nb_threads == 0) nb_threads = 1;
+		// At least 1 MB per thread
+		size_t max_threads = size/(1024*1024)+1;
+		if (nb_threads > max_threads) nb_threads = (unsigned int)max_threads;
+		return nb_threads;
+	}
+
+	template<typename Function> void MeshImporter::parallel(unsigned int nb_threads,Function f) {
+		std::vector<std::thread> workers;
+		for(unsigned int t=1;t<nb_threads;t++) workers.push_back(std::thread(f,t));
+		f(0u);
+		for(unsigned int t=0;t<workers.size();t++) workers[t].join();
+	}
+
+	inline std::vector<const char*> MeshImporter::splitLines(const char* text,size_t size,unsigned int nb) {
+		const char* end = text+size;
+		std::vector<const char*> cuts(nb+1,end);
+		cuts[0] = text;
+		for(unsigned int t=1;t<nb;t++) {
+			const char* p = text+rangeBegin(size,t,nb);
+			if (p < cuts[t-1]) p = cuts[t-1];
+			p = lineEnd(p,end);
+			cuts[t] = (p < end) ? p+1 : end;
+		}
+		return cuts;
+	}
+
+	inline IndexedMesh* MeshImporter::load(const std::string& filename,unsigned int nb_threads,MeshImportStats* stats) {
+		std::string::size_type dot = filename.rfind('.');
+		std::string ext = (dot == std::string::npos) ? "" : filename.substr(dot+1);
+		for(unsigned int i=0;i<ext.size();i++) ext[i] = tolower(ext[i]);
+		if (ext == "obj") return loadOBJ(filename,nb_threads,stats);
+		if (ext == "ply") return loadPLY(filename,nb_threads,stats);
+		STP3D::setError("MeshImporter : unknown file extension (obj or ply)");
+		return NULL;
+	}
+
+	inline IndexedMesh* MeshImporter::loadOBJ(const std::string& filename,unsigned int nb_threads,MeshImportStats* stats) {
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		MappedFile file;
+		if (!file.open(filename)) {
+			STP3D::setError("MeshImporter : unable to open "+filename);
+			return NULL;
+		}
+		nb_threads = threadCount(nb_threads,file.getSize());
+		IndexedMesh* mesh = parseOBJ((const char*)file.getData(),file.getSize(),nb_threads);
+		if (mesh && stats) {
+			stats->bytes = file.getSize();
+			stats->nb_vertices = mesh->nb_elts;
+			stats->nb_triangles = mesh->nb_primitive;
+			stats->nb_threads = nb_threads;
+			stats->seconds = std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+		}
+		return mesh;
+	}
+
+	inline IndexedMesh* MeshImporter::loadPLY(const std::string& filename,unsigned int nb_threads,MeshImportStats* stats) {
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		MappedFile file;
+		if (!file.open(filename)) {
+			STP3D::setError("MeshImporter : unable to open "+filename);
+			return NULL;
+		}
+		nb_threads = threadCount(nb_threads,file.getSize());
+		IndexedMesh* mesh = parsePLY(file.getData(),file.getSize(),nb_threads);
+		if (mesh && stats) {
+			stats->bytes = file.getSize();
+			stats->nb_vertices = mesh->nb_elts;
+			stats->nb_triangles = mesh->nb_primitive;
+			stats->nb_threads = nb_threads;
+			stats->seconds = std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+		}
+		return mesh;
+	}
+
+	////////////////////////////////////////////////////////////////////////////
+	// OBJ
+	////////////////////////////////////////////////////////////////////////////
+
+	inline bool MeshImporter::parseObjCorner(const char*& p,const char* end,const ObjChunk& chunk,ObjCorner& corner,unsigned char& relative) {
+		// v, v/vt, v//vn or v/vt/vn
+		int* numbers[3] = {&corner.v,&corner.t,&corner.n};
+		size_t counts[3] = {chunk.positions.size()/3,chunk.uvs.size()/2,chunk.normals.size()/3};
+		corner.v = corner.t = corner.n = NO_INDEX;
+		relative = 0;
+		for(int i=0;i<3;i++) {
+			if (i > 0) {
+				if (p == end || *p != '/') break;
+				p++;
+				if (p < end && *p == '/') continue;
+			}
+			if (p == end || (!isDigit(*p) && *p != '-' && *p != '+')) return false;
+			int64_t x;
+			p = parseInt(p,end,x);
+			if (!p || x == 0 || x > INT_MAX || x < -INT_MAX) return false;
+			if (x > 0) *numbers[i] = int(x-1);
+			else {
+				*numbers[i] = int(int64_t(counts[i])+x);
+				relative |= (1<<i);
+			}
+		}
+		return true;
+	}
+
+	inline void MeshImporter::reserveObjChunk(ObjChunk& chunk) {
+		const size_t nb_samples = 64,sample_size = 4096;
+		size_t size = chunk.end-chunk.begin;
+		if (size < nb_samples*sample_size*4) return;
+		size_t sampled = 0,nb_v = 0,nb_t = 0,nb_n = 0,nb_corners = 0;
+		for(size_t i=0;i<nb_samples;i++) {
+			const char* sample_end = chunk.begin+rangeBegin(size,i,nb_samples)+sample_size;
+			// Whole lines of the sample only
+			const char* first = lineEnd(sample_end-sample_size,sample_end)+1;
+			const char* line = first;
+			for(const char* eol;line < sample_end && (eol = lineEnd(line,sample_end)) < sample_end;line = eol+1) {
+				if (eol-line < 2) continue;
+				if (line[0] == 'v' && isBlank(line[1])) nb_v++;
+				else if (line[0] == 'v' && line[1] == 't') nb_t++;
+				else if (line[0] == 'v' && line[1] == 'n') nb_n++;
+				else if (line[0] == 'f' && isBlank(line[1])) {
+					// Triangles of the polygon : one per corner after the second
+					int nb = 0;
+					for(const char* p = line+1;p < eol;nb++) {
+						p = skipBlanks(p,eol);
+						if (p == eol) break;
+						while (p < eol && !isBlank(*p)) p++;
+					}
+					if (nb > 2) nb_corners += 3*(nb-2);
+				}
+			}
+			if (line > first) sampled += line-first;
+		}
+		if (sampled == 0) return;
+		// 5% more : one reallocation at most for regular files
+		double scale = 1.05*double(size)/double(sampled);
+		chunk.positions.reserve(size_t(nb_v*scale)*3);
+		chunk.uvs.reserve(size_t(nb_t*scale)*2);
+		chunk.normals.reserve(size_t(nb_n*scale)*3);
+		chunk.corners.reserve(size_t(nb_corners*scale));
+	}
+
+	inline void MeshImporter::parseObjChunk(ObjChunk& chunk) {
+		reserveObjChunk(chunk);
+		const char* end = chunk.end;
+		std::vector<ObjCorner> polygon;
+		std::vector<unsigned char> polygon_relative;
+		for(const char* line = chunk.begin;line < end;) {
+			const char* eol = lineEnd(line,end);
+			const char* p = skipBlanks(line,eol);
+			bool ok = true;
+			if (eol-p >= 2 && p[0] == 'v' && isBlank(p[1])) {
+				float x,y,z;
+				ok = (p = parseFloat(p+1,eol,x)) && (p = parseFloat(p,eol,y)) && (p = parseFloat(p,eol,z));
+				if (ok) {
+					chunk.positions.push_back(x);
+					chunk.positions.push_back(y);
+					chunk.positions.push_back(z);
+				}
+			}
+			else if (eol-p >= 3 && p[0] == 'v' && p[1] == 't' && isBlank(p[2])) {
+				float u,v = 0.0f;
+				ok = (p = parseFloat(p+2,eol,u)) != NULL;
+				if (ok && skipBlanks(p,eol) < eol && !parseFloat(p,eol,v)) ok = false;
+				if (ok) {
+					chunk.uvs.push_back(u);
+					chunk.uvs.push_back(v);
+				}
+			}
+			else if (eol-p >= 3 && p[0] == 'v' && p[1] == 'n' && isBlank(p[2])) {
+				float x,y,z;
+				ok = (p = parseFloat(p+2,eol,x)) && (p = parseFloat(p,eol,y)) && (p = parseFloat(p,eol,z));
+				if (ok) {
+					chunk.normals.push_back(x);
+					chunk.normals.push_back(y);
+					chunk.normals.push_back(z);
+				}
+			}
+			else if (eol-p >= 2 && p[0] == 'f' && isBlank(p[1])) {
+				polygon.clear();
+				polygon_relative.clear();
+				p++;
+				while (ok) {
+					p = skipBlanks(p,eol);
+					if (p == eol || *p == '#') break;
+					ObjCorner corner;
+					unsigned char relative;
+					ok = parseObjCorner(p,eol,chunk,corner,relative);
+					polygon.push_back(corner);
+					polygon_relative.push_back(relative);
+				}
+				// Triangle fan
+				for(unsigned int i=2;ok && i<polygon.size();i++) {
+					unsigned int fan[3] = {0,i-1,i};
+					for(int k=0;k<3;k++) {
+						unsigned char relative = polygon_relative[fan[k]];
+						if (relative || !chunk.relative.empty()) {
+							// Flags of the previous corners (0) on the first relative corner
+							chunk.relative.resize(chunk.corners.size(),0);
+							chunk.relative.push_back(relative);
+						}
+						chunk.corners.push_back(polygon[fan[k]]);
+					}
+				}
+			}
+			// Other statements (o, g, s, usemtl, l...) and comments are skipped
+			if (!ok) {
+				chunk.error = line;
+				return;
+			}
+			line = eol+1;
+		}
+	}
+
+	inline uint64_t MeshImporter::hashCorner(const ObjCorner& c) {
+		uint64_t h = uint64_t(uint32_t(c.v))*0x9E3779B97F4A7C15ULL;
+		h ^= uint64_t(uint32_t(c.t))*0xC2B2AE3D27D4EB4FULL+(h<<6)+(h>>2);
+		h ^= uint64_t(uint32_t(c.n))*0x165667B19E3779F9ULL+(h<<6)+(h>>2);
+		return h*0x94D049BB133111EBULL;
+	}
+
+	inline IndexedMesh* MeshImporter::parseOBJ(const char* text,size_t size,unsigned int nb_threads) {
+		if (nb_threads == 0) nb_threads = threadCount(0,size);
+		std::vector<const char*> cuts = splitLines(text,size,nb_threads);
+		std::vector<ObjChunk> chunks(nb_threads);
+		for(unsigned int t=0;t<nb_threads;t++) {
+			chunks[t].begin = cuts[t];
+			chunks[t].end = cuts[t+1];
+		}
+		parallel(nb_threads,[&](unsigned int t) {parseObjChunk(chunks[t]);});
+
+		// Numbers of the first v, vt, vn and corner of each chunk
+		std::vector<size_t> first_v(nb_threads+1,0),first_t(nb_threads+1,0),first_n(nb_threads+1,0),first_c(nb_threads+1,0);
+		for(unsigned int t=0;t<nb_threads;t++) {
+			if (chunks[t].error) {
+				size_t line = 1;
+				for(const char* p = text;(p = (const char*)memchr(p,'\n',chunks[t].error-p)) != NULL;p++) line++;
+				STP3D::setError("MeshImporter : syntax error in the OBJ file at line "+intToString((int)line));
+				return NULL;
+			}
+			first_v[t+1] = first_v[t]+chunks[t].positions.size()/3;
+			first_t[t+1] = first_t[t]+chunks[t].uvs.size()/2;
+			first_n[t+1] = first_n[t]+chunks[t].normals.size()/3;
+			first_c[t+1] = first_c[t]+chunks[t].corners.size();
+		}
+		size_t nb_v = first_v[nb_threads],nb_t = first_t[nb_threads],nb_n = first_n[nb_threads];
+		size_t nb_corners = first_c[nb_threads];
+		if (nb_corners == 0) {
+			STP3D::setError("MeshImporter : no face in the OBJ file");
+			return NULL;
+		}
+		if (nb_corners > INT_MAX || nb_v > INT_MAX || nb_t > INT_MAX || nb_n > INT_MAX) {
+			STP3D::setError("MeshImporter : OBJ file too big");
+			return NULL;
+		}
+
+		// Gather the chunks, with absolute numbers (-1 if missing)
+		std::vector<float> positions(nb_v*3),uvs(nb_t*2),normals(nb_n*3);
+		std::vector<ObjCorner> corners(nb_corners);
+		std::vector<char> range_error(nb_threads,0),with_attributes(nb_threads,0);
+		parallel(nb_threads,[&](unsigned int t) {
+			ObjChunk& chunk = chunks[t];
+			std::copy(chunk.positions.begin(),chunk.positions.end(),positions.begin()+first_v[t]*3);
+			std::copy(chunk.uvs.begin(),chunk.uvs.end(),uvs.begin()+first_t[t]*2);
+			std::copy(chunk.normals.begin(),chunk.normals.end(),normals.begin()+first_n[t]*3);
+			int offsets[3] = {(int)first_v[t],(int)first_t[t],(int)first_n[t]};
+			int counts[3] = {(int)nb_v,(int)nb_t,(int)nb_n};
+			for(size_t i=0;i<chunk.corners.size();i++) {
+				ObjCorner c = chunk.corners[i];
+				int* numbers[3] = {&c.v,&c.t,&c.n};
+				unsigned char relative = chunk.relative.empty() ? 0 : chunk.relative[i];
+				for(int k=0;k<3;k++) {
+					if (*numbers[k] == NO_INDEX) {
+						*numbers[k] = -1;
+						continue;
+					}
+					if (relative & (1<<k)) *numbers[k] += offsets[k];
+					if (*numbers[k] < 0 || *numbers[k] >= counts[k]) range_error[t] = 1;
+				}
+				if (c.t >= 0 || c.n >= 0) with_attributes[t] = 1;
+				corners[first_c[t]+i] = c;
+			}
+			// Free the chunk now : the whole file is in memory twice otherwise
+			std::vector<float>().swap(chunk.positions);
+			std::vector<float>().swap(chunk.uvs);
+			std::vector<float>().swap(chunk.normals);
+			std::vector<ObjCorner>().swap(chunk.corners);
+			std::vector<unsigned char>().swap(chunk.relative);
+		});
+		bool welding = false;
+		for(unsigned int t=0;t<nb_threads;t++) {
+			if (range_error[t]) {
+				STP3D::setError("MeshImporter : vertex number out of range in the OBJ file");
+				return NULL;
+			}
+			if (with_attributes[t]) welding = true;
+		}
+
+		unsigned int nb_triangles = (unsigned int)(nb_corners/3);
+		unsigned int* indices = new unsigned int[nb_corners];
+		if (!welding) {
+			// Positions only : the vertices are the v of the file
+			parallel(nb_threads,[&](unsigned int t) {
+				for(size_t i=rangeBegin(nb_corners,t,nb_threads);i<rangeBegin(nb_corners,t+1,nb_threads);i++) indices[i] = corners[i].v;
+			});
+			float* vertex_positions = new float[nb_v*3];
+			std::copy(positions.begin(),positions.end(),vertex_positions);
+			return makeMesh((unsigned int)nb_v,nb_triangles,vertex_positions,NULL,NULL,indices);
+		}
+
+		// Welding : indices[c] = first corner with the same v/vt/vn triplet as the corner c.
+		// Most files give the same vt and vn to all the corners of a v : the corners are first
+		// compared with the first corner of their v (array indexed by v, small and read in order).
+		// The other corners go through a lock free hash table (open addressing, compare and swap)
+		// holding 1 + the first corner of each triplet. Threads race but the smallest corner always
+		// wins : the result does not depend on the number of threads. Corners are read only :
+		// relaxed atomics are enough, the threads are joined between the passes.
+		std::unique_ptr<std::atomic<unsigned int>[]> first_of_v(new std::atomic<unsigned int>[nb_v]);
+		parallel(nb_threads,[&](unsigned int t) {
+			for(size_t v=rangeBegin(nb_v,t,nb_threads);v<rangeBegin(nb_v,t+1,nb_threads);v++) first_of_v[v].store(UINT_MAX,std::memory_order_relaxed);
+		});
+		parallel(nb_threads,[&](unsigned int t) {
+			for(size_t c=rangeBegin(nb_corners,t,nb_threads);c<rangeBegin(nb_corners,t+1,nb_threads);c++) {
+				atomicMin(first_of_v[corners[c].v],(unsigned int)c);
+			}
+		});
+		std::vector<std::vector<unsigned int> > others(nb_threads);
+		parallel(nb_threads,[&](unsigned int t) {
+			for(size_t c=rangeBegin(nb_corners,t,nb_threads);c<rangeBegin(nb_corners,t+1,nb_threads);c++) {
+				unsigned int first = first_of_v[corners[c].v].load(std::memory_order_relaxed);
+				if (corners[first] == corners[c]) indices[c] = first;
+				else others[t].push_back((unsigned int)c);
+			}
+		});
+		first_of_v.reset();
+		size_t nb_others = 0;
+		for(unsigned int t=0;t<nb_threads;t++) nb_others += others[t].size();
+		if (nb_others > 0) {
+			unsigned int bits = 1;
+			while ((size_t(1)<<bits) < nb_others*2) bits++;
+			size_t table_size = size_t(1)<<bits,mask = table_size-1;
+			std::unique_ptr<std::atomic<unsigned int>[]> table(new std::atomic<unsigned int>[table_size]);
+			parallel(nb_threads,[&](unsigned int t) {
+				for(size_t i=rangeBegin(table_size,t,nb_threads);i<rangeBegin(table_size,t+1,nb_threads);i++) {
+					table[i].store(0,std::memory_order_relaxed);
+				}
+			});
+			// The slot of each corner is kept in indices
+			parallel(nb_threads,[&](unsigned int t) {
+				for(size_t i=0;i<others[t].size();i++) {
+					unsigned int c = others[t][i];
+					size_t slot = size_t(hashCorner(corners[c]) >> (64-bits));
+					while (true) {
+						unsigned int stored = table[slot].load(std::memory_order_relaxed);
+						if (stored == 0) {
+							if (table[slot].compare_exchange_weak(stored,c+1,std::memory_order_relaxed)) break;
+							continue;
+						}
+						if (corners[stored-1] == corners[c]) {
+							if (c < stored-1 && !table[slot].compare_exchange_weak(stored,c+1,std::memory_order_relaxed)) continue;
+							break;
+						}
+						slot = (slot+1) & mask;
+					}
+					indices[c] = (unsigned int)slot;
+				}
+			});
+			parallel(nb_threads,[&](unsigned int t) {
+				for(size_t i=0;i<others[t].size();i++) {
+					indices[others[t][i]] = table[indices[others[t][i]]].load(std::memory_order_relaxed)-1;
+				}
+				std::vector<unsigned int>().swap(others[t]);
+			});
+		}
+		// Vertices numbered in order of first corner
+		std::vector<unsigned int> nb_new(nb_threads+1,0);
+		parallel(nb_threads,[&](unsigned int t) {
+			unsigned int count = 0;
+			for(size_t c=rangeBegin(nb_corners,t,nb_threads);c<rangeBegin(nb_corners,t+1,nb_threads);c++) {
+				if (indices[c] == c) count++;
+			}
+			nb_new[t+1] = count;
+		});
+		for(unsigned int t=0;t<nb_threads;t++) nb_new[t+1] += nb_new[t];
+		unsigned int nb_vertices = nb_new[nb_threads];
+		float* vertex_positions = new float[size_t(nb_vertices)*3];
+		float* vertex_normals = (nb_n > 0) ? new float[size_t(nb_vertices)*3] : NULL;
+		float* vertex_uvs = (nb_t > 0) ? new float[size_t(nb_vertices)*2] : NULL;
+		std::vector<unsigned int> vertex_of_corner(nb_corners);
+		parallel(nb_threads,[&](unsigned int t) {
+			unsigned int vertex = nb_new[t];
+			for(size_t c=rangeBegin(nb_corners,t,nb_threads);c<rangeBegin(nb_corners,t+1,nb_threads);c++) {
+				if (indices[c] != c) continue;
+				const ObjCorner& corner = corners[c];
+				vertex_of_corner[c] = vertex;
+				memcpy(vertex_positions+size_t(vertex)*3,&positions[size_t(corner.v)*3],3*sizeof(float));
+				if (vertex_normals) {
+					if (corner.n >= 0) memcpy(vertex_normals+size_t(vertex)*3,&normals[size_t(corner.n)*3],3*sizeof(float));
+					else memset(vertex_normals+size_t(vertex)*3,0,3*sizeof(float));
+				}
+				if (vertex_uvs) {
+					if (corner.t >= 0) memcpy(vertex_uvs+size_t(vertex)*2,&uvs[size_t(corner.t)*2],2*sizeof(float));
+					else memset(vertex_uvs+size_t(vertex)*2,0,2*sizeof(float));
+				}
+				vertex++;
+			}
+		});
+		parallel(nb_threads,[&](unsigned int t) {
+			for(size_t c=rangeBegin(nb_corners,t,nb_threads);c<rangeBegin(nb_corners,t+1,nb_threads);c++) {
+				indices[c] = vertex_of_corner[indices[c]];
+			}
+		});
+		return makeMesh(nb_vertices,nb_triangles,vertex_positions,vertex_normals,vertex_uvs,indices);
+	}
+
+	////////////////////////////////////////////////////////////////////////////
+	// PLY
+	////////////////////////////////////////////////////////////////////////////
+
+	inline MeshImporter::PlyType MeshImporter::plyType(const std::string& name) {
+		if (name == "char" || name == "int8") return PlyInt8;
+		if (name == "uchar" || name == "uint8") return PlyUInt8;
+		if (name == "short" || name == "int16") return PlyInt16;
+		if (name == "ushort" || name == "uint16") return PlyUInt16;
+		if (name == "int" || name == "int32") return PlyInt32;
+		if (name == "uint" || name == "uint32") return PlyUInt32;
+		if (name == "float" || name == "float32") return PlyFloat32;
+		if (name == "double" || name == "float64") return PlyFloat64;
+		return PlyUnknown;
+	}
+
+	inline size_t MeshImporter::plySize(PlyType type) {
+		static const size_t sizes[] = {1,1,2,2,4,4,4,8,0};
+		return sizes[type];
+	}
+
+	inline double MeshImporter::plyValue(const unsigned char* p,PlyType type,bool swap) {
+		unsigned char bytes[8];
+		size_t size = plySize(type);
+		if (swap) for(size_t i=0;i<size;i++) bytes[i] = p[size-1-i];
+		else memcpy(bytes,p,size);
+		switch (type) {
+			case PlyInt8 : {int8_t x;memcpy(&x,bytes,1);return x;}
+			case PlyUInt8 : return bytes[0];
+			case PlyInt16 : {int16_t x;memcpy(&x,bytes,2);return x;}
+			case PlyUInt16 : {uint16_t x;memcpy(&x,bytes,2);return x;}
+			case PlyInt32 : {int32_t x;memcpy(&x,bytes,4);return x;}
+			case PlyUInt32 : {uint32_t x;memcpy(&x,bytes,4);return x;}
+			case PlyFloat32 : {float x;memcpy(&x,bytes,4);return x;}
+			case PlyFloat64 : {double x;memcpy(&x,bytes,8);return x;}
+			default : return 0.0;
+		}
+	}
+
+	inline bool MeshImporter::parsePlyHeader(const unsigned char* data,size_t size,std::vector<PlyElement>& elements,int& format,size_t& body) {
+		const char* text = (const char*)data;
+		const char* end = text+size;
+		if (size < 4 || memcmp(text,"ply",3) != 0) return false;
+		format = -1;
+		for(const char* line = text;line < end;) {
+			const char* eol = lineEnd(line,end);
+			std::vector<std::string> words;
+			for(const char* p = skipBlanks(line,eol);p < eol;p = skipBlanks(p,eol)) {
+				const char* q = p;
+				while (q < eol && !isBlank(*q)) q++;
+				words.push_back(std::string(p,q));
+				p = q;
+			}
+			line = (eol < end) ? eol+1 : end;
+			if (words.empty() || words[0] == "comment" || words[0] == "obj_info" || words[0] == "ply") continue;
+			if (words[0] == "end_header") {
+				body = line-text;
+				return format >= 0;
+			}
+			if (words[0] == "format" && words.size() >= 2) {
+				if (words[1] == "ascii") format = 0;
+				else if (words[1] == "binary_little_endian") format = 1;
+				else if (words[1] == "binary_big_endian") format = 2;
+				else return false;
+			}
+			else if (words[0] == "element" && words.size() == 3) {
+				PlyElement element;
+				element.name = words[1];
+				element.count = (size_t)strtoull(words[2].c_str(),NULL,10);
+				element.stride = 0;
+				elements.push_back(element);
+			}
+			else if (words[0] == "property" && !elements.empty()) {
+				PlyProperty property;
+				property.list = (words.size() == 5 && words[1] == "list");
+				if (!property.list && words.size() != 3) return false;
+				property.count_type = property.list ? plyType(words[2]) : PlyUnknown;
+				property.type = plyType(words[property.list ? 3 : 1]);
+				property.name = words.back();
+				property.target = -1;
+				if (property.type == PlyUnknown || (property.list && property.count_type == PlyUnknown)) return false;
+				elements.back().properties.push_back(property);
+			}
+			else return false;
+		}
+		return false;
+	}
+
+	inline const unsigned char* MeshImporter::skipPlyElement(const unsigned char* p,const unsigned char* end,const PlyElement& element,bool swap) {
+		for(size_t i=0;i<element.count;i++) {
+			for(unsigned int k=0;k<element.properties.size();k++) {
+				const PlyProperty& property = element.properties[k];
+				size_t size = plySize(property.type);
+				if (property.list) {
+					if (size_t(end-p) < plySize(property.count_type)) return NULL;
+					double count = plyValue(p,property.count_type,swap);
+					p += plySize(property.count_type);
+					if (count < 0 || count*size > double(end-p)) return NULL;
+					size *= size_t(count);
+				}
+				if (size_t(end-p) < size) return NULL;
+				p += size;
+			}
+		}
+		return p;
+	}
+
+	inline IndexedMesh* MeshImporter::parsePLY(const unsigned char* data,size_t size,unsigned int nb_threads) {
+		if (nb_threads == 0) nb_threads = threadCount(0,size);
+		std::vector<PlyElement> elements;
+		int format;
+		size_t body;
+		if (!parsePlyHeader(data,size,elements,format,body)) {
+			STP3D::setError("MeshImporter : wrong PLY header");
+			return NULL;
+		}
+		bool swap = (format == 2);
+		int vertex_element = -1,face_element = -1;
+		int index_property = -1;
+		bool has_target[8] = {false,false,false,false,false,false,false,false};
+		for(unsigned int e=0;e<elements.size();e++) {
+			PlyElement& element = elements[e];
+			for(unsigned int k=0;k<element.properties.size();k++) {
+				PlyProperty& property = element.properties[k];
+				if (element.name == "face" && property.list && (property.name == "vertex_indices" || property.name == "vertex_index")) {
+					index_property = k;
+				}
+				if (element.name != "vertex" || property.list) continue;
+				static const char* names[8][4] = {{"x",NULL},{"y",NULL},{"z",NULL},{"nx",NULL},{"ny",NULL},{"nz",NULL},
+				                                   {"u","s","texture_u","texture_s"},{"v","t","texture_v","texture_t"}};
+				for(int c=0;c<8;c++) {
+					for(int n=0;n<4 && names[c][n];n++) {
+						if (property.name == names[c][n] && !has_target[c]) {
+							property.target = c;
+							has_target[c] = true;
+						}
+					}
+				}
+			}
+			element.stride = 0;
+			for(unsigned int k=0;k<element.properties.size();k++) {
+				if (element.properties[k].list) {
+					element.stride = 0;
+					break;
+				}
+				element.stride += plySize(element.properties[k].type);
+			}
+			if (element.name == "vertex") vertex_element = e;
+			if (element.name == "face") face_element = e;
+		}
+		if (vertex_element < 0 || face_element < 0 || index_property < 0 || !has_target[0] || !has_target[1] || !has_target[2]) {
+			STP3D::setError("MeshImporter : no vertex x,y,z or face vertex_indices in the PLY file");
+			return NULL;
+		}
+		const PlyElement& vertices = elements[vertex_element];
+		const PlyElement& faces = elements[face_element];
+		if (vertices.count > UINT_MAX/3 || faces.count > UINT_MAX/3) {
+			STP3D::setError("MeshImporter : PLY file too big");
+			return NULL;
+		}
+		bool with_normals = has_target[3] && has_target[4] && has_target[5];
+		bool with_uvs = has_target[6] && has_target[7];
+		unsigned int nb_vertices = (unsigned int)vertices.count;
+		float* positions = new float[size_t(nb_vertices)*3];
+		float* normals = with_normals ? new float[size_t(nb_vertices)*3] : NULL;
+		float* uvs = with_uvs ? new float[size_t(nb_vertices)*2] : NULL;
+		float* targets[8] = {positions,positions+1,positions+2,normals,normals ? normals+1 : NULL,normals ? normals+2 : NULL,
+		                     uvs,uvs ? uvs+1 : NULL};
+		unsigned int strides[8] = {3,3,3,3,3,3,2,2};
+		std::vector<unsigned int> triangles;
+		unsigned int* indices = NULL;
+		unsigned int nb_triangles = 0;
+		std::vector<char> errors(nb_threads,0);
+		bool failed = false;
+
+		if (format == 0) {
+			// ascii : one element per line. Lines are counted per chunk to find the element of each line.
+			std::vector<size_t> first_line(elements.size()+1,0);
+			for(unsigned int e=0;e<elements.size();e++) first_line[e+1] = first_line[e]+elements[e].count;
+			const char* text = (const char*)data+body;
+			std::vector<const char*> cuts = splitLines(text,size-body,nb_threads);
+			std::vector<size_t> chunk_line(nb_threads+1,0);
+			parallel(nb_threads,[&](unsigned int t) {
+				size_t count = 0;
+				for(const char* p = cuts[t];p < cuts[t+1] && (p = (const char*)memchr(p,'\n',cuts[t+1]-p)) != NULL;p++) count++;
+				chunk_line[t+1] = count;
+			});
+			for(unsigned int t=0;t<nb_threads;t++) chunk_line[t+1] += chunk_line[t];
+			std::vector<std::vector<unsigned int> > chunk_triangles(nb_threads);
+			parallel(nb_threads,[&](unsigned int t) {
+				size_t line_number = chunk_line[t];
+				unsigned int e = 0;
+				std::vector<unsigned int> polygon;
+				for(const char* line = cuts[t];line < cuts[t+1] && !errors[t];line_number++) {
+					const char* eol = lineEnd(line,cuts[t+1]);
+					while (e < elements.size() && line_number >= first_line[e+1]) e++;
+					if (e == elements.size()) break;
+					const PlyElement& element = elements[e];
+					const char* p = line;
+					if ((int)e == vertex_element || (int)e == face_element) {
+						size_t item = line_number-first_line[e];
+						for(unsigned int k=0;k<element.properties.size() && p;k++) {
+							const PlyProperty& property = element.properties[k];
+							float x;
+							if (!property.list) {
+								p = parseFloat(p,eol,x);
+								if (p && property.target >= 0 && targets[property.target]) targets[property.target][item*strides[property.target]] = x;
+								continue;
+							}
+							int64_t count,index = 0;
+							p = parseInt(p,eol,count);
+							if (!p || count < 0) {
+								p = NULL;
+								break;
+							}
+							polygon.clear();
+							for(int64_t i=0;i<count && p;i++) {
+								if ((int)e == face_element && (int)k == index_property) {
+									p = parseInt(p,eol,index);
+									if (p && (index < 0 || index >= int64_t(nb_vertices))) p = NULL;
+									polygon.push_back((unsigned int)index);
+								}
+								else p = parseFloat(p,eol,x);
+							}
+							for(unsigned int i=2;p && i<polygon.size();i++) {
+								chunk_triangles[t].push_back(polygon[0]);
+								chunk_triangles[t].push_back(polygon[i-1]);
+								chunk_triangles[t].push_back(polygon[i]);
+							}
+						}
+						if (!p) errors[t] = 1;
+					}
+					line = eol+1;
+				}
+			});
+			// The last line may have no line end
+			size_t needed = std::max(first_line[vertex_element+1],first_line[face_element+1]);
+			if (chunk_line[nb_threads]+1 < needed) failed = true;
+			for(unsigned int t=0;t<nb_threads;t++) {
+				if (errors[t]) failed = true;
+				nb_triangles += (unsigned int)(chunk_triangles[t].size()/3);
+			}
+			if (!failed && nb_triangles > 0) {
+				indices = new unsigned int[size_t(nb_triangles)*3];
+				std::vector<size_t> first(nb_threads+1,0);
+				for(unsigned int t=0;t<nb_threads;t++) first[t+1] = first[t]+chunk_triangles[t].size();
+				parallel(nb_threads,[&](unsigned int t) {
+					std::copy(chunk_triangles[t].begin(),chunk_triangles[t].end(),indices+first[t]);
+					std::vector<unsigned int>().swap(chunk_triangles[t]);
+				});
+			}
+		}
+		else {
+			// binary : find the vertex and face elements (elements before them are skipped)
+			const unsigned char* end = data+size;
+			const unsigned char* p = data+body;
+			const unsigned char* vertex_data = NULL;
+			const unsigned char* face_data = NULL;
+			for(unsigned int e=0;e<elements.size() && p && (!vertex_data || !face_data);e++) {
+				if ((int)e == vertex_element) vertex_data = p;
+				if ((int)e == face_element) face_data = p;
+				if (elements[e].stride > 0) {
+					if (elements[e].stride*double(elements[e].count) > double(end-p)) p = NULL;
+					else p += elements[e].stride*elements[e].count;
+				}
+				else if (!vertex_data || !face_data) p = skipPlyElement(p,end,elements[e],swap);
+			}
+			if (!p || vertices.stride == 0) failed = true;
+			if (!failed) {
+				parallel(nb_threads,[&](unsigned int t) {
+					for(size_t v=rangeBegin(nb_vertices,t,nb_threads);v<rangeBegin(nb_vertices,t+1,nb_threads);v++) {
+						const unsigned char* q = vertex_data+v*vertices.stride;
+						for(unsigned int k=0;k<vertices.properties.size();k++) {
+							const PlyProperty& property = vertices.properties[k];
+							if (property.target >= 0 && targets[property.target]) {
+								targets[property.target][v*strides[property.target]] = float(plyValue(q,property.type,swap));
+							}
+							q += plySize(property.type);
+						}
+					}
+				});
+				// Faces : triangles only (the usual case), read in parallel at once.
+				// Otherwise a first pass finds where each range of faces starts.
+				const PlyProperty& index_list = faces.properties[index_property];
+				size_t count_size = plySize(index_list.count_type),index_size = plySize(index_list.type);
+				size_t triangle_size = count_size+3*index_size;
+				bool only_triangles = (faces.properties.size() == 1 && triangle_size*double(faces.count) <= double(end-face_data));
+				std::vector<const unsigned char*> range_data(nb_threads+1,face_data);
+				std::vector<size_t> range_triangle(nb_threads+1,0);
+				if (only_triangles) {
+					for(unsigned int t=0;t<=nb_threads;t++) {
+						range_data[t] = face_data+rangeBegin(faces.count,t,nb_threads)*triangle_size;
+						range_triangle[t] = rangeBegin(faces.count,t,nb_threads);
+					}
+					nb_triangles = (unsigned int)faces.count;
+					indices = new unsigned int[size_t(nb_triangles)*3];
+					parallel(nb_threads,[&](unsigned int t) {
+						const unsigned char* q = range_data[t];
+						unsigned int* out = indices+range_triangle[t]*3;
+						for(size_t f=range_triangle[t];f<range_triangle[t+1] && !errors[t];f++) {
+							if (plyValue(q,index_list.count_type,swap) != 3.0) errors[t] = 1;
+							q += count_size;
+							for(int i=0;i<3;i++,q+=index_size) {
+								double index = plyValue(q,index_list.type,swap);
+								if (index < 0 || index >= nb_vertices) errors[t] = 1;
+								*out++ = (unsigned int)index;
+							}
+						}
+					});
+					for(unsigned int t=0;t<nb_threads;t++) if (errors[t]) only_triangles = false;
+					if (!only_triangles) {
+						// Not only triangles (or wrong indices : found again below)
+						delete[](indices);
+						indices = NULL;
+						std::fill(errors.begin(),errors.end(),0);
+					}
+				}
+				if (!only_triangles) {
+					const unsigned char* q = face_data;
+					size_t triangles_before = 0;
+					unsigned int next_range = 1;
+					for(size_t f=0;f<faces.count && q;f++) {
+						for(;next_range < nb_threads && rangeBegin(faces.count,next_range,nb_threads) == f;next_range++) {
+							range_data[next_range] = q;
+							range_triangle[next_range] = triangles_before;
+						}
+						for(unsigned int k=0;k<faces.properties.size() && q;k++) {
+							const PlyProperty& property = faces.properties[k];
+							size_t value_size = plySize(property.type);
+							if (!property.list) {
+								q = (size_t(end-q) >= value_size) ? q+value_size : NULL;
+								continue;
+							}
+							if (size_t(end-q) < plySize(property.count_type)) {
+								q = NULL;
+								break;
+							}
+							double count = plyValue(q,property.count_type,swap);
+							q += plySize(property.count_type);
+							if (count < 0 || count*value_size > double(end-q)) {
+								q = NULL;
+								break;
+							}
+							if ((int)k == index_property && count > 2) triangles_before += size_t(count)-2;
+							q += size_t(count)*value_size;
+						}
+					}
+					if (!q || triangles_before > UINT_MAX/3) failed = true;
+					else {
+						range_triangle[nb_threads] = triangles_before;
+						nb_triangles = (unsigned int)triangles_before;
+						indices = new unsigned int[size_t(nb_triangles)*3+1];
+						parallel(nb_threads,[&](unsigned int t) {
+							const unsigned char* r = range_data[t];
+							unsigned int* out = indices+range_triangle[t]*3;
+							std::vector<unsigned int> polygon;
+							for(size_t f=rangeBegin(faces.count,t,nb_threads);f<rangeBegin(faces.count,t+1,nb_threads);f++) {
+								for(unsigned int k=0;k<faces.properties.size();k++) {
+									const PlyProperty& property = faces.properties[k];
+									size_t value_size = plySize(property.type);
+									size_t count = 1;
+									if (property.list) {
+										count = size_t(plyValue(r,property.count_type,swap));
+										r += plySize(property.count_type);
+									}
+									if ((int)k != index_property) {
+										r += count*value_size;
+										continue;
+									}
+									polygon.clear();
+									for(size_t i=0;i<count;i++,r+=value_size) {
+										double index = plyValue(r,property.type,swap);
+										if (index < 0 || index >= nb_vertices) errors[t] = 1;
+										polygon.push_back((unsigned int)index);
+									}
+									for(size_t i=2;i<polygon.size();i++) {
+										*out++ = polygon[0];
+										*out++ = polygon[i-1];
+										*out++ = polygon[i];
+									}
+								}
+							}
+						});
+						for(unsigned int t=0;t<nb_threads;t++) if (errors[t]) failed = true;
+					}
+				}
+			}
+		}
+		if (failed || nb_triangles == 0) {
+			STP3D::setError(failed ? "MeshImporter : wrong or truncated PLY data" : "MeshImporter : no face in the PLY file");
+			delete[](positions);
+			delete[](normals);
+			delete[](uvs);
+			delete[](indices);
+			return NULL;
+		}
+		return makeMesh(nb_vertices,nb_triangles,positions,normals,uvs,indices);
+	}
+
+	////////////////////////////////////////////////////////////////////////////
+	// Mesh
+	////////////////////////////////////////////////////////////////////////////
+
+	inline void MeshImporter::computeNormals(const float* positions,const unsigned int* indices,unsigned int nb_vertices,
+	                                         unsigned int nb_triangles,float* normals) {
+		// Sum of the (area weighted) normals of the triangles around each vertex
+		memset(normals,0,size_t(nb_vertices)*3*sizeof(float));
+		for(size_t f=0;f<nb_triangles;f++) {
+			const float* a = positions+size_t(indices[f*3])*3;
+			const float* b = positions+size_t(indices[f*3+1])*3;
+			const float* c = positions+size_t(indices[f*3+2])*3;
+			float u[3] = {b[0]-a[0],b[1]-a[1],b[2]-a[2]};
+			float v[3] = {c[0]-a[0],c[1]-a[1],c[2]-a[2]};
+			float n[3] = {u[1]*v[2]-u[2]*v[1],u[2]*v[0]-u[0]*v[2],u[0]*v[1]-u[1]*v[0]};
+			for(int k=0;k<3;k++) {
+				float* normal = normals+size_t(indices[f*3+k])*3;
+				normal[0] += n[0];
+				normal[1] += n[1];
+				normal[2] += n[2];
+			}
+		}
+		for(size_t i=0;i<nb_vertices;i++) {
+			float* normal = normals+i*3;
+			float length = sqrtf(normal[0]*normal[0]+normal[1]*normal[1]+normal[2]*normal[2]);
+			if (length > 0.0f) {
+				normal[0] /= length;
+				normal[1] /= length;
+				normal[2] /= length;
+			}
+		}
+	}
+
+	inline IndexedMesh* MeshImporter::makeMesh(unsigned int nb_vertices,unsigned int nb_triangles,float* positions,float* normals,
+	                                           float* uvs,unsigned int* indices) {
+		if (!normals) {
+			normals = new float[size_t(nb_vertices)*3];
+			computeNormals(positions,indices,nb_vertices,nb_triangles,normals);
+		}
+		IndexedMesh* mesh = new IndexedMesh(0,nb_vertices,GL_TRIANGLES);
+		mesh->nb_primitive = nb_triangles;
+		mesh->addIndexBuffer(indices,false);
+		mesh->addOneBuffer(0,3,positions,"coordinates",false);
+		mesh->addOneBuffer(1,3,normals,"normals",false);
+		if (uvs) mesh->addOneBuffer(2,2,uvs,"uvs",false);
+		return mesh;
+	}
+
+};
+
+#endif
@@ -21,21 +21,69 @@
 #include <iostream>
 #include <vector>
 #include <map>
+#include <unordered_map>
+#include <string>
+#include <cstdio>
+#include <cstdint>
+#include <cmath>
+#include <chrono>
+#include <algorithm>
 #include "globals.hpp"
+#include "matrix4d.hpp"
+#include "mesh_file.hpp"
 
 
 namespace STP3D {
 
+	/// Handle of a mesh of a MeshManager : index of its slot (20 bits) and generation of the slot
+	/// (12 bits), so that the handle of a destroyed mesh does not resolve to the next one. A slot
+	/// is not reused after its last generation : a handle is never given twice. 0 : no mesh.
+	typedef uint32_t MeshHandle;
+
+	/// Where the data of a mesh with a handle is
+	enum MeshResidency {MESH_ON_GPU,MESH_ON_CPU,MESH_ON_DISK};
+
+	/// Residency of the meshes with a handle (see MeshManager::useIdxMesh)
+	struct MeshResidencyStats {
+		MeshResidencyStats() : nb_meshes(0),on_gpu(0),on_cpu(0),on_disk(0),gpu_bytes(0),peak_gpu_bytes(0),gpu_budget(0),
+		                       uses(0),evictions(0),reloads(0),reload_seconds(0.0) {}
+		unsigned int nb_meshes;
+		unsigned int on_gpu,on_cpu,on_disk;
+		size_t gpu_bytes,peak_gpu_bytes;
+		/// 0 : no budget
+		size_t gpu_budget;
+		/// Calls to useIdxMesh, meshes sent out of the GPU and meshes sent back
+		unsigned int uses,evictions,reloads;
+		double reload_seconds;
+	};
+
+	inline std::ostream& operator<<(std::ostream& os,const MeshResidencyStats& st) {
+		os<<st.nb_meshes<<" meshes ("<<st.on_gpu<<" on GPU, "<<st.on_cpu<<" on CPU, "<<st.on_disk<<" on disk), GPU ";
+		os<<st.gpu_bytes/(1024.0*1024.0)<<" MB (peak "<<st.peak_gpu_bytes/(1024.0*1024.0)<<" MB";
+		if (st.gpu_budget) os<<", budget "<<st.gpu_budget/(1024.0*1024.0)<<" MB";
+		os<<"), "<<st.uses<<" uses, "<<st.evictions<<" evictions, "<<st.reloads<<" reloads in "<<st.reload_seconds*1000.0<<" ms";
+		return os;
+	}
+
 	/**
 	  * \brief Mesh manager store efficiently meshes using symbolic names.
 	  * Mesh manager can be used to store, once, each mesh of a scene. It
 	  * can also be used for memory management. Mesh manager can handle only
 	  * generic mesh type which are StandardMesh and IndexedMesh
+	  *
+	  * Indexed meshes can also be managed by handles (MeshHandle) : a handle is resolved
+	  * without lookup, and counts references (the mesh is deleted with the last one). These
+	  * meshes fit in a GPU memory budget : when useIdxMesh goes over it, the meshes drawn the
+	  * longest time ago leave the GPU. They stay in CPU memory, or, when they have no CPU data
+	  * or an eviction folder is set, on disk (mesh files). useIdxMesh sends them back.
+	  * Meshes used since beginFrame() stay on the GPU (their draws may still be recorded) :
+	  * the budget is exceeded when one frame needs more. Without calls to beginFrame(), every
+	  * mesh used is in the same frame and nothing is evicted.
 	  */
 	class MeshManager {
 	public:
 		/// Standard construtor. Creates an empty mesh withouh any information.
-		MeshManager() {
+		MeshManager() : projection_scale(0.0f),lod_threshold(1.0f),frame(1),lru_first(NO_SLOT),lru_last(NO_SLOT) {
 			indexed_meshes.clear();
 			standard_meshes.clear();
 		};
@@ -70,6 +118,124 @@ namespace STP3D {
 		  * \return The found mesh. If it does not exist, return NULL
 		  */
 		const IndexedMesh* getIdxMesh(const std::string name);
+		/** Load an indexed mesh from a mesh file (see MeshFile) and add it to the manager.
+		  * If a mesh is already stored with this name, the file is not read.
+		  * \param name the id/name of the mesh. Must be unique for each particular mesh
+		  * \param filename the mesh file, mapped in memory during the upload
+		  * \param layout vertex layout of the GPU buffers
+		  * \return The mesh. If the file cannot be loaded, return NULL
+		  */
+		const IndexedMesh* loadIdxMesh(const std::string name,const std::string& filename,const VertexLayout& layout = VertexLayout());
+		/** Load a standard mesh from a mesh file (see MeshFile) and add it to the manager.
+		  * If a mesh is already stored with this name, the file is not read.
+		  * \param name the id/name of the mesh. Must be unique for each particular mesh
+		  * \param filename the mesh file, mapped in memory during the upload
+		  * \param layout vertex layout of the GPU buffers
+		  * \return The mesh. If the file cannot be loaded, return NULL
+		  */
+		const StandardMesh* loadMesh(const std::string name,const std::string& filename,const VertexLayout& layout = VertexLayout());
+
+		/** Projection used to select the levels of detail of the meshes (see selectLOD).
+		  * \param proj the perspective projection matrix
+		  * \param viewport_height height of the viewport in pixels
+		  */
+		void setProjection(const Matrix4D& proj,unsigned int viewport_height);
+		/// Largest screen space error allowed, in pixels (1 by default)
+		void setLODThreshold(float pixels) {lod_threshold = pixels;};
+		/** Select the coarsest level of detail of \param mesh (see MeshSimplifier) whose error,
+		  * projected on the screen at the nearest point of its bounding sphere, is under the threshold.
+		  * \param modelview matrix of the mesh (the error and the radius are scaled by its largest scale)
+		  * \return The level to draw, 0 (the full mesh) without projection or if the sphere reaches the camera plane
+		  */
+		unsigned int selectLOD(const IndexedMesh& mesh,const Matrix4D& modelview) const;
+
+		/*****************************************************************
+		 *                      MESHES WITH HANDLES
+		 *****************************************************************/
+		/** Manage an indexed mesh by handle (reference count 1).
+		  * \param name the id/name of the mesh. Must be unique for each particular mesh
+		  * \param mesh the mesh, with its CPU data (createVAO is done by useIdxMesh if needed)
+		  * \return The handle, 0 if the name is already used (the mesh is not managed then)
+		  */
+		MeshHandle addIdxMeshHandle(const std::string& name,IndexedMesh* mesh);
+		/** Manage the indexed mesh of a mesh file (see MeshFile) by handle (reference count 1).
+		  * The file is read by the first useIdxMesh.
+		  * \param layout vertex layout of the GPU buffers
+		  */
+		MeshHandle addIdxMeshFile(const std::string& name,const std::string& filename,const VertexLayout& layout = VertexLayout());
+		/// Handle of a mesh by name (0 if none) : one lookup, then use the handle
+		MeshHandle findHandle(const std::string& name) const;
+		bool isValid(MeshHandle handle) const {return slotOf(handle) != NO_SLOT;};
+		/// Reference counting : the mesh is deleted (and its handle invalid) when the count is 0
+		void retain(MeshHandle handle);
+		void release(MeshHandle handle);
+		unsigned int getRefCount(MeshHandle handle) const;
+		MeshResidency getResidency(MeshHandle handle) const;
+		/// The mesh as it is (NULL if it is on disk or if the handle is invalid)
+		IndexedMesh* getIdxMesh(MeshHandle handle) const;
+		/// The mesh, on the GPU, marked as drawn now (NULL if the handle is invalid or the
+		/// mesh cannot be reloaded). Meshes that are not used anymore may be evicted.
+		/// The pointer may change after an eviction : resolve the handle at each frame.
+		IndexedMesh* useIdxMesh(MeshHandle handle);
+		/// Start a frame : meshes used before it may be evicted (call it once per frame, or the budget is never applied)
+		void beginFrame() {frame++;};
+		/// GPU memory for the meshes with handles (0 : no limit)
+		void setGPUBudget(size_t bytes);
+		/// Evicted meshes are written in \param folder (existing) and leave the CPU memory too
+		/// (except meshes with levels of detail, that mesh files do not store). Empty : no folder.
+		void setEvictionFolder(const std::string& folder) {eviction_folder = folder;};
+		const MeshResidencyStats& residencyStats() const {return residency_stats;};
+
+	private:
+		/// Pixels per unit of length at distance 1 from the camera
+		float projection_scale;
+		float lod_threshold;
+
+		static const unsigned int NO_SLOT = 0xFFFFFFFFu;
+		static const unsigned int SLOT_BITS = 20;
+		static const unsigned int GENERATION_MASK = 0xFFFu;
+		struct MeshSlot {
+			MeshSlot() : mesh(NULL),gpu_bytes(0),generation(0),ref_count(0),last_frame(0),residency(MESH_ON_DISK),
+			             written(false),lru_prev(NO_SLOT),lru_next(NO_SLOT) {}
+			/// NULL on disk
+			IndexedMesh* mesh;
+			std::string name;
+			/// Mesh file to reload the mesh from (empty : kept in CPU memory)
+			std::string filename;
+			VertexLayout layout;
+			size_t gpu_bytes;
+			unsigned int generation;
+			/// 0 : free slot
+			unsigned int ref_count;
+			unsigned int last_frame;
+			MeshResidency residency;
+			/// filename was written by the manager (removed with the mesh)
+			bool written;
+			/// List of the meshes on the GPU, least recently used first
+			unsigned int lru_prev,lru_next;
+		};
+		std::vector<MeshSlot> slots;
+		std::vector<unsigned int> free_slots;
+		std::unordered_map<std::string,MeshHandle> handles;
+		std::string eviction_folder;
+		MeshResidencyStats residency_stats;
+		unsigned int frame;
+		unsigned int lru_first,lru_last;
+
+		/// Slot of a valid handle, NO_SLOT otherwise
+		unsigned int slotOf(MeshHandle handle) const;
+		MeshHandle newSlot(const std::string& name);
+		void lruRemove(unsigned int slot);
+		void lruAppend(unsigned int slot);
+		/// Counter of the meshes with this residency in the statistics
+		unsigned int& residencyCount(MeshResidency residency);
+		void setResidency(MeshSlot& slot,MeshResidency residency);
+		/// Send the mesh of the slot back to the GPU
+		bool reload(unsigned int slot);
+		/// Send the mesh out of the GPU. Return false if it cannot be reloaded.
+		bool evict(unsigned int slot);
+		/// Evict the least recently used meshes while over the budget
+		void fitBudget();
 	};
 
 	inline MeshManager::~MeshManager() {
@@ -81,6 +247,10 @@ namespace STP3D {
 			std::cerr<<"Name "<<it->first<<" is deleted"<<std::endl;
 			if (it->second) delete(it->second);
 		}
+		for(unsigned int i=0;i<slots.size();i++) {
+			if (slots[i].mesh) delete(slots[i].mesh);
+			if (slots[i].written) std::remove(slots[i].filename.c_str());
+		}
 	}
 
 	inline void MeshManager::addIdxMesh(const std::string name,const IndexedMesh* addedMesh) {
@@ -111,6 +281,283 @@ namespace STP3D {
 		return (res == indexed_meshes.end()) ? NULL : res->second;
 	}
 
+	inline const IndexedMesh* MeshManager::loadIdxMesh(const std::string name,const std::string& filename,const VertexLayout& layout) {
+		const IndexedMesh* mesh = getIdxMesh(name);
+		if (mesh) return mesh;
+		mesh = MeshFile::loadIndexedMesh(filename,layout);
+		if (!mesh) {
+			std::cerr<<"Unable to load mesh "<<name<<" from "<<filename<<std::endl;
+			return NULL;
+		}
+		addIdxMesh(name,mesh);
+		return mesh;
+	}
+
+	inline void MeshManager::setProjection(const Matrix4D& proj,unsigned int viewport_height) {
+		// proj.mat[5] is cot(fovy/2) : the viewport spans 2/mat[5] units at distance 1
+		projection_scale = proj.mat[5]*viewport_height*0.5f;
+	}
+
+	inline unsigned int MeshManager::selectLOD(const IndexedMesh& mesh,const Matrix4D& modelview) const {
+		if (projection_scale <= 0.0f) return 0;
+		float scale = 0.0f;
+		for(int c=0;c<3;c++) {
+			const float* axis = modelview.mat+4*c;
+			scale = std::max(scale,axis[0]*axis[0]+axis[1]*axis[1]+axis[2]*axis[2]);
+		}
+		scale = sqrtf(scale);
+		// Depth of the nearest point of the mesh
+		float depth = -modelview.mat[14]-scale*mesh.getBoundingRadius();
+		if (depth <= 0.0f) return 0;
+		float pixels_per_unit = scale*projection_scale/depth;
+		unsigned int level = 0;
+		for(unsigned int l=1;l<mesh.getNbLODs();l++) {
+			if (mesh.getLODError(l)*pixels_per_unit > lod_threshold) break;
+			level = l;
+		}
+		return level;
+	}
+
+	inline const StandardMesh* MeshManager::loadMesh(const std::string name,const std::string& filename,const VertexLayout& layout) {
+		const StandardMesh* mesh = getMesh(name);
+		if (mesh) return mesh;
+		mesh = MeshFile::loadStandardMesh(filename,layout);
+		if (!mesh) {
+			std::cerr<<"Unable to load mesh "<<name<<" from "<<filename<<std::endl;
+			return NULL;
+		}
+		addMesh(name,mesh);
+		return mesh;
+	}
+
+	inline unsigned int MeshManager::slotOf(MeshHandle handle) const {
+		unsigned int slot = (handle & ((1u << SLOT_BITS)-1))-1;
+		if (handle == 0 || slot >= slots.size()) return NO_SLOT;
+		const MeshSlot& s = slots[slot];
+		if (s.ref_count == 0 || s.generation != (handle >> SLOT_BITS)) return NO_SLOT;
+		return slot;
+	}
+
+	inline MeshHandle MeshManager::newSlot(const std::string& name) {
+		if (handles.find(name) != handles.end()) {
+			std::cerr<<"Mesh "<<name<<" already loaded in manager"<<std::endl;
+			return 0;
+		}
+		unsigned int slot;
+		if (!free_slots.empty()) {
+			slot = free_slots.back();
+			free_slots.pop_back();
+		}
+		else {
+			if (slots.size()+1 >= (1u << SLOT_BITS)) {
+				std::cerr<<"Too many meshes with handles in manager"<<std::endl;
+				return 0;
+			}
+			slot = slots.size();
+			slots.push_back(MeshSlot());
+		}
+		MeshSlot& s = slots[slot];
+		// Generation 0 is never used : no valid handle is 0
+		s.generation++;
+		s.name = name;
+		s.ref_count = 1;
+		s.last_frame = 0;
+		MeshHandle handle = (s.generation << SLOT_BITS) | (slot+1);
+		handles[name] = handle;
+		residency_stats.nb_meshes++;
+		return handle;
+	}
+
+	inline MeshHandle MeshManager::addIdxMeshHandle(const std::string& name,IndexedMesh* mesh) {
+		if (!mesh) return 0;
+		MeshHandle handle = newSlot(name);
+		if (!handle) return 0;
+		unsigned int slot = slotOf(handle);
+		MeshSlot& s = slots[slot];
+		s.mesh = mesh;
+		s.residency = mesh->isOnGPU() ? MESH_ON_GPU : MESH_ON_CPU;
+		residencyCount(s.residency)++;
+		if (mesh->isOnGPU()) {
+			s.gpu_bytes = mesh->getGPUBytes();
+			residency_stats.gpu_bytes += s.gpu_bytes;
+			residency_stats.peak_gpu_bytes = std::max(residency_stats.peak_gpu_bytes,residency_stats.gpu_bytes);
+			lruAppend(slot);
+		}
+		return handle;
+	}
+
+	inline MeshHandle MeshManager::addIdxMeshFile(const std::string& name,const std::string& filename,const VertexLayout& layout) {
+		MeshHandle handle = newSlot(name);
+		if (!handle) return 0;
+		MeshSlot& s = slots[slotOf(handle)];
+		s.filename = filename;
+		s.layout = layout;
+		s.residency = MESH_ON_DISK;
+		residencyCount(s.residency)++;
+		return handle;
+	}
+
+	inline MeshHandle MeshManager::findHandle(const std::string& name) const {
+		std::unordered_map<std::string,MeshHandle>::const_iterator it = handles.find(name);
+		return (it == handles.end()) ? 0 : it->second;
+	}
+
+	inline void MeshManager::retain(MeshHandle handle) {
+		unsigned int slot = slotOf(handle);
+		if (slot != NO_SLOT) slots[slot].ref_count++;
+	}
+
+	inline void MeshManager::release(MeshHandle handle) {
+		unsigned int slot = slotOf(handle);
+		if (slot == NO_SLOT) return;
+		MeshSlot& s = slots[slot];
+		if (--s.ref_count > 0) return;
+		if (s.residency == MESH_ON_GPU) {
+			lruRemove(slot);
+			residency_stats.gpu_bytes -= s.gpu_bytes;
+			s.mesh->releaseGPUMemory();
+		}
+		residencyCount(s.residency)--;
+		residency_stats.nb_meshes--;
+		if (s.mesh) delete s.mesh;
+		if (s.written) std::remove(s.filename.c_str());
+		handles.erase(s.name);
+		unsigned int generation = s.generation;
+		s = MeshSlot();
+		s.generation = generation;
+		// After its last generation, the slot would give the handles of its first ones again
+		if (generation < GENERATION_MASK) free_slots.push_back(slot);
+	}
+
+	inline unsigned int MeshManager::getRefCount(MeshHandle handle) const {
+		unsigned int slot = slotOf(handle);
+		return (slot == NO_SLOT) ? 0 : slots[slot].ref_count;
+	}
+
+	inline MeshResidency MeshManager::getResidency(MeshHandle handle) const {
+		unsigned int slot = slotOf(handle);
+		return (slot == NO_SLOT) ? MESH_ON_DISK : slots[slot].residency;
+	}
+
+	inline IndexedMesh* MeshManager::getIdxMesh(MeshHandle handle) const {
+		unsigned int slot = slotOf(handle);
+		return (slot == NO_SLOT) ? NULL : slots[slot].mesh;
+	}
+
+	inline IndexedMesh* MeshManager::useIdxMesh(MeshHandle handle) {
+		unsigned int slot = slotOf(handle);
+		if (slot == NO_SLOT) return NULL;
+		residency_stats.uses++;
+		if (slots[slot].residency != MESH_ON_GPU && !reload(slot)) return NULL;
+		slots[slot].last_frame = frame;
+		// Most recently used last
+		if (lru_last != slot) {
+			lruRemove(slot);
+			lruAppend(slot);
+		}
+		fitBudget();
+		return slots[slot].mesh;
+	}
+
+	inline void MeshManager::setGPUBudget(size_t bytes) {
+		residency_stats.gpu_budget = bytes;
+		fitBudget();
+	}
+
+	inline void MeshManager::lruRemove(unsigned int slot) {
+		MeshSlot& s = slots[slot];
+		if (s.lru_prev != NO_SLOT) slots[s.lru_prev].lru_next = s.lru_next;
+		else lru_first = s.lru_next;
+		if (s.lru_next != NO_SLOT) slots[s.lru_next].lru_prev = s.lru_prev;
+		else lru_last = s.lru_prev;
+		s.lru_prev = s.lru_next = NO_SLOT;
+	}
+
+	inline void MeshManager::lruAppend(unsigned int slot) {
+		MeshSlot& s = slots[slot];
+		s.lru_prev = lru_last;
+		s.lru_next = NO_SLOT;
+		if (lru_last != NO_SLOT) slots[lru_last].lru_next = slot;
+		else lru_first = slot;
+		lru_last = slot;
+	}
+
+	inline unsigned int& MeshManager::residencyCount(MeshResidency residency) {
+		if (residency == MESH_ON_GPU) return residency_stats.on_gpu;
+		return (residency == MESH_ON_CPU) ? residency_stats.on_cpu : residency_stats.on_disk;
+	}
+
+	inline void MeshManager::setResidency(MeshSlot& slot,MeshResidency residency) {
+		residencyCount(slot.residency)--;
+		residencyCount(residency)++;
+		slot.residency = residency;
+	}
+
+	inline bool MeshManager::reload(unsigned int slot) {
+		MeshSlot& s = slots[slot];
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		if (s.residency == MESH_ON_DISK) {
+			s.mesh = MeshFile::loadIndexedMesh(s.filename,s.layout);
+			if (!s.mesh) {
+				std::cerr<<"Unable to load mesh "<<s.name<<" from "<<s.filename<<std::endl;
+				return false;
+			}
+		}
+		else if (!s.mesh->createVAO()) {
+			std::cerr<<"Unable to send mesh "<<s.name<<" to the GPU"<<std::endl;
+			return false;
+		}
+		residency_stats.reload_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+		// The first load of a mesh file is not a reload
+		if (s.last_frame != 0) residency_stats.reloads++;
+		setResidency(s,MESH_ON_GPU);
+		s.gpu_bytes = s.mesh->getGPUBytes();
+		residency_stats.gpu_bytes += s.gpu_bytes;
+		residency_stats.peak_gpu_bytes = std::max(residency_stats.peak_gpu_bytes,residency_stats.gpu_bytes);
+		lruAppend(slot);
+		return true;
+	}
+
+	inline bool MeshManager::evict(unsigned int slot) {
+		MeshSlot& s = slots[slot];
+		bool to_disk = !s.filename.empty() && !s.mesh->hasCPUData();
+		if (!to_disk && !eviction_folder.empty() && s.mesh->getNbLODs() == 1) {
+			if (s.filename.empty()) {
+				char name[32];
+				snprintf(name,sizeof(name),"/mesh_%u_%u.smesh",slot,s.generation);
+				s.filename = eviction_folder+name;
+				s.written = MeshFile::write(s.filename,*s.mesh);
+				if (!s.written) s.filename.clear();
+			}
+			to_disk = !s.filename.empty();
+		}
+		// Without CPU data nor file, the mesh could not come back
+		if (!to_disk && !s.mesh->hasCPUData()) return false;
+		lruRemove(slot);
+		residency_stats.gpu_bytes -= s.gpu_bytes;
+		s.gpu_bytes = 0;
+		s.mesh->releaseGPUMemory();
+		if (to_disk) {
+			s.layout = s.mesh->getVertexLayout();
+			delete s.mesh;
+			s.mesh = NULL;
+		}
+		setResidency(s,to_disk ? MESH_ON_DISK : MESH_ON_CPU);
+		residency_stats.evictions++;
+		return true;
+	}
+
+	inline void MeshManager::fitBudget() {
+		if (residency_stats.gpu_budget == 0) return;
+		unsigned int slot = lru_first;
+		while (residency_stats.gpu_bytes > residency_stats.gpu_budget && slot != NO_SLOT) {
+			unsigned int next = slots[slot].lru_next;
+			// Meshes used in this frame stay, the ones after them may not be (added without use)
+			if (slots[slot].last_frame != frame) evict(slot);
+			slot = next;
+		}
+	}
+
 };
 
 #endif
@@ -0,0 +1,347 @@
+/***************************************************************************
+                      mesh_optimizer.hpp  -  description
+                             -------------------
+    copyright            : (C) 2012 by Biri Venceslas
+    email                : biri@univ-mlv.fr
+ ***************************************************************************/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef _STP3D_MESH_OPTIMIZER_HPP_
+#define _STP3D_MESH_OPTIMIZER_HPP_
+
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+#include "globals.hpp"
+#include "indexed_mesh.hpp"
+
+namespace STP3D {
+
+	/// Vertex cache efficiency of an index buffer (simulated FIFO cache)
+	struct VertexCacheStats {
+		VertexCacheStats() : acmr(0.0f),atvr(0.0f) {}
+		/// Average cache miss ratio : transformed vertices per triangle (0.5 at best, 3 at worst)
+		float acmr;
+		/// Average transformed vertex ratio : transformed vertices per used vertex (1 at best)
+		float atvr;
+	};
+
+	/**
+	  * \brief Reordering of triangle lists for the GPU, before createVAO.
+	  * The full pass (optimize) runs three steps :
+	  * <ul>
+	  * <li> optimizeVertexCache : Tipsify (Sander, Nehab, Barczak 2007). Triangles are emitted
+	  *      in fans around vertices chosen to stay in a post-transform cache of cacheSize
+	  *      vertices. Linear time (times the cache size).
+	  * <li> optimizeOverdraw : the triangles are cut in clusters (where Tipsify had to jump,
+	  *      and where the cache locality allows it), then clusters facing outward of the mesh
+	  *      are drawn first, so that they hide the others (less overdraw with depth test).
+	  * <li> optimizeVertexFetch : vertices are renumbered in order of first use and all the
+	  *      buffers of the mesh are moved accordingly (sequential vertex fetch).
+	  * </ul>
+	  * Everything is deterministic (no hash, stable sorts) : the same mesh gives the same
+	  * buffers, so the pass can run at load time or offline.
+	  * The functions on raw arrays work on GL_TRIANGLES lists of nb_triangles*3 indices.
+	  */
+	class MeshOptimizer {
+	public:
+		/// Cache size of the simulation and of Tipsify (current GPUs behave like 16 to 32 entries)
+		static const unsigned int DEFAULT_CACHE_SIZE = 16;
+
+		/// ACMR and ATVR of the index buffer with a FIFO cache of \param cache_size vertices
+		static VertexCacheStats analyze(const unsigned int* indices,unsigned int nb_triangles,unsigned int nb_vertices,
+		                                unsigned int cache_size = DEFAULT_CACHE_SIZE);
+		/// Tipsify. \param clusters (if not NULL) receives the first triangle of each part drawn without
+		/// jumping elsewhere in the mesh (ends with nb_triangles).
+		static void optimizeVertexCache(unsigned int* indices,unsigned int nb_triangles,unsigned int nb_vertices,
+		                                unsigned int cache_size = DEFAULT_CACHE_SIZE,std::vector<unsigned int>* clusters = NULL);
+		/** Sort the clusters front to back as seen from outside of the mesh. \param positions
+		  * holds \param stride floats per vertex (x,y,z first). Clusters are cut further where the
+		  * ACMR of the cluster is under \param threshold times the ACMR of the whole list :
+		  * the greater the threshold, the more clusters (less overdraw, more cache misses).
+		  */
+		static void optimizeOverdraw(unsigned int* indices,unsigned int nb_triangles,const float* positions,unsigned int stride,
+		                             const std::vector<unsigned int>& clusters,unsigned int cache_size = DEFAULT_CACHE_SIZE,
+		                             float threshold = 1.05f);
+		/// New number of each vertex (\param remap) in order of first use, unused vertices last.
+		/// The indices are renumbered. Return the number of used vertices.
+		static unsigned int optimizeVertexFetch(unsigned int* indices,unsigned int nb_indices,unsigned int nb_vertices,
+		                                        std::vector<unsigned int>& remap);
+		/// Move the elements of \param data (nb_comp floats each) to their new number
+		static void remapBuffer(float* data,unsigned int nb_comp,unsigned int nb_vertices,const std::vector<unsigned int>& remap);
+
+		/// Run the three steps on a mesh with CPU data (triangles, positions on attribute 0).
+		/// Must be called before createVAO. Prints ACMR and ATVR before and after if \param verbose.
+		static bool optimize(IndexedMesh& mesh,unsigned int cache_size = DEFAULT_CACHE_SIZE,bool verbose = false);
+
+	private:
+		/// Triangles around each vertex : triangles of vertex v are adjacency[offsets[v]..offsets[v+1][
+		static void buildAdjacency(const unsigned int* indices,unsigned int nb_triangles,unsigned int nb_vertices,
+		                           std::vector<unsigned int>& offsets,std::vector<unsigned int>& adjacency);
+	};
+
+	inline VertexCacheStats MeshOptimizer::analyze(const unsigned int* indices,unsigned int nb_triangles,unsigned int nb_vertices,
+	                                               unsigned int cache_size) {
+		VertexCacheStats stats;
+		if (nb_triangles == 0) return stats;
+		// FIFO : a vertex is in the cache if less than cache_size misses happened since it was loaded
+		std::vector<unsigned int> loaded(nb_vertices,0);
+		std::vector<bool> used(nb_vertices,false);
+		unsigned int misses = 0,nb_used = 0;
+		for(unsigned int i=0;i<3*nb_triangles;i++) {
+			unsigned int v = indices[i];
+			if (!used[v]) {
+				used[v] = true;
+				nb_used++;
+			}
+			else if (misses+cache_size-loaded[v] < cache_size) continue;
+			// Timestamps start at cache_size so that 0 means never loaded
+			loaded[v] = misses+cache_size;
+			misses++;
+		}
+		stats.acmr = float(misses)/nb_triangles;
+		stats.atvr = float(misses)/nb_used;
+		return stats;
+	}
+
+	inline void MeshOptimizer::buildAdjacency(const unsigned int* indices,unsigned int nb_triangles,unsigned int nb_vertices,
+	                                          std::vector<unsigned int>& offsets,std::vector<unsigned int>& adjacency) {
+		offsets.assign(nb_vertices+1,0);
+		for(unsigned int i=0;i<3*nb_triangles;i++) offsets[indices[i]+1]++;
+		for(unsigned int v=0;v<nb_vertices;v++) offsets[v+1] += offsets[v];
+		adjacency.resize(3*nb_triangles);
+		std::vector<unsigned int> fill(offsets.begin(),offsets.end()-1);
+		for(unsigned int i=0;i<3*nb_triangles;i++) adjacency[fill[indices[i]]++] = i/3;
+	}
+
+	inline void MeshOptimizer::optimizeVertexCache(unsigned int* indices,unsigned int nb_triangles,unsigned int nb_vertices,
+	                                               unsigned int cache_size,std::vector<unsigned int>* clusters) {
+		if (clusters) clusters->clear();
+		if (nb_triangles == 0) {
+			if (clusters) clusters->push_back(0);
+			return;
+		}
+		std::vector<unsigned int> offsets,adjacency;
+		buildAdjacency(indices,nb_triangles,nb_vertices,offsets,adjacency);
+		// Live triangles of each vertex, time it entered the cache
+		std::vector<unsigned int> live(nb_vertices);
+		for(unsigned int v=0;v<nb_vertices;v++) live[v] = offsets[v+1]-offsets[v];
+		std::vector<unsigned int> cache_time(nb_vertices,0);
+		std::vector<bool> emitted(nb_triangles,false);
+		std::vector<unsigned int> dead_end,candidates;
+		std::vector<unsigned int> output;
+		output.reserve(3*nb_triangles);
+		unsigned int time = cache_size+1;
+		unsigned int cursor = 0;
+
+		// First fanning vertex : the first vertex used
+		int fan = indices[0];
+		bool jump = true;
+		while (fan >= 0) {
+			if (jump && clusters) clusters->push_back(output.size()/3);
+			candidates.clear();
+			for(unsigned int a=offsets[fan];a<offsets[fan+1];a++) {
+				unsigned int t = adjacency[a];
+				if (emitted[t]) continue;
+				emitted[t] = true;
+				for(int c=0;c<3;c++) {
+					unsigned int v = indices[3*t+c];
+					output.push_back(v);
+					dead_end.push_back(v);
+					candidates.push_back(v);
+					live[v]--;
+					if (time-cache_time[v] > cache_size) cache_time[v] = time++;
+				}
+			}
+			// Next fan : the candidate staying the longest in the cache after its fan
+			int best = -1,best_priority = -1;
+			for(unsigned int i=0;i<candidates.size();i++) {
+				unsigned int v = candidates[i];
+				if (live[v] == 0) continue;
+				int priority = 0;
+				if (time-cache_time[v]+2*live[v] <= cache_size) priority = time-cache_time[v];
+				if (priority > best_priority) {
+					best_priority = priority;
+					best = v;
+				}
+			}
+			jump = (best < 0);
+			if (jump) {
+				// Dead end : the last vertices emitted, else the next vertex in input order
+				while (!dead_end.empty() && best < 0) {
+					unsigned int v = dead_end.back();
+					dead_end.pop_back();
+					if (live[v] > 0) best = v;
+				}
+				while (best < 0 && cursor < nb_vertices) {
+					if (live[cursor] > 0) best = cursor;
+					cursor++;
+				}
+			}
+			fan = best;
+		}
+		memcpy(indices,&output[0],output.size()*sizeof(unsigned int));
+		if (clusters) clusters->push_back(nb_triangles);
+	}
+
+	inline void MeshOptimizer::optimizeOverdraw(unsigned int* indices,unsigned int nb_triangles,const float* positions,unsigned int stride,
+	                                            const std::vector<unsigned int>& clusters,unsigned int cache_size,float threshold) {
+		if (nb_triangles == 0 || clusters.size() < 2) return;
+		// Soft boundaries : inside each cluster, cut where the cache locality is good
+		unsigned int nb_vertices = *std::max_element(indices,indices+3*nb_triangles)+1;
+		float target = threshold*analyze(indices,nb_triangles,nb_vertices,cache_size).acmr;
+		std::vector<unsigned int> cuts;
+		// Each cluster is simulated with an empty cache : it may be drawn after any other one
+		std::vector<unsigned int> loaded(nb_vertices,0);
+		unsigned int time = cache_size;
+		for(unsigned int c=0;c+1<clusters.size();c++) {
+			unsigned int start = clusters[c];
+			unsigned int cluster_misses = 0;
+			cuts.push_back(start);
+			time += cache_size;
+			for(unsigned int t=clusters[c];t<clusters[c+1];t++) {
+				for(int k=0;k<3;k++) {
+					unsigned int v = indices[3*t+k];
+					if (time-loaded[v] < cache_size) continue;
+					loaded[v] = time++;
+					cluster_misses++;
+				}
+				// The cluster has amortized its first misses : cutting here costs little
+				if (t+1 < clusters[c+1] && cluster_misses <= target*(t+1-start)) {
+					cuts.push_back(t+1);
+					start = t+1;
+					cluster_misses = 0;
+					time += cache_size;
+				}
+			}
+		}
+		cuts.push_back(nb_triangles);
+
+		// Centroid of the mesh, then of each cluster with its mean normal (weighted by area)
+		unsigned int nb_clusters = cuts.size()-1;
+		std::vector<float> centers(3*nb_clusters,0.0f),normals(3*nb_clusters,0.0f),areas(nb_clusters,0.0f);
+		double mesh_center[3] = {0.0,0.0,0.0};
+		double mesh_area = 0.0;
+		for(unsigned int c=0;c<nb_clusters;c++) {
+			for(unsigned int t=cuts[c];t<cuts[c+1];t++) {
+				const float* p0 = positions+stride*indices[3*t];
+				const float* p1 = positions+stride*indices[3*t+1];
+				const float* p2 = positions+stride*indices[3*t+2];
+				float e1[3] = {p1[0]-p0[0],p1[1]-p0[1],p1[2]-p0[2]};
+				float e2[3] = {p2[0]-p0[0],p2[1]-p0[1],p2[2]-p0[2]};
+				float n[3] = {e1[1]*e2[2]-e1[2]*e2[1],e1[2]*e2[0]-e1[0]*e2[2],e1[0]*e2[1]-e1[1]*e2[0]};
+				float area = sqrtf(n[0]*n[0]+n[1]*n[1]+n[2]*n[2]);
+				for(int k=0;k<3;k++) {
+					centers[3*c+k] += area*(p0[k]+p1[k]+p2[k])/3.0f;
+					normals[3*c+k] += n[k];
+				}
+				areas[c] += area;
+			}
+			for(int k=0;k<3;k++) mesh_center[k] += centers[3*c+k];
+			mesh_area += areas[c];
+		}
+		if (mesh_area > 0.0) {
+			for(int k=0;k<3;k++) mesh_center[k] /= mesh_area;
+		}
+		// Clusters far outward along their normal hide the others : they come first
+		std::vector<std::pair<float,unsigned int> > order(nb_clusters);
+		for(unsigned int c=0;c<nb_clusters;c++) {
+			float dot = 0.0f;
+			if (areas[c] > 0.0f) {
+				for(int k=0;k<3;k++) dot += (centers[3*c+k]/areas[c]-float(mesh_center[k]))*normals[3*c+k];
+				dot /= areas[c];
+			}
+			order[c] = std::make_pair(-dot,c);
+		}
+		std::stable_sort(order.begin(),order.end());
+		std::vector<unsigned int> sorted;
+		sorted.reserve(3*nb_triangles);
+		for(unsigned int i=0;i<nb_clusters;i++) {
+			unsigned int c = order[i].second;
+			sorted.insert(sorted.end(),indices+3*cuts[c],indices+3*cuts[c+1]);
+		}
+		memcpy(indices,&sorted[0],sorted.size()*sizeof(unsigned int));
+	}
+
+	inline unsigned int MeshOptimizer::optimizeVertexFetch(unsigned int* indices,unsigned int nb_indices,unsigned int nb_vertices,
+	                                                       std::vector<unsigned int>& remap) {
+		const unsigned int unused = 0xFFFFFFFFu;
+		remap.assign(nb_vertices,unused);
+		unsigned int next = 0;
+		for(unsigned int i=0;i<nb_indices;i++) {
+			unsigned int& r = remap[indices[i]];
+			if (r == unused) r = next++;
+			indices[i] = r;
+		}
+		unsigned int nb_used = next;
+		for(unsigned int v=0;v<nb_vertices;v++) {
+			if (remap[v] == unused) remap[v] = next++;
+		}
+		return nb_used;
+	}
+
+	inline void MeshOptimizer::remapBuffer(float* data,unsigned int nb_comp,unsigned int nb_vertices,const std::vector<unsigned int>& remap) {
+		std::vector<float> copy(data,data+nb_comp*nb_vertices);
+		for(unsigned int v=0;v<nb_vertices;v++) {
+			memcpy(data+nb_comp*remap[v],&copy[nb_comp*v],nb_comp*sizeof(float));
+		}
+	}
+
+	inline bool MeshOptimizer::optimize(IndexedMesh& mesh,unsigned int cache_size,bool verbose) {
+		if (mesh.gl_type_mesh != GL_TRIANGLES || !mesh.index_buffer) {
+			STP3D::setError("MeshOptimizer : only triangle meshes with CPU indices can be optimized");
+			return false;
+		}
+		int id_pos = -1;
+		for(unsigned int i=0;i<mesh.attr_id.size();i++) {
+			if (mesh.attr_id[i] == 0 && mesh.buffers[i] && mesh.size_one_elt[i] >= 3) id_pos = i;
+		}
+		if (id_pos < 0) {
+			STP3D::setError("MeshOptimizer : the mesh needs 3D positions (attribute 0) on the CPU");
+			return false;
+		}
+		for(unsigned int i=0;i<mesh.buffers.size();i++) {
+			if (!mesh.buffers[i]) {
+				STP3D::setError("MeshOptimizer : all the buffers must be on the CPU");
+				return false;
+			}
+		}
+		unsigned int* idx = mesh.index_buffer;
+		unsigned int nb_tri = mesh.nb_primitive;
+		unsigned int nb_vert = mesh.nb_elts;
+		for(unsigned int i=0;i<3*nb_tri;i++) {
+			if (idx[i] >= nb_vert) {
+				STP3D::setError("MeshOptimizer : index out of the vertex buffers");
+				return false;
+			}
+		}
+		VertexCacheStats before = analyze(idx,nb_tri,nb_vert,cache_size);
+
+		std::vector<unsigned int> clusters;
+		optimizeVertexCache(idx,nb_tri,nb_vert,cache_size,&clusters);
+		optimizeOverdraw(idx,nb_tri,mesh.buffers[id_pos],mesh.size_one_elt[id_pos],clusters,cache_size);
+		std::vector<unsigned int> remap;
+		optimizeVertexFetch(idx,3*nb_tri,nb_vert,remap);
+		for(unsigned int i=0;i<mesh.buffers.size();i++) remapBuffer(mesh.buffers[i],mesh.size_one_elt[i],nb_vert,remap);
+
+		if (verbose) {
+			VertexCacheStats after = analyze(idx,nb_tri,nb_vert,cache_size);
+			std::cout<<"Mesh optimized ("<<nb_tri<<" triangles, cache "<<cache_size<<") : ACMR "<<before.acmr<<" -> "<<after.acmr;
+			std::cout<<", ATVR "<<before.atvr<<" -> "<<after.atvr<<std::endl;
+		}
+		return true;
+	}
+
+};
+
+#endif
@@ -0,0 +1,386 @@
+/***************************************************************************
+                     mesh_simplifier.hpp  -  description
+                             -------------------
+    copyright            : (C) 2012 by Biri Venceslas
+    email                : biri@univ-mlv.fr
+ ***************************************************************************/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef _STP3D_MESH_SIMPLIFIER_HPP_
+#define _STP3D_MESH_SIMPLIFIER_HPP_
+
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <cstring>
+#include <cfloat>
+#include <climits>
+#include <cstdint>
+#include <cmath>
+#include "globals.hpp"
+#include "indexed_mesh.hpp"
+#include "mesh_optimizer.hpp"
+
+namespace STP3D {
+
+	/**
+	  * \brief Levels of detail of triangle meshes by edge collapses (Garland, Heckbert 1997).
+	  * Each vertex has the quadric of the planes of its triangles (weighted by their area).
+	  * A vertex is collapsed on one of its neighbours, the one of least quadric error : no new
+	  * vertex is made, so every level uses the vertex buffers of the full mesh and is only an
+	  * index buffer. Collapses are done by passes : in a pass, the cheapest collapses are done
+	  * if their neighbourhoods are disjoint, then the index buffer is rebuilt.
+	  * A collapse is refused if it flips a triangle or makes the surface non manifold. Vertices
+	  * on a border or on a seam (several vertices at the same position, with other normals or
+	  * uvs) do not move : the outline and the texture mapping are kept.
+	  * The error of a level is the RMS distance of its vertices to the planes of the triangles
+	  * they replace, in the units of the positions. It is an estimate, not a bound : projected
+	  * on the screen, it is compared against the screen space threshold (see MeshManager::selectLOD).
+	  */
+	class MeshSimplifier {
+	public:
+		/// Triangles kept by the levels of the default chain, after the full mesh (100%)
+		static std::vector<float> defaultRatios() {
+			std::vector<float> ratios;
+			ratios.push_back(0.5f);
+			ratios.push_back(0.25f);
+			ratios.push_back(0.125f);
+			return ratios;
+		}
+
+		/** Simplify a GL_TRIANGLES index buffer down to each count of \param targets (decreasing).
+		  * \param positions holds \param stride floats per vertex (x,y,z first).
+		  * \param levels receives the indices of each level reached and \param errors their error.
+		  * Stops early (less levels) when no collapse is possible anymore.
+		  */
+		static void simplify(const unsigned int* indices,unsigned int nb_triangles,const float* positions,unsigned int stride,
+		                     unsigned int nb_vertices,const std::vector<unsigned int>& targets,
+		                     std::vector<std::vector<unsigned int> >& levels,std::vector<float>& errors);
+		/// Add the levels of detail to \param mesh (CPU data needed, before createVAO). Each level keeps
+		/// \param ratios of the triangles of the mesh, and is ordered for the vertex cache (MeshOptimizer).
+		/// Return the number of levels added.
+		static unsigned int generateLODs(IndexedMesh& mesh,const std::vector<float>& ratios = defaultRatios());
+		/// Same for several meshes, simplified in parallel on \param nb_threads threads (0 : one per core).
+		/// Return the number of levels added.
+		static unsigned int generateLODs(const std::vector<IndexedMesh*>& meshes,const std::vector<float>& ratios = defaultRatios(),
+		                                 unsigned int nb_threads = 0);
+
+	private:
+		/// Symmetric 4x4 matrix of the squared distance to a set of planes, and their total weight
+		struct Quadric {
+			Quadric() : w(0.0) {memset(a,0,sizeof(a));}
+			/// xx xy xz xw yy yz yw zz zw ww
+			double a[10];
+			double w;
+			void addPlane(const double n[3],double d,double weight) {
+				double p[4] = {n[0],n[1],n[2],d};
+				a[0] += weight*p[0]*p[0]; a[1] += weight*p[0]*p[1]; a[2] += weight*p[0]*p[2]; a[3] += weight*p[0]*p[3];
+				a[4] += weight*p[1]*p[1]; a[5] += weight*p[1]*p[2]; a[6] += weight*p[1]*p[3];
+				a[7] += weight*p[2]*p[2]; a[8] += weight*p[2]*p[3];
+				a[9] += weight*p[3]*p[3];
+				w += weight;
+			}
+			Quadric& operator+=(const Quadric& q) {
+				for(int i=0;i<10;i++) a[i] += q.a[i];
+				w += q.w;
+				return *this;
+			}
+			/// Weighted mean of the squared distances of \param p to the planes
+			double error(const float* p) const {
+				double x = p[0],y = p[1],z = p[2];
+				double e = a[0]*x*x+2.0*a[1]*x*y+2.0*a[2]*x*z+2.0*a[3]*x+a[4]*y*y+2.0*a[5]*y*z+2.0*a[6]*y
+				          +a[7]*z*z+2.0*a[8]*z+a[9];
+				return (w > 0.0) ? std::max(e,0.0)/w : 0.0;
+			}
+		};
+		struct Collapse {
+			double cost;
+			unsigned int from,to;
+			bool operator<(const Collapse& c) const {return cost < c.cost || (cost == c.cost && from < c.from);}
+		};
+		/// Levels of one mesh. Return NULL or the reason of the failure.
+		static const char* buildLODs(IndexedMesh& mesh,const std::vector<float>& ratios,unsigned int& nb_levels);
+		/// Positions of the triangle, \param from replaced by \param to
+		static void triangleNormal(const float* positions,unsigned int stride,const unsigned int* tri,
+		                           unsigned int from,unsigned int to,double n[3]);
+	};
+
+	inline void MeshSimplifier::triangleNormal(const float* positions,unsigned int stride,const unsigned int* tri,
+	                                           unsigned int from,unsigned int to,double n[3]) {
+		const float* p[3];
+		for(int k=0;k<3;k++) p[k] = positions+size_t(tri[k] == from ? to : tri[k])*stride;
+		double u[3] = {double(p[1][0])-p[0][0],double(p[1][1])-p[0][1],double(p[1][2])-p[0][2]};
+		double v[3] = {double(p[2][0])-p[0][0],double(p[2][1])-p[0][1],double(p[2][2])-p[0][2]};
+		n[0] = u[1]*v[2]-u[2]*v[1];
+		n[1] = u[2]*v[0]-u[0]*v[2];
+		n[2] = u[0]*v[1]-u[1]*v[0];
+	}
+
+	inline void MeshSimplifier::simplify(const unsigned int* indices,unsigned int nb_triangles,const float* positions,unsigned int stride,
+	                                     unsigned int nb_vertices,const std::vector<unsigned int>& targets,
+	                                     std::vector<std::vector<unsigned int> >& levels,std::vector<float>& errors) {
+		levels.clear();
+		errors.clear();
+		std::vector<unsigned int> current(indices,indices+size_t(nb_triangles)*3);
+
+		// Vertices at the same position share one quadric (position_of : first vertex at this position)
+		std::vector<unsigned int> order(nb_vertices);
+		for(unsigned int i=0;i<nb_vertices;i++) order[i] = i;
+		std::stable_sort(order.begin(),order.end(),[&](unsigned int i,unsigned int j) {
+			const float* a = positions+size_t(i)*stride;
+			const float* b = positions+size_t(j)*stride;
+			return a[0] < b[0] || (a[0] == b[0] && (a[1] < b[1] || (a[1] == b[1] && a[2] < b[2])));
+		});
+		std::vector<unsigned int> position_of(nb_vertices);
+		std::vector<unsigned char> locked(nb_vertices,0);
+		for(unsigned int i=0;i<nb_vertices;) {
+			const float* p = positions+size_t(order[i])*stride;
+			unsigned int j = i+1;
+			while (j < nb_vertices && memcmp(p,positions+size_t(order[j])*stride,3*sizeof(float)) == 0) j++;
+			// Seam : several vertices at this position
+			for(unsigned int k=i;k<j;k++) {
+				position_of[order[k]] = order[i];
+				locked[order[k]] = (j-i > 1);
+			}
+			i = j;
+		}
+
+		std::vector<Quadric> quadrics(nb_vertices);
+		std::vector<uint64_t> edges;
+		edges.reserve(size_t(nb_triangles)*3);
+		for(size_t t=0;t<nb_triangles;t++) {
+			const unsigned int* tri = &current[t*3];
+			double n[3];
+			triangleNormal(positions,stride,tri,UINT_MAX,UINT_MAX,n);
+			double length = sqrt(n[0]*n[0]+n[1]*n[1]+n[2]*n[2]);
+			if (length > 0.0) {
+				for(int c=0;c<3;c++) n[c] /= length;
+				const float* p = positions+size_t(tri[0])*stride;
+				double d = -(n[0]*p[0]+n[1]*p[1]+n[2]*p[2]);
+				for(int k=0;k<3;k++) quadrics[position_of[tri[k]]].addPlane(n,d,0.5*length);
+			}
+			for(int k=0;k<3;k++) {
+				uint64_t a = position_of[tri[k]],b = position_of[tri[(k+1)%3]];
+				edges.push_back(a < b ? (a << 32) | b : (b << 32) | a);
+			}
+		}
+		// Border or non manifold edges (not shared by exactly two triangles) : their ends do not move
+		std::sort(edges.begin(),edges.end());
+		std::vector<unsigned char> locked_position(nb_vertices,0);
+		for(size_t i=0;i<edges.size();) {
+			size_t j = i+1;
+			while (j < edges.size() && edges[j] == edges[i]) j++;
+			if (j-i != 2) locked_position[edges[i] >> 32] = locked_position[edges[i] & 0xFFFFFFFFu] = 1;
+			i = j;
+		}
+		std::vector<uint64_t>().swap(edges);
+		for(unsigned int v=0;v<nb_vertices;v++) locked[v] |= locked_position[position_of[v]];
+
+		double max_error = 0.0;
+		size_t level = 0;
+		std::vector<unsigned int> first(nb_vertices+1),triangles,remap(nb_vertices);
+		std::vector<double> best_cost(nb_vertices);
+		std::vector<unsigned int> best_target(nb_vertices);
+		std::vector<unsigned char> touched(nb_vertices);
+		std::vector<Collapse> collapses;
+		std::vector<unsigned int> ring_from,ring_to;
+		while (level < targets.size()) {
+			unsigned int nb_current = current.size()/3;
+			if (nb_current <= targets[level]) {
+				levels.push_back(current);
+				errors.push_back(float(sqrt(max_error)));
+				level++;
+				continue;
+			}
+			// Triangles around each vertex
+			std::fill(first.begin(),first.end(),0);
+			for(size_t i=0;i<current.size();i++) first[current[i]+1]++;
+			for(unsigned int v=0;v<nb_vertices;v++) first[v+1] += first[v];
+			triangles.resize(current.size());
+			for(size_t i=0;i<current.size();i++) triangles[first[current[i]]++] = i/3;
+			for(unsigned int v=nb_vertices;v>0;v--) first[v] = first[v-1];
+			first[0] = 0;
+
+			// Cheapest collapse of each vertex along its edges
+			std::fill(best_cost.begin(),best_cost.end(),DBL_MAX);
+			for(size_t i=0;i<current.size();i++) {
+				unsigned int ends[2] = {current[i],current[i-i%3+(i+1)%3]};
+				for(int k=0;k<2;k++) {
+					unsigned int from = ends[k],to = ends[1-k];
+					if (locked[from] || from == to) continue;
+					Quadric q = quadrics[position_of[from]];
+					q += quadrics[position_of[to]];
+					double cost = q.error(positions+size_t(to)*stride);
+					if (cost < best_cost[from] || (cost == best_cost[from] && to < best_target[from])) {
+						best_cost[from] = cost;
+						best_target[from] = to;
+					}
+				}
+			}
+			collapses.clear();
+			for(unsigned int v=0;v<nb_vertices;v++) {
+				if (best_cost[v] == DBL_MAX) continue;
+				Collapse c;
+				c.cost = best_cost[v];
+				c.from = v;
+				c.to = best_target[v];
+				collapses.push_back(c);
+			}
+			if (collapses.empty()) break;
+			// About two triangles less per collapse, but neighbours of a collapse wait for the next pass :
+			// the cheapest collapses, twice the number needed (at least a quarter of them), are tried
+			size_t needed = 2*(size_t(nb_current-targets[level])/2+1);
+			size_t window = std::min(collapses.size(),std::max(needed,collapses.size()/4));
+			std::nth_element(collapses.begin(),collapses.begin()+window-1,collapses.end());
+			std::sort(collapses.begin(),collapses.begin()+window);
+
+			std::fill(touched.begin(),touched.end(),0);
+			for(unsigned int v=0;v<nb_vertices;v++) remap[v] = v;
+			unsigned int nb_left = nb_current,nb_collapses = 0;
+			for(size_t c=0;c<collapses.size() && nb_left > targets[level];c++) {
+				if (c == window) {
+					// The others, only when none of the cheapest was possible
+					if (nb_collapses > 0) break;
+					std::sort(collapses.begin()+window,collapses.end());
+				}
+				unsigned int from = collapses[c].from,to = collapses[c].to;
+				if (touched[from] || touched[to]) continue;
+				// No flipped triangle
+				bool valid = true;
+				unsigned int nb_removed = 0;
+				ring_from.clear();
+				for(unsigned int i=first[from];i<first[from+1] && valid;i++) {
+					const unsigned int* tri = &current[size_t(triangles[i])*3];
+					for(int k=0;k<3;k++) if (tri[k] != from) ring_from.push_back(position_of[tri[k]]);
+					if (tri[0] == to || tri[1] == to || tri[2] == to) {
+						nb_removed++;
+						continue;
+					}
+					double before[3],after[3];
+					triangleNormal(positions,stride,tri,UINT_MAX,UINT_MAX,before);
+					triangleNormal(positions,stride,tri,from,to,after);
+					if (before[0]*after[0]+before[1]*after[1]+before[2]*after[2] <= 0.0) valid = false;
+				}
+				if (!valid) continue;
+				// Link condition : the two ends share only the vertices of the two triangles of the edge
+				ring_to.clear();
+				for(unsigned int i=first[to];i<first[to+1];i++) {
+					const unsigned int* tri = &current[size_t(triangles[i])*3];
+					for(int k=0;k<3;k++) if (tri[k] != to) ring_to.push_back(position_of[tri[k]]);
+				}
+				std::sort(ring_from.begin(),ring_from.end());
+				ring_from.erase(std::unique(ring_from.begin(),ring_from.end()),ring_from.end());
+				std::sort(ring_to.begin(),ring_to.end());
+				ring_to.erase(std::unique(ring_to.begin(),ring_to.end()),ring_to.end());
+				unsigned int nb_common = 0;
+				for(size_t i=0,j=0;i<ring_from.size() && j<ring_to.size();) {
+					if (ring_from[i] < ring_to[j]) i++;
+					else if (ring_to[j] < ring_from[i]) j++;
+					else {
+						nb_common++;
+						i++;
+						j++;
+					}
+				}
+				if (nb_common > 2) continue;
+
+				remap[from] = to;
+				quadrics[position_of[to]] += quadrics[position_of[from]];
+				max_error = std::max(max_error,collapses[c].cost);
+				nb_left -= std::min(nb_left,nb_removed);
+				nb_collapses++;
+				// The triangles around both ends change : no other collapse there in this pass
+				for(unsigned int e=0;e<2;e++) {
+					unsigned int v = e ? to : from;
+					for(unsigned int i=first[v];i<first[v+1];i++) {
+						const unsigned int* tri = &current[size_t(triangles[i])*3];
+						touched[tri[0]] = touched[tri[1]] = touched[tri[2]] = 1;
+					}
+				}
+			}
+			if (nb_collapses == 0) break;
+			// Collapsed triangles are removed
+			size_t nb_indices = 0;
+			for(size_t t=0;t<current.size();t+=3) {
+				unsigned int a = remap[current[t]],b = remap[current[t+1]],c = remap[current[t+2]];
+				if (a == b || b == c || a == c) continue;
+				current[nb_indices++] = a;
+				current[nb_indices++] = b;
+				current[nb_indices++] = c;
+			}
+			current.resize(nb_indices);
+		}
+	}
+
+	inline const char* MeshSimplifier::buildLODs(IndexedMesh& mesh,const std::vector<float>& ratios,unsigned int& nb_levels) {
+		nb_levels = 0;
+		if (mesh.gl_type_mesh != GL_TRIANGLES) return "MeshSimplifier : only GL_TRIANGLES meshes are simplified";
+		const float* positions = NULL;
+		unsigned int stride = 0;
+		for(unsigned int i=0;i<mesh.attr_id.size();i++) {
+			if (mesh.attr_id[i] != 0) continue;
+			positions = mesh.buffers[i];
+			stride = mesh.size_one_elt[i];
+		}
+		if (!positions || stride < 3 || !mesh.index_buffer) return "MeshSimplifier : no CPU positions or indices";
+		std::vector<unsigned int> targets;
+		for(unsigned int i=0;i<ratios.size();i++) {
+			unsigned int target = (unsigned int)(ratios[i]*mesh.nb_primitive);
+			if (target > 0 && (targets.empty() || target < targets.back())) targets.push_back(target);
+		}
+		std::vector<std::vector<unsigned int> > levels;
+		std::vector<float> errors;
+		simplify(mesh.index_buffer,mesh.nb_primitive,positions,stride,mesh.nb_elts,targets,levels,errors);
+		mesh.clearLODs();
+		for(unsigned int l=0;l<levels.size();l++) {
+			if (levels[l].empty()) continue;
+			MeshOptimizer::optimizeVertexCache(&levels[l][0],levels[l].size()/3,mesh.nb_elts);
+			if (mesh.addLOD(&levels[l][0],levels[l].size(),errors[l])) nb_levels++;
+		}
+		return NULL;
+	}
+
+	inline unsigned int MeshSimplifier::generateLODs(IndexedMesh& mesh,const std::vector<float>& ratios) {
+		unsigned int nb_levels;
+		const char* error = buildLODs(mesh,ratios,nb_levels);
+		if (error) STP3D::setError(error);
+		return nb_levels;
+	}
+
+	inline unsigned int MeshSimplifier::generateLODs(const std::vector<IndexedMesh*>& meshes,const std::vector<float>& ratios,
+	                                                 unsigned int nb_threads) {
+		if (nb_threads == 0) nb_threads = std::thread::hardware_concurrency();
+		nb_threads = std::max(1u,std::min(nb_threads,(unsigned int)meshes.size()));
+		// Each thread takes the next mesh to simplify
+		std::atomic<unsigned int> next(0),nb_levels(0);
+		std::vector<const char*> errors(meshes.size(),(const char*)NULL);
+		auto worker = [&]() {
+			for(unsigned int m;(m = next.fetch_add(1)) < meshes.size();) {
+				unsigned int levels = 0;
+				if (meshes[m]) errors[m] = buildLODs(*meshes[m],ratios,levels);
+				nb_levels += levels;
+			}
+		};
+		std::vector<std::thread> workers;
+		for(unsigned int t=1;t<nb_threads;t++) workers.push_back(std::thread(worker));
+		worker();
+		for(unsigned int t=0;t<workers.size();t++) workers[t].join();
+		for(unsigned int m=0;m<meshes.size();m++) {
+			if (errors[m]) STP3D::setError(errors[m]);
+		}
+		return nb_levels;
+	}
+
+};
+
+#endif
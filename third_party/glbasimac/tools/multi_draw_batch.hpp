@@ -0,0 +1,323 @@
+/***************************************************************************
+                      multi_draw_batch.hpp  -  description
+                             -------------------
+    copyright            : (C) 2012 by Biri Venceslas
+    email                : biri@univ-mlv.fr
+ ***************************************************************************/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef _STP3D_MULTI_DRAW_BATCH_HPP_
+#define _STP3D_MULTI_DRAW_BATCH_HPP_
+
+#include <vector>
+#include <cstring>
+#include "globals.hpp"
+#include "gl_tools.hpp"
+#include "gl_ext.hpp"
+#include "gl_state.hpp"
+#include "mesh.hpp"
+#include "indexed_mesh.hpp"
+#include "instance_buffer.hpp"
+#include "profiler.hpp"
+
+namespace STP3D {
+
+	/// Command read by glMultiDrawArraysIndirect
+	struct DrawArraysIndirectCommand {
+		GLuint count;
+		GLuint instanceCount;
+		GLuint first;
+		GLuint baseInstance;
+	};
+
+	/// Command read by glMultiDrawElementsIndirect
+	struct DrawElementsIndirectCommand {
+		GLuint count;
+		GLuint instanceCount;
+		GLuint firstIndex;
+		GLint baseVertex;
+		GLuint baseInstance;
+	};
+
+	/**
+	  * \brief Many draws of several meshes sharing the same vertex layout, in one submission.
+	  * The geometry of every mesh added to the batch is copied in shared
+	  * buffers (one VBO per attribute, as the meshes do, plus one index buffer
+	  * for indexed meshes). Each frame, the application lists the draws (mesh,
+	  * model matrix, color) and draw() submits them all :
+	  * <ul>
+	  * <li> PathMultiDrawIndirect (GL 4.3) : one glMultiDraw*Indirect call
+	  * <li> PathBaseInstance (GL 4.2) : one glDraw*BaseInstance call per draw
+	  * <li> PathLoop (GL 4.0) : one draw call per draw, instance attributes moved each time
+	  * </ul>
+	  * Draw i reads instance i of an InstanceBuffer (base instance i), so the
+	  * batch is drawn with the GLBI_INSTANCED permutation of flat_shading.vert
+	  * or phong_shading.vert.
+	  * All meshes of a batch are either StandardMesh or IndexedMesh, with the
+	  * same primitive type. Their CPU data must still exist when added.
+	  */
+	class MultiDrawBatch {
+	public:
+		enum Path {PathAuto,PathMultiDrawIndirect,PathBaseInstance,PathLoop};
+		/// Returned by addMesh on error
+		static const unsigned int INVALID_MESH = 0xFFFFFFFFu;
+
+		MultiDrawBatch() : indexed(false),gl_type(0),nb_vertices(0),id_vao(0),id_index(0),id_indirect(0),
+		                   instance_serial(0),cmds_dirty(true),wanted_path(PathAuto) {};
+		~MultiDrawBatch();
+
+		/// Copy the geometry of a mesh in the batch. Return its id in the batch (INVALID_MESH on error)
+		unsigned int addMesh(const StandardMesh& mesh);
+		unsigned int addMesh(const IndexedMesh& mesh);
+		unsigned int getNbMeshes() const {return meshes.size();};
+		/// Create the shared buffers. Meshes must all be added before.
+		bool createVAO();
+		unsigned int getIdVAO() const {return id_vao;};
+
+		/// Remove all the draws
+		void clearDraws() {draws.clear();instances.clear();cmds_dirty = true;};
+		/// Add a draw of the mesh \param id_mesh with the \param model matrix and the color r,g,b
+		void addDraw(unsigned int id_mesh,const Matrix4D& model,float r,float g,float b);
+		unsigned int getNbDraws() const {return draws.size();};
+
+		/// Force a submission path (PathAuto : the best one the context supports)
+		void setPath(Path path) {wanted_path = path;};
+		/// Path used by draw()
+		Path getPath() const;
+		/// Submit all the draws. Returns the number of GL draw calls issued.
+		unsigned int draw();
+
+	private:
+		// Owns GL objects : no copy
+		MultiDrawBatch(const MultiDrawBatch&);
+		MultiDrawBatch& operator=(const MultiDrawBatch&);
+		/// Check the mesh layout against the batch one (set it for the first mesh)
+		bool checkLayout(bool mesh_indexed,unsigned int mesh_type,const std::vector<unsigned int>& ids,
+		                 const std::vector<unsigned int>& sizes,const std::vector<float*>& data);
+		void addVertices(unsigned int nb_elts,const std::vector<unsigned int>& ids,const std::vector<float*>& data);
+
+		/// Range of a mesh in the shared buffers
+		struct MeshRange {
+			/// First index (indexed) or vertex, number of indices or vertices
+			unsigned int first,count;
+			/// Value added to the indices of the mesh
+			int base_vertex;
+		};
+
+		/// Layout : attribute id and number of floats of each buffer
+		bool indexed;
+		unsigned int gl_type;
+		std::vector<unsigned int> attr_id,size_one_elt;
+		/// CPU copy of the geometry (released by createVAO)
+		std::vector<std::vector<float> > vertices;
+		std::vector<unsigned int> indices;
+		unsigned int nb_vertices;
+		std::vector<MeshRange> meshes;
+
+		/// Mesh of each draw, and its matrix and color
+		std::vector<unsigned int> draws;
+		InstanceBuffer instances;
+
+		std::vector<unsigned int> vbo_id;
+		unsigned int id_vao,id_index,id_indirect;
+		unsigned int instance_serial;
+		std::vector<DrawArraysIndirectCommand> array_cmds;
+		std::vector<DrawElementsIndirectCommand> element_cmds;
+		bool cmds_dirty;
+		Path wanted_path;
+	};
+
+	inline MultiDrawBatch::~MultiDrawBatch() {
+		if (!vbo_id.empty()) GLState::deleteBuffers(vbo_id.size(),&(vbo_id[0]));
+		if (id_index) GLState::deleteBuffers(1,&id_index);
+		if (id_indirect) GLState::deleteBuffers(1,&id_indirect);
+		if (id_vao) GLState::deleteVertexArrays(1,&id_vao);
+	}
+
+	inline bool MultiDrawBatch::checkLayout(bool mesh_indexed,unsigned int mesh_type,const std::vector<unsigned int>& ids,
+	                                        const std::vector<unsigned int>& sizes,const std::vector<float*>& data) {
+		if (id_vao) {
+			STP3D::setError("Meshes must be added to a batch before createVAO");
+			return false;
+		}
+		for(unsigned int i=0;i<data.size();i++) {
+			if (!data[i]) {
+				STP3D::setError("Unable to add a mesh without CPU data to a batch");
+				return false;
+			}
+		}
+		if (meshes.empty()) {
+			indexed = mesh_indexed;
+			gl_type = mesh_type;
+			attr_id = ids;
+			size_one_elt = sizes;
+			vertices.resize(ids.size());
+			return true;
+		}
+		if (mesh_indexed != indexed || mesh_type != gl_type || ids != attr_id || sizes != size_one_elt) {
+			STP3D::setError("All the meshes of a batch must have the same type and vertex layout");
+			return false;
+		}
+		return true;
+	}
+
+	inline void MultiDrawBatch::addVertices(unsigned int nb_elts,const std::vector<unsigned int>& ids,const std::vector<float*>& data) {
+		for(unsigned int i=0;i<ids.size();i++) {
+			vertices[i].insert(vertices[i].end(),data[i],data[i]+nb_elts*size_one_elt[i]);
+		}
+		nb_vertices += nb_elts;
+	}
+
+	inline unsigned int MultiDrawBatch::addMesh(const StandardMesh& mesh) {
+		if (!checkLayout(false,mesh.gl_type_mesh,mesh.attr_id,mesh.size_one_elt,mesh.buffers)) return INVALID_MESH;
+		MeshRange range = {nb_vertices,mesh.nb_elts,0};
+		addVertices(mesh.nb_elts,mesh.attr_id,mesh.buffers);
+		meshes.push_back(range);
+		return meshes.size()-1;
+	}
+
+	inline unsigned int MultiDrawBatch::addMesh(const IndexedMesh& mesh) {
+		if (!mesh.index_buffer) {
+			STP3D::setError("Unable to add a mesh without index buffer to a batch");
+			return INVALID_MESH;
+		}
+		if (!checkLayout(true,mesh.gl_type_mesh,mesh.attr_id,mesh.size_one_elt,mesh.buffers)) return INVALID_MESH;
+		unsigned int nb_idx = mesh.nb_primitive*mesh.nb_idx_per_primitive;
+		// Indices are kept as they are : each draw has the base vertex of its mesh
+		MeshRange range = {(unsigned int)indices.size(),nb_idx,(int)nb_vertices};
+		indices.insert(indices.end(),mesh.index_buffer,mesh.index_buffer+nb_idx);
+		addVertices(mesh.nb_elts,mesh.attr_id,mesh.buffers);
+		meshes.push_back(range);
+		return meshes.size()-1;
+	}
+
+	inline bool MultiDrawBatch::createVAO() {
+		STP3D_PROFILE_ZONE("MultiDrawBatch::createVAO");
+		if (meshes.empty()) {
+			STP3D::setError("Impossible to create the VAO of an empty batch");
+			return false;
+		}
+		glGenVertexArrays(1,&id_vao);
+		if (id_vao == 0) {
+			STP3D::setError("Unable to find a value for a VAO");
+			return false;
+		}
+		GLState::bindVertexArray(id_vao);
+
+		// Meshes without vertices or indices leave empty vectors : no pointer in them
+		vbo_id.resize(vertices.size());
+		if (!vbo_id.empty()) glGenBuffers(vbo_id.size(),&(vbo_id[0]));
+		for(unsigned int i=0;i<vertices.size();i++) {
+			GLState::bindBuffer(GL_ARRAY_BUFFER,vbo_id[i]);
+			glBufferData(GL_ARRAY_BUFFER,vertices[i].size()*sizeof(GLfloat),vertices[i].empty() ? NULL : &(vertices[i][0]),GL_STATIC_DRAW);
+			glEnableVertexAttribArray(attr_id[i]);
+			glVertexAttribPointer(attr_id[i],size_one_elt[i],GL_FLOAT,GL_FALSE,0,0);
+			std::vector<float>().swap(vertices[i]);
+		}
+		if (indexed) {
+			glGenBuffers(1,&id_index);
+			GLState::bindBuffer(GL_ELEMENT_ARRAY_BUFFER,id_index);
+			glBufferData(GL_ELEMENT_ARRAY_BUFFER,indices.size()*sizeof(unsigned int),indices.empty() ? NULL : &(indices[0]),GL_STATIC_DRAW);
+			std::vector<unsigned int>().swap(indices);
+		}
+		GLState::bindBuffer(GL_ARRAY_BUFFER,0);
+		instance_serial = 0;
+		return true;
+	}
+
+	inline void MultiDrawBatch::addDraw(unsigned int id_mesh,const Matrix4D& model,float r,float g,float b) {
+		if (id_mesh >= meshes.size()) {
+			STP3D::setError("Unknown mesh in batch");
+			return;
+		}
+		draws.push_back(id_mesh);
+		instances.addInstance(model,r,g,b);
+		cmds_dirty = true;
+	}
+
+	inline MultiDrawBatch::Path MultiDrawBatch::getPath() const {
+		if (wanted_path <= PathMultiDrawIndirect && GLExt::hasMultiDrawIndirect()) return PathMultiDrawIndirect;
+		if (wanted_path <= PathBaseInstance && GLExt::hasBaseInstance()) return PathBaseInstance;
+		return PathLoop;
+	}
+
+	inline unsigned int MultiDrawBatch::draw() {
+		STP3D_PROFILE_GPU_ZONE("MultiDrawBatch::draw");
+		if (draws.empty() || !id_vao) return 0;
+		GLState::bindVertexArray(id_vao);
+		Path path = getPath();
+		const GLExt::Functions& ext = GLExt::fn();
+		unsigned int nb_draws = draws.size();
+
+		if (path == PathLoop) {
+			// Without base instance, the instance attributes are moved on each draw
+			instances.upload();
+			for(unsigned int i=0;i<nb_draws;i++) {
+				const MeshRange& m = meshes[draws[i]];
+				instances.setAttributes(i);
+				if (indexed) {
+					glDrawElementsBaseVertex(gl_type,m.count,GL_UNSIGNED_INT,(const void*)(m.first*sizeof(unsigned int)),m.base_vertex);
+				}
+				else {
+					glDrawArrays(gl_type,m.first,m.count);
+				}
+			}
+			// The VAO does not point on instance 0 anymore
+			instance_serial = 0;
+			return nb_draws;
+		}
+
+		instances.attach(instance_serial);
+		if (path == PathBaseInstance) {
+			for(unsigned int i=0;i<nb_draws;i++) {
+				const MeshRange& m = meshes[draws[i]];
+				if (indexed) {
+					ext.DrawElementsInstancedBaseVertexBaseInstance(gl_type,m.count,GL_UNSIGNED_INT,(const void*)(m.first*sizeof(unsigned int)),1,m.base_vertex,i);
+				}
+				else {
+					ext.DrawArraysInstancedBaseInstance(gl_type,m.first,m.count,1,i);
+				}
+			}
+			return nb_draws;
+		}
+
+		// One indirect command per draw, rebuilt when the draws changed
+		if (!id_indirect) glGenBuffers(1,&id_indirect);
+		GLState::bindBuffer(GL_DRAW_INDIRECT_BUFFER,id_indirect);
+		if (cmds_dirty) {
+			if (indexed) {
+				element_cmds.resize(nb_draws);
+				for(unsigned int i=0;i<nb_draws;i++) {
+					const MeshRange& m = meshes[draws[i]];
+					DrawElementsIndirectCommand cmd = {m.count,1,m.first,m.base_vertex,i};
+					element_cmds[i] = cmd;
+				}
+				glBufferData(GL_DRAW_INDIRECT_BUFFER,nb_draws*sizeof(DrawElementsIndirectCommand),&(element_cmds[0]),GL_STREAM_DRAW);
+			}
+			else {
+				array_cmds.resize(nb_draws);
+				for(unsigned int i=0;i<nb_draws;i++) {
+					const MeshRange& m = meshes[draws[i]];
+					DrawArraysIndirectCommand cmd = {m.count,1,m.first,i};
+					array_cmds[i] = cmd;
+				}
+				glBufferData(GL_DRAW_INDIRECT_BUFFER,nb_draws*sizeof(DrawArraysIndirectCommand),&(array_cmds[0]),GL_STREAM_DRAW);
+			}
+			cmds_dirty = false;
+		}
+		if (indexed) ext.MultiDrawElementsIndirect(gl_type,GL_UNSIGNED_INT,0,nb_draws,0);
+		else ext.MultiDrawArraysIndirect(gl_type,0,nb_draws,0);
+		return 1;
+	}
+
+};
+
+#endif
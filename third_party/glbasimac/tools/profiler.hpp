@@ -0,0 +1,398 @@
+/***************************************************************************
+                         profiler.hpp  -  description
+                             -------------------
+    copyright            : (C) 2012 by Biri Venceslas
+    email                : biri@univ-mlv.fr
+ ***************************************************************************/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef _STP3D_PROFILER_HPP_
+#define _STP3D_PROFILER_HPP_
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <map>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <algorithm>
+#include "gl_tools.hpp"
+
+/**
+  * Profiling macros. They expand to nothing unless STP3D_ENABLE_PROFILER is
+  * defined (CMake option GLBASIMAC_PROFILER) : instrumented code costs nothing
+  * in normal builds. Zone names must be string literals.
+  * STP3D_PROFILE_ZONE(name) : CPU time of the enclosing scope
+  * STP3D_PROFILE_GPU_ZONE(name) : CPU time and GPU time (timestamp queries) of the enclosing scope
+  * STP3D_PROFILE_FRAME() : end of a frame (once per frame, after the swap)
+  */
+#ifdef STP3D_ENABLE_PROFILER
+#define STP3D_PROFILE_CONCAT_(a,b) a##b
+#define STP3D_PROFILE_CONCAT(a,b) STP3D_PROFILE_CONCAT_(a,b)
+#define STP3D_PROFILE_ZONE(name) STP3D::Profiler::CpuZone STP3D_PROFILE_CONCAT(stp3d_zone_,__LINE__)(name)
+#define STP3D_PROFILE_GPU_ZONE(name) STP3D::Profiler::GpuZone STP3D_PROFILE_CONCAT(stp3d_zone_,__LINE__)(name)
+#define STP3D_PROFILE_FRAME() STP3D::Profiler::frameMark()
+#else
+#define STP3D_PROFILE_ZONE(name)
+#define STP3D_PROFILE_GPU_ZONE(name)
+#define STP3D_PROFILE_FRAME()
+#endif
+
+namespace STP3D {
+
+	/**
+	  * \brief Frame profiler : CPU zones and GPU zones, exported as a Chrome trace and as rolling percentiles.
+	  * CPU zones measure the wall time of a scope. GPU zones add a pair of
+	  * GL_TIMESTAMP queries around the GL commands of the scope. Queries come
+	  * from a pool and are read FRAME_LATENCY frames later, only when their
+	  * result is available : the profiler never waits for the GPU (zones still
+	  * pending when their frame slot is needed again are dropped and counted).
+	  * At each frameMark(), the time spent in every zone during the frame is
+	  * added to a rolling window (setWindow()) giving the percentiles of report().
+	  * writeChromeTrace() writes all the zones in the JSON format of
+	  * chrome://tracing (or ui.perfetto.dev). If the environment variable
+	  * STP3D_TRACE_FILE is set, the trace is written there at exit, and the
+	  * report is printed on std::cerr.
+	  * GPU zones need a current GL context (GL 3.3 queries).
+	  */
+	class Profiler {
+	public:
+		/// Number of frames a GPU query has to give its result
+		static const unsigned int FRAME_LATENCY = 4;
+
+		/// Statistics of one zone over the frames of the rolling window where it appears
+		struct ZoneStats {
+			std::string name;
+			bool gpu;
+			unsigned int frames;
+			double callsPerFrame;
+			double p50Ms,p95Ms,p99Ms,maxMs;
+		};
+
+		/// Scoped CPU zone (see STP3D_PROFILE_ZONE)
+		class CpuZone {
+		public:
+			CpuZone(const char* zone_name) : name(zone_name),start(now()) {}
+			~CpuZone() {addCpuEvent(name,start,now()-start);}
+		private:
+			const char* name;
+			double start;
+		};
+
+		/// Scoped CPU and GPU zone (see STP3D_PROFILE_GPU_ZONE)
+		class GpuZone {
+		public:
+			GpuZone(const char* zone_name) : cpu(zone_name),id(beginGpuZone(zone_name)) {}
+			~GpuZone() {endGpuZone(id);}
+		private:
+			CpuZone cpu;
+			unsigned int id;
+		};
+
+		/// Microseconds since the start of the program
+		static double now() {
+			return std::chrono::duration<double,std::micro>(std::chrono::steady_clock::now()-state().origin).count();
+		}
+		/// Number of frames of the rolling statistics
+		static void setWindow(unsigned int nb_frames);
+		/// Maximum number of zones kept for the trace (later ones are only counted in the statistics)
+		static void setMaxEvents(size_t nb_events) {State& s = state();std::lock_guard<std::mutex> lock(s.mtx);s.maxEvents = nb_events;}
+
+		static void addCpuEvent(const char* name,double start_us,double dur_us);
+		static unsigned int beginGpuZone(const char* name);
+		static void endGpuZone(unsigned int id);
+		/// End of the frame : frame time, GPU results of previous frames, rolling statistics
+		static void frameMark();
+
+		/// Rolling statistics of every zone
+		static std::vector<ZoneStats> stats();
+		static void report(std::ostream& os);
+		/// Write the trace (JSON Object Format of the Chrome trace viewer). Returns false if the file cannot be written.
+		static bool writeChromeTrace(const std::string& filename);
+
+	private:
+		struct Event {
+			const char* name;
+			double start,dur;
+			/// Thread number, GPU_THREAD for GPU zones
+			unsigned int thread;
+		};
+		static const unsigned int GPU_THREAD = 1000;
+		struct GpuPending {
+			const char* name;
+			GLuint queries[2];
+		};
+		struct FrameSlot {
+			std::vector<GpuPending> zones;
+		};
+		/// Time per frame in a zone (ms) and number of calls, for the last frames
+		struct ZoneHistory {
+			ZoneHistory() : head(0) {}
+			std::vector<float> ms;
+			std::vector<unsigned int> calls;
+			unsigned int head;
+		};
+		struct FrameSum {
+			FrameSum() : us(0.0),calls(0) {}
+			double us;
+			unsigned int calls;
+		};
+		struct NameLess {
+			bool operator()(const char* a,const char* b) const {return strcmp(a,b) < 0;}
+		};
+		typedef std::map<const char*,FrameSum,NameLess> FrameSums;
+		typedef std::map<std::pair<std::string,bool>,ZoneHistory> Histories;
+
+		struct State {
+			State() : origin(std::chrono::steady_clock::now()),maxEvents(1000000),droppedEvents(0),
+			          window(240),frame(0),lastFrameMark(0.0),gpuOffset(0.0),gpuSynced(false),droppedGpuZones(0) {
+				const char* file = getenv("STP3D_TRACE_FILE");
+				if (file) traceFile = file;
+			}
+			~State() {
+				if (traceFile.empty()) return;
+				// state() is being destroyed : the helpers are given this state
+				report(*this,std::cerr);
+				writeChromeTrace(*this,traceFile);
+			}
+			std::chrono::steady_clock::time_point origin;
+			std::mutex mtx;
+			std::vector<Event> events;
+			size_t maxEvents,droppedEvents;
+			std::map<std::thread::id,unsigned int> threads;
+			unsigned int window;
+			unsigned long frame;
+			double lastFrameMark;
+			FrameSums cpuSums;
+			Histories histories;
+			/// GPU timestamps to CPU time : cpu_us = gpu_ns/1000 + gpuOffset
+			double gpuOffset;
+			bool gpuSynced;
+			FrameSlot slots[FRAME_LATENCY];
+			std::vector<GLuint> freeQueries;
+			size_t droppedGpuZones;
+			std::string traceFile;
+		};
+
+		static State& state() {static State s;return s;}
+		static void pushHistory(State& s,const std::string& name,bool gpu,double us,unsigned int calls);
+		static void resolveSlot(State& s,FrameSlot& slot,bool force);
+		static GLuint allocQuery(State& s);
+		static std::vector<ZoneStats> stats(State& s);
+		static void report(State& s,std::ostream& os);
+		static bool writeChromeTrace(State& s,const std::string& filename);
+	};
+
+	inline void Profiler::setWindow(unsigned int nb_frames) {
+		State& s = state();
+		std::lock_guard<std::mutex> lock(s.mtx);
+		s.window = std::max(1u,nb_frames);
+		s.histories.clear();
+	}
+
+	inline void Profiler::addCpuEvent(const char* name,double start_us,double dur_us) {
+		State& s = state();
+		std::lock_guard<std::mutex> lock(s.mtx);
+		FrameSum& sum = s.cpuSums[name];
+		sum.us += dur_us;
+		sum.calls++;
+		if (s.events.size() >= s.maxEvents) {
+			s.droppedEvents++;
+			return;
+		}
+		std::map<std::thread::id,unsigned int>::iterator it = s.threads.find(std::this_thread::get_id());
+		if (it == s.threads.end()) {
+			it = s.threads.insert(std::make_pair(std::this_thread::get_id(),(unsigned int)s.threads.size())).first;
+		}
+		Event e = {name,start_us,dur_us,it->second};
+		s.events.push_back(e);
+	}
+
+	inline GLuint Profiler::allocQuery(State& s) {
+		if (s.freeQueries.empty()) {
+			s.freeQueries.resize(64);
+			glGenQueries(64,&(s.freeQueries[0]));
+		}
+		GLuint q = s.freeQueries.back();
+		s.freeQueries.pop_back();
+		return q;
+	}
+
+	inline unsigned int Profiler::beginGpuZone(const char* name) {
+		State& s = state();
+		std::lock_guard<std::mutex> lock(s.mtx);
+		if (!s.gpuSynced) {
+			GLint64 gpu_ns = 0;
+			glGetInteger64v(GL_TIMESTAMP,&gpu_ns);
+			s.gpuOffset = now()-gpu_ns/1000.0;
+			s.gpuSynced = true;
+		}
+		FrameSlot& slot = s.slots[s.frame%FRAME_LATENCY];
+		GpuPending zone = {name,{allocQuery(s),allocQuery(s)}};
+		glQueryCounter(zone.queries[0],GL_TIMESTAMP);
+		slot.zones.push_back(zone);
+		return slot.zones.size()-1;
+	}
+
+	inline void Profiler::endGpuZone(unsigned int id) {
+		State& s = state();
+		std::lock_guard<std::mutex> lock(s.mtx);
+		glQueryCounter(s.slots[s.frame%FRAME_LATENCY].zones[id].queries[1],GL_TIMESTAMP);
+	}
+
+	inline void Profiler::resolveSlot(State& s,FrameSlot& slot,bool force) {
+		if (slot.zones.empty()) return;
+		// Only the last query of the slot has to be checked : queries complete in order
+		GLuint available = 0;
+		glGetQueryObjectuiv(slot.zones.back().queries[1],GL_QUERY_RESULT_AVAILABLE,&available);
+		if (!available && !force) return;
+		FrameSums sums;
+		for(unsigned int i=0;i<slot.zones.size();i++) {
+			GpuPending& zone = slot.zones[i];
+			if (available) {
+				GLuint64 t0 = 0,t1 = 0;
+				glGetQueryObjectui64v(zone.queries[0],GL_QUERY_RESULT,&t0);
+				glGetQueryObjectui64v(zone.queries[1],GL_QUERY_RESULT,&t1);
+				double dur = (t1 > t0) ? (t1-t0)/1000.0 : 0.0;
+				FrameSum& sum = sums[zone.name];
+				sum.us += dur;
+				sum.calls++;
+				if (s.events.size() < s.maxEvents) {
+					Event e = {zone.name,t0/1000.0+s.gpuOffset,dur,GPU_THREAD};
+					s.events.push_back(e);
+				}
+				else {
+					s.droppedEvents++;
+				}
+			}
+			else {
+				s.droppedGpuZones++;
+			}
+			s.freeQueries.push_back(zone.queries[0]);
+			s.freeQueries.push_back(zone.queries[1]);
+		}
+		for(FrameSums::iterator it=sums.begin();it!=sums.end();++it) {
+			pushHistory(s,it->first,true,it->second.us,it->second.calls);
+		}
+		slot.zones.clear();
+	}
+
+	inline void Profiler::pushHistory(State& s,const std::string& name,bool gpu,double us,unsigned int calls) {
+		ZoneHistory& h = s.histories[std::make_pair(name,gpu)];
+		if (h.ms.size() < s.window) {
+			h.ms.push_back(us/1000.0);
+			h.calls.push_back(calls);
+			return;
+		}
+		h.ms[h.head] = us/1000.0;
+		h.calls[h.head] = calls;
+		h.head = (h.head+1)%s.window;
+	}
+
+	inline void Profiler::frameMark() {
+		double t = now();
+		State& s = state();
+		std::lock_guard<std::mutex> lock(s.mtx);
+		if (s.frame > 0) pushHistory(s,"frame",false,t-s.lastFrameMark,1);
+		s.lastFrameMark = t;
+		for(FrameSums::iterator it=s.cpuSums.begin();it!=s.cpuSums.end();++it) {
+			pushHistory(s,it->first,false,it->second.us,it->second.calls);
+		}
+		s.cpuSums.clear();
+		// GPU results of the previous frames, if ready. The next slot is reused now : forced.
+		s.frame++;
+		for(unsigned int i=1;i<FRAME_LATENCY;i++) {
+			resolveSlot(s,s.slots[(s.frame+i)%FRAME_LATENCY],false);
+		}
+		resolveSlot(s,s.slots[s.frame%FRAME_LATENCY],true);
+	}
+
+	inline std::vector<Profiler::ZoneStats> Profiler::stats() {
+		return stats(state());
+	}
+
+	inline std::vector<Profiler::ZoneStats> Profiler::stats(State& s) {
+		std::lock_guard<std::mutex> lock(s.mtx);
+		std::vector<ZoneStats> result;
+		for(Histories::iterator it=s.histories.begin();it!=s.histories.end();++it) {
+			const ZoneHistory& h = it->second;
+			if (h.ms.empty()) continue;
+			std::vector<float> sorted(h.ms);
+			std::sort(sorted.begin(),sorted.end());
+			unsigned long calls = 0;
+			for(unsigned int i=0;i<h.calls.size();i++) calls += h.calls[i];
+			ZoneStats st;
+			st.name = it->first.first;
+			st.gpu = it->first.second;
+			st.frames = sorted.size();
+			st.callsPerFrame = double(calls)/sorted.size();
+			st.p50Ms = sorted[(sorted.size()-1)*50/100];
+			st.p95Ms = sorted[(sorted.size()-1)*95/100];
+			st.p99Ms = sorted[(sorted.size()-1)*99/100];
+			st.maxMs = sorted.back();
+			result.push_back(st);
+		}
+		return result;
+	}
+
+	inline void Profiler::report(std::ostream& os) {
+		report(state(),os);
+	}
+
+	inline void Profiler::report(State& s,std::ostream& os) {
+		std::vector<ZoneStats> all = stats(s);
+		os<<"Profile (ms per frame, over the last frames where the zone appears)"<<std::endl;
+		for(unsigned int i=0;i<all.size();i++) {
+			const ZoneStats& st = all[i];
+			os<<"  "<<(st.gpu ? "GPU " : "CPU ")<<st.name<<" : p50 "<<st.p50Ms<<" p95 "<<st.p95Ms<<" p99 "<<st.p99Ms;
+			os<<" max "<<st.maxMs<<" ("<<st.callsPerFrame<<" calls/frame, "<<st.frames<<" frames)"<<std::endl;
+		}
+		std::lock_guard<std::mutex> lock(s.mtx);
+		if (s.droppedEvents || s.droppedGpuZones) {
+			os<<"  dropped : "<<s.droppedEvents<<" trace events, "<<s.droppedGpuZones<<" GPU zones not ready in time"<<std::endl;
+		}
+	}
+
+	inline bool Profiler::writeChromeTrace(const std::string& filename) {
+		return writeChromeTrace(state(),filename);
+	}
+
+	inline bool Profiler::writeChromeTrace(State& s,const std::string& filename) {
+		std::ofstream out(filename.c_str());
+		if (!out) {
+			std::cerr<<"Unable to write the trace "<<filename<<std::endl;
+			return false;
+		}
+		std::lock_guard<std::mutex> lock(s.mtx);
+		out<<"{\"traceEvents\":["<<std::endl;
+		out<<"{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":"<<GPU_THREAD<<",\"args\":{\"name\":\"GPU\"}}";
+		for(std::map<std::thread::id,unsigned int>::iterator it=s.threads.begin();it!=s.threads.end();++it) {
+			out<<","<<std::endl<<"{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":"<<it->second;
+			out<<",\"args\":{\"name\":\"CPU "<<it->second<<"\"}}";
+		}
+		out.precision(3);
+		out<<std::fixed;
+		for(unsigned int i=0;i<s.events.size();i++) {
+			const Event& e = s.events[i];
+			out<<","<<std::endl<<"{\"name\":\""<<e.name<<"\",\"ph\":\"X\",\"pid\":0,\"tid\":"<<e.thread;
+			out<<",\"ts\":"<<e.start<<",\"dur\":"<<e.dur<<"}";
+		}
+		out<<std::endl<<"],\"displayTimeUnit\":\"ms\"}"<<std::endl;
+		return true;
+	}
+
+};
+
+#endif
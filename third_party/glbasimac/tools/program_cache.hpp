@@ -0,0 +1,234 @@
+/***************************************************************************
+                      program_cache.hpp  -  description
+                             -------------------
+    copyright            : (C) 2012 by Biri Venceslas
+    email                : biri@univ-mlv.fr
+ ***************************************************************************/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef _STP3D_PROGRAM_CACHE_HPP_
+#define _STP3D_PROGRAM_CACHE_HPP_
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+#include "globals.hpp"
+#include "gl_tools.hpp"
+#include "gl_ext.hpp"
+
+namespace STP3D {
+
+	/// Counters of the program cache, since the start of the application
+	struct ProgramCacheStats {
+		ProgramCacheStats() : hits(0),misses(0),rejected(0),stored(0),loadTime(0.0) {}
+		/// Programs restored from a binary
+		unsigned int hits;
+		/// Programs compiled from their sources (no binary, or binary rejected)
+		unsigned int misses;
+		/// Binaries found but refused by the driver (then compiled and saved again)
+		unsigned int rejected;
+		/// Binaries written in the cache directory
+		unsigned int stored;
+		/// Seconds spent in ShaderManager::loadShader (restore or compilation, linkage)
+		double loadTime;
+	};
+
+	/**
+	  * \brief On-disk cache of linked programs, used by ShaderManager::loadShader.
+	  * A program is saved with glGetProgramBinary in <directory>/<key>.bin. The
+	  * key is a 64 bits FNV-1a hash of the shader sources and stages and of
+	  * the vendor, renderer and version strings of the driver : editing a
+	  * shader or updating the driver gives another file. A binary refused by
+	  * glProgramBinary (driver change not seen in the strings) is compiled
+	  * again and its file rewritten.
+	  * The cache is off until a directory is given, by setDirectory or by the
+	  * environment variable STP3D_SHADER_CACHE. It needs GL 4.1 (or
+	  * ARB_get_program_binary) and a driver with at least one binary format.
+	  * Files are written under a temporary name then renamed : several
+	  * processes may share the directory.
+	  */
+	class ProgramCache {
+	public:
+		typedef unsigned long long Key;
+
+		/// Cache directory (created if needed), "" : no cache
+		static void setDirectory(const std::string& dir);
+		static const std::string& getDirectory() {return directory();}
+		/// True if there is a directory and the current context can save programs
+		static bool isEnabled() {return !directory().empty() && GLExt::hasProgramBinary();}
+
+		/// FNV-1a hash of size bytes, continuing hash h
+		static Key hash(const void* data,size_t size,Key h = 14695981039346656037ULL);
+		/// Hash of the driver strings, to start the key of a program
+		static Key driverKey();
+
+		/// Restore the program from the cache. False if there is no binary or if the driver refuses it.
+		static bool load(GLuint programObject,Key key);
+		/// To call before glLinkProgram so that the binary can be read back
+		static void prepare(GLuint programObject);
+		/// Save the binary of the linked program
+		static bool store(GLuint programObject,Key key);
+
+		static const ProgramCacheStats& stats() {return statistics();}
+
+		/// Adds its lifetime to the load time of the statistics
+		struct LoadTimer {
+			LoadTimer() : start(std::chrono::steady_clock::now()) {}
+			~LoadTimer() {statistics().loadTime += std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();}
+			std::chrono::steady_clock::time_point start;
+		};
+
+	private:
+		static std::string& directory() {
+			static std::string dir = getenv("STP3D_SHADER_CACHE") ? getenv("STP3D_SHADER_CACHE") : "";
+			return dir;
+		}
+		static ProgramCacheStats& statistics() {static ProgramCacheStats st;return st;}
+		static std::string filename(Key key);
+	};
+
+	/// Header of the cache files
+	struct ProgramCacheHeader {
+		char magic[8];
+		ProgramCache::Key key;
+		GLenum format;
+		GLint length;
+	};
+
+	inline void ProgramCache::setDirectory(const std::string& dir) {
+		directory() = dir;
+		if (dir.empty()) return;
+#ifdef _WIN32
+		_mkdir(dir.c_str());
+#else
+		mkdir(dir.c_str(),0755);
+#endif
+	}
+
+	inline ProgramCache::Key ProgramCache::hash(const void* data,size_t size,Key h) {
+		const unsigned char* bytes = (const unsigned char*)data;
+		for(size_t i=0;i<size;i++) {
+			h ^= bytes[i];
+			h *= 1099511628211ULL;
+		}
+		return h;
+	}
+
+	inline ProgramCache::Key ProgramCache::driverKey() {
+		Key h = hash(NULL,0);
+		const GLenum names[4] = {GL_VENDOR,GL_RENDERER,GL_VERSION,GL_SHADING_LANGUAGE_VERSION};
+		for(int i=0;i<4;i++) {
+			const char* str = (const char*)glGetString(names[i]);
+			// The terminating 0 separates the strings
+			if (str) h = hash(str,strlen(str)+1,h);
+		}
+		return h;
+	}
+
+	inline std::string ProgramCache::filename(Key key) {
+		char name[24];
+		snprintf(name,sizeof(name),"%016llx.bin",key);
+		return directory()+"/"+name;
+	}
+
+	inline bool ProgramCache::load(GLuint programObject,Key key) {
+		if (!isEnabled()) return false;
+		std::ifstream file(filename(key).c_str(),std::ios::binary);
+		ProgramCacheHeader header;
+		if (!file || !file.read((char*)&header,sizeof(header)) || memcmp(header.magic,"STP3DPB1",8) != 0 ||
+		    header.key != key || header.length <= 0) {
+			statistics().misses++;
+			return false;
+		}
+		std::vector<char> binary(header.length);
+		if (!file.read(&binary[0],header.length)) {
+			statistics().misses++;
+			return false;
+		}
+		GLExt::fn().ProgramBinary(programObject,header.format,&binary[0],header.length);
+		GLint linked = 0;
+		glGetProgramiv(programObject,GL_LINK_STATUS,&linked);
+		if (!linked) {
+			// Clear the error of a refused format
+			while (glGetError() != GL_NO_ERROR) {}
+			statistics().rejected++;
+			statistics().misses++;
+			return false;
+		}
+		statistics().hits++;
+		return true;
+	}
+
+	inline void ProgramCache::prepare(GLuint programObject) {
+		if (isEnabled()) GLExt::fn().ProgramParameteri(programObject,GL_PROGRAM_BINARY_RETRIEVABLE_HINT,GL_TRUE);
+	}
+
+	inline bool ProgramCache::store(GLuint programObject,Key key) {
+		if (!isEnabled()) return false;
+		GLint length = 0;
+		glGetProgramiv(programObject,GL_PROGRAM_BINARY_LENGTH,&length);
+		if (length <= 0) return false;
+		ProgramCacheHeader header;
+		memcpy(header.magic,"STP3DPB1",8);
+		header.key = key;
+		header.length = 0;
+		std::vector<char> binary(length);
+		GLExt::fn().GetProgramBinary(programObject,length,&header.length,&header.format,&binary[0]);
+		if (header.length <= 0) return false;
+
+		// Unique temporary name, renamed when complete : readers never see a partial file.
+		// The clock alone is not unique between processes (it may count from the boot).
+		std::string name = filename(key);
+		std::ostringstream tmp;
+#ifdef _WIN32
+		tmp<<name<<"."<<_getpid();
+#else
+		tmp<<name<<"."<<getpid();
+#endif
+		tmp<<"."<<std::chrono::steady_clock::now().time_since_epoch().count()<<".tmp";
+		{
+			std::ofstream file(tmp.str().c_str(),std::ios::binary);
+			if (!file) {
+				STP3D::setError("ProgramCache : unable to write in the cache directory");
+				return false;
+			}
+			file.write((const char*)&header,sizeof(header));
+			file.write(&binary[0],header.length);
+			if (!file) {
+				file.close();
+				remove(tmp.str().c_str());
+				return false;
+			}
+		}
+		if (rename(tmp.str().c_str(),name.c_str()) != 0) {
+			remove(tmp.str().c_str());
+			return false;
+		}
+		statistics().stored++;
+		return true;
+	}
+
+};
+
+#endif
@@ -25,13 +25,47 @@
 #include <cstring>
 #include <sys/stat.h>
 #include <vector>
+#include <map>
+#include <algorithm>
 #include "globals.hpp"
 #include "gl_tools.hpp"
+#include "gl_state.hpp"
+#include "profiler.hpp"
+#include "program_cache.hpp"
 
 namespace STP3D {
 
 	enum ShaderType {Vertex,Fragment,Geometry,TesControl,TesEval};
 
+	/**
+	  \brief Active uniforms and attributes of a linked program, with their locations.
+	  Built once when the program is linked (see ShaderManager::linkProgram), so that
+	  applications never have to query the driver by name in their rendering loop.
+	  Uniform arrays are stored with their base name ("lightPos" for "lightPos[0]").
+	  Members of uniform blocks are listed with location -1.
+	*/
+	struct ProgramInterface {
+		std::map<std::string,GLint> uniforms;
+		std::map<std::string,GLint> attributes;
+		std::map<std::string,GLuint> uniformBlocks;
+
+		/// Location of an active uniform, -1 if the program does not use it
+		GLint getUniformLocation(const std::string& name) const {
+			std::map<std::string,GLint>::const_iterator it = uniforms.find(name);
+			return (it == uniforms.end()) ? -1 : it->second;
+		}
+		/// Location of an active attribute, -1 if the program does not use it
+		GLint getAttribLocation(const std::string& name) const {
+			std::map<std::string,GLint>::const_iterator it = attributes.find(name);
+			return (it == attributes.end()) ? -1 : it->second;
+		}
+		/// Index of an active uniform block, GL_INVALID_INDEX if the program does not use it
+		GLuint getUniformBlockIndex(const std::string& name) const {
+			std::map<std::string,GLuint>::const_iterator it = uniformBlocks.find(name);
+			return (it == uniformBlocks.end()) ? GL_INVALID_INDEX : it->second;
+		}
+	};
+
 	/**
 	  \brief ShaderManager class allows to create and use shaders
 
@@ -43,7 +77,10 @@ namespace STP3D {
 	  <li> Geometry processing : Geometry shader
 	  <li> Tesselation operations : Tesselation control and tesselation shader
 	  </ul>
-	  The class ShaderManager offers tools to load and use easily such shaders
+	  The class ShaderManager offers tools to load and use easily such shaders.
+	  Shader files are preprocessed (see preprocess) : they may include other files with
+	  #include "file" and a program may be built with #define lines (permutations, see beginProgram).
+	  Linked programs are saved in and restored from the ProgramCache when it has a directory.
 	*/
 	class ShaderManager {
 	public:
@@ -52,13 +89,52 @@ namespace STP3D {
 		static GLuint loadShader(const std::vector<const char *> filenames, const std::vector<ShaderType> shaderTypes, bool v = false);
 		static bool linkProgram(GLuint programObject, bool verbose);
 		static bool compileShader(const char *filename, const ShaderType shaderType, GLuint& programObject, bool verbose);
+		/// Queue the compilation and the linkage of a program without reading any status (see finishProgram).
+		/// With GL_KHR_parallel_shader_compile, the driver builds it in the background.
+		/// A program found in the ProgramCache is restored at once.
+		/// \param defines (lines of #define) are given to all the shaders (see preprocess).
+		static GLuint beginProgram(const std::vector<const char *>& filenames, const std::vector<ShaderType>& shaderTypes, bool v = false, const std::string& defines = "");
+		/// True if the program started by beginProgram can be finished without waiting
+		static bool isProgramCompleted(GLuint programObject);
+		/// Wait for a program started by beginProgram, check it, build its interface and save it in the ProgramCache.
+		/// False if it failed : the program is deleted.
+		static bool finishProgram(GLuint programObject, bool v = false);
 		static void deleteProgram(GLuint programObject);
 		static bool loadSource(const char* filename, char** source);
+		/// Source of a shader file with the lines #include "file" replaced by the file (path relative to the
+		/// including file, each file included once) and \param defines inserted after the #version line.
+		/// #line directives keep the lines of the compiler logs right : source string 0 is the file,
+		/// the next ones are the included files in order of inclusion.
+		static bool preprocess(const char* filename, const std::string& defines, std::string& source);
 		static bool areShadersSupported(bool v);
+		static void introspectProgram(GLuint programObject);
+		static const ProgramInterface& getProgramInterface(GLuint programObject);
+		static bool bindUniformBlock(GLuint programObject, const std::string& blockName, GLuint bindingPoint);
 
 		// SMALL TOOLS
 		static std::string writeShaderType(ShaderType shdtype);
 		static GLenum convertToGLShaderType(ShaderType shdtype);
+
+	private:
+		/// Cache key of the program made of these preprocessed sources (driver, stages and sources)
+		static ProgramCache::Key programKey(const std::vector<std::string>& sources, const std::vector<ShaderType>& shaderTypes);
+		/// Cache key of the program made of these files, 0 if a file cannot be read
+		static ProgramCache::Key programKey(const std::vector<const char *>& filenames, const std::vector<ShaderType>& shaderTypes, const std::string& defines);
+		/// Append the file to source (see preprocess). \param defines is inserted after #version if not NULL.
+		static bool includeFile(const std::string& filename, const std::string* defines, std::string& source, std::vector<std::string>& included);
+		/// Restore the program from the cache if the key is not 0
+		static bool restoreProgram(GLuint programObject, ProgramCache::Key key, bool verbose);
+
+		/// Programs started by beginProgram and not finished, with their cache key
+		static std::map<GLuint,ProgramCache::Key>& pendingPrograms() {
+			static std::map<GLuint,ProgramCache::Key> pending;
+			return pending;
+		}
+		/// Interfaces of all the linked programs
+		static std::map<GLuint,ProgramInterface>& programInterfaces() {
+			static std::map<GLuint,ProgramInterface> interfaces;
+			return interfaces;
+		}
 	};
 
 	inline void ShaderManager::printLog(GLuint object, bool isShader, const char* str) {
@@ -91,6 +167,8 @@ namespace STP3D {
 	}
 
 	inline GLuint ShaderManager::loadShader(const char *vertexFile, const char *fragmentFile, bool v) {
+		STP3D_PROFILE_ZONE("ShaderManager::loadShader");
+		ProgramCache::LoadTimer timer;
 		GLuint programObject;
 		if(v) std::cout << "Begin initializing shaders" << std::endl;
 		CHECK_GL;
@@ -113,6 +191,17 @@ namespace STP3D {
 		}
 		CHECK_GL;
 
+		// Linked program of a previous run
+		ProgramCache::Key key = 0;
+		if (ProgramCache::isEnabled()) {
+			std::vector<const char *> files(1,vertexFile);
+			files.push_back(fragmentFile);
+			std::vector<ShaderType> types(1,Vertex);
+			types.push_back(Fragment);
+			key = programKey(files,types,"");
+		}
+		if (restoreProgram(programObject,key,v)) return programObject;
+
 		// Compile the vertex shader
 		if(!compileShader(vertexFile, Vertex, programObject, v)) {
 			if(v) std::cout << "Shader will not be used" << std::endl;
@@ -126,7 +215,9 @@ namespace STP3D {
 		}
 		CHECK_GL;
 
+		ProgramCache::prepare(programObject);
 		if(linkProgram(programObject, v)) {
+			if(key) ProgramCache::store(programObject,key);
 			if(v) std::cout << "End of shader initialization" << std::endl;
 			CHECK_GL;
 			return programObject;
@@ -138,6 +229,8 @@ namespace STP3D {
 	}
 
 	inline GLuint ShaderManager::loadShader(const std::vector<const char *> filenames, const std::vector<ShaderType> shaderTypes, bool v) {
+		STP3D_PROFILE_ZONE("ShaderManager::loadShader");
+		ProgramCache::LoadTimer timer;
 		GLuint programObject;
 		if(v) std::cout << "Begin initializing shaders" << std::endl;
 		CHECK_GL;
@@ -159,6 +252,10 @@ namespace STP3D {
 			printLog(programObject,false,0);
 		}
 
+		// Linked program of a previous run
+		ProgramCache::Key key = ProgramCache::isEnabled() ? programKey(filenames,shaderTypes,"") : 0;
+		if (restoreProgram(programObject,key,v)) return programObject;
+
 		// Compile all shaders
 		for(unsigned int i=0;i<shaderTypes.size();i++) {
 			if (!compileShader(filenames[i], shaderTypes[i], programObject, v)) {
@@ -168,7 +265,9 @@ namespace STP3D {
 		}
 
 		// Link program
+		ProgramCache::prepare(programObject);
 		if(linkProgram(programObject, v)) {
+			if(key) ProgramCache::store(programObject,key);
 			if(v) std::cout << "End of shader initialization" << std::endl;
 			return programObject;
 		}
@@ -197,6 +296,7 @@ namespace STP3D {
 				std::cout << "[OK]" << std::endl;
 				printLog(programObject, false, 0);
 			}
+			introspectProgram(programObject);
 			return true;
 		}
 
@@ -209,11 +309,11 @@ namespace STP3D {
 
 	inline bool ShaderManager::compileShader(const char *shaderFile, const ShaderType shaderType, GLuint& programObject, bool verbose) {
 		// Vertex shader
-		GLchar *shaderSource;
+		std::string shaderSource;
 		GLenum glShaderType = convertToGLShaderType(shaderType);
 		if(shaderFile) {
 			if(verbose) std::cout << writeShaderType(shaderType) << " shader : " << std::endl;
-			if(!loadSource(shaderFile, &shaderSource)){
+			if(!preprocess(shaderFile, "", shaderSource)){
 				if(verbose) std::cout << "Loading shader '" << shaderFile << "' [FAILED]" << std::endl;
 				return false;
 			}
@@ -224,7 +324,8 @@ namespace STP3D {
 			// Create an object that will contain source
 			GLuint shaderObject = glCreateShader(glShaderType);
 			// Associate the source
-			glShaderSource(shaderObject, 1, (const GLchar**)&shaderSource, 0);
+			const GLchar* source = shaderSource.c_str();
+			glShaderSource(shaderObject, 1, &source, 0);
 			// Compile the source
 			glCompileShader(shaderObject);
 
@@ -245,16 +346,183 @@ namespace STP3D {
 				if(verbose){
 					std::cout << "[FAILED]" << std::endl;
 					printLog(shaderObject,true,0);
-					delete shaderSource;
 					return false;
 				}
 			}
 			glDeleteShader(shaderObject);
-			delete[](shaderSource);
 		}
 		return true;
 	}
 
+	inline GLuint ShaderManager::beginProgram(const std::vector<const char *>& filenames, const std::vector<ShaderType>& shaderTypes, bool v, const std::string& defines) {
+		STP3D_PROFILE_ZONE("ShaderManager::beginProgram");
+		ProgramCache::LoadTimer timer;
+		GLuint programObject = glCreateProgram();
+		if(!programObject) {
+			if(v) std::cout << "Initialization of the shader program [FAILED]" << std::endl;
+			return 0;
+		}
+
+		std::vector<std::string> sources(shaderTypes.size());
+		for(unsigned int i=0;i<shaderTypes.size();i++) {
+			if (!filenames[i]) continue;
+			if(!preprocess(filenames[i], defines, sources[i])) {
+				if(v) std::cout << "Loading shader '" << filenames[i] << "' [FAILED]" << std::endl;
+				glDeleteProgram(programObject);
+				return 0;
+			}
+			if(v) std::cout << "Loading shader '" << filenames[i] << "' [OK]" << std::endl;
+		}
+		ProgramCache::Key key = ProgramCache::isEnabled() ? programKey(sources,shaderTypes) : 0;
+		if (restoreProgram(programObject,key,v)) return programObject;
+
+		for(unsigned int i=0;i<shaderTypes.size();i++) {
+			if (!filenames[i]) continue;
+			GLuint shaderObject = glCreateShader(convertToGLShaderType(shaderTypes[i]));
+			const GLchar* source = sources[i].c_str();
+			glShaderSource(shaderObject, 1, &source, 0);
+			glCompileShader(shaderObject);
+			// The compilation status is read by finishProgram : the shader lives while attached
+			glAttachShader(programObject, shaderObject);
+			glDeleteShader(shaderObject);
+		}
+		ProgramCache::prepare(programObject);
+		glLinkProgram(programObject);
+		pendingPrograms()[programObject] = key;
+		return programObject;
+	}
+
+	inline bool ShaderManager::isProgramCompleted(GLuint programObject) {
+		if (!GLExt::hasParallelShaderCompile() || pendingPrograms().count(programObject) == 0) return true;
+		GLint completed = 0;
+		glGetProgramiv(programObject, GL_COMPLETION_STATUS_KHR, &completed);
+		return completed != 0;
+	}
+
+	inline bool ShaderManager::finishProgram(GLuint programObject, bool v) {
+		std::map<GLuint,ProgramCache::Key>::iterator it = pendingPrograms().find(programObject);
+		// Restored from the cache
+		if (it == pendingPrograms().end()) return programObject != 0;
+		STP3D_PROFILE_ZONE("ShaderManager::finishProgram");
+		ProgramCache::LoadTimer timer;
+		ProgramCache::Key key = it->second;
+		pendingPrograms().erase(it);
+
+		int linked = 0;
+		glGetProgramiv(programObject, GL_LINK_STATUS, &linked);
+		if(!linked) {
+			if(v) {
+				// Logs of the shaders that did not compile, then of the linkage
+				GLint nb_shaders = 0;
+				glGetProgramiv(programObject, GL_ATTACHED_SHADERS, &nb_shaders);
+				std::vector<GLuint> shaders(nb_shaders > 0 ? nb_shaders : 1);
+				glGetAttachedShaders(programObject, nb_shaders, 0, &shaders[0]);
+				for(GLint i=0;i<nb_shaders;i++) {
+					int compiled = 0;
+					glGetShaderiv(shaders[i], GL_COMPILE_STATUS, &compiled);
+					if(!compiled) printLog(shaders[i],true,"Compilation of shader [FAILED]");
+				}
+				std::cout << "Program linkage [FAILED]" << std::endl;
+				printLog(programObject, false, 0);
+				std::cout << "Shader will not be used" << std::endl;
+			}
+			GLState::deleteProgram(programObject);
+			return false;
+		}
+		if(v) {
+			std::cout << "Program linkage [OK]" << std::endl;
+			printLog(programObject, false, 0);
+		}
+		introspectProgram(programObject);
+		if(key) ProgramCache::store(programObject,key);
+		return true;
+	}
+
+	inline ProgramCache::Key ShaderManager::programKey(const std::vector<std::string>& sources, const std::vector<ShaderType>& shaderTypes) {
+		ProgramCache::Key key = ProgramCache::driverKey();
+		for(unsigned int i=0;i<shaderTypes.size();i++) {
+			GLenum type = convertToGLShaderType(shaderTypes[i]);
+			key = ProgramCache::hash(&type,sizeof(type),key);
+			key = ProgramCache::hash(sources[i].c_str(),sources[i].size()+1,key);
+		}
+		return key;
+	}
+
+	inline ProgramCache::Key ShaderManager::programKey(const std::vector<const char *>& filenames, const std::vector<ShaderType>& shaderTypes, const std::string& defines) {
+		std::vector<std::string> sources(shaderTypes.size());
+		for(unsigned int i=0;i<shaderTypes.size();i++) {
+			if (filenames[i] && !preprocess(filenames[i], defines, sources[i])) return 0;
+		}
+		return programKey(sources,shaderTypes);
+	}
+
+	inline bool ShaderManager::restoreProgram(GLuint programObject, ProgramCache::Key key, bool verbose) {
+		if (!key || !ProgramCache::load(programObject,key)) return false;
+		introspectProgram(programObject);
+		if(verbose) std::cout << "Program restored from the shader cache" << std::endl;
+		return true;
+	}
+
+	inline bool ShaderManager::preprocess(const char* filename, const std::string& defines, std::string& source) {
+		std::vector<std::string> included;
+		source.clear();
+		return includeFile(filename, &defines, source, included);
+	}
+
+	inline bool ShaderManager::includeFile(const std::string& filename, const std::string* defines, std::string& source, std::vector<std::string>& included) {
+		std::ifstream file(filename.c_str());
+		if(!file){
+			std::cout << "Unable to open file '" << filename << "'" << std::endl;
+			return false;
+		}
+		size_t start = source.size();
+		size_t file_number = included.size();
+		included.push_back(filename);
+		// Included files are searched from the directory of the file
+		size_t slash = filename.find_last_of("/\\");
+		std::string dir = (slash == std::string::npos) ? std::string() : filename.substr(0,slash+1);
+
+		std::string line;
+		int line_number = 0;
+		std::ostringstream directive;
+		while (std::getline(file,line)) {
+			line_number++;
+			if (!line.empty() && line[line.size()-1] == '\r') line.erase(line.size()-1);
+			size_t first = line.find_first_not_of(" \t");
+			if (first != std::string::npos && line.compare(first,8,"#include") == 0) {
+				size_t open = line.find('"',first+8);
+				size_t close = (open == std::string::npos) ? open : line.find('"',open+1);
+				if (close == std::string::npos) {
+					std::cout << filename << "(" << line_number << ") : #include without \"file\"" << std::endl;
+					return false;
+				}
+				std::string name = dir+line.substr(open+1,close-open-1);
+				if (std::find(included.begin(),included.end(),name) == included.end()) {
+					directive.str("");
+					directive << "#line 1 " << included.size() << "\n";
+					source += directive.str();
+					if (!includeFile(name, NULL, source, included)) return false;
+				}
+				directive.str("");
+				directive << "#line " << line_number+1 << " " << file_number << "\n";
+				source += directive.str();
+				continue;
+			}
+			source += line;
+			source += '\n';
+			// The defines follow #version, which must be the first directive
+			if (defines && first != std::string::npos && line.compare(first,8,"#version") == 0) {
+				source += *defines;
+				directive.str("");
+				directive << "#line " << line_number+1 << " " << file_number << "\n";
+				source += directive.str();
+				defines = NULL;
+			}
+		}
+		if (defines && !defines->empty()) source.insert(start,*defines+"#line 1 0\n");
+		return true;
+	}
+
 	inline bool ShaderManager::loadSource(const char* filename, char** source) {
 		std::ifstream file(filename);
 		if(!file){
@@ -279,9 +547,62 @@ namespace STP3D {
 		return true;
 	}
 
+	inline void ShaderManager::introspectProgram(GLuint programObject) {
+		ProgramInterface& itf = programInterfaces()[programObject];
+		itf.uniforms.clear();
+		itf.attributes.clear();
+		itf.uniformBlocks.clear();
+
+		GLint nb_active = 0,max_length = 0;
+		GLint size;
+		GLenum type;
+		glGetProgramiv(programObject, GL_ACTIVE_UNIFORM_MAX_LENGTH, &max_length);
+		glGetProgramiv(programObject, GL_ACTIVE_UNIFORMS, &nb_active);
+		std::vector<GLchar> name(max_length > 0 ? max_length : 1);
+		for(GLint i=0;i<nb_active;i++) {
+			glGetActiveUniform(programObject, i, name.size(), 0, &size, &type, &name[0]);
+			std::string str(&name[0]);
+			// Uniforms in blocks have no location
+			GLint loc = glGetUniformLocation(programObject, str.c_str());
+			if (str.size() > 3 && str.compare(str.size()-3,3,"[0]") == 0) str.resize(str.size()-3);
+			itf.uniforms[str] = loc;
+		}
+
+		glGetProgramiv(programObject, GL_ACTIVE_ATTRIBUTE_MAX_LENGTH, &max_length);
+		glGetProgramiv(programObject, GL_ACTIVE_ATTRIBUTES, &nb_active);
+		name.resize(max_length > 0 ? max_length : 1);
+		for(GLint i=0;i<nb_active;i++) {
+			glGetActiveAttrib(programObject, i, name.size(), 0, &size, &type, &name[0]);
+			itf.attributes[std::string(&name[0])] = glGetAttribLocation(programObject, &name[0]);
+		}
+
+		glGetProgramiv(programObject, GL_ACTIVE_UNIFORM_BLOCK_MAX_NAME_LENGTH, &max_length);
+		glGetProgramiv(programObject, GL_ACTIVE_UNIFORM_BLOCKS, &nb_active);
+		name.resize(max_length > 0 ? max_length : 1);
+		for(GLint i=0;i<nb_active;i++) {
+			glGetActiveUniformBlockName(programObject, i, name.size(), 0, &name[0]);
+			itf.uniformBlocks[std::string(&name[0])] = i;
+		}
+	}
+
+	/// Attach the uniform block blockName of the program to the binding point. False if the program has no such block.
+	inline bool ShaderManager::bindUniformBlock(GLuint programObject, const std::string& blockName, GLuint bindingPoint) {
+		GLuint idx = getProgramInterface(programObject).getUniformBlockIndex(blockName);
+		if (idx == GL_INVALID_INDEX) return false;
+		glUniformBlockBinding(programObject, idx, bindingPoint);
+		return true;
+	}
+
+	inline const ProgramInterface& ShaderManager::getProgramInterface(GLuint programObject) {
+		return programInterfaces()[programObject];
+	}
+
 	inline void ShaderManager::deleteProgram(GLuint programObject) {
 		// S'il existe on supprime le programme GLSL
-		if(programObject) glDeleteShader(programObject);
+		if(programObject) {
+			programInterfaces().erase(programObject);
+			GLState::deleteProgram(programObject);
+		}
 	}
 
 	inline bool ShaderManager::areShadersSupported(bool v = false) {
@@ -26,6 +26,7 @@
 #include <stdio.h>
 #include <setjmp.h>
 #include "globals.hpp"
+#include "gl_state.hpp"
 
 /** \addtogroup Macros */
 /*@{*/
@@ -227,7 +228,7 @@ namespace STP3D {
 
 	inline void Texture2D::initTexture() {
 		glGenTextures(1,&gl_id_tex);
-		glBindTexture(GL_TEXTURE_2D,gl_id_tex);
+		GLState::bindTexture(GL_TEXTURE_2D,gl_id_tex);
 		glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_S,GL_REPEAT);
 		glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_T,GL_REPEAT);
 		glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,GL_LINEAR);
@@ -245,34 +246,34 @@ namespace STP3D {
 		else {
 			STP3D::setError("[Texture : initTexture] NULL initialization of texture is impossible");
 		}
-		glBindTexture(GL_TEXTURE_2D,0);
+		GLState::bindTexture(GL_TEXTURE_2D,0);
 		//cout<<"Fin initialisation Texture : "<<*this<<std::endl;
 	}
 
 	inline void Texture2D::setTextureWraping(GLenum param_s,GLenum param_t) {
-		glBindTexture(GL_TEXTURE_2D,gl_id_tex);
+		GLState::bindTexture(GL_TEXTURE_2D,gl_id_tex);
 		glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_S,param_s);
 		glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_T,param_t);
-		glBindTexture(GL_TEXTURE_2D,0);
+		GLState::bindTexture(GL_TEXTURE_2D,0);
 	}
 
 	inline void Texture2D::setTextureFiltering(GLenum param_min,GLenum param_max) {
-		glBindTexture(GL_TEXTURE_2D,gl_id_tex);
+		GLState::bindTexture(GL_TEXTURE_2D,gl_id_tex);
 		glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,param_max);
 		glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,param_min);
-		glBindTexture(GL_TEXTURE_2D,0);
+		GLState::bindTexture(GL_TEXTURE_2D,0);
 	}
 
 	inline void Texture2D::loadTexture(GLuint target_tex) {
 		last_tex_unit = target_tex;
-		glActiveTextureARB(target_tex);
-		glBindTexture(GL_TEXTURE_2D,gl_id_tex);
+		GLState::activeTexture(target_tex);
+		GLState::bindTexture(GL_TEXTURE_2D,gl_id_tex);
 	}
 
 	inline void Texture2D::unloadTexture(GLuint target_tex) {
 		last_tex_unit = target_tex;
-		glActiveTextureARB(last_tex_unit);
-		glBindTexture(GL_TEXTURE_2D,0);
+		GLState::activeTexture(last_tex_unit);
+		GLState::bindTexture(GL_TEXTURE_2D,0);
 	}
 
 	/* *************************************************************************************
@@ -0,0 +1,348 @@
+/***************************************************************************
+                       vertex_layout.hpp  -  description
+                             -------------------
+    copyright            : (C) 2012 by Biri Venceslas
+    email                : biri@univ-mlv.fr
+ ***************************************************************************/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef _STP3D_VERTEX_LAYOUT_HPP_
+#define _STP3D_VERTEX_LAYOUT_HPP_
+
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+#include <cfloat>
+#include "globals.hpp"
+#include "gl_tools.hpp"
+#include "gl_state.hpp"
+#include "matrix4d.hpp"
+#include "matrix_stack.hpp"
+
+namespace STP3D {
+
+	/**
+	  * \brief How the float buffers of a mesh (addOneBuffer) are stored in GL.
+	  * By default each attribute has its own VBO of floats. A layout may
+	  * instead interleave all the attributes in one VBO (one cache line
+	  * holds whole vertices) and store each attribute in a smaller format :
+	  * <ul>
+	  * <li> FormatFloat : 32 bits floats (default)
+	  * <li> FormatHalf : 16 bits floats (uvs, colors)
+	  * <li> FormatUNorm16 : unsigned shorts normalized, for values in [0,1] (uvs)
+	  * <li> FormatSNorm16 : shorts normalized, for values in [-1,1]
+	  * <li> FormatPacked1010102 : GL_INT_2_10_10_10_REV, 3 components in 4 bytes (normals)
+	  * <li> FormatQuantized16 : unsigned shorts normalized in the bounding cube of the
+	  *      attribute (positions). The mesh then has a dequantization matrix, a translation
+	  *      and a uniform scale, to compose with the modelview matrix (GLBI_Engine::draw does it).
+	  *      The scale is the same on the 3 axes so that normals need no correction.
+	  * </ul>
+	  * The signed normalized formats are encoded for the conversion of GL 4.1, the version of
+	  * the contexts, where the integer q gives (2q+1)/(2^b-1) : there is no exact 0, and a
+	  * GL 4.2 context (q/(2^(b-1)-1)) reads them with an error under one step.
+	  * Every attribute starts on 4 bytes (formats of 16 bits are padded).
+	  * Only one attribute, the position, can be quantized.
+	  */
+	class VertexLayout {
+	public:
+		enum Format {FormatFloat,FormatHalf,FormatUNorm16,FormatSNorm16,FormatPacked1010102,FormatQuantized16};
+
+		VertexLayout(bool interleave = false) : interleaved(interleave) {};
+
+		/// One VBO for all the attributes (true) or one VBO per attribute
+		void setInterleaved(bool interleave) {interleaved = interleave;};
+		bool isInterleaved() const {return interleaved;};
+		/// Format of the attribute \param id_attribute (FormatFloat if not set)
+		void setFormat(unsigned int id_attribute,Format format);
+		Format getFormat(unsigned int id_attribute) const {
+			return (id_attribute < formats.size()) ? formats[id_attribute] : FormatFloat;
+		};
+		/// True if the layout is the default one (separate VBO of floats)
+		bool isDefault() const;
+
+		/// Bytes of one attribute of \param nb_components in \param format
+		static unsigned int attributeSize(Format format,unsigned int nb_components);
+		/// Bytes of one vertex with these attributes
+		unsigned int vertexSize(const std::vector<unsigned int>& ids,const std::vector<unsigned int>& sizes) const;
+
+		/** Create the VBO of the vertices in the bound VAO and set its attributes.
+		  * \param data are the float buffers of the mesh (nb_elts elements of sizes[i] floats).
+		  * \param dequant receives the dequantization matrix (identity without quantized attribute).
+		  */
+		bool createBuffers(unsigned int nb_elts,const std::vector<unsigned int>& ids,const std::vector<unsigned int>& sizes,
+		                   const std::vector<float*>& data,std::vector<unsigned int>& vbo_id,Matrix4D& dequant) const;
+
+		/// Shared buffers (see BufferArena) : the same steps, for vertices stored at any place of the VBOs
+		/// Number of VBOs of the layout, and bytes of one vertex in the VBO \param buffer
+		unsigned int nbBuffers(const std::vector<unsigned int>& ids) const {return interleaved ? 1 : ids.size();};
+		unsigned int bufferStride(unsigned int buffer,const std::vector<unsigned int>& ids,const std::vector<unsigned int>& sizes) const;
+		/// Check the formats, and compute the bounding cube of the quantized attribute : its values are
+		/// stored as (v-offset)*scale, and \param dequant is the matrix to go back (identity if none)
+		bool quantization(unsigned int nb_elts,const std::vector<unsigned int>& ids,const std::vector<unsigned int>& sizes,
+		                  const std::vector<float*>& data,float offset[3],float& scale,Matrix4D& dequant) const;
+		/// Write the \param nb_elts vertices of the VBO \param buffer at \param dst (bufferStride bytes each)
+		void packBuffer(unsigned int buffer,unsigned int nb_elts,const std::vector<unsigned int>& ids,const std::vector<unsigned int>& sizes,
+		                const std::vector<float*>& data,const float offset[3],float scale,unsigned char* dst) const;
+		/// Set the attributes of the bound VAO on the VBOs \param vbo_id (nbBuffers of them)
+		void setAttributes(const std::vector<unsigned int>& ids,const std::vector<unsigned int>& sizes,
+		                   const std::vector<unsigned int>& vbo_id) const;
+
+		/// Float to half float (round to nearest even, overflow gives infinity)
+		static unsigned short floatToHalf(float value);
+		/// Pack 3 components in [-1,1] in GL_INT_2_10_10_10_REV (w = 0)
+		static unsigned int packSNorm1010102(float x,float y,float z);
+		/// Nearest signed integer of \param bits bits of \param v in [-1,1], for the GL 4.1 conversion (2q+1)/(2^bits-1)
+		static int encodeSNorm(float v,unsigned int bits);
+
+	private:
+		/// Write nb_elts attributes of \param nb_comp floats at dst, one every \param stride bytes.
+		/// Quantized values are (v-offset)*scale.
+		static void packAttribute(Format format,unsigned int nb_comp,unsigned int nb_elts,const float* src,
+		                          unsigned char* dst,unsigned int stride,const float offset[3],float scale);
+		/// Type and normalization of a format for glVertexAttribPointer
+		static void glFormat(Format format,unsigned int nb_comp,GLint& size,GLenum& type,GLboolean& normalized);
+
+		bool interleaved;
+		std::vector<Format> formats;
+	};
+
+	inline void VertexLayout::setFormat(unsigned int id_attribute,Format format) {
+		if (id_attribute >= formats.size()) formats.resize(id_attribute+1,FormatFloat);
+		formats[id_attribute] = format;
+	}
+
+	inline bool VertexLayout::isDefault() const {
+		if (interleaved) return false;
+		for(unsigned int i=0;i<formats.size();i++) {
+			if (formats[i] != FormatFloat) return false;
+		}
+		return true;
+	}
+
+	inline unsigned int VertexLayout::attributeSize(Format format,unsigned int nb_components) {
+		switch(format) {
+			case FormatFloat : return 4*nb_components;
+			case FormatPacked1010102 : return 4;
+			default : return (2*nb_components+3)&~3u;
+		}
+	}
+
+	inline unsigned int VertexLayout::vertexSize(const std::vector<unsigned int>& ids,const std::vector<unsigned int>& sizes) const {
+		unsigned int size = 0;
+		for(unsigned int i=0;i<ids.size();i++) size += attributeSize(getFormat(ids[i]),sizes[i]);
+		return size;
+	}
+
+	inline unsigned short VertexLayout::floatToHalf(float value) {
+		unsigned int bits;
+		memcpy(&bits,&value,sizeof(float));
+		unsigned short sign = (bits>>16) & 0x8000;
+		unsigned int exponent = (bits>>23) & 0xFF;
+		unsigned int mantissa = bits & 0x7FFFFF;
+		// NaN stays NaN, too large gives infinity
+		if (exponent == 0xFF) return sign | 0x7C00 | (mantissa ? 0x200 : 0);
+		int e = int(exponent)-127+15;
+		if (e >= 31) return sign | 0x7C00;
+		if (e <= 0) {
+			// Subnormal half (or zero)
+			if (e < -10) return sign;
+			mantissa |= 0x800000;
+			unsigned int shift = 14-e;
+			unsigned int half = mantissa>>shift;
+			unsigned int rest = mantissa & ((1u<<shift)-1);
+			unsigned int middle = 1u<<(shift-1);
+			if (rest > middle || (rest == middle && (half & 1))) half++;
+			return sign | half;
+		}
+		unsigned int half = (e<<10) | (mantissa>>13);
+		unsigned int rest = mantissa & 0x1FFF;
+		// A carry to the exponent is the right rounding (up to infinity)
+		if (rest > 0x1000 || (rest == 0x1000 && (half & 1))) half++;
+		return sign | half;
+	}
+
+	inline int VertexLayout::encodeSNorm(float v,unsigned int bits) {
+		float c = (v > 1.0f) ? 1.0f : ((v < -1.0f) ? -1.0f : v);
+		int high = (1<<(bits-1))-1;
+		int q = int(floorf((c*float((1<<bits)-1)-1.0f)*0.5f+0.5f));
+		return std::min(std::max(q,-high-1),high);
+	}
+
+	inline unsigned int VertexLayout::packSNorm1010102(float x,float y,float z) {
+		const float v[3] = {x,y,z};
+		unsigned int packed = 0;
+		for(int i=0;i<3;i++) packed |= (unsigned int)(encodeSNorm(v[i],10) & 0x3FF)<<(10*i);
+		return packed;
+	}
+
+	inline void VertexLayout::packAttribute(Format format,unsigned int nb_comp,unsigned int nb_elts,const float* src,
+	                                        unsigned char* dst,unsigned int stride,const float offset[3],float scale) {
+		for(unsigned int e=0;e<nb_elts;e++,src+=nb_comp,dst+=stride) {
+			switch(format) {
+				case FormatFloat :
+					memcpy(dst,src,nb_comp*sizeof(float));
+					break;
+				case FormatHalf : {
+					unsigned short h[4] = {0,0,0,0};
+					for(unsigned int c=0;c<nb_comp;c++) h[c] = floatToHalf(src[c]);
+					memcpy(dst,h,attributeSize(format,nb_comp));
+					break;
+				}
+				case FormatUNorm16 :
+				case FormatQuantized16 : {
+					unsigned short q[4] = {0,0,0,0};
+					for(unsigned int c=0;c<nb_comp;c++) {
+						float v = (format == FormatQuantized16) ? (src[c]-offset[c])*scale : src[c];
+						v = (v > 1.0f) ? 1.0f : ((v < 0.0f) ? 0.0f : v);
+						q[c] = (unsigned short)(v*65535.0f+0.5f);
+					}
+					memcpy(dst,q,attributeSize(format,nb_comp));
+					break;
+				}
+				case FormatSNorm16 : {
+					short q[4] = {0,0,0,0};
+					for(unsigned int c=0;c<nb_comp;c++) q[c] = (short)encodeSNorm(src[c],16);
+					memcpy(dst,q,attributeSize(format,nb_comp));
+					break;
+				}
+				case FormatPacked1010102 : {
+					unsigned int p = packSNorm1010102(src[0],(nb_comp > 1) ? src[1] : 0.0f,(nb_comp > 2) ? src[2] : 0.0f);
+					memcpy(dst,&p,4);
+					break;
+				}
+			}
+		}
+	}
+
+	inline void VertexLayout::glFormat(Format format,unsigned int nb_comp,GLint& size,GLenum& type,GLboolean& normalized) {
+		size = nb_comp;
+		normalized = GL_TRUE;
+		switch(format) {
+			case FormatFloat : type = GL_FLOAT; normalized = GL_FALSE; break;
+			case FormatHalf : type = GL_HALF_FLOAT; normalized = GL_FALSE; break;
+			case FormatSNorm16 : type = GL_SHORT; break;
+			case FormatPacked1010102 : type = GL_INT_2_10_10_10_REV; size = 4; break;
+			default : type = GL_UNSIGNED_SHORT; break;
+		}
+	}
+
+	inline unsigned int VertexLayout::bufferStride(unsigned int buffer,const std::vector<unsigned int>& ids,
+	                                               const std::vector<unsigned int>& sizes) const {
+		return interleaved ? vertexSize(ids,sizes) : attributeSize(getFormat(ids[buffer]),sizes[buffer]);
+	}
+
+	inline bool VertexLayout::quantization(unsigned int nb_elts,const std::vector<unsigned int>& ids,const std::vector<unsigned int>& sizes,
+	                                       const std::vector<float*>& data,float offset[3],float& scale,Matrix4D& dequant) const {
+		dequant = Matrix4D();
+		offset[0] = offset[1] = offset[2] = 0.0f;
+		scale = 1.0f;
+		int quantized = -1;
+		for(unsigned int i=0;i<ids.size();i++) {
+			Format format = getFormat(ids[i]);
+			if (format != FormatFloat && sizes[i] > 4) {
+				STP3D::setError("VertexLayout : packed formats have at most 4 components");
+				return false;
+			}
+			if (format != FormatQuantized16) continue;
+			if (quantized >= 0 || sizes[i] > 3) {
+				STP3D::setError("VertexLayout : only one position (at most 3 components) can be quantized");
+				return false;
+			}
+			quantized = i;
+			float bmin[3] = {FLT_MAX,FLT_MAX,FLT_MAX};
+			float bmax[3] = {-FLT_MAX,-FLT_MAX,-FLT_MAX};
+			for(unsigned int e=0;e<nb_elts;e++) {
+				for(unsigned int c=0;c<sizes[i];c++) {
+					float v = data[i][e*sizes[i]+c];
+					if (v < bmin[c]) bmin[c] = v;
+					if (v > bmax[c]) bmax[c] = v;
+				}
+			}
+			float extent = 0.0f;
+			for(unsigned int c=0;c<sizes[i];c++) {
+				offset[c] = (nb_elts > 0) ? bmin[c] : 0.0f;
+				if (nb_elts > 0 && bmax[c]-bmin[c] > extent) extent = bmax[c]-bmin[c];
+			}
+			if (extent > 0.0f) scale = 1.0f/extent;
+			dequant = Matrix4D::translation(offset[0],offset[1],offset[2])*Matrix4D::homothety(extent > 0.0f ? extent : 1.0f);
+		}
+		return true;
+	}
+
+	inline void VertexLayout::packBuffer(unsigned int buffer,unsigned int nb_elts,const std::vector<unsigned int>& ids,
+	                                     const std::vector<unsigned int>& sizes,const std::vector<float*>& data,
+	                                     const float offset[3],float scale,unsigned char* dst) const {
+		if (nb_elts == 0) return;
+		if (!interleaved) {
+			packAttribute(getFormat(ids[buffer]),sizes[buffer],nb_elts,data[buffer],dst,bufferStride(buffer,ids,sizes),offset,scale);
+			return;
+		}
+		unsigned int stride = vertexSize(ids,sizes);
+		unsigned int attr_offset = 0;
+		for(unsigned int i=0;i<ids.size();i++) {
+			Format format = getFormat(ids[i]);
+			packAttribute(format,sizes[i],nb_elts,data[i],dst+attr_offset,stride,offset,scale);
+			attr_offset += attributeSize(format,sizes[i]);
+		}
+	}
+
+	inline void VertexLayout::setAttributes(const std::vector<unsigned int>& ids,const std::vector<unsigned int>& sizes,
+	                                        const std::vector<unsigned int>& vbo_id) const {
+		unsigned int stride = interleaved ? vertexSize(ids,sizes) : 0;
+		unsigned int attr_offset = 0;
+		for(unsigned int i=0;i<ids.size();i++) {
+			Format format = getFormat(ids[i]);
+			GLint size;
+			GLenum type;
+			GLboolean normalized;
+			glFormat(format,sizes[i],size,type,normalized);
+			GLState::bindBuffer(GL_ARRAY_BUFFER,vbo_id[interleaved ? 0 : i]);
+			glEnableVertexAttribArray(ids[i]);
+			glVertexAttribPointer(ids[i],size,type,normalized,stride,(const void*)(size_t)(interleaved ? attr_offset : 0));
+			attr_offset += attributeSize(format,sizes[i]);
+		}
+		GLState::bindBuffer(GL_ARRAY_BUFFER,0);
+	}
+
+	inline bool VertexLayout::createBuffers(unsigned int nb_elts,const std::vector<unsigned int>& ids,const std::vector<unsigned int>& sizes,
+	                                        const std::vector<float*>& data,std::vector<unsigned int>& vbo_id,Matrix4D& dequant) const {
+		vbo_id.clear();
+		float offset[3];
+		float scale;
+		if (!quantization(nb_elts,ids,sizes,data,offset,scale,dequant)) return false;
+		if (ids.empty()) return true;
+
+		unsigned int nb_vbo = nbBuffers(ids);
+		vbo_id.resize(nb_vbo);
+		glGenBuffers(nb_vbo,&(vbo_id[0]));
+		for(unsigned int i=0;i<nb_vbo;i++) {
+			if (vbo_id[i]==0) {STP3D::setError("Unable to find an empty VBO");return false;}
+		}
+
+		std::vector<unsigned char> packed;
+		for(unsigned int i=0;i<nb_vbo;i++) {
+			GLState::bindBuffer(GL_ARRAY_BUFFER,vbo_id[i]);
+			if (!interleaved && getFormat(ids[i]) == FormatFloat) {
+				glBufferData(GL_ARRAY_BUFFER,nb_elts*sizes[i]*sizeof(GLfloat),data[i],GL_STATIC_DRAW);
+				continue;
+			}
+			packed.resize(size_t(nb_elts)*bufferStride(i,ids,sizes));
+			packBuffer(i,nb_elts,ids,sizes,data,offset,scale,packed.empty() ? NULL : &packed[0]);
+			glBufferData(GL_ARRAY_BUFFER,packed.size(),packed.empty() ? NULL : &packed[0],GL_STATIC_DRAW);
+		}
+		setAttributes(ids,sizes,vbo_id);
+		return true;
+	}
+
+};
+
+#endif
@@ -0,0 +1,255 @@
+/***************************************************************************
+                        video_sink.hpp  -  description
+                             -------------------
+    copyright            : (C) 2012 by Biri Venceslas
+    email                : biri@univ-mlv.fr
+ ***************************************************************************/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef _STP3D_VIDEO_SINK_HPP_
+#define _STP3D_VIDEO_SINK_HPP_
+
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <atomic>
+#include "globals.hpp"
+#include "frame_capture.hpp"
+
+// SSE2 is part of every x86_64 target. Define STP3D_NO_SIMD to force the scalar conversion.
+#if !defined(STP3D_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define STP3D_USE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+namespace STP3D {
+
+namespace simd {
+
+	/// RGB to YCbCr, BT.601 limited range, 8 bit fixed point (chroma offset folded in : always positive before the shift)
+	inline unsigned char rgbToY(int r,int g,int b) {return (unsigned char)(((66*r+129*g+25*b+128) >> 8)+16);}
+	inline unsigned char rgbToU(int r,int g,int b) {return (unsigned char)((112*b-38*r-74*g+32896) >> 8);}
+	inline unsigned char rgbToV(int r,int g,int b) {return (unsigned char)((112*r-94*g-18*b+32896) >> 8);}
+
+	/** Two rows of RGB(A) to YUV 4:2:0, from column x_begin (even) to w. Chroma is
+	  * computed from the mean of each 2x2 block (edges are repeated when w or the
+	  * number of rows is odd : row1 == row0 and y1 == NULL for a last single row).
+	  */
+	inline void rgbToYuv420Rows(const unsigned char* row0,const unsigned char* row1,int x_begin,int w,unsigned int nb_channels,
+	                            unsigned char* y0,unsigned char* y1,unsigned char* u,unsigned char* v) {
+		for(int x=x_begin;x<w;x+=2) {
+			int xn = (x+1 < w) ? x+1 : x;
+			const unsigned char* p00 = row0+x*nb_channels;
+			const unsigned char* p01 = row0+xn*nb_channels;
+			const unsigned char* p10 = row1+x*nb_channels;
+			const unsigned char* p11 = row1+xn*nb_channels;
+			y0[x] = rgbToY(p00[0],p00[1],p00[2]);
+			if (xn != x) y0[xn] = rgbToY(p01[0],p01[1],p01[2]);
+			if (y1) {
+				y1[x] = rgbToY(p10[0],p10[1],p10[2]);
+				if (xn != x) y1[xn] = rgbToY(p11[0],p11[1],p11[2]);
+			}
+			int r = (p00[0]+p01[0]+p10[0]+p11[0]+2) >> 2;
+			int g = (p00[1]+p01[1]+p10[1]+p11[1]+2) >> 2;
+			int b = (p00[2]+p01[2]+p10[2]+p11[2]+2) >> 2;
+			u[x/2] = rgbToU(r,g,b);
+			v[x/2] = rgbToV(r,g,b);
+		}
+	}
+
+#if defined(STP3D_USE_SSE2)
+	/// R, G and B of 8 RGBA pixels as 16 bit lanes
+	inline void unpackRGBA8(const unsigned char* p,__m128i& r,__m128i& g,__m128i& b) {
+		const __m128i mask = _mm_set1_epi32(0xFF);
+		__m128i a = _mm_loadu_si128((const __m128i*)p);
+		__m128i c = _mm_loadu_si128((const __m128i*)(p+16));
+		r = _mm_packs_epi32(_mm_and_si128(a,mask),_mm_and_si128(c,mask));
+		g = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(a,8),mask),_mm_and_si128(_mm_srli_epi32(c,8),mask));
+		b = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(a,16),mask),_mm_and_si128(_mm_srli_epi32(c,16),mask));
+	}
+
+	/// c0*x+c1*y+c2*z+add on 16 bit lanes, then >> 8. Wraps modulo 2^16 : exact when the true result is in [0,65535]
+	inline __m128i dot3Shift8(__m128i x,__m128i y,__m128i z,short c0,short c1,short c2,unsigned short add) {
+		__m128i s = _mm_mullo_epi16(x,_mm_set1_epi16(c0));
+		s = _mm_add_epi16(s,_mm_mullo_epi16(y,_mm_set1_epi16(c1)));
+		s = _mm_add_epi16(s,_mm_mullo_epi16(z,_mm_set1_epi16(c2)));
+		s = _mm_add_epi16(s,_mm_set1_epi16((short)add));
+		return _mm_srli_epi16(s,8);
+	}
+
+	/// Mean of the 2x2 blocks of 8 columns of two rows (4 results, duplicated in the 8 lanes)
+	inline __m128i mean2x2(__m128i top,__m128i bottom) {
+		__m128i sums = _mm_madd_epi16(_mm_add_epi16(top,bottom),_mm_set1_epi16(1));
+		sums = _mm_srli_epi32(_mm_add_epi32(sums,_mm_set1_epi32(2)),2);
+		return _mm_packs_epi32(sums,sums);
+	}
+
+	/// rgbToYuv420Rows for RGBA, 8 columns at a time. Returns the first column left to the scalar code.
+	inline int rgbaToYuv420RowsSSE2(const unsigned char* row0,const unsigned char* row1,int w,
+	                                unsigned char* y0,unsigned char* y1,unsigned char* u,unsigned char* v) {
+		const __m128i y_offset = _mm_set1_epi16(16);
+		int x = 0;
+		for(;x+8<=w;x+=8) {
+			__m128i r0,g0,b0,r1,g1,b1;
+			unpackRGBA8(row0+4*x,r0,g0,b0);
+			unpackRGBA8(row1+4*x,r1,g1,b1);
+			__m128i luma = _mm_add_epi16(dot3Shift8(r0,g0,b0,66,129,25,128),y_offset);
+			_mm_storel_epi64((__m128i*)(y0+x),_mm_packus_epi16(luma,luma));
+			if (y1) {
+				luma = _mm_add_epi16(dot3Shift8(r1,g1,b1,66,129,25,128),y_offset);
+				_mm_storel_epi64((__m128i*)(y1+x),_mm_packus_epi16(luma,luma));
+			}
+			__m128i r = mean2x2(r0,r1),g = mean2x2(g0,g1),b = mean2x2(b0,b1);
+			int cb = _mm_cvtsi128_si32(_mm_packus_epi16(dot3Shift8(b,r,g,112,-38,-74,32896),r));
+			int cr = _mm_cvtsi128_si32(_mm_packus_epi16(dot3Shift8(r,g,b,112,-94,-18,32896),r));
+			memcpy(u+x/2,&cb,4);
+			memcpy(v+x/2,&cr,4);
+		}
+		return x;
+	}
+#endif
+
+	/** Image of w x h RGB(A) pixels (first row at the top, rows packed) to YUV 4:2:0 planes :
+	  * y of w x h, u and v of (w+1)/2 x (h+1)/2. SSE2 for RGBA, same bits as the scalar code.
+	  */
+	inline void rgbToYuv420(const unsigned char* src,int w,int h,unsigned int nb_channels,
+	                        unsigned char* y_plane,unsigned char* u_plane,unsigned char* v_plane) {
+		const size_t row = size_t(w)*nb_channels;
+		const int cw = (w+1)/2;
+		for(int y=0;y<h;y+=2) {
+			const unsigned char* row0 = src+y*row;
+			const unsigned char* row1 = (y+1 < h) ? row0+row : row0;
+			unsigned char* y0 = y_plane+size_t(y)*w;
+			unsigned char* y1 = (y+1 < h) ? y0+w : NULL;
+			unsigned char* u = u_plane+size_t(y/2)*cw;
+			unsigned char* v = v_plane+size_t(y/2)*cw;
+			int x = 0;
+#if defined(STP3D_USE_SSE2)
+			if (nb_channels == 4) x = rgbaToYuv420RowsSSE2(row0,row1,w,y0,y1,u,v);
+#endif
+			rgbToYuv420Rows(row0,row1,x,w,nb_channels,y0,y1,u,v);
+		}
+	}
+
+}
+
+	/**
+	  * \brief Writes captured frames as one video stream : YUV4MPEG2 (4:2:0) or raw RGB24.
+	  * The stream goes to a file, a FIFO or the standard output ("-"), to be
+	  * read by an encoder, e.g. ffmpeg -i frames.y4m ... or, for raw RGB,
+	  * ffmpeg -f rawvideo -pix_fmt rgb24 -s WxH -r FPS -i - ...
+	  * attach() makes the sink the consumer of a FrameCapture : frames are
+	  * converted and written on the capture worker. A slow reader blocks the
+	  * worker, the capture queue fills up and the render loop waits (the
+	  * capture is set to wait when full) : memory stays bounded by the
+	  * capture queue and no frame is lost.
+	  */
+	class VideoSink {
+	public:
+		enum Format {Y4M,RawRGB};
+
+		VideoSink() : out(NULL),format(Y4M),width(0),height(0),framesWritten(0),error(false) {}
+		~VideoSink() {close();}
+
+		/// Open the stream. \param path file or FIFO name, "-" : standard output. Frame rate fps_num/fps_den.
+		bool open(const std::string& path,Format stream_format,int w,int h,int fps_num,int fps_den = 1);
+		void close();
+		/// Feed the sink with the frames of \param capture (RGBA readback, waits when full)
+		void attach(FrameCapture& capture);
+		/// Write one frame (called by the capture worker once attached). Frames of another size are refused.
+		bool write(const CapturedFrame& frame);
+
+		unsigned long getNbFramesWritten() const {return framesWritten;}
+		/// A write failed (reader gone, disk full...) : next frames are ignored
+		bool failed() const {return error;}
+
+	private:
+		// Owns a stream : no copy
+		VideoSink(const VideoSink&);
+		VideoSink& operator=(const VideoSink&);
+
+		FILE* out;
+		Format format;
+		int width,height;
+		/// Written by the capture worker, read by the render thread
+		std::atomic<unsigned long> framesWritten;
+		std::atomic<bool> error;
+		/// Frame converted before writing (Y, U and V planes, or RGB), reused
+		std::vector<unsigned char> buffer;
+	};
+
+	inline bool VideoSink::open(const std::string& path,Format stream_format,int w,int h,int fps_num,int fps_den) {
+		close();
+		out = (path == "-") ? stdout : fopen(path.c_str(),"wb");
+		if (!out) {
+			std::cerr<<"Unable to open the video stream "<<path<<std::endl;
+			return false;
+		}
+		format = stream_format;
+		width = w;
+		height = h;
+		framesWritten = 0;
+		error = false;
+		if (format == Y4M) {
+			fprintf(out,"YUV4MPEG2 W%d H%d F%d:%d Ip A1:1 C420jpeg XCOLORRANGE=LIMITED\n",w,h,fps_num,fps_den);
+			buffer.resize(size_t(w)*h+2*size_t((w+1)/2)*((h+1)/2));
+		}
+		else {
+			buffer.resize(size_t(w)*h*3);
+		}
+		return true;
+	}
+
+	inline void VideoSink::close() {
+		if (!out) return;
+		if (out == stdout) fflush(out);
+		else fclose(out);
+		out = NULL;
+	}
+
+	inline void VideoSink::attach(FrameCapture& capture) {
+		capture.setNbChannels(4);
+		capture.setWaitWhenFull(true);
+		capture.setConsumer([this](const CapturedFrame& frame) {write(frame);});
+	}
+
+	inline bool VideoSink::write(const CapturedFrame& frame) {
+		if (!out || error) return false;
+		if (frame.width != width || frame.height != height) {
+			STP3D::setError("VideoSink : frame size differs from the stream size");
+			return false;
+		}
+		const size_t nb_pixels = size_t(width)*height;
+		if (format == Y4M) {
+			const size_t chroma = size_t((width+1)/2)*((height+1)/2);
+			simd::rgbToYuv420(frame.pixels,width,height,frame.nbChannels,&buffer[0],&buffer[nb_pixels],&buffer[nb_pixels+chroma]);
+			error = fputs("FRAME\n",out) < 0;
+		}
+		else if (frame.nbChannels == 3) {
+			memcpy(&buffer[0],frame.pixels,3*nb_pixels);
+		}
+		else {
+			for(size_t i=0;i<nb_pixels;i++) memcpy(&buffer[3*i],frame.pixels+i*frame.nbChannels,3);
+		}
+		if (!error && fwrite(&buffer[0],1,buffer.size(),out) != buffer.size()) error = true;
+		if (error) {
+			std::cerr<<"VideoSink : write failed, the stream is stopped"<<std::endl;
+			return false;
+		}
+		framesWritten++;
+		return true;
+	}
+
+};
+
+#endif